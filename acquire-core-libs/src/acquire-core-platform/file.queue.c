@@ -0,0 +1,242 @@
+//! file_queue, the same on every platform. Writes run on a pool of threads
+//! unless the platform sets up a kernel queue for them. See file.queue.h.
+
+#include "file.queue.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+static void
+file_queue_worker(struct file_queue_inner* self)
+{
+    void* state = file_queue_worker_state_init();
+    lock_acquire(&self->lock);
+    while (1) {
+        while (!self->is_stopping && self->pending_head == self->pending_tail)
+            condition_variable_wait(&self->changed, &self->lock);
+        if (self->pending_head == self->pending_tail)
+            break;
+        const uint32_t i = self->pending[self->pending_tail++ % self->depth];
+        lock_release(&self->lock);
+
+        file_queue_worker_write(state, self->slots[i].request);
+
+        lock_acquire(&self->lock);
+        self->completed[self->completed_head++ % self->depth] = i;
+        condition_variable_notify_all(&self->changed);
+    }
+    lock_release(&self->lock);
+    file_queue_worker_state_destroy(state);
+}
+
+/// Stops the threads, if any, and frees `self`.
+static void
+file_queue_release(struct file_queue_inner* self)
+{
+    if (!self)
+        return;
+    lock_acquire(&self->lock);
+    self->is_stopping = 1;
+    condition_variable_notify_all(&self->changed);
+    lock_release(&self->lock);
+    for (uint32_t i = 0; i < self->nthreads; ++i)
+        thread_join(self->threads + i);
+    file_queue_ring_destroy(self);
+    free(self->slots);
+    free(self->free);
+    free(self->pending);
+    free(self->completed);
+    free(self);
+}
+
+/// @param[in] use_ring 0 to write on threads even if the platform has a
+///                     kernel queue.
+static int
+file_queue_init_(struct file_queue* self, uint32_t depth, int use_ring)
+{
+    struct file_queue_inner* q = 0;
+    *self = (struct file_queue){ 0 };
+    EXPECT(depth, "A file queue needs room for at least one write.");
+    CHECK(q = calloc(1, sizeof(*q)));
+    lock_init(&q->lock);
+    condition_variable_init(&q->changed);
+    q->depth = depth;
+    CHECK(q->slots = calloc(depth, sizeof(*q->slots)));
+    CHECK(q->free = malloc(depth * sizeof(*q->free)));
+    CHECK(q->pending = malloc(depth * sizeof(*q->pending)));
+    CHECK(q->completed = malloc(depth * sizeof(*q->completed)));
+    for (uint32_t i = 0; i < depth; ++i)
+        q->free[i] = depth - 1 - i;
+    q->nfree = depth;
+
+    if (!use_ring || !file_queue_ring_init(q, depth)) {
+        const uint32_t n =
+          depth < MAX_FILE_QUEUE_THREADS ? depth : MAX_FILE_QUEUE_THREADS;
+        for (uint32_t i = 0; i < n; ++i) {
+            thread_init(q->threads + i);
+            CHECK(thread_create(
+              q->threads + i, (void (*)(void*))file_queue_worker, q));
+            q->nthreads = i + 1;
+        }
+    }
+    self->inner_ = q;
+    return 1;
+Error:
+    file_queue_release(q);
+    return 0;
+}
+
+int
+file_queue_init(struct file_queue* self, uint32_t depth)
+{
+    return file_queue_init_(self, depth, 1);
+}
+
+void
+file_queue_destroy(struct file_queue* self)
+{
+    struct file_queue_inner* q = self->inner_;
+    while (q && q->in_flight && file_queue_wait(self)) {
+    }
+    file_queue_release(q);
+    self->inner_ = 0;
+}
+
+int
+file_queue_submit(struct file_queue* self, struct file_write_request* request)
+{
+    struct file_queue_inner* q = self->inner_;
+    CHECK(q);
+    EXPECT(q->nfree, "Can't have more than %u writes in flight.", q->depth);
+    const uint32_t i = q->free[--q->nfree];
+    q->slots[i] = (struct file_queue_slot){
+        .request = request,
+        .cur = request->beg,
+        .offset = request->offset,
+    };
+    request->ok = 0;
+    if (q->ring) {
+        if (!file_queue_ring_submit(q, i)) {
+            q->free[q->nfree++] = i;
+            goto Error;
+        }
+    } else {
+        lock_acquire(&q->lock);
+        q->pending[q->pending_head++ % q->depth] = i;
+        condition_variable_notify_all(&q->changed);
+        lock_release(&q->lock);
+    }
+    ++q->in_flight;
+    return 1;
+Error:
+    return 0;
+}
+
+struct file_write_request*
+file_queue_wait(struct file_queue* self)
+{
+    struct file_queue_inner* q = self->inner_;
+    if (!q || !q->in_flight)
+        return 0;
+    uint32_t i = 0;
+    if (q->ring) {
+        i = file_queue_ring_wait(q);
+    } else {
+        lock_acquire(&q->lock);
+        while (q->completed_head == q->completed_tail)
+            condition_variable_wait(&q->changed, &q->lock);
+        i = q->completed[q->completed_tail++ % q->depth];
+        lock_release(&q->lock);
+    }
+    q->free[q->nfree++] = i;
+    --q->in_flight;
+    return q->slots[i].request;
+}
+
+#ifndef NO_UNIT_TESTS
+/// Writes a file in chunks, last chunk first, with every chunk in flight at
+/// once. Then reads it back.
+static int
+check_file_queue_writes_out_of_order(int use_ring)
+{
+    const char filename[] = "unit-test-file-queue.bin";
+    const size_t nchunks = 8, chunk_bytes = 3 << 16;
+    struct file file = { 0 };
+    int is_open = 0;
+    struct file_queue queue = { 0 };
+    struct file_mapping mapping = { 0 };
+    struct file_write_request requests[8] = { 0 };
+    uint8_t* data = 0;
+    int is_ok = 0;
+
+    remove(filename);
+    CHECK(data = malloc(nchunks * chunk_bytes));
+    for (size_t i = 0; i < nchunks * chunk_bytes; ++i)
+        data[i] = (uint8_t)(i * 7 + (i >> 16));
+    CHECK(is_open = file_create(&file, filename, sizeof(filename)));
+    CHECK(file_queue_init_(&queue, nchunks, use_ring));
+
+    for (size_t i = 0; i < nchunks; ++i) {
+        const size_t k = nchunks - 1 - i;
+        requests[k] = (struct file_write_request){
+            .file = &file,
+            .offset = k * chunk_bytes,
+            .beg = data + k * chunk_bytes,
+            .end = data + (k + 1) * chunk_bytes,
+        };
+        CHECK(file_queue_submit(&queue, requests + k));
+    }
+    {
+        struct file_write_request extra = requests[0];
+        CHECK(!file_queue_submit(&queue, &extra));
+    }
+    for (size_t i = 0; i < nchunks; ++i) {
+        struct file_write_request* r = 0;
+        CHECK(r = file_queue_wait(&queue));
+        CHECK(r->ok);
+    }
+    CHECK(!file_queue_wait(&queue));
+    file_queue_destroy(&queue);
+    file_close(&file);
+    is_open = 0;
+
+    CHECK(file_map_read(&mapping, filename, sizeof(filename)));
+    CHECK(mapping.nbytes == nchunks * chunk_bytes);
+    CHECK(memcmp(mapping.data, data, mapping.nbytes) == 0);
+    is_ok = 1;
+Error:
+    file_unmap(&mapping);
+    file_queue_destroy(&queue);
+    if (is_open)
+        file_close(&file);
+    free(data);
+    remove(filename);
+    return is_ok;
+}
+
+int
+unit_test__file_queue_writes_out_of_order()
+{
+    return check_file_queue_writes_out_of_order(1);
+}
+
+int
+unit_test__file_queue_writes_on_threads()
+{
+    return check_file_queue_writes_out_of_order(0);
+}
+#endif
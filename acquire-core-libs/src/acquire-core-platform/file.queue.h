@@ -0,0 +1,82 @@
+#ifndef H_ACQUIRE_PLATFORM_FILE_QUEUE_V0
+#define H_ACQUIRE_PLATFORM_FILE_QUEUE_V0
+
+//! The parts of a file_queue shared by every platform. file.queue.c runs
+//! writes on a pool of threads. Each platform's platform.c provides the
+//! functions declared at the bottom: how a pool thread writes, and,
+//! optionally, a kernel queue ("ring") that replaces the pool.
+
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Upper bound on the threads a file_queue writes on.
+#define MAX_FILE_QUEUE_THREADS (16)
+
+    /// A request in flight, and the part of it left to write.
+    struct file_queue_slot
+    {
+        struct file_write_request* request;
+        const uint8_t* cur;
+        uint64_t offset;
+        int retries;
+    };
+
+    struct file_queue_inner
+    {
+        uint32_t depth;
+        uint32_t in_flight;
+        struct file_queue_slot* slots;
+        /// Indices of the slots not in flight.
+        uint32_t* free;
+        uint32_t nfree;
+
+        /// The platform's kernel queue, if it has one and it could be set
+        /// up. Writes go through it instead of the threads.
+        void* ring;
+
+        /// Otherwise, a pool of threads. Slot indices pass through the
+        /// pending and completed FIFOs.
+        struct lock lock;
+        struct condition_variable changed;
+        uint32_t *pending, *completed;
+        uint64_t pending_head, pending_tail;
+        uint64_t completed_head, completed_tail;
+        uint8_t is_stopping;
+        struct thread threads[MAX_FILE_QUEUE_THREADS];
+        uint32_t nthreads;
+    };
+
+    /// Sets up `self->ring` with room for `depth` writes.
+    /// @returns 0, leaving `self->ring` NULL, if the platform has no kernel
+    ///          queue or it isn't allowed.
+    int file_queue_ring_init(struct file_queue_inner* self, uint32_t depth);
+
+    /// Releases `self->ring`, if any. Nothing may be in flight on it.
+    void file_queue_ring_destroy(struct file_queue_inner* self);
+
+    /// Submits the rest of slot `i` to the ring.
+    /// @returns 0 if the write isn't in flight.
+    int file_queue_ring_submit(struct file_queue_inner* self, uint32_t i);
+
+    /// Waits for a write on the ring to complete. Sets the request's `ok`.
+    /// @returns the completed slot.
+    uint32_t file_queue_ring_wait(struct file_queue_inner* self);
+
+    /// Per-thread state a pool thread writes with.
+    void* file_queue_worker_state_init(void);
+    void file_queue_worker_state_destroy(void* state);
+
+    /// Runs `request` on a pool thread and sets its `ok`. Several threads
+    /// may write to the same file at once.
+    void file_queue_worker_write(void* state,
+                                 struct file_write_request* request);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_PLATFORM_FILE_QUEUE_V0
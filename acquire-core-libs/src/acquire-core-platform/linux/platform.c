@@ -2,13 +2,20 @@
 
 #include "platform.h"
 #include "logger.h"
+#include "../file.queue.h"
 
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <stdio.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
 
 #define L (aq_logger)
 #define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
@@ -55,6 +62,33 @@ Error:
     return 0;
 }
 
+int
+file_create_direct(struct file* file,
+                   const char* filename,
+                   size_t bytesof_filename)
+{
+    CHECK(file_create(file, filename, bytesof_filename));
+    // Some file systems, like older tmpfs, refuse O_DIRECT.
+    const int flags = fcntl(file->fid, F_GETFL);
+    if (flags < 0 || fcntl(file->fid, F_SETFL, flags | O_DIRECT) < 0) {
+        LOG("\"%s\" can't be written around the page cache. Writing through "
+            "it instead.",
+            filename);
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+int
+file_truncate(const struct file* file, uint64_t nbytes)
+{
+    CHECK_POSIX(ftruncate(file->fid, (off_t)nbytes) ? errno : 0);
+    return 1;
+Error:
+    return 0;
+}
+
 void
 file_close(struct file* file)
 {
@@ -120,18 +154,660 @@ Error:
     return 0;
 }
 
+int
+file_map_read(struct file_mapping* self, const char* filename, size_t nbytes)
+{
+    *self = (struct file_mapping){ 0 };
+    int fid = open(filename, O_RDONLY);
+    if (fid < 0)
+        CHECK_POSIX(errno);
+    struct stat st = { 0 };
+    void* data = MAP_FAILED;
+    errno = 0;
+    if (fstat(fid, &st) == 0 && st.st_size > 0)
+        data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fid, 0);
+    const int ecode = (data == MAP_FAILED) ? (errno ? errno : EINVAL) : 0;
+    close(fid); // the mapping keeps the file open
+    CHECK_POSIX(ecode);
+    // Mapped files are usually read front to back.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    self->data = data;
+    self->nbytes = st.st_size;
+    return 1;
+Error:
+    LOGE("Failed to map \"%s\"", filename);
+    return 0;
+}
+
+void
+file_unmap(struct file_mapping* self)
+{
+    if (self->data)
+        munmap((void*)self->data, self->nbytes);
+    *self = (struct file_mapping){ 0 };
+}
+
+/// io_uring writes at most this many bytes at a time. Longer writes are
+/// split.
+#define MAX_FILE_QUEUE_WRITE_BYTES (1ULL << 30)
+
+/// A file_queue's io_uring.
+struct file_queue_ring
+{
+    int fd;
+    uint8_t* sq;
+    size_t sq_bytes;
+    uint8_t* cq;
+    size_t cq_bytes;
+    struct io_uring_sqe* sqes;
+    size_t sqes_bytes;
+    uint32_t *sq_head, *sq_tail, *sq_array, sq_mask;
+    uint32_t *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe* cqes;
+    /// What was last submitted for each slot.
+    struct iovec* iovs;
+};
+
+void*
+file_queue_worker_state_init(void)
+{
+    return 0;
+}
+
+void
+file_queue_worker_state_destroy(void* state)
+{
+}
+
+void
+file_queue_worker_write(void* state, struct file_write_request* request)
+{
+    request->ok =
+      file_write(request->file, request->offset, request->beg, request->end);
+}
+
+/// Sets up an io_uring with room for `depth` writes.
+/// @returns 0 if the kernel doesn't allow it.
+int
+file_queue_ring_init(struct file_queue_inner* self, uint32_t depth)
+{
+    struct io_uring_params p = { 0 };
+    struct file_queue_ring* ring = 0;
+    CHECK(ring = calloc(1, sizeof(*ring)));
+    ring->fd = -1;
+    self->ring = ring;
+    CHECK(ring->iovs = calloc(depth, sizeof(*ring->iovs)));
+    ring->fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (ring->fd < 0) {
+        LOG("io_uring is unavailable (%s). Writing on threads instead.",
+            strerror(errno));
+        file_queue_ring_destroy(self);
+        return 0;
+    }
+
+    ring->sq_bytes = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_bytes > ring->sq_bytes)
+            ring->sq_bytes = ring->cq_bytes;
+    }
+    ring->sq = mmap(0,
+                    ring->sq_bytes,
+                    PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE,
+                    ring->fd,
+                    IORING_OFF_SQ_RING);
+    if (ring->sq == MAP_FAILED)
+        ring->sq = 0;
+    CHECK_POSIX(ring->sq ? 0 : errno);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq = ring->sq;
+        ring->cq_bytes = ring->sq_bytes;
+    } else {
+        ring->cq = mmap(0,
+                        ring->cq_bytes,
+                        PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE,
+                        ring->fd,
+                        IORING_OFF_CQ_RING);
+        if (ring->cq == MAP_FAILED)
+            ring->cq = 0;
+        CHECK_POSIX(ring->cq ? 0 : errno);
+    }
+    ring->sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(0,
+                      ring->sqes_bytes,
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE,
+                      ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        ring->sqes = 0;
+    CHECK_POSIX(ring->sqes ? 0 : errno);
+
+    ring->sq_head = (uint32_t*)(ring->sq + p.sq_off.head);
+    ring->sq_tail = (uint32_t*)(ring->sq + p.sq_off.tail);
+    ring->sq_array = (uint32_t*)(ring->sq + p.sq_off.array);
+    ring->sq_mask = *(uint32_t*)(ring->sq + p.sq_off.ring_mask);
+    ring->cq_head = (uint32_t*)(ring->cq + p.cq_off.head);
+    ring->cq_tail = (uint32_t*)(ring->cq + p.cq_off.tail);
+    ring->cq_mask = *(uint32_t*)(ring->cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ring->cq + p.cq_off.cqes);
+    return 1;
+Error:
+    LOGE("Failed to set up the io_uring. Writing on threads instead.");
+    file_queue_ring_destroy(self);
+    return 0;
+}
+
+void
+file_queue_ring_destroy(struct file_queue_inner* self)
+{
+    struct file_queue_ring* ring = self->ring;
+    if (!ring)
+        return;
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_bytes);
+    if (ring->cq && ring->cq != ring->sq)
+        munmap(ring->cq, ring->cq_bytes);
+    if (ring->sq)
+        munmap(ring->sq, ring->sq_bytes);
+    if (ring->fd >= 0)
+        close(ring->fd);
+    free(ring->iovs);
+    free(ring);
+    self->ring = 0;
+}
+
+/// Submits the rest of slot `i` to the io_uring.
+int
+file_queue_ring_submit(struct file_queue_inner* self, uint32_t i)
+{
+    struct file_queue_ring* ring = self->ring;
+    struct file_queue_slot* slot = self->slots + i;
+    const uint64_t remaining = slot->request->end - slot->cur;
+    ring->iovs[i] = (struct iovec){
+        .iov_base = (void*)slot->cur,
+        .iov_len = remaining < MAX_FILE_QUEUE_WRITE_BYTES
+                     ? remaining
+                     : MAX_FILE_QUEUE_WRITE_BYTES,
+    };
+
+    // This thread is the only producer, so only the kernel's reads of the
+    // tail need ordering.
+    const uint32_t tail = *ring->sq_tail;
+    const uint32_t k = tail & ring->sq_mask;
+    ring->sqes[k] = (struct io_uring_sqe){
+        .opcode = IORING_OP_WRITEV,
+        .fd = slot->request->file->fid,
+        .off = slot->offset,
+        .addr = (uint64_t)(uintptr_t)(ring->iovs + i),
+        .len = 1,
+        .user_data = i,
+    };
+    ring->sq_array[k] = k;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int ret;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, 0, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != 1) {
+        const int err = (ret < 0) ? errno : 0;
+        // The kernel only reads the submission queue in io_uring_enter(). If
+        // it didn't take the write, take it back, so it's never in flight.
+        if (__atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == tail) {
+            __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+            CHECK_POSIX(err);
+            EXPECT(0, "io_uring accepted %d of 1 writes.", ret);
+        }
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+/// Waits for a write on the io_uring to complete, resubmitting what's left
+/// of short writes.
+///
+/// The kernel posts completions whether or not it's asked to wait for them.
+/// If io_uring_enter() fails, this polls for them instead, so every write in
+/// flight is accounted for before its buffer can be freed.
+/// @returns the completed slot.
+uint32_t
+file_queue_ring_wait(struct file_queue_inner* self)
+{
+    struct file_queue_ring* ring = self->ring;
+    int can_enter = 1;
+    while (1) {
+        const uint32_t head = *ring->cq_head;
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (can_enter && syscall(__NR_io_uring_enter,
+                                     ring->fd,
+                                     0,
+                                     1,
+                                     IORING_ENTER_GETEVENTS,
+                                     0,
+                                     0) < 0 &&
+                errno != EINTR) {
+                LOGE("Failed to wait on the io_uring (%s). Polling it instead.",
+                     strerror(errno));
+                can_enter = 0;
+            }
+            if (!can_enter) {
+                const struct timespec t = { .tv_nsec = 1000000 };
+                nanosleep(&t, 0);
+            }
+            continue;
+        }
+        const struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        const uint32_t i = (uint32_t)cqe.user_data;
+        struct file_queue_slot* slot = self->slots + i;
+        if (cqe.res < 0) {
+            LOGE("Write of %llu bytes at offset %llu failed: %s",
+                 (unsigned long long)ring->iovs[i].iov_len,
+                 (unsigned long long)slot->offset,
+                 strerror(-cqe.res));
+            slot->request->ok = 0;
+            return i;
+        }
+        slot->cur += cqe.res;
+        slot->offset += cqe.res;
+        slot->retries += (cqe.res == 0);
+        if (slot->cur == slot->request->end || slot->retries >= 3) {
+            slot->request->ok = slot->cur == slot->request->end;
+            return i;
+        }
+        if (!file_queue_ring_submit(self, i)) {
+            slot->request->ok = 0;
+            return i;
+        }
+    }
+}
+
+#ifndef NO_UNIT_TESTS
+/// Reads `nbytes` from a pipe after giving the writer time to block on it.
+struct pipe_drain
+{
+    int fd;
+    uint8_t* buf;
+    size_t nbytes;
+    int ok;
+};
+
+static void
+drain_pipe_later(struct pipe_drain* self)
+{
+    const struct timespec t = { .tv_nsec = 20000000 };
+    nanosleep(&t, 0);
+    size_t n = 0;
+    ssize_t ret = 0;
+    while (n < self->nbytes &&
+           (ret = read(self->fd, self->buf + n, self->nbytes - n)) > 0)
+        n += (size_t)ret;
+    self->ok = n == self->nbytes;
+}
+
+/// Once io_uring_enter() fails, a write in flight is still waited for, and a
+/// write the kernel didn't take isn't counted as in flight.
+int
+unit_test__file_queue_waits_out_io_uring_errors()
+{
+    // Pipe writes of up to 4 KiB are all or nothing.
+    const size_t nbytes = 4096;
+    int fds[2] = { -1, -1 };
+    struct file out = { 0 };
+    struct file_queue queue = { 0 };
+    struct file_queue_inner* q = 0;
+    struct file_queue_ring* uring = 0;
+    struct file_write_request request = { 0 };
+    struct thread reader = { 0 };
+    struct pipe_drain drain = { 0 };
+    uint8_t data[4096];
+    uint8_t* filler = 0;
+    size_t nfilled = 0;
+    int ring = -1, not_a_ring = -1, is_reading = 0;
+    int is_ok = 0;
+
+    for (size_t i = 0; i < nbytes; ++i)
+        data[i] = (uint8_t)(i * 13 + 1);
+    CHECK_POSIX(pipe(fds) ? errno : 0);
+    out.fid = fds[1];
+    CHECK(file_queue_init(&queue, 2));
+    q = queue.inner_;
+    if (!(uring = q->ring)) {
+        LOG("io_uring is unavailable. Nothing to test.");
+        is_ok = 1;
+        goto Error;
+    }
+
+    // Fill the pipe so the queued write has to wait for the reader.
+    CHECK(filler = calloc(1, nbytes));
+    CHECK_POSIX(fcntl(fds[1], F_SETFL, O_NONBLOCK) ? errno : 0);
+    {
+        ssize_t ret = 0;
+        while ((ret = write(fds[1], filler, nbytes)) > 0)
+            nfilled += (size_t)ret;
+        CHECK_POSIX(errno == EAGAIN ? 0 : errno);
+    }
+    CHECK_POSIX(fcntl(fds[1], F_SETFL, 0) ? errno : 0);
+    request = (struct file_write_request){
+        .file = &out,
+        .beg = data,
+        .end = data + nbytes,
+    };
+    CHECK(file_queue_submit(&queue, &request));
+
+    // io_uring_enter() fails on a file that isn't an io_uring.
+    CHECK_POSIX((not_a_ring = open("/dev/null", O_RDONLY)) < 0 ? errno : 0);
+    ring = uring->fd;
+    uring->fd = not_a_ring;
+    {
+        struct file_write_request extra = request;
+        CHECK(!file_queue_submit(&queue, &extra));
+    }
+    CHECK(q->in_flight == 1);
+    CHECK(*uring->sq_tail == *uring->sq_head);
+
+    drain = (struct pipe_drain){ .fd = fds[0], .nbytes = nfilled + nbytes };
+    CHECK(drain.buf = malloc(drain.nbytes));
+    thread_init(&reader);
+    CHECK(is_reading = thread_create(
+            &reader, (void (*)(void*))drain_pipe_later, &drain));
+    CHECK(file_queue_wait(&queue) == &request);
+    CHECK(request.ok);
+    CHECK(!file_queue_wait(&queue));
+    thread_join(&reader);
+    is_reading = 0;
+    CHECK(drain.ok);
+    CHECK(memcmp(drain.buf + nfilled, data, nbytes) == 0);
+
+    // The taken-back write doesn't get in the way of the next one.
+    uring->fd = ring;
+    ring = -1;
+    drain = (struct pipe_drain){ .fd = fds[0],
+                                 .buf = drain.buf,
+                                 .nbytes = nbytes };
+    CHECK(file_queue_submit(&queue, &request));
+    CHECK(file_queue_wait(&queue) == &request);
+    CHECK(request.ok);
+    drain_pipe_later(&drain);
+    CHECK(drain.ok);
+    CHECK(memcmp(drain.buf, data, nbytes) == 0);
+    is_ok = 1;
+Error:
+    if (ring >= 0)
+        uring->fd = ring;
+    if (is_reading)
+        thread_join(&reader);
+    file_queue_destroy(&queue);
+    if (not_a_ring >= 0)
+        close(not_a_ring);
+    for (int i = 0; i < 2; ++i)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    free(drain.buf);
+    free(filler);
+    return is_ok;
+}
+#endif
+
+/// Large page and mirrored allocations are mapped rather than malloc'd. Their
+/// sizes are needed to unmap them, so they are tracked here.
+struct memory_mapping
+{
+    void* address;
+    size_t nbytes;
+    enum MemoryBacking backing;
+    struct memory_mapping* next;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    struct memory_mapping* mappings;
+} memory_globals = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static size_t
+huge_page_size_bytes(void)
+{
+    static size_t nbytes = 0;
+    if (!nbytes) {
+        size_t kib = 0;
+        FILE* fp = fopen("/proc/meminfo", "r");
+        if (fp) {
+            char line[256];
+            while (fgets(line, sizeof(line), fp)) {
+                if (sscanf(line, "Hugepagesize: %zu kB", &kib) == 1)
+                    break;
+            }
+            fclose(fp);
+        }
+        nbytes = kib ? (kib << 10) : (2ULL << 20);
+    }
+    return nbytes;
+}
+
+static int
+is_transparent_huge_page_enabled(void)
+{
+    char buf[128] = { 0 };
+    int fid = open("/sys/kernel/mm/transparent_hugepage/enabled", O_RDONLY);
+    if (fid < 0)
+        return 0;
+    ssize_t n = read(fid, buf, sizeof(buf) - 1);
+    close(fid);
+    return n > 0 && !strstr(buf, "[never]");
+}
+
+/// Tries explicit huge pages, then transparent huge pages, then falls back
+/// to regular pages.
+/// `nbytes` must be a multiple of the huge page size.
+static void*
+map_large_pages(size_t nbytes, enum MemoryBacking* backing)
+{
+    const size_t page = huge_page_size_bytes();
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    void* out = mmap(0, nbytes, prot, flags | MAP_HUGETLB, -1, 0);
+    if (out != MAP_FAILED) {
+        *backing = MemoryBacking_LargePage;
+        return out;
+    }
+
+    // Transparent huge pages only back aligned regions, so over-allocate
+    // and trim. Pages are committed as they're touched, so don't reserve
+    // swap for the whole region up front.
+    uint8_t* raw = mmap(0, nbytes + page, prot, flags | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) {
+        LOGE("Failed to map %llu bytes: %s",
+             (unsigned long long)nbytes,
+             strerror(errno));
+        return 0;
+    }
+    uint8_t* aligned =
+      (uint8_t*)(((uintptr_t)raw + page - 1) & ~(uintptr_t)(page - 1));
+    if (aligned > raw)
+        munmap(raw, aligned - raw);
+    if (raw + page > aligned)
+        munmap(aligned + nbytes, (raw + page) - aligned);
+
+    *backing = MemoryBacking_Default;
+    if (is_transparent_huge_page_enabled() &&
+        madvise(aligned, nbytes, MADV_HUGEPAGE) == 0) {
+        *backing = MemoryBacking_TransparentLargePage;
+    }
+    return aligned;
+}
+
+/// Adds `mapping` to the list of tracked mappings.
+static void
+push_mapping(struct memory_mapping* mapping)
+{
+    pthread_mutex_lock(&memory_globals.lock);
+    mapping->next = memory_globals.mappings;
+    memory_globals.mappings = mapping;
+    pthread_mutex_unlock(&memory_globals.lock);
+}
+
 void*
 memory_alloc(size_t capacity_bytes, enum AllocatorHint hint)
 {
-    return malloc(capacity_bytes);
+    const size_t page = huge_page_size_bytes();
+    if (hint != AllocatorHint_LargePage || capacity_bytes < page)
+        return malloc(capacity_bytes);
+
+    struct memory_mapping* mapping = 0;
+    CHECK(mapping = malloc(sizeof(*mapping)));
+    *mapping = (struct memory_mapping){
+        .nbytes = page * ((capacity_bytes + page - 1) / page),
+    };
+    CHECK(mapping->address =
+            map_large_pages(mapping->nbytes, &mapping->backing));
+    LOG("Allocated %llu bytes backed by %s pages.",
+        (unsigned long long)mapping->nbytes,
+        memory_backing_as_string(mapping->backing));
+    push_mapping(mapping);
+    return mapping->address;
+Error:
+    free(mapping);
+    return 0;
+}
+
+size_t
+memory_page_size_bytes(void)
+{
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void*
+memory_alloc_mirrored(size_t capacity_bytes)
+{
+    struct memory_mapping* mapping = 0;
+    uint8_t* base = MAP_FAILED;
+    int fid = -1;
+    EXPECT(capacity_bytes && capacity_bytes % memory_page_size_bytes() == 0,
+           "Mirrored allocations must be a multiple of the page size. Got %llu "
+           "bytes.",
+           (unsigned long long)capacity_bytes);
+
+    // Reserve the address range for both copies first, then map the same
+    // file over each half. Pages are committed as they're touched.
+    CHECK_POSIX((fid = memfd_create("acquire-mirrored", MFD_CLOEXEC)) < 0
+                  ? errno
+                  : 0);
+    CHECK_POSIX(ftruncate(fid, (off_t)capacity_bytes) ? errno : 0);
+    base = mmap(0,
+                2 * capacity_bytes,
+                PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                -1,
+                0);
+    CHECK_POSIX(base == MAP_FAILED ? errno : 0);
+    for (int i = 0; i < 2; ++i) {
+        void* half = base + i * capacity_bytes;
+        CHECK_POSIX(mmap(half,
+                         capacity_bytes,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_FIXED,
+                         fid,
+                         0) == half
+                      ? 0
+                      : errno);
+    }
+    close(fid);
+    fid = -1;
+
+    CHECK(mapping = malloc(sizeof(*mapping)));
+    *mapping = (struct memory_mapping){
+        .address = base,
+        .nbytes = 2 * capacity_bytes,
+        .backing = MemoryBacking_Default,
+    };
+    push_mapping(mapping);
+    return base;
+Error:
+    if (base != MAP_FAILED)
+        munmap(base, 2 * capacity_bytes);
+    if (fid >= 0)
+        close(fid);
+    return 0;
+}
+
+/// Removes the mapping for `address` from the list of tracked mappings.
+/// @returns the mapping, or 0 if `address` wasn't mapped by memory_alloc().
+static struct memory_mapping*
+pop_mapping(const void* address)
+{
+    struct memory_mapping* out = 0;
+    pthread_mutex_lock(&memory_globals.lock);
+    for (struct memory_mapping** cur = &memory_globals.mappings; *cur;
+         cur = &(*cur)->next) {
+        if ((*cur)->address == address) {
+            out = *cur;
+            *cur = out->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&memory_globals.lock);
+    return out;
 }
 
 void
 memory_free(void* address)
 {
-    free(address);
+    struct memory_mapping* mapping = pop_mapping(address);
+    if (mapping) {
+        munmap(mapping->address, mapping->nbytes);
+        free(mapping);
+    } else {
+        free(address);
+    }
 }
 
+enum MemoryBacking
+memory_backing(const void* address)
+{
+    enum MemoryBacking out = MemoryBacking_Default;
+    pthread_mutex_lock(&memory_globals.lock);
+    for (const struct memory_mapping* cur = memory_globals.mappings; cur;
+         cur = cur->next) {
+        if (cur->address == address) {
+            out = cur->backing;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&memory_globals.lock);
+    return out;
+}
+
+#ifndef NO_UNIT_TESTS
+int
+unit_test__memory_alloc_mirrored_aliases()
+{
+    const size_t nbytes = 4 * memory_page_size_bytes();
+    uint8_t* p = 0;
+    CHECK(p = memory_alloc_mirrored(nbytes));
+    memset(p, 0, nbytes);
+    p[0] = 0x11;
+    p[2 * nbytes - 1] = 0x22;
+    CHECK(p[nbytes] == 0x11);
+    CHECK(p[nbytes - 1] == 0x22);
+
+    // A span that straddles the end of the first copy reads back whole.
+    memset(p + nbytes - 8, 0xcd, 16);
+    CHECK(p[nbytes - 8] == 0xcd && p[7] == 0xcd);
+    memory_free(p);
+    return 1;
+Error:
+    memory_free(p);
+    return 0;
+}
+#endif
+
 void
 clock_init(struct clock* clock)
 {
@@ -287,6 +963,25 @@ condition_variable_wait(struct condition_variable* restrict self,
 Error:;
 }
 
+int
+condition_variable_wait_for_ms(struct condition_variable* restrict self,
+                               struct lock* restrict lock,
+                               float timeout_ms)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t); // pthread_cond's default clock
+    const int64_t ns = (int64_t)t.tv_nsec + (int64_t)(1e6 * (double)timeout_ms);
+    t.tv_sec += (time_t)(ns / 1000000000LL);
+    t.tv_nsec = (long)(ns % 1000000000LL);
+    const int ecode = pthread_cond_timedwait(&self->inner_, &lock->inner_, &t);
+    if (ecode == ETIMEDOUT)
+        return 0;
+    CHECK_POSIX(ecode);
+    return 1;
+Error:
+    return 0;
+}
+
 void
 condition_variable_notify_all(struct condition_variable* self)
 {
@@ -0,0 +1,59 @@
+//! Memory helpers that are the same on every platform. Each platform's
+//! library builds this next to its own platform.c.
+
+#include "platform.h"
+#include "logger.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+const char*
+memory_backing_as_string(enum MemoryBacking backing)
+{
+    switch (backing) {
+        case MemoryBacking_Default:
+            return "regular";
+        case MemoryBacking_TransparentLargePage:
+            return "transparent huge";
+        case MemoryBacking_LargePage:
+            return "huge";
+        default:
+            return "(unknown)";
+    }
+}
+
+#ifndef NO_UNIT_TESTS
+int
+unit_test__memory_alloc_large_page_is_writable()
+{
+    const size_t nbytes = 8ULL << 20;
+    uint8_t* large = 0;
+    uint8_t* small = 0;
+    CHECK(large = memory_alloc(nbytes, AllocatorHint_LargePage));
+    CHECK(small = memory_alloc(4096, AllocatorHint_Default));
+    memset(large, 0xab, nbytes);
+    CHECK(large[nbytes - 1] == 0xab);
+    CHECK(memory_backing(small) == MemoryBacking_Default);
+    LOG("Large page allocation backed by %s pages.",
+        memory_backing_as_string(memory_backing(large)));
+    memory_free(large);
+    memory_free(small);
+    return 1;
+Error:
+    memory_free(large);
+    memory_free(small);
+    return 0;
+}
+#endif
@@ -1,5 +1,6 @@
 #include "platform.h"
 #include "logger.h"
+#include "../file.queue.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +11,8 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define L (aq_logger)
 #define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
@@ -54,6 +57,31 @@ Error:
     return 0;
 }
 
+int
+file_create_direct(struct file* file,
+                   const char* filename,
+                   size_t bytesof_filename)
+{
+    CHECK(file_create(file, filename, bytesof_filename));
+    if (fcntl(file->fid, F_NOCACHE, 1) < 0) {
+        LOG("\"%s\" can't be written around the page cache. Writing through "
+            "it instead.",
+            filename);
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+int
+file_truncate(const struct file* file, uint64_t nbytes)
+{
+    CHECK_POSIX(ftruncate(file->fid, (off_t)nbytes) ? errno : 0);
+    return 1;
+Error:
+    return 0;
+}
+
 void
 file_close(struct file* file)
 {
@@ -119,6 +147,90 @@ Error:
     return 0;
 }
 
+int
+file_map_read(struct file_mapping* self, const char* filename, size_t nbytes)
+{
+    *self = (struct file_mapping){ 0 };
+    int fid = open(filename, O_RDONLY);
+    if (fid < 0)
+        CHECK_POSIX(errno);
+    struct stat st = { 0 };
+    void* data = MAP_FAILED;
+    errno = 0;
+    if (fstat(fid, &st) == 0 && st.st_size > 0)
+        data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fid, 0);
+    const int ecode = (data == MAP_FAILED) ? (errno ? errno : EINVAL) : 0;
+    close(fid); // the mapping keeps the file open
+    CHECK_POSIX(ecode);
+    // Mapped files are usually read front to back.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    self->data = data;
+    self->nbytes = st.st_size;
+    return 1;
+Error:
+    LOGE("Failed to map \"%s\"", filename);
+    return 0;
+}
+
+void
+file_unmap(struct file_mapping* self)
+{
+    if (self->data)
+        munmap((void*)self->data, self->nbytes);
+    *self = (struct file_mapping){ 0 };
+}
+
+void*
+file_queue_worker_state_init(void)
+{
+    return 0;
+}
+
+void
+file_queue_worker_state_destroy(void* state)
+{
+}
+
+void
+file_queue_worker_write(void* state, struct file_write_request* request)
+{
+    request->ok =
+      file_write(request->file, request->offset, request->beg, request->end);
+}
+
+int
+file_queue_ring_init(struct file_queue_inner* self, uint32_t depth)
+{
+    // There's no kernel write queue here, so writes run on threads.
+    return 0;
+}
+
+void
+file_queue_ring_destroy(struct file_queue_inner* self)
+{
+}
+
+int
+file_queue_ring_submit(struct file_queue_inner* self, uint32_t i)
+{
+    return 0;
+}
+
+uint32_t
+file_queue_ring_wait(struct file_queue_inner* self)
+{
+    return 0;
+}
+
+#ifndef NO_UNIT_TESTS
+int
+unit_test__file_queue_waits_out_io_uring_errors()
+{
+    // There's no io_uring here.
+    return 1;
+}
+#endif
+
 void*
 memory_alloc(size_t capacity_bytes, enum AllocatorHint hint)
 {
@@ -131,6 +243,35 @@ memory_free(void* address)
     free(address);
 }
 
+size_t
+memory_page_size_bytes(void)
+{
+    return (size_t)getpagesize();
+}
+
+void*
+memory_alloc_mirrored(size_t capacity_bytes)
+{
+    // Not implemented. Callers fall back to a single mapping.
+    return 0;
+}
+
+enum MemoryBacking
+memory_backing(const void* address)
+{
+    (void)address;
+    return MemoryBacking_Default;
+}
+
+#ifndef NO_UNIT_TESTS
+int
+unit_test__memory_alloc_mirrored_aliases()
+{
+    // Mirrored allocations aren't supported on this platform.
+    return memory_alloc_mirrored(memory_page_size_bytes()) == 0;
+}
+#endif
+
 void
 clock_init(struct clock* clock)
 {
@@ -279,6 +420,24 @@ condition_variable_wait(struct condition_variable* restrict self,
 Error:;
 }
 
+int
+condition_variable_wait_for_ms(struct condition_variable* restrict self,
+                               struct lock* restrict lock,
+                               float timeout_ms)
+{
+    const int64_t ns = (int64_t)(1e6 * (double)timeout_ms);
+    const struct timespec t = { .tv_sec = (time_t)(ns / 1000000000LL),
+                                .tv_nsec = (long)(ns % 1000000000LL) };
+    const int ecode =
+      pthread_cond_timedwait_relative_np(&self->inner_, &lock->inner_, &t);
+    if (ecode == ETIMEDOUT)
+        return 0;
+    CHECK_POSIX(ecode);
+    return 1;
+Error:
+    return 0;
+}
+
 void
 condition_variable_notify_all(struct condition_variable* self)
 {
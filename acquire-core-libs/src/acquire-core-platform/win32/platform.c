@@ -2,9 +2,14 @@
 
 #include "platform.h"
 #include "logger.h"
+#include "../file.queue.h"
 
+#include <psapi.h>
 #include <stdint.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #define L aq_logger
 #define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
@@ -64,8 +69,9 @@ errstr()
     return buf;
 }
 
-int
-file_create(struct file* file, const char* filename, size_t bytes_of_filename)
+/// Creates `filename` for writing, with `flags` added to the usual ones.
+static int
+file_create_with_flags(struct file* file, const char* filename, DWORD flags)
 {
     memset(file, 0, sizeof(*file));
 
@@ -77,7 +83,7 @@ file_create(struct file* file, const char* filename, size_t bytes_of_filename)
                                            FILE_SHARE_READ,
                                            0,
                                            CREATE_ALWAYS,
-                                           FILE_FLAG_OVERLAPPED,
+                                           FILE_FLAG_OVERLAPPED | flags,
                                            0));
     return 1;
 Error:
@@ -85,6 +91,31 @@ Error:
     return 0;
 }
 
+int
+file_create(struct file* file, const char* filename, size_t bytes_of_filename)
+{
+    return file_create_with_flags(file, filename, 0);
+}
+
+int
+file_create_direct(struct file* file,
+                   const char* filename,
+                   size_t bytes_of_filename)
+{
+    return file_create_with_flags(file, filename, FILE_FLAG_NO_BUFFERING);
+}
+
+int
+file_truncate(const struct file* file, uint64_t nbytes)
+{
+    FILE_END_OF_FILE_INFO info = { .EndOfFile.QuadPart = (LONGLONG)nbytes };
+    CHECK(SetFileInformationByHandle(
+      file->hfile, FileEndOfFileInfo, &info, sizeof(info)));
+    return 1;
+Error:
+    return 0;
+}
+
 void
 file_close(struct file* file)
 {
@@ -165,6 +196,104 @@ file_is_writable(const char* filename, size_t nbytes)
     return 0;
 }
 
+int
+file_map_read(struct file_mapping* self, const char* filename, size_t nbytes)
+{
+    memset(self, 0, sizeof(*self));
+    CHECK_HANDLE(self->hfile = CreateFileA(filename,
+                                           GENERIC_READ,
+                                           FILE_SHARE_READ,
+                                           0,
+                                           OPEN_EXISTING,
+                                           FILE_FLAG_SEQUENTIAL_SCAN,
+                                           0));
+    LARGE_INTEGER size = { 0 };
+    CHECK(GetFileSizeEx(self->hfile, &size));
+    EXPECT(size.QuadPart > 0, "Can't map an empty file");
+    CHECK(self->hmapping =
+            CreateFileMappingA(self->hfile, 0, PAGE_READONLY, 0, 0, 0));
+    CHECK(self->data = MapViewOfFile(self->hmapping, FILE_MAP_READ, 0, 0, 0));
+    self->nbytes = (size_t)size.QuadPart;
+    return 1;
+Error:
+    if (self->hfile == INVALID_HANDLE_VALUE)
+        self->hfile = 0;
+    file_unmap(self);
+    LOGE("Failed to map \"%s\"", filename);
+    return 0;
+}
+
+void
+file_unmap(struct file_mapping* self)
+{
+    if (self->data)
+        CHECK_WARN(UnmapViewOfFile(self->data));
+    if (self->hmapping)
+        CHECK_WARN(CloseHandle(self->hmapping));
+    if (self->hfile)
+        CHECK_WARN(CloseHandle(self->hfile));
+    memset(self, 0, sizeof(*self));
+}
+
+void*
+file_queue_worker_state_init(void)
+{
+    // Writes to a file share its event, so each thread waits on its own.
+    HANDLE event = CreateEventA(0, TRUE, FALSE, 0);
+    if (!event)
+        LOGE("Failed to create an event for file writes.");
+    return event;
+}
+
+void
+file_queue_worker_state_destroy(void* state)
+{
+    if (state)
+        CloseHandle((HANDLE)state);
+}
+
+void
+file_queue_worker_write(void* state, struct file_write_request* request)
+{
+    struct file file = *request->file;
+    file.overlapped.hEvent = (HANDLE)state;
+    request->ok =
+      state && file_write(&file, request->offset, request->beg, request->end);
+}
+
+int
+file_queue_ring_init(struct file_queue_inner* self, uint32_t depth)
+{
+    // There's no kernel write queue here, so writes run on threads.
+    return 0;
+}
+
+void
+file_queue_ring_destroy(struct file_queue_inner* self)
+{
+}
+
+int
+file_queue_ring_submit(struct file_queue_inner* self, uint32_t i)
+{
+    return 0;
+}
+
+uint32_t
+file_queue_ring_wait(struct file_queue_inner* self)
+{
+    return 0;
+}
+
+#ifndef NO_UNIT_TESTS
+int
+unit_test__file_queue_waits_out_io_uring_errors()
+{
+    // There's no io_uring here.
+    return 1;
+}
+#endif
+
 void*
 mem_alloc_default(size_t capacity);
 
@@ -235,6 +364,42 @@ memory_free(void* address)
     VirtualFree(address, 0, MEM_RELEASE);
 }
 
+size_t
+memory_page_size_bytes(void)
+{
+    SYSTEM_INFO info = { 0 };
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+}
+
+void*
+memory_alloc_mirrored(size_t capacity_bytes)
+{
+    // Not implemented. Callers fall back to a single mapping.
+    return 0;
+}
+
+enum MemoryBacking
+memory_backing(const void* address)
+{
+    PSAPI_WORKING_SET_EX_INFORMATION info = { .VirtualAddress =
+                                                (PVOID)address };
+    if (QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info)) &&
+        info.VirtualAttributes.Valid && info.VirtualAttributes.LargePage) {
+        return MemoryBacking_LargePage;
+    }
+    return MemoryBacking_Default;
+}
+
+#ifndef NO_UNIT_TESTS
+int
+unit_test__memory_alloc_mirrored_aliases()
+{
+    // Mirrored allocations aren't supported on this platform.
+    return memory_alloc_mirrored(memory_page_size_bytes()) == 0;
+}
+#endif
+
 void
 clock_init(struct clock* clock)
 {
@@ -390,6 +555,21 @@ condition_variable_wait(struct condition_variable* restrict self,
     SleepConditionVariableSRW(&self->inner_, &lock->inner_, INFINITE, 0);
 }
 
+int
+condition_variable_wait_for_ms(struct condition_variable* restrict self,
+                               struct lock* restrict lock,
+                               float timeout_ms)
+{
+    if (!SleepConditionVariableSRW(
+          &self->inner_, &lock->inner_, (DWORD)timeout_ms, 0)) {
+        if (GetLastError() == ERROR_TIMEOUT)
+            return 0;
+        LOGE("Failed to wait on condition variable: %s", errstr());
+        return 0;
+    }
+    return 1;
+}
+
 void
 event_init(struct event* self)
 {
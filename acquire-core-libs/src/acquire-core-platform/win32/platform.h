@@ -45,12 +45,51 @@ extern "C"
         AllocatorHint_LargePage
     };
 
+    /// The kind of pages actually backing an allocation.
+    enum MemoryBacking
+    {
+        MemoryBacking_Default,
+        MemoryBacking_TransparentLargePage,
+        MemoryBacking_LargePage
+    };
+
     struct file
     {
         HANDLE hfile;
         OVERLAPPED overlapped;
     };
 
+    /// @brief A read-only view of a whole file.
+    struct file_mapping
+    {
+        const uint8_t* data;
+        size_t nbytes;
+        HANDLE hfile;
+        HANDLE hmapping;
+    };
+
+    /// @brief A write to run on a file_queue.
+    struct file_write_request
+    {
+        const struct file* file;
+        uint64_t offset;
+        /// The bytes to write, `[beg,end)`.
+        const uint8_t* beg;
+        const uint8_t* end;
+        /// Set when the write completes: 1 if every byte was written,
+        /// otherwise 0.
+        int ok;
+        /// Not used by the queue.
+        void* user;
+    };
+
+    /// @brief Runs file writes in the background, several at a time.
+    /// @see file_queue_init()
+    struct file_queue
+    {
+        void* inner_;
+    };
+
     struct lib
     {
         HMODULE inner;
@@ -101,6 +140,27 @@ extern "C"
 
     void file_close(struct file* file);
 
+/// Writes to files made by file_create_direct() must start at offsets that
+/// are multiples of this, span a multiple of it, and come from memory aligned
+/// to it.
+#define FILE_DIRECT_ALIGNMENT_BYTES (4096)
+
+    /// @brief Like file_create(), but writes go around the page cache.
+    /// @return 1 on success, otherwise 0
+    /// @see FILE_DIRECT_ALIGNMENT_BYTES
+    ///
+    /// If the file system can't write around the page cache, the file is
+    /// created as by file_create(). Opens the file with
+    /// FILE_FLAG_NO_BUFFERING.
+    int file_create_direct(struct file* file,
+                           const char* filename,
+                           size_t bytes_of_filename);
+
+    /// @brief Sets the size of `file` to `nbytes`, cutting it short or
+    /// padding it with zeros.
+    /// @return 1 on success, otherwise 0
+    int file_truncate(const struct file* file, uint64_t nbytes);
+
     /// @brief Write the memory in `[beg,end)` to `file` starting at `offset`.
     /// @param file Writable file context
     /// @param offset byte offset from the beginning of the file
@@ -122,10 +182,64 @@ extern "C"
     /// @return 1 if the file is writable, otherwise 0
     int file_is_writable(const char* filename, size_t nbytes);
 
+    /// @brief Maps the file at `filename` into memory, read-only.
+    /// @param filename NULL-terminated path string
+    /// @param nbytes length of the filename string in bytes
+    /// @return 1 on success, otherwise 0
+    /// @see file_unmap()
+    int file_map_read(struct file_mapping* self,
+                      const char* filename,
+                      size_t nbytes);
+
+    /// @brief Unmaps a file mapped by file_map_read(). Does nothing if `self`
+    /// is zeroed.
+    void file_unmap(struct file_mapping* self);
+
+    /// @brief Starts a queue that runs up to `depth` writes at once.
+    /// @return 1 on success, otherwise 0
+    /// @see file_queue_destroy()
+    ///
+    /// Submitting and waiting for writes must be done from one thread at a
+    /// time. Writes run on a pool of threads.
+    int file_queue_init(struct file_queue* self, uint32_t depth);
+
+    /// @brief Waits for the writes in flight, then releases the queue.
+    void file_queue_destroy(struct file_queue* self);
+
+    /// @brief Starts writing `request`.
+    /// The request and the bytes it points to must stay valid until
+    /// file_queue_wait() returns it. Writes in flight may complete in any
+    /// order, so they shouldn't overlap.
+    /// @return 1 on success, or 0 if `depth` writes are already in flight.
+    int file_queue_submit(struct file_queue* self,
+                          struct file_write_request* request);
+
+    /// @brief Waits for a write to complete.
+    /// @return the completed request, with `ok` set, or NULL if no writes
+    /// are in flight.
+    struct file_write_request* file_queue_wait(struct file_queue* self);
+
     void* memory_alloc(size_t capacity_bytes, enum AllocatorHint hint);
 
     void memory_free(void* address);
 
+    /// @brief Allocates `capacity_bytes` of memory that is mapped twice, back
+    /// to back.
+    /// The byte at `p + i` is the same as the one at `p + capacity_bytes + i`,
+    /// so a span that runs off the end of the first mapping continues at its
+    /// start. Free with memory_free().
+    /// @param capacity_bytes Must be a multiple of memory_page_size_bytes().
+    /// @returns 0 on failure, or if the platform doesn't support it.
+    void* memory_alloc_mirrored(size_t capacity_bytes);
+
+    /// @returns the granularity of memory_alloc_mirrored() allocations.
+    size_t memory_page_size_bytes(void);
+
+    /// @returns the kind of pages backing memory returned by memory_alloc().
+    enum MemoryBacking memory_backing(const void* address);
+
+    const char* memory_backing_as_string(enum MemoryBacking backing);
+
     void clock_init(struct clock* clock);
 
     void clock_shift_ms(struct clock* clock, double ms);
@@ -168,6 +282,14 @@ extern "C"
     void condition_variable_wait(struct condition_variable* __restrict self,
                                  struct lock* __restrict lock);
 
+    /// @brief Like condition_variable_wait(), but gives up after
+    ///        `timeout_ms` milliseconds.
+    /// @returns 0 if the wait timed out, otherwise 1.
+    int condition_variable_wait_for_ms(
+      struct condition_variable* __restrict self,
+      struct lock* __restrict lock,
+      float timeout_ms);
+
     void condition_variable_notify_all(struct condition_variable* self);
 
     void event_init(struct event* self);
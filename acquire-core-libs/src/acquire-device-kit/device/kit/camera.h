@@ -52,6 +52,10 @@ extern "C"
         enum DeviceStatusCode (*execute_trigger)(struct Camera*);
 
         /// @brief Gets the next frame from the camera.
+        /// @details `im` points to `*nbytes` bytes of the runtime's frame
+        ///          queue and stays valid until this returns. Where it can,
+        ///          a camera should render or DMA the frame straight into
+        ///          `im` rather than staging it and copying.
         enum DeviceStatusCode (*get_frame)(struct Camera*,
                                            void* im,
                                            size_t* nbytes,
@@ -11,6 +11,19 @@ extern "C"
 {
 #endif
 
+    /// @brief When a camera that replays recorded frames emits each one.
+    enum ReplayTiming
+    {
+        /// Keep the intervals between the frames' recorded hardware
+        /// timestamps, read as nanoseconds.
+        ReplayTiming_Timestamps,
+        /// Emit a frame every `CameraProperties::exposure_time_us`.
+        ReplayTiming_FixedRate,
+        /// Emit frames as fast as they are asked for.
+        ReplayTiming_Unthrottled,
+        ReplayTiming_Count
+    };
+
     /// @brief Stores the properties of a camera.
     /// @details Can be populated with values from a camera or
     ///          can be filled out to define new values that a camera should
@@ -65,6 +78,37 @@ extern "C"
         {
             struct Trigger exposure, frame_start, trigger_wait;
         } output_triggers;
+
+        /// @brief Number of threads that render each frame.
+        /// @details Only used by cameras that render frames in software, like
+        ///          the simulated cameras. Each thread renders a band of the
+        ///          frame. Zero selects one. Takes effect the next time the
+        ///          camera starts.
+        uint32_t render_thread_count;
+
+        /// @brief Number of frames the camera buffers for get_frame().
+        /// @details Zero paces the camera to the caller: a frame is read out
+        ///          for each get_frame() call. Otherwise the camera runs
+        ///          freely and queues up to this many frames. Frames read
+        ///          out while the queue is full are lost, and show up as
+        ///          gaps in `ImageInfo::hardware_frame_id`. Takes effect the
+        ///          next time the camera starts.
+        uint32_t frame_queue_depth;
+
+        /// @brief Where and how cameras that replay recorded frames read
+        ///        them.
+        struct camera_properties_replay_s
+        {
+            /// @brief Path, or `file://` URI, of a file written by the "raw"
+            ///        or "tiff" storage devices.
+            /// @details The camera keeps its own copy of the string.
+            struct String uri;
+            enum ReplayTiming timing;
+            /// @brief When nonzero, the first frame follows the last.
+            ///        Otherwise the camera stops emitting frames after the
+            ///        last one.
+            uint8_t loop;
+        } replay;
     };
 
     /// @brief Stores the metadata about camera properties.
@@ -113,6 +157,12 @@ extern "C"
                 uint8_t output;
             } acquisition_start, exposure, frame_start;
         } triggers;
+
+        /// @brief Zero for cameras that don't render frames in software.
+        struct Property render_thread_count;
+
+        /// @brief Zero for cameras that can't queue frames.
+        struct Property frame_queue_depth;
     };
 
 #ifdef __cplusplus
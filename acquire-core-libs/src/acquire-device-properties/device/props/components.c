@@ -20,6 +20,7 @@ sample_type_as_string(enum SampleType type)
         XXX(u10),
         XXX(u12),
         XXX(u14),
+        XXX(u32),
 #undef XXX
     };
     // clang-format on
@@ -32,7 +33,7 @@ sample_type_as_string(enum SampleType type)
 size_t
 bytes_of_type(enum SampleType type)
 {
-    size_t table[SampleTypeCount]; // = { 1, 2, 1, 2, 4, 2, 2, 2 };
+    size_t table[SampleTypeCount]; // = { 1, 2, 1, 2, 4, 2, 2, 2, 4 };
 
     // clang-format off
 #define XXX(s, b) table[(s)] = (b)
@@ -44,6 +45,7 @@ bytes_of_type(enum SampleType type)
         XXX(SampleType_u10, 2);
         XXX(SampleType_u12, 2);
         XXX(SampleType_u14, 2);
+        XXX(SampleType_u32, 4);
 #undef XXX
     // clang-format on
     if (type >= countof(table))
@@ -75,6 +75,7 @@ extern "C"
         SampleType_u10, // unpacked 10 bit in 2 bytes
         SampleType_u12, // unpacked 12 bit in 2 bytes
         SampleType_u14, // unpacked 14 bit in 2 bytes
+        SampleType_u32,
         SampleTypeCount,
         SampleType_Unknown
     };
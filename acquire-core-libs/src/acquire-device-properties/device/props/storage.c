@@ -255,6 +255,17 @@ Error:
     return 0;
 }
 
+int
+storage_properties_set_direct_io(struct StorageProperties* out,
+                                 uint8_t enable)
+{
+    CHECK(out);
+    out->direct_io = enable;
+    return 1;
+Error:
+    return 0;
+}
+
 int
 storage_properties_init(struct StorageProperties* out,
                         uint32_t first_frame_id,
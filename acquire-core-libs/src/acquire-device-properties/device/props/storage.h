@@ -64,6 +64,11 @@ extern "C"
 
         /// Enable multiscale storage if true.
         uint8_t enable_multiscale;
+
+        /// Write files around the operating system's page cache if true, so
+        /// long recordings don't fill memory other processes need. Where
+        /// supported, frames are placed on 4 KiB boundaries in the file.
+        uint8_t direct_io;
     };
 
     struct StoragePropertyMetadata
@@ -72,6 +77,7 @@ extern "C"
         uint8_t sharding_is_supported;
         uint8_t multiscale_is_supported;
         uint8_t s3_is_supported;
+        uint8_t direct_io_is_supported;
     };
 
     /// Initializes StorageProperties, allocating string storage on the heap
@@ -181,6 +187,13 @@ extern "C"
     int storage_properties_set_enable_multiscale(struct StorageProperties* out,
                                                  uint8_t enable);
 
+    /// @brief Set whether files are written around the page cache.
+    /// @returns 1 on success, otherwise 0
+    /// @param[in, out] out The storage properties to change.
+    /// @param[in] enable A flag to enable or disable direct I/O.
+    int storage_properties_set_direct_io(struct StorageProperties* out,
+                                         uint8_t enable);
+
     /// Free allocated string storage.
     void storage_properties_destroy(struct StorageProperties* self);
 
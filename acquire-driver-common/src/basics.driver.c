@@ -5,6 +5,7 @@
 #include "logger.h"
 
 #include "simcams/simulated.camera.h"
+#include "replay/replay.camera.h"
 #include "storage/basic.storage.h"
 
 #include <stdlib.h>
@@ -42,6 +43,8 @@ basic_device_kind_to_string(enum BasicDeviceKind kind)
         CASE(BasicDevice_Storage_Tiff);
         CASE(BasicDevice_Storage_Trash);
         CASE(BasicDevice_Storage_SideBySideTiffJson);
+        CASE(BasicDevice_Camera_Replay);
+        CASE(BasicDevice_Camera_Beads);
         CASE(BasicDeviceKindCount);
 #undef CASE
         default:
@@ -90,6 +93,8 @@ basic_device_describe(const struct Driver* driver,
         XXX(Storage,Tiff,"tiff"),
         XXX(Storage,Trash,"trash"),
         XXX(Storage,SideBySideTiffJson,"tiff-json"),
+        XXX(Camera,Replay,"replay"),
+        XXX(Camera,Beads,"simulated: beads"),
     };
     // clang-format on
 #undef XXX
@@ -110,12 +115,19 @@ basic_device_open(struct Driver* driver,
     switch (device_id) {
         case BasicDevice_Camera_Random:
         case BasicDevice_Camera_Sin:
-        case BasicDevice_Camera_Empty: {
+        case BasicDevice_Camera_Empty:
+        case BasicDevice_Camera_Beads: {
             struct Camera* camera = 0;
             CHECK(camera = simcam_make_camera(device_id));
             *out = &camera->device;
             break;
         }
+        case BasicDevice_Camera_Replay: {
+            struct Camera* camera = 0;
+            CHECK(camera = replay_make_camera());
+            *out = &camera->device;
+            break;
+        }
         case BasicDevice_Storage_Raw:
         case BasicDevice_Storage_Tiff:
         case BasicDevice_Storage_Trash:
@@ -141,10 +153,15 @@ basic_device_close(struct Driver* driver, struct Device* in)
     switch (in->identifier.device_id) {
         case BasicDevice_Camera_Random:
         case BasicDevice_Camera_Sin:
-        case BasicDevice_Camera_Empty: {
+        case BasicDevice_Camera_Empty:
+        case BasicDevice_Camera_Beads: {
             struct Camera* camera = containerof(in, struct Camera, device);
             return simcam_close_camera(camera);
         }
+        case BasicDevice_Camera_Replay: {
+            struct Camera* camera = containerof(in, struct Camera, device);
+            return replay_close_camera(camera);
+        }
         case BasicDevice_Storage_Raw:
         case BasicDevice_Storage_Tiff:
         case BasicDevice_Storage_Trash:
@@ -15,6 +15,8 @@ extern "C"
         BasicDevice_Storage_Tiff,
         BasicDevice_Storage_Trash,
         BasicDevice_Storage_SideBySideTiffJson,
+        BasicDevice_Camera_Replay,
+        BasicDevice_Camera_Beads,
         BasicDeviceKindCount
     };
 
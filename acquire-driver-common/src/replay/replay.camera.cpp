@@ -0,0 +1,595 @@
+#include "replay.camera.h"
+
+#include "device/kit/camera.h"
+#include "device/props/camera.h"
+#include "device/props/components.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+#define containerof(ptr, T, V) ((T*)(((char*)(ptr)) - offsetof(T, V)))
+
+namespace {
+
+/// A recorded frame, in the mapped file.
+struct Frame
+{
+    const uint8_t* data;
+    uint64_t hardware_timestamp;
+};
+
+struct Replay
+{
+    struct Camera camera;
+    struct CameraProperties properties;
+
+    /// The file being replayed. `properties.replay.uri` refers to this.
+    std::string filename;
+    struct file_mapping file;
+    struct ImageShape shape;
+    std::vector<Frame> frames;
+
+    /// Guards is_running, so stopping wakes a get_frame() that's waiting.
+    struct lock lock;
+    struct condition_variable stopped;
+    uint8_t is_running;
+    /// Frames emitted since the camera started.
+    uint64_t frame_count;
+    struct clock started;
+};
+
+/// Copies the `T` at byte `offset` of `file` to `out`.
+/// @returns false if it runs past the end of the file.
+template<typename T>
+bool
+read_at(const struct file_mapping& file, uint64_t offset, T* out)
+{
+    if (offset > file.nbytes || file.nbytes - offset < sizeof(T))
+        return false;
+    memcpy(out, file.data + offset, sizeof(T)); // NOLINT
+    return true;
+}
+
+ImageShape
+make_shape(uint32_t width, uint32_t height, SampleType type)
+{
+    ImageShape shape = {};
+    shape.dims = { .channels = 1, .width = width, .height = height, .planes = 1 };
+    shape.strides = { .channels = 1,
+                      .width = 1,
+                      .height = width,
+                      .planes = (int64_t)width * height };
+    shape.type = type;
+    return shape;
+}
+
+/// Adds a frame to the index. Every frame must have the first one's shape.
+bool
+add_frame(Replay* self, const ImageShape& shape, const uint8_t* data, uint64_t t)
+{
+    EXPECT(shape.type < SampleTypeCount,
+           "Frame %llu has an unknown sample type %d.",
+           (unsigned long long)self->frames.size(),
+           (int)shape.type);
+    if (self->frames.empty()) {
+        self->shape = shape;
+    } else {
+        EXPECT(shape.type == self->shape.type &&
+                 !memcmp(&shape.dims, &self->shape.dims, sizeof(shape.dims)),
+               "Frame %llu is %ux%u %s. Expected every frame to be %ux%u %s.",
+               (unsigned long long)self->frames.size(),
+               shape.dims.width,
+               shape.dims.height,
+               sample_type_as_string(shape.type),
+               self->shape.dims.width,
+               self->shape.dims.height,
+               sample_type_as_string(self->shape.type));
+    }
+    self->frames.push_back({ data, t });
+    return true;
+Error:
+    return false;
+}
+
+/// Indexes a file written by the raw storage: `VideoFrame`s back to back.
+/// With direct I/O, the raw storage pads each frame to a block boundary and
+/// counts the padding in `bytes_of_frame`, so the image is read by its shape.
+bool
+index_raw(Replay* self)
+{
+    const struct file_mapping& file = self->file;
+    for (uint64_t offset = 0; offset < file.nbytes;) {
+        VideoFrame frame = {};
+        EXPECT(read_at(file, offset, &frame),
+               "Frame %llu at byte %llu is truncated.",
+               (unsigned long long)self->frames.size(),
+               (unsigned long long)offset);
+        EXPECT(frame.shape.type < SampleTypeCount &&
+                 frame.bytes_of_frame >=
+                   sizeof(frame) + bytes_of_image(&frame.shape) &&
+                 frame.bytes_of_frame <= file.nbytes - offset,
+               "Frame %llu at byte %llu is truncated or corrupt.",
+               (unsigned long long)self->frames.size(),
+               (unsigned long long)offset);
+        CHECK(add_frame(self,
+                        frame.shape,
+                        file.data + offset + offsetof(VideoFrame, data),
+                        frame.timestamps.hardware));
+        offset += frame.bytes_of_frame;
+    }
+    return true;
+Error:
+    return false;
+}
+
+#pragma pack(push, 1)
+/// A BigTIFF tag, as the tiff storage writes them.
+struct TiffTag
+{
+    uint16_t tag, type;
+    uint64_t count;
+    uint8_t value[8];
+};
+#pragma pack(pop)
+
+/// @returns the integer held in a tag with a count of one.
+uint64_t
+tag_integer(const TiffTag& tag)
+{
+    uint16_t u16 = 0;
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    switch (tag.type) {
+        case 3:
+            memcpy(&u16, tag.value, sizeof(u16)); // NOLINT
+            return u16;
+        case 4:
+            memcpy(&u32, tag.value, sizeof(u32)); // NOLINT
+            return u32;
+        case 16:
+            memcpy(&u64, tag.value, sizeof(u64)); // NOLINT
+            return u64;
+        default:
+            return 0;
+    }
+}
+
+/// @returns the sample type for TIFF's bits per sample and sample format, or
+/// SampleTypeCount if there isn't one.
+SampleType
+sample_type_of(uint64_t bits, uint64_t format)
+{
+    const uint64_t is_unsigned = 1, is_signed = 2, is_float = 3;
+    if (bits == 8 && format == is_unsigned)
+        return SampleType_u8;
+    if (bits == 8 && format == is_signed)
+        return SampleType_i8;
+    if (bits == 16 && format == is_unsigned)
+        return SampleType_u16;
+    if (bits == 16 && format == is_signed)
+        return SampleType_i16;
+    if (bits == 32 && format == is_unsigned)
+        return SampleType_u32;
+    if (bits == 32 && format == is_float)
+        return SampleType_f32;
+    return SampleTypeCount;
+}
+
+/// @returns the hardware timestamp in the JSON the tiff storage writes to
+/// each frame's description, or zero if there isn't one.
+uint64_t
+hardware_timestamp_of(std::string_view description)
+{
+    constexpr std::string_view key = "\"hardware\":";
+    const size_t i = description.find(key);
+    if (i == std::string_view::npos)
+        return 0;
+    uint64_t t = 0;
+    for (size_t j = i + key.size();
+         j < description.size() && description[j] >= '0' &&
+         description[j] <= '9';
+         ++j)
+        t = 10 * t + (description[j] - '0');
+    return t;
+}
+
+/// Indexes a little-endian BigTIFF, as written by the tiff storage. Each
+/// frame must be a single uncompressed strip.
+bool
+index_tiff(Replay* self)
+{
+    const struct file_mapping& file = self->file;
+    uint64_t ifd = 0;
+    CHECK(read_at(file, 8, &ifd));
+    while (ifd) {
+        const size_t iframe = self->frames.size();
+        uint64_t ntags = 0;
+        EXPECT(read_at(file, ifd, &ntags) &&
+                 ntags <= (file.nbytes - ifd - 8) / sizeof(TiffTag),
+               "The directory of frame %llu at byte %llu is truncated.",
+               (unsigned long long)iframe,
+               (unsigned long long)ifd);
+
+        uint64_t width = 0, height = 0, bits = 0, format = 1, compression = 1,
+                 strip_count = 0, offset = 0, nbytes = 0, t = 0;
+        for (uint64_t i = 0; i < ntags; ++i) {
+            TiffTag tag = {};
+            CHECK(read_at(file, ifd + 8 + i * sizeof(tag), &tag));
+            switch (tag.tag) {
+                case 256:
+                    width = tag_integer(tag);
+                    break;
+                case 257:
+                    height = tag_integer(tag);
+                    break;
+                case 258:
+                    bits = tag_integer(tag);
+                    break;
+                case 259:
+                    compression = tag_integer(tag);
+                    break;
+                case 270: {
+                    // Strings of up to 8 bytes are held in the tag.
+                    const uint8_t* str = file.data + ifd + 8 +
+                                         i * sizeof(tag) +
+                                         offsetof(TiffTag, value);
+                    uint64_t at = 0;
+                    if (tag.count > sizeof(tag.value)) {
+                        memcpy(&at, tag.value, sizeof(at)); // NOLINT
+                        if (at > file.nbytes || file.nbytes - at < tag.count)
+                            break;
+                        str = file.data + at;
+                    }
+                    t = hardware_timestamp_of(
+                      std::string_view((const char*)str, tag.count));
+                    break;
+                }
+                case 273:
+                    strip_count = tag.count;
+                    offset = tag_integer(tag);
+                    break;
+                case 279:
+                    nbytes = tag_integer(tag);
+                    break;
+                case 339:
+                    format = tag_integer(tag);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        EXPECT(compression == 1 && strip_count == 1,
+               "Frame %llu isn't a single uncompressed strip.",
+               (unsigned long long)iframe);
+        const SampleType type = sample_type_of(bits, format);
+        EXPECT(type != SampleTypeCount,
+               "Frame %llu has %d-bit samples of TIFF sample format %d, which "
+               "don't map to a sample type.",
+               (unsigned long long)iframe,
+               (int)bits,
+               (int)format);
+        EXPECT(width && height && width <= UINT32_MAX && height <= UINT32_MAX,
+               "Frame %llu is %llux%llu.",
+               (unsigned long long)iframe,
+               (unsigned long long)width,
+               (unsigned long long)height);
+        const ImageShape shape =
+          make_shape((uint32_t)width, (uint32_t)height, type);
+        EXPECT(nbytes >= bytes_of_image(&shape) && offset <= file.nbytes &&
+                 file.nbytes - offset >= bytes_of_image(&shape),
+               "Frame %llu is truncated.",
+               (unsigned long long)iframe);
+        CHECK(add_frame(self, shape, file.data + offset, t));
+
+        uint64_t next = 0;
+        CHECK(read_at(file, ifd + 8 + ntags * sizeof(TiffTag), &next));
+        // The tiff storage writes frames in order. Requiring that here also
+        // rules out a loop of directories.
+        EXPECT(next == 0 || next > ifd,
+               "The directory after frame %llu goes backwards.",
+               (unsigned long long)iframe);
+        ifd = next;
+    }
+    return true;
+Error:
+    return false;
+}
+
+void
+close_file(Replay* self)
+{
+    file_unmap(&self->file);
+    self->filename.clear();
+    self->frames.clear();
+    self->shape = {};
+}
+
+/// Maps `filename` and indexes its frames.
+bool
+open_file(Replay* self, const std::string& filename)
+{
+    close_file(self);
+    if (filename.empty())
+        return true;
+    CHECK(file_map_read(&self->file, filename.c_str(), filename.size() + 1));
+    {
+        uint16_t magic[2] = { 0 };
+        const uint16_t little_endian = 0x4949, bigtiff = 43;
+        // A raw file starts with the size of its first frame, a multiple of
+        // eight, so it can't be mistaken for either.
+        if (read_at(self->file, 0, &magic) && magic[0] == little_endian) {
+            EXPECT(magic[1] == bigtiff,
+                   "Only BigTIFF files can be replayed, like the ones the "
+                   "tiff storage writes. Got version %d.",
+                   (int)magic[1]);
+            CHECK(index_tiff(self));
+        } else {
+            CHECK(index_raw(self));
+        }
+    }
+    EXPECT(!self->frames.empty(), "No frames in \"%s\".", filename.c_str());
+    self->filename = filename;
+    LOG("Replaying %llu %ux%u %s frames from \"%s\"",
+        (unsigned long long)self->frames.size(),
+        self->shape.dims.width,
+        self->shape.dims.height,
+        sample_type_as_string(self->shape.type),
+        filename.c_str());
+    return true;
+Error:
+    LOGE("Can't replay \"%s\"", filename.c_str());
+    close_file(self);
+    return false;
+}
+
+/// @returns when frame `k` of the replay is due, in milliseconds after the
+/// camera started.
+double
+due_ms(const Replay* self, uint64_t k)
+{
+    const size_t n = self->frames.size();
+    switch (self->properties.replay.timing) {
+        case ReplayTiming_FixedRate:
+            return 1e-3 * self->properties.exposure_time_us * (double)k;
+        case ReplayTiming_Timestamps: {
+            const uint64_t t0 = self->frames.front().hardware_timestamp;
+            const uint64_t t1 = self->frames.back().hardware_timestamp;
+            if (n < 2 || t1 <= t0)
+                return 0.0; // no intervals to keep
+            // Looping back to the first frame takes the mean interval.
+            const double lap_ms = 1e-6 * (double)(t1 - t0) * n / (n - 1);
+            const uint64_t t = self->frames[k % n].hardware_timestamp;
+            return lap_ms * (double)(k / n) + 1e-6 * (double)(t > t0 ? t - t0 : 0);
+        }
+        default:
+            return 0.0;
+    }
+}
+
+//
+//  CAMERA INTERFACE
+//
+
+DeviceStatusCode
+replay_set(struct Camera* camera, struct CameraProperties* settings)
+{
+    Replay* self = containerof(camera, Replay, camera);
+    try {
+        std::string filename;
+        const String& uri = settings->replay.uri;
+        if (uri.str && uri.nbytes)
+            filename.assign(uri.str, strnlen(uri.str, uri.nbytes));
+        if (filename.rfind("file://", 0) == 0)
+            filename.erase(0, 7);
+
+        EXPECT(settings->replay.timing < ReplayTiming_Count,
+               "Unknown replay timing %d.",
+               (int)settings->replay.timing);
+        if (filename != self->filename) {
+            EXPECT(!self->is_running,
+                   "Can't change the file being replayed while running.");
+            CHECK(open_file(self, filename));
+        }
+
+        self->properties = *settings;
+        self->properties.replay.uri = { .str = (char*)self->filename.c_str(),
+                                        .nbytes = self->filename.size() + 1,
+                                        .is_ref = 1 };
+        // The recording fixes the frames.
+        self->properties.binning = 1;
+        self->properties.pixel_type = self->shape.type;
+        self->properties.offset = { 0, 0 };
+        self->properties.shape = { .x = self->shape.dims.width,
+                                   .y = self->shape.dims.height };
+        self->properties.render_thread_count = 0;
+        self->properties.frame_queue_depth = 0;
+        self->properties.input_triggers = {};
+        return Device_Ok;
+    } catch (const std::exception& e) {
+        LOGE("Exception: %s", e.what());
+    } catch (...) {
+        LOGE("Unknown exception");
+    }
+Error:
+    return Device_Err;
+}
+
+DeviceStatusCode
+replay_get(const struct Camera* camera, struct CameraProperties* settings)
+{
+    const Replay* self = containerof(camera, const Replay, camera);
+    *settings = self->properties;
+    return Device_Ok;
+}
+
+DeviceStatusCode
+replay_get_meta(const struct Camera* camera,
+                struct CameraPropertyMetadata* meta)
+{
+    const Replay* self = containerof(camera, const Replay, camera);
+    const float w = (float)self->shape.dims.width;
+    const float h = (float)self->shape.dims.height;
+    *meta = {};
+    meta->exposure_time_us = { .writable = 1, .low = 0.0f, .high = 1.0e6f };
+    meta->binning = { .writable = 0, .low = 1.0f, .high = 1.0f };
+    meta->shape.x = { .writable = 0, .low = w, .high = w };
+    meta->shape.y = { .writable = 0, .low = h, .high = h };
+    meta->supported_pixel_types =
+      self->frames.empty() ? 0 : (1ULL << self->shape.type);
+    return Device_Ok;
+}
+
+DeviceStatusCode
+replay_get_shape(const struct Camera* camera, struct ImageShape* shape)
+{
+    const Replay* self = containerof(camera, const Replay, camera);
+    *shape = self->shape;
+    return Device_Ok;
+}
+
+DeviceStatusCode
+replay_start(struct Camera* camera)
+{
+    Replay* self = containerof(camera, Replay, camera);
+    EXPECT(!self->frames.empty(),
+           "Nothing to replay. Set CameraProperties::replay.uri to a file "
+           "written by the raw or tiff storage.");
+    lock_acquire(&self->lock);
+    self->is_running = 1;
+    self->frame_count = 0;
+    clock_init(&self->started);
+    lock_release(&self->lock);
+    return Device_Ok;
+Error:
+    return Device_Err;
+}
+
+DeviceStatusCode
+replay_stop(struct Camera* camera)
+{
+    Replay* self = containerof(camera, Replay, camera);
+    lock_acquire(&self->lock);
+    self->is_running = 0;
+    condition_variable_notify_all(&self->stopped);
+    lock_release(&self->lock);
+    return Device_Ok;
+}
+
+DeviceStatusCode
+replay_execute_trigger(struct Camera* camera)
+{
+    LOGE("The replay camera doesn't support software triggers.");
+    return Device_Err;
+}
+
+/// Waits until the next frame is due, then copies it from the mapped file
+/// to `im`. Sets `*nbytes` to zero if the camera stops first.
+DeviceStatusCode
+replay_get_frame(struct Camera* camera,
+                 void* im,
+                 size_t* nbytes,
+                 struct ImageInfo* info_out)
+{
+    Replay* self = containerof(camera, Replay, camera);
+    CHECK(*nbytes >= bytes_of_image(&self->shape));
+    CHECK(self->is_running);
+    {
+        const uint64_t k = self->frame_count;
+        const size_t n = self->frames.size();
+        // Without a loop, the camera has nothing more to emit until it's
+        // stopped.
+        const double due = (self->properties.replay.loop || k < n)
+                             ? due_ms(self, k)
+                             : INFINITY;
+
+        lock_acquire(&self->lock);
+        double remaining_ms = 0;
+        while (self->is_running &&
+               (remaining_ms = due - clock_toc_ms(&self->started)) > 0) {
+            if (std::isinf(remaining_ms))
+                condition_variable_wait(&self->stopped, &self->lock);
+            else
+                condition_variable_wait_for_ms(
+                  &self->stopped, &self->lock, (float)remaining_ms);
+        }
+        const uint8_t is_running = self->is_running;
+        lock_release(&self->lock);
+        if (!is_running) {
+            *nbytes = 0;
+            return Device_Ok;
+        }
+
+        memcpy(im, self->frames[k % n].data, bytes_of_image(&self->shape));
+        info_out->shape = self->shape;
+        info_out->hardware_frame_id = k;
+        info_out->hardware_timestamp = clock_tic(0);
+        self->frame_count = k + 1;
+    }
+    return Device_Ok;
+Error:
+    return Device_Err;
+}
+
+} // end namespace ::{anonymous}
+
+extern "C" struct Camera*
+replay_make_camera(void)
+{
+    Replay* self = new (std::nothrow) Replay();
+    EXPECT(self, "Allocation of %llu bytes failed.", sizeof(*self));
+    self->properties.exposure_time_us = 10000;
+    self->properties.binning = 1;
+    self->properties.replay.uri = { .str = (char*)"", .nbytes = 1, .is_ref = 1 };
+    self->camera = Camera{
+        .state = DeviceState_AwaitingConfiguration,
+        .set = replay_set,
+        .get = replay_get,
+        .get_meta = replay_get_meta,
+        .get_shape = replay_get_shape,
+        .start = replay_start,
+        .stop = replay_stop,
+        .execute_trigger = replay_execute_trigger,
+        .get_frame = replay_get_frame,
+    };
+    lock_init(&self->lock);
+    condition_variable_init(&self->stopped);
+    return &self->camera;
+Error:
+    return 0;
+}
+
+extern "C" enum DeviceStatusCode
+replay_close_camera(struct Camera* camera)
+{
+    EXPECT(camera, "Invalid NULL parameter");
+    {
+        Replay* self = containerof(camera, Replay, camera);
+        replay_stop(camera);
+        file_unmap(&self->file);
+        delete self;
+    }
+    return Device_Ok;
+Error:
+    return Device_Err;
+}
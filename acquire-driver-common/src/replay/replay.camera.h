@@ -0,0 +1,34 @@
+//!
+//! # Replay camera
+//!
+//! Emits frames recorded by the "raw" or "tiff" storage devices, so the
+//! pipeline can be tested and benchmarked with real data. The file named by
+//! `CameraProperties::replay.uri` is mapped into memory, and each frame is
+//! copied once, straight from the mapping into the buffer passed to
+//! `get_frame()`. `CameraProperties::replay.timing` selects when frames are
+//! emitted.
+//!
+//! Every frame in the file must have the same shape and sample type. The
+//! camera reports them as its shape and pixel type, and ignores the shape,
+//! offset, binning and pixel type it's given.
+//!
+
+#ifndef H_ACQUIRE_DRIVER_BASICS_REPLAY_CAMERA_V0
+#define H_ACQUIRE_DRIVER_BASICS_REPLAY_CAMERA_V0
+
+#include "../identifiers.h"
+#include "device/kit/driver.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    struct Camera* replay_make_camera(void);
+    enum DeviceStatusCode replay_close_camera(struct Camera* camera);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_REPLAY_CAMERA_V0
@@ -1,69 +1,145 @@
-#ifdef __AVX2__
+//! AVX2 binning kernels. See bin2.h.
+//!
+//! These are compiled for AVX2 regardless of the target's compile flags and
+//! are only called once bin2_kernels_get() has checked the CPU.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include "bin2.h"
+
 #include <immintrin.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define LANES (32)
-#define CEIL_BLOCKS(n) ((n + LANES - 1) / LANES)
-#define FLOOR_BLOCKS(n) (n / LANES)
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX2 __attribute__((target("avx2")))
+#else
+#define AVX2
+#endif
 
-static void
-bin2(uint8_t* im_, int w, int h)
+/// Averages the column pairs in each 16-bit lane of `v`.
+static inline AVX2 __m256i
+pair_columns_u8(__m256i v)
 {
-    __m256i* const im = (__m256i*)im_;
-    const int dy = w / LANES;
+    const __m256i lo = _mm256_set1_epi16(0x00ff);
+    return _mm256_avg_epu16(_mm256_and_si256(v, lo), _mm256_srli_epi16(v, 8));
+}
 
-    for (int y = 0; y < h / 2; ++y) {
-        __m256i* const row = im + 2 * y * dy;
-        for (int x = 0; x < CEIL_BLOCKS(w); ++x) {
-            __m256i* const col = row + x;
-            im[x + y * dy] = _mm256_avg_epu8(col[0], col[dy]);
-        }
-    }
+/// Packs the 16-bit lanes of `a` then `b` to bytes, in order.
+static inline AVX2 __m256i
+pack_u8(__m256i a, __m256i b)
+{
+    // packus works within 128-bit lanes, which leaves the 64-bit halves
+    // ordered a0 b0 a1 b1.
+    const __m256i v = _mm256_packus_epi16(a, b);
+    return _mm256_permute4x64_epi64(v, (3 << 6) | (1 << 4) | (2 << 2));
+}
 
-    const __m256i mask = _mm256_set1_epi16(0x00ff);
-    for (int x = 0; x < FLOOR_BLOCKS(w * h / 2); ++x) {
-        const __m256i b = _mm256_srli_epi16(im[x], 8);
-        const __m256i v = _mm256_avg_epu8(im[x], b);
-        im[x] = _mm256_and_si256(v, mask);
-    }
-    for (int x = 0; x < FLOOR_BLOCKS(w * h / 4); ++x) {
-        const __m256i v = _mm256_packus_epi16(im[2 * x], im[2 * x + 1]);
-        im[x] = _mm256_permute4x64_epi64(v, (3 << 6) | (1 << 4) | (2 << 2));
-    }
+/// Averages the column pairs in each 32-bit lane of `v`.
+static inline AVX2 __m256i
+pair_columns_u16(__m256i v)
+{
+    const __m256i lo = _mm256_and_si256(v, _mm256_set1_epi32(0xffff));
+    const __m256i sum = _mm256_add_epi32(lo, _mm256_srli_epi32(v, 16));
+    return _mm256_srli_epi32(_mm256_add_epi32(sum, _mm256_set1_epi32(1)), 1);
 }
-#endif
 
-/*
-AVX2 2x2 averaging of an image with size (w,h).
+/// Packs the 32-bit lanes of `a` then `b` to 16 bits, in order.
+static inline AVX2 __m256i
+pack_u16(__m256i a, __m256i b)
+{
+    const __m256i v = _mm256_packus_epi32(a, b);
+    return _mm256_permute4x64_epi64(v, (3 << 6) | (1 << 4) | (2 << 2));
+}
 
-This happens in three phases:
-(endian is ignored below)
+/// Bins 32 output columns from 64 columns of rows `a` and `b`.
+static inline AVX2 void
+block_u8(uint8_t* out, const uint8_t* a, const uint8_t* b)
+{
+    const __m256i* pa = (const __m256i*)a;
+    const __m256i* pb = (const __m256i*)b;
+    const __m256i v0 =
+      _mm256_avg_epu8(_mm256_loadu_si256(pa), _mm256_loadu_si256(pb));
+    const __m256i v1 =
+      _mm256_avg_epu8(_mm256_loadu_si256(pa + 1), _mm256_loadu_si256(pb + 1));
+    _mm256_storeu_si256((__m256i*)out,
+                        pack_u8(pair_columns_u8(v0), pair_columns_u8(v1)));
+}
 
-1. Rows are averaged together in blocks of size LANES.
-   The result is stored in the first h/2 rows.
-2. Columns are averaged together (now in the first h/2 rows).
-   This is done by reading in a block, shifting it left by 1 lane and averaging.
-   Something like:
+/// Like block_u8(). Flipping the sign bit maps i8 to u8 preserving order, and
+/// rounding halves up commutes with the offset.
+static inline AVX2 void
+block_i8(int8_t* out, const int8_t* a, const int8_t* b)
+{
+    const __m256i bias = _mm256_set1_epi8((char)0x80);
+    const __m256i* pa = (const __m256i*)a;
+    const __m256i* pb = (const __m256i*)b;
+    const __m256i v0 =
+      _mm256_avg_epu8(_mm256_xor_si256(_mm256_loadu_si256(pa), bias),
+                      _mm256_xor_si256(_mm256_loadu_si256(pb), bias));
+    const __m256i v1 =
+      _mm256_avg_epu8(_mm256_xor_si256(_mm256_loadu_si256(pa + 1), bias),
+                      _mm256_xor_si256(_mm256_loadu_si256(pb + 1), bias));
+    const __m256i v = pack_u8(pair_columns_u8(v0), pair_columns_u8(v1));
+    _mm256_storeu_si256((__m256i*)out, _mm256_xor_si256(v, bias));
+}
 
-        [x(1) x(2) x(3) 0]
-      + [x(0) x(1) x(2) x(3)]
+/// Bins 16 output columns from 32 columns of rows `a` and `b`.
+static inline AVX2 void
+block_u16(uint16_t* out, const uint16_t* a, const uint16_t* b)
+{
+    const __m256i* pa = (const __m256i*)a;
+    const __m256i* pb = (const __m256i*)b;
+    const __m256i v0 =
+      _mm256_avg_epu16(_mm256_loadu_si256(pa), _mm256_loadu_si256(pb));
+    const __m256i v1 =
+      _mm256_avg_epu16(_mm256_loadu_si256(pa + 1), _mm256_loadu_si256(pb + 1));
+    _mm256_storeu_si256((__m256i*)out,
+                        pack_u16(pair_columns_u16(v0), pair_columns_u16(v1)));
+}
 
-3. The last step leaves the averages in the even lanes.
-   Now we iterate through blocks, packing to get rid of unused lanes and
-   combining blocks. The main trick here is to use the packus instruction
-   which packs 32 16-bit lanes into 32 8-bit lanes - that requires masking
-   off the odd lanes from the previous step.
+/// Like block_u16(), offsetting i16 to u16 the way block_i8() does.
+static inline AVX2 void
+block_i16(int16_t* out, const int16_t* a, const int16_t* b)
+{
+    const __m256i bias = _mm256_set1_epi16((short)0x8000);
+    const __m256i* pa = (const __m256i*)a;
+    const __m256i* pb = (const __m256i*)b;
+    const __m256i v0 =
+      _mm256_avg_epu16(_mm256_xor_si256(_mm256_loadu_si256(pa), bias),
+                       _mm256_xor_si256(_mm256_loadu_si256(pb), bias));
+    const __m256i v1 =
+      _mm256_avg_epu16(_mm256_xor_si256(_mm256_loadu_si256(pa + 1), bias),
+                       _mm256_xor_si256(_mm256_loadu_si256(pb + 1), bias));
+    const __m256i v = pack_u16(pair_columns_u16(v0), pair_columns_u16(v1));
+    _mm256_storeu_si256((__m256i*)out, _mm256_xor_si256(v, bias));
+}
 
-   Looking at the two blocks involved:
-   (masked elements from the previous step are set to 0, x's have partial avg)
+/// Bins 8 output columns from 16 columns of rows `a` and `b`.
+static inline AVX2 void
+block_f32(float* out, const float* a, const float* b)
+{
+    const __m256 s0 = _mm256_add_ps(_mm256_loadu_ps(a), _mm256_loadu_ps(b));
+    const __m256 s1 =
+      _mm256_add_ps(_mm256_loadu_ps(a + 8), _mm256_loadu_ps(b + 8));
+    // The shuffles work within 128-bit lanes, like packus.
+    const __m256 even = _mm256_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m256 odd = _mm256_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1));
+    const __m256 v =
+      _mm256_mul_ps(_mm256_add_ps(even, odd), _mm256_set1_ps(0.25f));
+    _mm256_storeu_ps(out,
+                     _mm256_castpd_ps(_mm256_permute4x64_pd(
+                       _mm256_castps_pd(v), (3 << 6) | (1 << 4) | (2 << 2))));
+}
 
-                block 0               block 1
-        pack    [x(0)    0 x(2)    0] [x(4) 0 x(6) 0]
-              = [x(0) x(2) x(4) x(6)] [x(4) 0 x(6) 0]
+BIN2_DEFINE_KERNEL(AVX2, u8, uint8_t, 32)
+BIN2_DEFINE_KERNEL(AVX2, i8, int8_t, 32)
+BIN2_DEFINE_KERNEL(AVX2, u16, uint16_t, 16)
+BIN2_DEFINE_KERNEL(AVX2, i16, int16_t, 16)
+BIN2_DEFINE_KERNEL(AVX2, f32, float, 8)
 
-   The pack interleaves results from each block in 64-bit chunks.
-   The final permutation fixes the order of the output bytes.
+const struct bin2_kernels bin2_kernels_avx2 = {
+    .name = "avx2",
+    .bin2 = BIN2_KERNEL_TABLE,
+};
 
-        before [x(0:7) y(0:7)  x(8:15) y(8:15)]
-        after  [x(0:7) x(8:15) y(0:7)  y(8:15)]
-*/
+#endif // x86_64
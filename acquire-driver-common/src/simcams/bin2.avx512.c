@@ -0,0 +1,135 @@
+//! AVX-512 binning kernels. See bin2.h.
+//!
+//! These need AVX512F and AVX512BW. They are compiled for them regardless of
+//! the target's compile flags and are only called once bin2_kernels_get()
+//! has checked the CPU.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include "bin2.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+#else
+#define AVX512
+#endif
+
+/// Averages the column pairs in each 16-bit lane of `v`.
+static inline AVX512 __m512i
+pair_columns_u8(__m512i v)
+{
+    const __m512i lo = _mm512_set1_epi16(0x00ff);
+    return _mm512_avg_epu16(_mm512_and_si512(v, lo), _mm512_srli_epi16(v, 8));
+}
+
+/// Packs the 16-bit lanes of `a` then `b` to bytes, in order.
+static inline AVX512 __m512i
+pack_u8(__m512i a, __m512i b)
+{
+    // packus works within 128-bit lanes, which leaves the 64-bit quarters
+    // ordered a0 b0 a1 b1 a2 b2 a3 b3.
+    const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    return _mm512_permutexvar_epi64(order, _mm512_packus_epi16(a, b));
+}
+
+/// Averages the column pairs in each 32-bit lane of `v`.
+static inline AVX512 __m512i
+pair_columns_u16(__m512i v)
+{
+    const __m512i lo = _mm512_and_si512(v, _mm512_set1_epi32(0xffff));
+    const __m512i sum = _mm512_add_epi32(lo, _mm512_srli_epi32(v, 16));
+    return _mm512_srli_epi32(_mm512_add_epi32(sum, _mm512_set1_epi32(1)), 1);
+}
+
+/// Packs the 32-bit lanes of `a` then `b` to 16 bits, in order.
+static inline AVX512 __m512i
+pack_u16(__m512i a, __m512i b)
+{
+    const __m512i order = _mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0);
+    return _mm512_permutexvar_epi64(order, _mm512_packus_epi32(a, b));
+}
+
+/// Bins 64 output columns from 128 columns of rows `a` and `b`.
+static inline AVX512 void
+block_u8(uint8_t* out, const uint8_t* a, const uint8_t* b)
+{
+    const __m512i v0 =
+      _mm512_avg_epu8(_mm512_loadu_si512(a), _mm512_loadu_si512(b));
+    const __m512i v1 =
+      _mm512_avg_epu8(_mm512_loadu_si512(a + 64), _mm512_loadu_si512(b + 64));
+    _mm512_storeu_si512(out, pack_u8(pair_columns_u8(v0), pair_columns_u8(v1)));
+}
+
+/// Like block_u8(). Flipping the sign bit maps i8 to u8 preserving order, and
+/// rounding halves up commutes with the offset.
+static inline AVX512 void
+block_i8(int8_t* out, const int8_t* a, const int8_t* b)
+{
+    const __m512i bias = _mm512_set1_epi8((char)0x80);
+    const __m512i v0 =
+      _mm512_avg_epu8(_mm512_xor_si512(_mm512_loadu_si512(a), bias),
+                      _mm512_xor_si512(_mm512_loadu_si512(b), bias));
+    const __m512i v1 =
+      _mm512_avg_epu8(_mm512_xor_si512(_mm512_loadu_si512(a + 64), bias),
+                      _mm512_xor_si512(_mm512_loadu_si512(b + 64), bias));
+    const __m512i v = pack_u8(pair_columns_u8(v0), pair_columns_u8(v1));
+    _mm512_storeu_si512(out, _mm512_xor_si512(v, bias));
+}
+
+/// Bins 32 output columns from 64 columns of rows `a` and `b`.
+static inline AVX512 void
+block_u16(uint16_t* out, const uint16_t* a, const uint16_t* b)
+{
+    const __m512i v0 =
+      _mm512_avg_epu16(_mm512_loadu_si512(a), _mm512_loadu_si512(b));
+    const __m512i v1 =
+      _mm512_avg_epu16(_mm512_loadu_si512(a + 32), _mm512_loadu_si512(b + 32));
+    _mm512_storeu_si512(out,
+                        pack_u16(pair_columns_u16(v0), pair_columns_u16(v1)));
+}
+
+/// Like block_u16(), offsetting i16 to u16 the way block_i8() does.
+static inline AVX512 void
+block_i16(int16_t* out, const int16_t* a, const int16_t* b)
+{
+    const __m512i bias = _mm512_set1_epi16((short)0x8000);
+    const __m512i v0 =
+      _mm512_avg_epu16(_mm512_xor_si512(_mm512_loadu_si512(a), bias),
+                       _mm512_xor_si512(_mm512_loadu_si512(b), bias));
+    const __m512i v1 =
+      _mm512_avg_epu16(_mm512_xor_si512(_mm512_loadu_si512(a + 32), bias),
+                       _mm512_xor_si512(_mm512_loadu_si512(b + 32), bias));
+    const __m512i v = pack_u16(pair_columns_u16(v0), pair_columns_u16(v1));
+    _mm512_storeu_si512(out, _mm512_xor_si512(v, bias));
+}
+
+/// Bins 16 output columns from 32 columns of rows `a` and `b`.
+static inline AVX512 void
+block_f32(float* out, const float* a, const float* b)
+{
+    const __m512i even = _mm512_set_epi32(
+      30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0);
+    const __m512i odd = _mm512_add_epi32(even, _mm512_set1_epi32(1));
+    const __m512 s0 = _mm512_add_ps(_mm512_loadu_ps(a), _mm512_loadu_ps(b));
+    const __m512 s1 =
+      _mm512_add_ps(_mm512_loadu_ps(a + 16), _mm512_loadu_ps(b + 16));
+    const __m512 v = _mm512_add_ps(_mm512_permutex2var_ps(s0, even, s1),
+                                   _mm512_permutex2var_ps(s0, odd, s1));
+    _mm512_storeu_ps(out, _mm512_mul_ps(v, _mm512_set1_ps(0.25f)));
+}
+
+BIN2_DEFINE_KERNEL(AVX512, u8, uint8_t, 64)
+BIN2_DEFINE_KERNEL(AVX512, i8, int8_t, 64)
+BIN2_DEFINE_KERNEL(AVX512, u16, uint16_t, 32)
+BIN2_DEFINE_KERNEL(AVX512, i16, int16_t, 32)
+BIN2_DEFINE_KERNEL(AVX512, f32, float, 16)
+
+const struct bin2_kernels bin2_kernels_avx512 = {
+    .name = "avx512",
+    .bin2 = BIN2_KERNEL_TABLE,
+};
+
+#endif // x86_64
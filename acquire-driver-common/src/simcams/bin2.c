@@ -0,0 +1,269 @@
+#include "bin2.h"
+#include "logger.h"
+
+#include <stddef.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HAVE_X86_KERNELS
+extern const struct bin2_kernels bin2_kernels_sse41;
+extern const struct bin2_kernels bin2_kernels_avx2;
+extern const struct bin2_kernels bin2_kernels_avx512;
+#endif
+
+#define SCALAR_KERNEL(name, T)                                                 \
+    static void bin2_##name(void* im_, int w, int h)                           \
+    {                                                                          \
+        T* const im = (T*)im_;                                                 \
+        const int ow = w / 2;                                                  \
+        for (int y = 0; y < h / 2; ++y) {                                      \
+            const T* a = im + (size_t)2 * y * w;                               \
+            bin2_row_##name(im + (size_t)y * ow, a, a + w, 0, ow);             \
+        }                                                                      \
+    }
+
+SCALAR_KERNEL(u8, uint8_t)
+SCALAR_KERNEL(i8, int8_t)
+SCALAR_KERNEL(u16, uint16_t)
+SCALAR_KERNEL(i16, int16_t)
+SCALAR_KERNEL(f32, float)
+#undef SCALAR_KERNEL
+
+static const struct bin2_kernels bin2_kernels_scalar = {
+    .name = "scalar",
+    .bin2 = BIN2_KERNEL_TABLE,
+};
+
+#ifdef HAVE_X86_KERNELS
+static int
+cpu_supports(enum Bin2Isa isa)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    switch (isa) {
+        case Bin2Isa_Sse41:
+            return __builtin_cpu_supports("sse4.1");
+        case Bin2Isa_Avx2:
+            return __builtin_cpu_supports("avx2");
+        case Bin2Isa_Avx512:
+            return __builtin_cpu_supports("avx512f") &&
+                   __builtin_cpu_supports("avx512bw");
+        default:
+            return 0;
+    }
+#elif defined(_MSC_VER)
+    int r[4] = { 0 };
+    __cpuid(r, 0);
+    const int max_leaf = r[0];
+    __cpuid(r, 1);
+    if (isa == Bin2Isa_Sse41)
+        return (r[2] >> 19) & 1;
+    // The OS has to save the wide registers across context switches.
+    const int has_osxsave = (r[2] >> 27) & 1;
+    const int has_avx = (r[2] >> 28) & 1;
+    if (max_leaf < 7 || !has_osxsave || !has_avx)
+        return 0;
+    const unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(r, 7, 0);
+    switch (isa) {
+        case Bin2Isa_Avx2:
+            return (xcr0 & 6) == 6 && ((r[1] >> 5) & 1);
+        case Bin2Isa_Avx512:
+            // AVX512F and AVX512BW, with the opmask and zmm state enabled.
+            return (xcr0 & 0xe6) == 0xe6 && ((r[1] >> 16) & 1) &&
+                   ((r[1] >> 30) & 1);
+        default:
+            return 0;
+    }
+#else
+    return 0;
+#endif
+}
+#endif
+
+const struct bin2_kernels*
+bin2_kernels_get(enum Bin2Isa isa)
+{
+    switch (isa) {
+        case Bin2Isa_Scalar:
+            return &bin2_kernels_scalar;
+#ifdef HAVE_X86_KERNELS
+        case Bin2Isa_Sse41:
+            return cpu_supports(isa) ? &bin2_kernels_sse41 : 0;
+        case Bin2Isa_Avx2:
+            return cpu_supports(isa) ? &bin2_kernels_avx2 : 0;
+        case Bin2Isa_Avx512:
+            return cpu_supports(isa) ? &bin2_kernels_avx512 : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+const struct bin2_kernels*
+bin2_kernels_select(void)
+{
+    static const struct bin2_kernels* selected = 0;
+    if (!selected) {
+        const struct bin2_kernels* k = 0;
+        for (int isa = Bin2IsaCount - 1; !k; --isa)
+            k = bin2_kernels_get((enum Bin2Isa)isa);
+        LOG("Using %s binning kernels", k->name);
+        selected = k;
+    }
+    return selected;
+}
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+#include "pcg_basic.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+static size_t
+bytes_per_sample(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+        case SampleType_i8:
+            return 1;
+        case SampleType_f32:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+/// Bins one 2x2 block by the definition in bin2.h.
+static void
+bin_block(enum SampleType type, const void* src, int w, int x, int y, void* out)
+{
+#define INT_BLOCK(T)                                                           \
+    do {                                                                       \
+        const T* p = (const T*)src + (size_t)2 * y * w + 2 * x;                \
+        const int32_t l = ((int32_t)p[0] + p[w] + 1) >> 1;                     \
+        const int32_t r = ((int32_t)p[1] + p[w + 1] + 1) >> 1;                 \
+        *(T*)out = (T)((l + r + 1) >> 1);                                      \
+    } while (0)
+    switch (type) {
+        case SampleType_u8:
+            INT_BLOCK(uint8_t);
+            break;
+        case SampleType_i8:
+            INT_BLOCK(int8_t);
+            break;
+        case SampleType_i16:
+            INT_BLOCK(int16_t);
+            break;
+        case SampleType_f32: {
+            const float* p = (const float*)src + (size_t)2 * y * w + 2 * x;
+            *(float*)out = ((p[0] + p[w]) + (p[1] + p[w + 1])) * 0.25f;
+            break;
+        }
+        default:
+            INT_BLOCK(uint16_t);
+            break;
+    }
+#undef INT_BLOCK
+}
+
+acquire_export int
+unit_test_bin2_kernels_match_scalar()
+{
+    // Widths cover the vector bodies, their tails, and odd columns.
+    const int widths[] = { 1, 2, 3, 31, 64, 65, 130, 257, 300 };
+    const int heights[] = { 1, 2, 5, 8 };
+    const size_t capacity = 300 * 8 * sizeof(float);
+    uint8_t* src = malloc(capacity);
+    uint8_t* expected = malloc(capacity);
+    uint8_t* actual = malloc(capacity);
+    CHECK(src && expected && actual);
+
+    for (int type = 0; type < SampleTypeCount; ++type) {
+        if (!bin2_kernels_get(Bin2Isa_Scalar)->bin2[type])
+            continue;
+        const size_t bps = bytes_per_sample(type);
+        for (size_t i = 0; i < capacity; i += 4) {
+            const uint32_t r = pcg32_random();
+            if (type == SampleType_f32)
+                *(float*)(src + i) = (float)(int32_t)r * 0x1p-20f;
+            else
+                *(uint32_t*)(src + i) = r;
+        }
+
+        for (size_t iw = 0; iw < sizeof(widths) / sizeof(*widths); ++iw) {
+            for (size_t ih = 0; ih < sizeof(heights) / sizeof(*heights);
+                 ++ih) {
+                const int w = widths[iw], h = heights[ih];
+                const size_t nout = (size_t)(w / 2) * (h / 2);
+
+                // The scalar kernel works in place, so check it against the
+                // definition first.
+                memcpy(expected, src, (size_t)w * h * bps); // NOLINT
+                bin2_kernels_get(Bin2Isa_Scalar)->bin2[type](expected, w, h);
+                for (int y = 0; y < h / 2; ++y) {
+                    for (int x = 0; x < w / 2; ++x) {
+                        uint8_t block[sizeof(float)] = { 0 };
+                        bin_block(type, src, w, x, y, block);
+                        EXPECT(!memcmp(expected +
+                                         ((size_t)y * (w / 2) + x) * bps,
+                                       block,
+                                       bps),
+                               "Scalar binning of type %d is wrong at (%d, "
+                               "%d) of %dx%d.",
+                               type,
+                               x,
+                               y,
+                               w,
+                               h);
+                    }
+                }
+
+                for (int isa = 0; isa < Bin2IsaCount; ++isa) {
+                    const struct bin2_kernels* k =
+                      bin2_kernels_get((enum Bin2Isa)isa);
+                    if (!k)
+                        continue;
+                    CHECK(k->bin2[type]);
+                    memcpy(actual, src, (size_t)w * h * bps); // NOLINT
+                    k->bin2[type](actual, w, h);
+                    EXPECT(!memcmp(actual, expected, nout * bps),
+                           "%s binning of type %d disagrees with scalar for "
+                           "%dx%d.",
+                           k->name,
+                           type,
+                           w,
+                           h);
+                }
+            }
+        }
+    }
+    free(src);
+    free(expected);
+    free(actual);
+    return 1;
+Error:
+    free(src);
+    free(expected);
+    free(actual);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
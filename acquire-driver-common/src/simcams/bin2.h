@@ -0,0 +1,133 @@
+//!
+//! # 2x2 binning kernels
+//!
+//! Each kernel averages 2x2 blocks of a `w` by `h` image in place. The result
+//! is a `w/2` by `h/2` image packed at the start of the buffer. An odd last
+//! row or column is dropped.
+//!
+//! For integer samples, pairs of rows are averaged first, then pairs of
+//! columns, each rounding halves up, so a pixel is `avg(avg(a, c),
+//! avg(b, d))` where `a b` and `c d` are the top and bottom of its block. For
+//! f32 samples a pixel is `((a + c) + (b + d)) * 0.25f`.
+//!
+//! There's one set of kernels per instruction set. bin2_kernels_get() returns
+//! the kernels for an instruction set only when the CPU running the code
+//! supports it, so none of these need the target to be compiled for that
+//! instruction set. Every set produces the same result, bit for bit, as the
+//! scalar one.
+//!
+//! Example:
+//!
+//! ~~~{.c}
+//!     const struct bin2_kernels* k = bin2_kernels_select();
+//!     k->bin2[shape.type](buf, width, height);
+//! ~~~
+//!
+
+#ifndef H_ACQUIRE_DRIVER_SIMCAM_BIN2_V0
+#define H_ACQUIRE_DRIVER_SIMCAM_BIN2_V0
+
+#include "device/props/components.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    enum Bin2Isa
+    {
+        Bin2Isa_Scalar = 0,
+        Bin2Isa_Sse41,
+        Bin2Isa_Avx2,
+        Bin2Isa_Avx512,
+        Bin2IsaCount,
+    };
+
+    typedef void (*bin2_fn)(void* im, int w, int h);
+
+    struct bin2_kernels
+    {
+        const char* name;
+
+        /// Indexed by the image's `SampleType`. Set for every type the
+        /// simulated cameras produce, and for u10, u12 and u14, which bin as
+        /// u16.
+        bin2_fn bin2[SampleTypeCount];
+    };
+
+    /// Returns the kernels for `isa`, or 0 if this build or CPU can't run
+    /// them.
+    const struct bin2_kernels* bin2_kernels_get(enum Bin2Isa isa);
+
+    /// Returns the fastest kernels this CPU supports.
+    const struct bin2_kernels* bin2_kernels_select(void);
+
+// Each bin2_row_*() bins output columns `[x, ow)` of one row, where `a` and
+// `b` are the two input rows. The vector kernels use them for the columns
+// left over.
+
+#define BIN2_ROW_INT(name, T)                                                  \
+    static inline void bin2_row_##name(                                        \
+      T* out, const T* a, const T* b, int x, int ow)                           \
+    {                                                                          \
+        for (; x < ow; ++x) {                                                  \
+            const int32_t l = ((int32_t)a[2 * x] + b[2 * x] + 1) >> 1;         \
+            const int32_t r =                                                  \
+              ((int32_t)a[2 * x + 1] + b[2 * x + 1] + 1) >> 1;                 \
+            out[x] = (T)((l + r + 1) >> 1);                                    \
+        }                                                                      \
+    }
+
+    BIN2_ROW_INT(u8, uint8_t)
+    BIN2_ROW_INT(i8, int8_t)
+    BIN2_ROW_INT(u16, uint16_t)
+    BIN2_ROW_INT(i16, int16_t)
+#undef BIN2_ROW_INT
+
+    static inline void bin2_row_f32(float* out,
+                                    const float* a,
+                                    const float* b,
+                                    int x,
+                                    int ow)
+    {
+        for (; x < ow; ++x)
+            out[x] = ((a[2 * x] + b[2 * x]) + (a[2 * x + 1] + b[2 * x + 1])) *
+                     0.25f;
+    }
+
+/// Defines `bin2_<name>()`, a kernel that bins `step` output columns at a
+/// time with `block_<name>(out, a, b)`, and the rest of each row with
+/// `bin2_row_<name>()`. `attr` marks the instruction set to compile for.
+#define BIN2_DEFINE_KERNEL(attr, name, T, step)                                \
+    static attr void bin2_##name(void* im_, int w, int h)                      \
+    {                                                                          \
+        T* const im = (T*)im_;                                                 \
+        const int ow = w / 2;                                                  \
+        const int nvec = ow - ow % (step);                                     \
+        for (int y = 0; y < h / 2; ++y) {                                      \
+            const T* a = im + (size_t)2 * y * w;                               \
+            const T* b = a + w;                                                \
+            T* out = im + (size_t)y * ow;                                      \
+            for (int x = 0; x < nvec; x += (step))                             \
+                block_##name(out + x, a + 2 * x, b + 2 * x);                   \
+            bin2_row_##name(out, a, b, nvec, ow);                              \
+        }                                                                      \
+    }
+
+/// Fills a `bin2_kernels::bin2` table with the `bin2_<type>()` kernels.
+#define BIN2_KERNEL_TABLE                                                      \
+    {                                                                          \
+        [SampleType_u8] = bin2_u8, [SampleType_i8] = bin2_i8,                  \
+        [SampleType_u16] = bin2_u16, [SampleType_i16] = bin2_i16,              \
+        [SampleType_f32] = bin2_f32, [SampleType_u10] = bin2_u16,              \
+        [SampleType_u12] = bin2_u16, [SampleType_u14] = bin2_u16,              \
+    }
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // H_ACQUIRE_DRIVER_SIMCAM_BIN2_V0
@@ -0,0 +1,123 @@
+//! SSE4.1 binning kernels. See bin2.h.
+//!
+//! These are compiled for SSE4.1 regardless of the target's compile flags
+//! and are only called once bin2_kernels_get() has checked the CPU.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include "bin2.h"
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SSE41 __attribute__((target("sse4.1")))
+#else
+#define SSE41
+#endif
+
+/// Averages the column pairs in each 16-bit lane of `v`.
+static inline SSE41 __m128i
+pair_columns_u8(__m128i v)
+{
+    const __m128i lo = _mm_set1_epi16(0x00ff);
+    return _mm_avg_epu16(_mm_and_si128(v, lo), _mm_srli_epi16(v, 8));
+}
+
+/// Averages the column pairs in each 32-bit lane of `v`.
+static inline SSE41 __m128i
+pair_columns_u16(__m128i v)
+{
+    const __m128i lo = _mm_and_si128(v, _mm_set1_epi32(0xffff));
+    const __m128i sum = _mm_add_epi32(lo, _mm_srli_epi32(v, 16));
+    return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1)), 1);
+}
+
+/// Bins 16 output columns from 32 columns of rows `a` and `b`.
+static inline SSE41 void
+block_u8(uint8_t* out, const uint8_t* a, const uint8_t* b)
+{
+    const __m128i* pa = (const __m128i*)a;
+    const __m128i* pb = (const __m128i*)b;
+    const __m128i v0 = _mm_avg_epu8(_mm_loadu_si128(pa), _mm_loadu_si128(pb));
+    const __m128i v1 =
+      _mm_avg_epu8(_mm_loadu_si128(pa + 1), _mm_loadu_si128(pb + 1));
+    _mm_storeu_si128((__m128i*)out,
+                     _mm_packus_epi16(pair_columns_u8(v0), pair_columns_u8(v1)));
+}
+
+/// Like block_u8(). Flipping the sign bit maps i8 to u8 preserving order, and
+/// rounding halves up commutes with the offset.
+static inline SSE41 void
+block_i8(int8_t* out, const int8_t* a, const int8_t* b)
+{
+    const __m128i bias = _mm_set1_epi8((char)0x80);
+    const __m128i* pa = (const __m128i*)a;
+    const __m128i* pb = (const __m128i*)b;
+    const __m128i v0 =
+      _mm_avg_epu8(_mm_xor_si128(_mm_loadu_si128(pa), bias),
+                   _mm_xor_si128(_mm_loadu_si128(pb), bias));
+    const __m128i v1 =
+      _mm_avg_epu8(_mm_xor_si128(_mm_loadu_si128(pa + 1), bias),
+                   _mm_xor_si128(_mm_loadu_si128(pb + 1), bias));
+    const __m128i v =
+      _mm_packus_epi16(pair_columns_u8(v0), pair_columns_u8(v1));
+    _mm_storeu_si128((__m128i*)out, _mm_xor_si128(v, bias));
+}
+
+/// Bins 8 output columns from 16 columns of rows `a` and `b`.
+static inline SSE41 void
+block_u16(uint16_t* out, const uint16_t* a, const uint16_t* b)
+{
+    const __m128i* pa = (const __m128i*)a;
+    const __m128i* pb = (const __m128i*)b;
+    const __m128i v0 =
+      _mm_avg_epu16(_mm_loadu_si128(pa), _mm_loadu_si128(pb));
+    const __m128i v1 =
+      _mm_avg_epu16(_mm_loadu_si128(pa + 1), _mm_loadu_si128(pb + 1));
+    _mm_storeu_si128(
+      (__m128i*)out,
+      _mm_packus_epi32(pair_columns_u16(v0), pair_columns_u16(v1)));
+}
+
+/// Like block_u16(), offsetting i16 to u16 the way block_i8() does.
+static inline SSE41 void
+block_i16(int16_t* out, const int16_t* a, const int16_t* b)
+{
+    const __m128i bias = _mm_set1_epi16((short)0x8000);
+    const __m128i* pa = (const __m128i*)a;
+    const __m128i* pb = (const __m128i*)b;
+    const __m128i v0 =
+      _mm_avg_epu16(_mm_xor_si128(_mm_loadu_si128(pa), bias),
+                    _mm_xor_si128(_mm_loadu_si128(pb), bias));
+    const __m128i v1 =
+      _mm_avg_epu16(_mm_xor_si128(_mm_loadu_si128(pa + 1), bias),
+                    _mm_xor_si128(_mm_loadu_si128(pb + 1), bias));
+    const __m128i v =
+      _mm_packus_epi32(pair_columns_u16(v0), pair_columns_u16(v1));
+    _mm_storeu_si128((__m128i*)out, _mm_xor_si128(v, bias));
+}
+
+/// Bins 4 output columns from 8 columns of rows `a` and `b`.
+static inline SSE41 void
+block_f32(float* out, const float* a, const float* b)
+{
+    const __m128 s0 = _mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(b));
+    const __m128 s1 = _mm_add_ps(_mm_loadu_ps(a + 4), _mm_loadu_ps(b + 4));
+    const __m128 even = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 odd = _mm_shuffle_ps(s0, s1, _MM_SHUFFLE(3, 1, 3, 1));
+    _mm_storeu_ps(out, _mm_mul_ps(_mm_add_ps(even, odd), _mm_set1_ps(0.25f)));
+}
+
+BIN2_DEFINE_KERNEL(SSE41, u8, uint8_t, 16)
+BIN2_DEFINE_KERNEL(SSE41, i8, int8_t, 16)
+BIN2_DEFINE_KERNEL(SSE41, u16, uint16_t, 8)
+BIN2_DEFINE_KERNEL(SSE41, i16, int16_t, 8)
+BIN2_DEFINE_KERNEL(SSE41, f32, float, 4)
+
+const struct bin2_kernels bin2_kernels_sse41 = {
+    .name = "sse4.1",
+    .bin2 = BIN2_KERNEL_TABLE,
+};
+
+#endif // x86_64
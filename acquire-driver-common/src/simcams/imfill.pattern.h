@@ -0,0 +1,68 @@
+//!
+//! # Radial sine pattern
+//!
+//! Renders the "simulated: radial sin" camera's image: concentric rings
+//! around the center of the frame, shifted by `(ox, oy)`, that move outward
+//! over time. A pixel at squared distance `r2` from the center is
+//! `127 * (sin(6.28 * (10 * t + 0.01 * r2)) + 1)` at time `t` in seconds.
+//! Cameras pass the time from im_fill_pattern_time_sec(), a clock every
+//! pattern camera shares, so their rings move in step.
+//!
+//! To render part of a frame, pass the part's shape and move the center with
+//! `(ox, oy)`. The center of a `w` by `h` image is at `(ox + w/2, oy + h/2)`.
+//!
+//! The phase is split into a term per column and a term per row, held in
+//! fixed point, so each pixel costs an add and a short polynomial for the
+//! sine.
+//!
+
+#ifndef H_ACQUIRE_DRIVER_SIMCAM_IMFILL_PATTERN_V0
+#define H_ACQUIRE_DRIVER_SIMCAM_IMFILL_PATTERN_V0
+
+#include "device/props/components.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /// Seconds since the first call.
+    float im_fill_pattern_time_sec(void);
+
+    void im_fill_pattern_u8(const struct ImageShape* shape,
+                            float ox,
+                            float oy,
+                            float t,
+                            uint8_t* buf);
+
+    void im_fill_pattern_i8(const struct ImageShape* shape,
+                            float ox,
+                            float oy,
+                            float t,
+                            int8_t* buf);
+
+    void im_fill_pattern_u16(const struct ImageShape* shape,
+                             float ox,
+                             float oy,
+                             float t,
+                             uint16_t* buf);
+
+    void im_fill_pattern_i16(const struct ImageShape* shape,
+                             float ox,
+                             float oy,
+                             float t,
+                             int16_t* buf);
+
+    void im_fill_pattern_f32(const struct ImageShape* shape,
+                             float ox,
+                             float oy,
+                             float t,
+                             float* buf);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // H_ACQUIRE_DRIVER_SIMCAM_IMFILL_PATTERN_V0
@@ -0,0 +1,399 @@
+#include "imfill.scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+/// Tiles are this many pixels on a side. Each holds at most one bead.
+constexpr uint32_t tile_px = 64;
+
+/// Pixels are keyed by their index in a sensor this wide, the widest frame
+/// the simulated cameras render.
+constexpr uint32_t sensor_width = 1 << 13;
+
+/// The PSF's standard deviation, and how far from its center it's drawn.
+constexpr float psf_sigma_px = 1.2f;
+constexpr int psf_radius_px = 4;
+
+/// Beads rest within this distance of their tile's center and wander at
+/// most this far from where they rest. With the PSF's radius, that keeps
+/// them inside the tile.
+constexpr float rest_range_px = 16.0f;
+constexpr float wander_range_px = 8.0f;
+static_assert(rest_range_px + wander_range_px + psf_radius_px < tile_px / 2,
+              "Beads must stay inside their tile.");
+
+constexpr float background_e = 20.0f;
+constexpr float read_noise_e = 1.6f;
+
+/// Converts electrons to samples.
+struct Readout
+{
+    float gain;
+    float offset;
+    float max;
+};
+
+constexpr Readout readout_u8 = { 1.0f / 16.0f, 10.0f, 255.0f };
+constexpr Readout readout_u12 = { 1.0f, 100.0f, 4095.0f };
+constexpr Readout readout_u16 = { 2.0f, 100.0f, 65535.0f };
+
+/// A bijective 32-bit hash (Chris Wellons' "lowbias32"). Only shifts, xors
+/// and 32-bit multiplies, so loops over it vectorize.
+inline uint32_t
+hash32(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+/// Returns a float in [0, 1) from the top 24 bits of `h`.
+inline float
+unit(uint32_t h)
+{
+    return (float)(h >> 8) * 0x1p-24f;
+}
+
+struct Bead
+{
+    /// Center, in pixels of the part being rendered.
+    float x, y;
+    /// Electrons at the center.
+    float peak;
+    /// The PSF across the bead's columns, starting at column `x0`.
+    int32_t x0;
+    float gx[2 * psf_radius_px + 1];
+};
+
+/// Places the bead of tile `(tx, ty)` in frame `frame`. @returns false if
+/// the tile is empty.
+bool
+place_bead(uint32_t tx, uint32_t ty, uint64_t frame, Bead* bead)
+{
+    uint32_t h = hash32(ty * (sensor_width / tile_px) + tx + 0x5bd1e995u);
+    if (unit(h) > 0.7f)
+        return false;
+    float r[8];
+    for (float& v : r)
+        v = unit(h = hash32(h));
+
+    const double k = (double)frame;
+    const float wander = wander_range_px * r[2];
+    bead->x = (float)(tx * tile_px) + 0.5f * tile_px +
+              rest_range_px * (2.0f * r[0] - 1.0f) +
+              wander * (float)std::cos((0.02 + 0.08 * r[3]) * k + 6.28 * r[5]);
+    bead->y = (float)(ty * tile_px) + 0.5f * tile_px +
+              rest_range_px * (2.0f * r[1] - 1.0f) +
+              wander * (float)std::sin((0.02 + 0.08 * r[4]) * k + 6.28 * r[6]);
+    bead->peak = 300.0f + 2700.0f * r[7] * r[7];
+    return true;
+}
+
+/// Fills in the PSF across the bead's columns, once its center is in the
+/// part's pixels.
+void
+profile_bead(Bead* bead)
+{
+    bead->x0 = (int32_t)std::lround(bead->x) - psf_radius_px;
+    for (int i = 0; i <= 2 * psf_radius_px; ++i) {
+        const float d = (float)(bead->x0 + i) - bead->x;
+        bead->gx[i] = std::exp(-0.5f * d * d / (psf_sigma_px * psf_sigma_px));
+    }
+}
+
+/// Returns a sample with mean `mean` and standard deviation `sigma`, clipped
+/// to `[0, max]`. The noise is roughly normal: the sum of the four bytes of
+/// a hash of the pixel's sensor index `i` and the frame's `key`, scaled to
+/// unit variance.
+template<typename T>
+inline T
+read_out(float mean, float sigma, uint32_t i, uint32_t key, float max)
+{
+    const uint32_t h = hash32(i ^ key);
+    const uint32_t pairs = (h & 0x00ff00ffu) + ((h >> 8) & 0x00ff00ffu);
+    const uint32_t s = (pairs & 0xffff) + (pairs >> 16);
+    // Each byte has variance (256^2 - 1) / 12.
+    const float z = ((float)(int32_t)s - 510.0f) * (1.0f / 147.80f);
+    float v = mean + sigma * z + 0.5f;
+    v = v < 0.0f ? 0.0f : (v > max ? max : v);
+    return (T)(int32_t)v;
+}
+
+#if (defined(__x86_64__) || defined(_M_X64)) &&                               \
+  (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_TARGETS
+#endif
+
+/// Defines `name()`, which reads out `width` pixels of background, `stride`
+/// samples apart. Pixel `x` has sensor index `index + x`. It's defined once
+/// per instruction set, marked by `attr`, so the compiler can vectorize the
+/// contiguous loop for each.
+#define SCENE_ROW(attr, name)                                                  \
+    template<typename T>                                                       \
+    attr void name(T* row,                                                     \
+                   size_t stride,                                              \
+                   float mean,                                                 \
+                   float sigma,                                                \
+                   uint32_t index,                                             \
+                   uint32_t key,                                               \
+                   float max,                                                  \
+                   uint32_t width)                                             \
+    {                                                                          \
+        if (stride == 1) {                                                     \
+            for (uint32_t x = 0; x < width; ++x)                               \
+                row[x] = read_out<T>(mean, sigma, index + x, key, max);        \
+        } else {                                                               \
+            for (uint32_t x = 0; x < width; ++x)                               \
+                row[stride * x] =                                              \
+                  read_out<T>(mean, sigma, index + x, key, max);               \
+        }                                                                      \
+    }
+
+SCENE_ROW(, scene_row)
+#ifdef HAVE_X86_TARGETS
+SCENE_ROW(__attribute__((target("avx2"))), scene_row_avx2)
+SCENE_ROW(__attribute__((target("avx512f,avx512bw,prefer-vector-width=512"))),
+          scene_row_avx512)
+#endif
+#undef SCENE_ROW
+
+template<typename T>
+using scene_row_fn =
+  void (*)(T*, size_t, float, float, uint32_t, uint32_t, float, uint32_t);
+
+/// Returns the row renderer for the widest instruction set this CPU
+/// supports.
+template<typename T>
+scene_row_fn<T>
+select_scene_row()
+{
+#ifdef HAVE_X86_TARGETS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw"))
+        return scene_row_avx512<T>;
+    if (__builtin_cpu_supports("avx2"))
+        return scene_row_avx2<T>;
+#endif
+    return scene_row<T>;
+}
+
+template<typename T>
+void
+im_fill_scene(const struct ImageShape* const shape,
+              uint32_t ox,
+              uint32_t oy,
+              uint64_t frame,
+              const Readout& readout,
+              T* buf)
+{
+    const uint32_t width = shape->dims.width;
+    const uint32_t height = shape->dims.height;
+
+    const float background = readout.offset + readout.gain * background_e;
+    const float background_sigma =
+      readout.gain * std::sqrt(background_e + read_noise_e * read_noise_e);
+    const float max = readout.max + 0.5f;
+    thread_local std::vector<Bead> beads;
+
+    const uint32_t frame_key =
+      hash32((uint32_t)frame ^ hash32((uint32_t)(frame >> 32) + 0x9e3779b9u));
+    static const scene_row_fn<T> render_row = select_scene_row<T>();
+
+    uint32_t beads_ty = UINT32_MAX;
+    for (uint32_t y = 0; y < height; ++y) {
+        // Beads don't leave their tile, so a row only sees the beads in
+        // its row of tiles.
+        const uint32_t ty = (oy + y) / tile_px;
+        if (ty != beads_ty) {
+            beads.clear();
+            const uint32_t tx_end = (ox + width + tile_px - 1) / tile_px;
+            for (uint32_t tx = ox / tile_px; tx < tx_end; ++tx) {
+                Bead bead;
+                if (!place_bead(tx, ty, frame, &bead))
+                    continue;
+                bead.x -= (float)ox;
+                bead.y -= (float)oy;
+                profile_bead(&bead);
+                beads.push_back(bead);
+            }
+            beads_ty = ty;
+        }
+
+        // Read out the whole row as background, then the few pixels beads
+        // light up. Noise is keyed by where the pixel is on the sensor, so it
+        // doesn't depend on how the frame is split.
+        T* const row = buf + (size_t)shape->strides.height * y;
+        const size_t stride = (size_t)shape->strides.width;
+        const uint32_t index = (oy + y) * sensor_width + ox;
+        render_row(row,
+                   stride,
+                   background,
+                   background_sigma,
+                   index,
+                   frame_key,
+                   max,
+                   width);
+        for (const Bead& bead : beads) {
+            const float dy = (float)y - bead.y;
+            if (std::fabs(dy) > (float)psf_radius_px)
+                continue;
+            const float row_peak =
+              bead.peak *
+              std::exp(-0.5f * dy * dy / (psf_sigma_px * psf_sigma_px));
+            for (int i = 0; i <= 2 * psf_radius_px; ++i) {
+                const int32_t x = bead.x0 + i;
+                if (x < 0 || x >= (int32_t)width)
+                    continue;
+                const float e = background_e + row_peak * bead.gx[i];
+                row[stride * x] = read_out<T>(
+                  readout.offset + readout.gain * e,
+                  readout.gain * std::sqrt(e + read_noise_e * read_noise_e),
+                  index + x,
+                  frame_key,
+                  max);
+            }
+        }
+    }
+}
+} // end namespace ::{anonymous}
+
+extern "C"
+{
+    void im_fill_scene_u8(const struct ImageShape* shape,
+                          uint32_t ox,
+                          uint32_t oy,
+                          uint64_t frame,
+                          uint8_t* buf)
+    {
+        im_fill_scene<uint8_t>(shape, ox, oy, frame, readout_u8, buf);
+    }
+
+    void im_fill_scene_u12(const struct ImageShape* shape,
+                           uint32_t ox,
+                           uint32_t oy,
+                           uint64_t frame,
+                           uint16_t* buf)
+    {
+        im_fill_scene<uint16_t>(shape, ox, oy, frame, readout_u12, buf);
+    }
+
+    void im_fill_scene_u16(const struct ImageShape* shape,
+                           uint32_t ox,
+                           uint32_t oy,
+                           uint64_t frame,
+                           uint16_t* buf)
+    {
+        im_fill_scene<uint16_t>(shape, ox, oy, frame, readout_u16, buf);
+    }
+};
+
+#ifndef NO_UNIT_TESTS
+#include "device/kit/driver.h"
+#include "logger.h"
+
+#define L (aq_logger)
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+namespace {
+struct ImageShape
+make_shape(uint32_t w, uint32_t h)
+{
+    struct ImageShape shape = {};
+    shape.dims = { .channels = 1, .width = w, .height = h, .planes = 1 };
+    shape.strides = {
+        .channels = 1, .width = 1, .height = w, .planes = (int64_t)w * h
+    };
+    shape.type = SampleType_u16;
+    return shape;
+}
+} // end namespace ::{anonymous}
+
+/// Frames rendered in parts match the whole frame, the same frame always
+/// renders the same, and the pixels have the statistics of the model.
+extern "C" acquire_export int
+unit_test_im_fill_scene_is_seeded_and_splits()
+{
+    const uint32_t w = 200, h = 150, ox = 40, oy = 90;
+    const uint64_t frame = 7;
+    const struct ImageShape shape = make_shape(w, h);
+    std::vector<uint16_t> whole(w * h), part(w * h), other(w * h);
+    im_fill_scene_u16(&shape, ox, oy, frame, whole.data());
+
+    im_fill_scene_u16(&shape, ox, oy, frame, other.data());
+    CHECK(other == whole);
+    im_fill_scene_u16(&shape, ox, oy, frame + 1, other.data());
+    CHECK(other != whole);
+
+    // Render in bands of rows, the way the camera's threads do, and as a
+    // region of interest inside the frame.
+    {
+        const uint32_t beg[] = { 0, 37, 64, h };
+        for (int i = 0; i < 3; ++i) {
+            struct ImageShape band = shape;
+            band.dims.height = beg[i + 1] - beg[i];
+            im_fill_scene_u16(
+              &band, ox, oy + beg[i], frame, part.data() + (size_t)w * beg[i]);
+        }
+        CHECK(part == whole);
+
+        struct ImageShape roi = make_shape(w - 30, h - 20);
+        roi.strides.height = w;
+        std::fill(part.begin(), part.end(), 0);
+        im_fill_scene_u16(&roi, ox + 30, oy + 20, frame, part.data());
+        for (uint32_t y = 0; y < roi.dims.height; ++y) {
+            for (uint32_t x = 0; x < roi.dims.width; ++x) {
+                EXPECT(part[(size_t)w * y + x] ==
+                         whole[(size_t)w * (y + 20) + x + 30],
+                       "Region of interest differs at (%u, %u).",
+                       x,
+                       y);
+            }
+        }
+    }
+
+    // Most pixels are background: offset 100 plus 2 ADU per electron, with
+    // 20 electrons and a standard deviation of 2 * sqrt(20 + 1.6^2) = 9.5.
+    {
+        std::vector<uint16_t> sorted(whole);
+        std::sort(sorted.begin(), sorted.end());
+        const double median = sorted[sorted.size() / 2];
+        const double spread =
+          0.5 * (sorted[sorted.size() * 3 / 4] - sorted[sorted.size() / 4]);
+        EXPECT(std::fabs(median - 140.0) <= 1.0,
+               "Expected a median of 140. Got %f.",
+               median);
+        // A normal's semi-interquartile range is 0.674 sigma.
+        EXPECT(std::fabs(spread - 0.674 * 9.5) <= 1.0,
+               "Expected a semi-interquartile range of %f. Got %f.",
+               0.674 * 9.5,
+               spread);
+        EXPECT(sorted.back() > 1000,
+               "Expected beads brighter than the background. Brightest pixel "
+               "is %d.",
+               (int)sorted.back());
+    }
+
+    // u12 samples stay in range, even where u16 ones don't.
+    im_fill_scene_u12(&shape, ox, oy, frame, other.data());
+    for (const uint16_t v : other)
+        EXPECT(v <= 4095, "Got %d in a u12 frame.", (int)v);
+
+    return 1;
+Error:
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,69 @@
+//!
+//! # Bead scene
+//!
+//! Renders the "simulated: beads" camera's image: fluorescent beads drifting
+//! over a dim background, with the noise a scientific camera records. Unlike
+//! uniform noise or the radial sine, frames compress and filter the way
+//! recorded data does, so benchmarks that use them say something about
+//! production data.
+//!
+//! The sensor is split into 64 pixel square tiles. Most tiles hold a bead:
+//! a Gaussian spot (sigma 1.2 px) whose brightness, resting place and
+//! wandering path are drawn from the tile's index. Beads stay inside their
+//! tile, so a band of rows only needs the beads of the tiles it crosses.
+//!
+//! Each pixel collects a background of 20 electrons plus the beads' light.
+//! Shot noise and 1.6 electrons of read noise are drawn together, as one
+//! Gaussian with the variance of both. Electrons are scaled by a gain, a dark
+//! offset is added, and the result is rounded and clipped to the sample
+//! type's range:
+//!
+//! | type | gain (ADU/e-) | offset (ADU) | range      |
+//! |------|---------------|--------------|------------|
+//! | u8   | 1/16          | 10           | 0 - 255    |
+//! | u12  | 1             | 100          | 0 - 4095   |
+//! | u16  | 2             | 100          | 0 - 65535  |
+//!
+//! u12 samples are stored in 16 bits.
+//!
+//! Frame `frame` is always the same image. The beads move with the frame
+//! number, and the noise at each pixel comes from a hash of the frame and
+//! the pixel's place on the sensor. To render part of a frame, pass the
+//! part's shape and its sensor position `(ox, oy)`.
+//!
+
+#ifndef H_ACQUIRE_DRIVER_SIMCAM_IMFILL_SCENE_V0
+#define H_ACQUIRE_DRIVER_SIMCAM_IMFILL_SCENE_V0
+
+#include "device/props/components.h"
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void im_fill_scene_u8(const struct ImageShape* shape,
+                          uint32_t ox,
+                          uint32_t oy,
+                          uint64_t frame,
+                          uint8_t* buf);
+
+    void im_fill_scene_u12(const struct ImageShape* shape,
+                           uint32_t ox,
+                           uint32_t oy,
+                           uint64_t frame,
+                           uint16_t* buf);
+
+    void im_fill_scene_u16(const struct ImageShape* shape,
+                           uint32_t ox,
+                           uint32_t oy,
+                           uint64_t frame,
+                           uint16_t* buf);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // H_ACQUIRE_DRIVER_SIMCAM_IMFILL_SCENE_V0
@@ -8,22 +8,31 @@
 #include "logger.h"
 
 #include <math.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "pcg_basic.h"
-
-#ifdef __AVX2__
-#include "bin2.avx2.c"
-#else
-#include "bin2.plain.c"
-#endif
+#include "bin2.h"
+#include "imfill.pattern.h"
+#include "imfill.scene.h"
 
 #define MAX_IMAGE_WIDTH (1ULL << 13)
 #define MAX_IMAGE_HEIGHT (1ULL << 13)
 #define MAX_BYTES_PER_PIXEL (4)
 
+/// Upper bound on the threads, including the streaming thread, that render
+/// each frame.
+#define MAX_RENDER_THREADS (16)
+
+/// Random frames are filled in blocks of this many bytes, each from its own
+/// PCG stream, so a frame doesn't depend on how it's split between threads.
+#define RAND_BLOCK_BYTES (1 << 16)
+
+/// Upper bound on the frames a free-running camera holds for get_frame().
+#define MAX_FRAME_QUEUE_DEPTH (64)
+
 #define containerof(ptr, T, V) ((T*)(((char*)(ptr)) - offsetof(T, V)))
 #define countof(e) (sizeof(e) / sizeof(*(e)))
 
@@ -53,10 +62,82 @@
 uint8_t
 popcount_u8(uint8_t value);
 
+/// One frame to render, split into bands.
+struct render_job
+{
+    enum BasicDeviceKind kind;
+    struct ImageShape shape;
+    uint8_t* dst;
+    /// Where the frame sits on the sensor, which offsets the pattern's
+    /// center, and the time the pattern is rendered at.
+    float ox, oy, t;
+    /// Selects the random streams, and the frame of the bead scene.
+    uint64_t seed;
+};
+
+struct render_pool;
+
+/// A streaming thread helper. Renders one band of each frame.
+struct render_worker
+{
+    struct thread thread;
+    struct render_pool* pool;
+    uint32_t band;
+};
+
+/// Workers that help the streaming thread render frames. The streaming
+/// thread posts a job, renders the first band itself, then waits for the
+/// workers to finish the rest.
+struct render_pool
+{
+    struct lock lock;
+    struct condition_variable job_posted;
+    struct condition_variable job_done;
+    struct render_job job;
+    /// Incremented each time a job is posted.
+    uint64_t generation;
+    /// Workers that haven't finished the current job.
+    uint32_t pending;
+    /// The worker count plus one for the streaming thread.
+    uint32_t nbands;
+    uint8_t is_stopping;
+    struct render_worker workers[MAX_RENDER_THREADS - 1];
+};
+
+/// A frame read out by a free-running camera.
+struct frame_slot
+{
+    void* data;
+    uint64_t hardware_frame_id;
+    uint64_t hardware_timestamp;
+};
+
+/// Frames a free-running camera has read out, waiting for get_frame(). The
+/// streaming thread is the only writer and get_frame() the only reader, so
+/// frames change hands through the head and tail counters alone. A frame
+/// read out while the queue is full is dropped, leaving a gap in the
+/// hardware frame ids.
+struct frame_queue
+{
+    struct frame_slot slots[MAX_FRAME_QUEUE_DEPTH];
+    /// Slots in use. Zero when the camera waits for get_frame() instead.
+    uint32_t depth;
+    /// Frames pushed by the streaming thread.
+    _Atomic uint64_t head;
+    /// Frames popped by get_frame().
+    _Atomic uint64_t tail;
+    /// get_frame() calls waiting on an empty queue. The streaming thread only
+    /// takes the lock to wake them.
+    _Atomic uint32_t readers_waiting;
+    uint64_t frames_dropped;
+};
+
 struct SimulatedCamera
 {
     struct CameraProperties properties;
     enum BasicDeviceKind kind;
+    struct render_pool render;
+    struct frame_queue queue;
 
     struct
     {
@@ -75,6 +156,14 @@ struct SimulatedCamera
         int64_t last_emitted_frame_id;
         struct condition_variable frame_ready;
         uint8_t frame_wanted;
+
+        // The buffer a waiting get_frame() will copy the frame to. The
+        // streamer renders straight into it when it can, saving the copy.
+        void* target;
+        size_t target_nbytes;
+        uint8_t is_target_busy;     // the streamer is rendering into target
+        uint8_t is_frame_in_target; // the last frame emitted is in target
+        uint64_t frames_in_place;
     } im;
 
     struct
@@ -94,43 +183,21 @@ aligned_bytes_of_image(const struct ImageShape* const shape)
     return ((n + 31) >> 5) << 5;
 }
 
+/// Fills blocks `[beg, end)` of a `nbytes` frame with random words. Each
+/// block draws from the stream `seed` and its index select.
 static void
-im_fill_rand(const struct ImageShape* const shape, uint8_t* buf)
-{
-    const size_t nbytes = aligned_bytes_of_image(shape);
-    const uint8_t* const end = buf + nbytes;
-    for (uint8_t* p = buf; p < end; p += 4)
-        *(uint32_t*)p = pcg32_random();
-}
-
-void
-im_fill_pattern_u8(const struct ImageShape* const shape,
-                   float ox,
-                   float oy,
-                   uint8_t* buf);
-void
-im_fill_pattern_i8(const struct ImageShape* const shape,
-                   float ox,
-                   float oy,
-                   int8_t* buf);
-
-void
-im_fill_pattern_u16(const struct ImageShape* const shape,
-                    float ox,
-                    float oy,
-                    uint16_t* buf);
-
-void
-im_fill_pattern_i16(const struct ImageShape* const shape,
-                    float ox,
-                    float oy,
-                    int16_t* buf);
-
-void
-im_fill_pattern_f32(const struct ImageShape* const shape,
-                    float ox,
-                    float oy,
-                    float* buf);
+im_fill_rand(uint8_t* buf, size_t nbytes, uint64_t seed, size_t beg, size_t end)
+{
+    for (size_t i = beg; i < end; ++i) {
+        pcg32_random_t rng;
+        pcg32_srandom_r(&rng, seed, i);
+        uint8_t* p = buf + i * RAND_BLOCK_BYTES;
+        const size_t n = nbytes - i * RAND_BLOCK_BYTES;
+        const uint8_t* const e = p + (n < RAND_BLOCK_BYTES ? n : RAND_BLOCK_BYTES);
+        for (; p < e; p += 4)
+            *(uint32_t*)p = pcg32_random_r(&rng);
+    }
+}
 
 static const char*
 sample_type_to_string(enum SampleType type)
@@ -146,6 +213,7 @@ sample_type_to_string(enum SampleType type)
         XXX(u10),
         XXX(u12),
         XXX(u14),
+        XXX(u32),
     };
     // clang-format on
 #undef XXX
@@ -160,23 +228,47 @@ static void
 im_fill_pattern(const struct ImageShape* const shape,
                 float ox,
                 float oy,
+                float t,
                 uint8_t* buf)
 {
     switch (shape->type) {
         case SampleType_u8:
-            im_fill_pattern_u8(shape, ox, oy, buf);
+            im_fill_pattern_u8(shape, ox, oy, t, buf);
             break;
         case SampleType_i8:
-            im_fill_pattern_i8(shape, ox, oy, (int8_t*)buf);
+            im_fill_pattern_i8(shape, ox, oy, t, (int8_t*)buf);
             break;
         case SampleType_u16:
-            im_fill_pattern_u16(shape, ox, oy, (uint16_t*)buf);
+            im_fill_pattern_u16(shape, ox, oy, t, (uint16_t*)buf);
             break;
         case SampleType_i16:
-            im_fill_pattern_i16(shape, ox, oy, (int16_t*)buf);
+            im_fill_pattern_i16(shape, ox, oy, t, (int16_t*)buf);
             break;
         case SampleType_f32:
-            im_fill_pattern_f32(shape, ox, oy, (float*)buf);
+            im_fill_pattern_f32(shape, ox, oy, t, (float*)buf);
+            break;
+        default:
+            LOGE("Unsupported pixel type for this simcam: %s",
+                 sample_type_to_string(shape->type));
+    }
+}
+
+static void
+im_fill_scene(const struct ImageShape* const shape,
+              uint32_t ox,
+              uint32_t oy,
+              uint64_t frame,
+              uint8_t* buf)
+{
+    switch (shape->type) {
+        case SampleType_u8:
+            im_fill_scene_u8(shape, ox, oy, frame, buf);
+            break;
+        case SampleType_u12:
+            im_fill_scene_u12(shape, ox, oy, frame, (uint16_t*)buf);
+            break;
+        case SampleType_u16:
+            im_fill_scene_u16(shape, ox, oy, frame, (uint16_t*)buf);
             break;
         default:
             LOGE("Unsupported pixel type for this simcam: %s",
@@ -184,6 +276,150 @@ im_fill_pattern(const struct ImageShape* const shape,
     }
 }
 
+/// Renders band `band` of `n` of `job`. Random frames are split by blocks,
+/// patterns and scenes by rows.
+static void
+render_job_run_band(const struct render_job* job, uint32_t band, uint32_t n)
+{
+    switch (job->kind) {
+        case BasicDevice_Camera_Random: {
+            const size_t nbytes = aligned_bytes_of_image(&job->shape);
+            const size_t nblocks =
+              (nbytes + RAND_BLOCK_BYTES - 1) / RAND_BLOCK_BYTES;
+            im_fill_rand(job->dst,
+                         nbytes,
+                         job->seed,
+                         nblocks * band / n,
+                         nblocks * (band + 1) / n);
+            break;
+        }
+        case BasicDevice_Camera_Sin: {
+            const uint32_t h = job->shape.dims.height;
+            const uint32_t beg = (uint32_t)((uint64_t)h * band / n);
+            const uint32_t end = (uint32_t)((uint64_t)h * (band + 1) / n);
+            if (end <= beg)
+                break;
+            // The band's center has to land on the frame's.
+            struct ImageShape shape = job->shape;
+            shape.dims.height = end - beg;
+            const float oy = job->oy + 0.5f * (float)h - (float)beg -
+                             0.5f * (float)shape.dims.height;
+            ECHO(im_fill_pattern(&shape,
+                                 job->ox,
+                                 oy,
+                                 job->t,
+                                 job->dst + (size_t)beg *
+                                              job->shape.strides.height *
+                                              bytes_of_type(shape.type)));
+            break;
+        }
+        case BasicDevice_Camera_Beads: {
+            const uint32_t h = job->shape.dims.height;
+            const uint32_t beg = (uint32_t)((uint64_t)h * band / n);
+            const uint32_t end = (uint32_t)((uint64_t)h * (band + 1) / n);
+            if (end <= beg)
+                break;
+            struct ImageShape shape = job->shape;
+            shape.dims.height = end - beg;
+            ECHO(im_fill_scene(&shape,
+                               (uint32_t)job->ox,
+                               (uint32_t)job->oy + beg,
+                               job->seed,
+                               job->dst + (size_t)beg *
+                                            job->shape.strides.height *
+                                            bytes_of_type(shape.type)));
+            break;
+        }
+        case BasicDevice_Camera_Empty:
+            break; // do nothing
+        default:
+            LOGE("Unexpected index for the kind of simulated camera. Got: %d",
+                 job->kind);
+    }
+}
+
+static void
+render_worker_thread(struct render_worker* self)
+{
+    struct render_pool* pool = self->pool;
+    uint64_t generation = 0;
+    lock_acquire(&pool->lock);
+    while (1) {
+        while (!pool->is_stopping && pool->generation == generation)
+            condition_variable_wait(&pool->job_posted, &pool->lock);
+        if (pool->is_stopping)
+            break;
+        generation = pool->generation;
+        const struct render_job job = pool->job;
+        const uint32_t nbands = pool->nbands;
+        lock_release(&pool->lock);
+
+        render_job_run_band(&job, self->band, nbands);
+
+        lock_acquire(&pool->lock);
+        if (--pool->pending == 0)
+            condition_variable_notify_all(&pool->job_done);
+    }
+    lock_release(&pool->lock);
+}
+
+/// Starts `thread_count - 1` workers. On failure the pool is left with the
+/// workers that did start.
+static int
+render_pool_start(struct render_pool* self, uint32_t thread_count)
+{
+    self->generation = 0;
+    self->pending = 0;
+    self->nbands = 1;
+    self->is_stopping = 0;
+    for (uint32_t i = 1; i < thread_count; ++i) {
+        struct render_worker* w = self->workers + i - 1;
+        *w = (struct render_worker){ .pool = self, .band = i };
+        thread_init(&w->thread);
+        CHECK(thread_create(
+          &w->thread, (void (*)(void*))render_worker_thread, w));
+        self->nbands = i + 1;
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+static void
+render_pool_stop(struct render_pool* self)
+{
+    lock_acquire(&self->lock);
+    self->is_stopping = 1;
+    condition_variable_notify_all(&self->job_posted);
+    lock_release(&self->lock);
+    for (uint32_t i = 0; i + 1 < self->nbands; ++i)
+        thread_join(&self->workers[i].thread);
+    self->nbands = 1;
+}
+
+/// Renders `job` across the pool. The calling thread takes the first band.
+static void
+render_pool_run(struct render_pool* self, const struct render_job* job)
+{
+    if (self->nbands == 1) {
+        render_job_run_band(job, 0, 1);
+        return;
+    }
+    lock_acquire(&self->lock);
+    self->job = *job;
+    self->pending = self->nbands - 1;
+    ++self->generation;
+    condition_variable_notify_all(&self->job_posted);
+    lock_release(&self->lock);
+
+    render_job_run_band(job, 0, self->nbands);
+
+    lock_acquire(&self->lock);
+    while (self->pending)
+        condition_variable_wait(&self->job_done, &self->lock);
+    lock_release(&self->lock);
+}
+
 static void
 compute_strides(struct ImageShape* shape)
 {
@@ -227,12 +463,78 @@ compute_full_resolution_shape_and_offset(const struct SimulatedCamera* self,
     compute_strides(shape);
 }
 
+/// Whether a frame of `full` resolution can be rendered straight into the
+/// buffer posted by get_frame(). Rendering writes whole words and bins in
+/// place, so only when that fits. Call with `im.lock` held.
+static int
+can_render_into_target(const struct SimulatedCamera* self,
+                       const struct ImageShape* full)
+{
+    return self->im.target && self->properties.binning == 1 &&
+           self->im.target_nbytes >= aligned_bytes_of_image(full);
+}
+
+/// Sizes the queue to `depth` slots of `nbytes` each and empties it.
+static int
+frame_queue_start(struct frame_queue* self, uint32_t depth, size_t nbytes)
+{
+    self->depth = 0;
+    for (uint32_t i = 0; i < depth; ++i) {
+        CHECK(self->slots[i].data =
+                checked_realloc(self->slots[i].data, nbytes));
+    }
+    self->depth = depth;
+    atomic_store(&self->head, 0);
+    atomic_store(&self->tail, 0);
+    self->frames_dropped = 0;
+    return 1;
+Error:
+    return 0;
+}
+
+/// @returns the slot the next frame should be read out into, or NULL if the
+/// queue is full.
+static struct frame_slot*
+frame_queue_reserve(struct frame_queue* self)
+{
+    const uint64_t head =
+      atomic_load_explicit(&self->head, memory_order_relaxed);
+    // Acquire, so get_frame() is done copying out of the slot.
+    const uint64_t tail =
+      atomic_load_explicit(&self->tail, memory_order_acquire);
+    if (head - tail >= self->depth)
+        return 0;
+    return self->slots + head % self->depth;
+}
+
+/// Publishes the frame in `slot`, from frame_queue_reserve(), to
+/// get_frame().
+static void
+simcam_push_frame(struct SimulatedCamera* self,
+                  struct frame_slot* slot,
+                  int64_t frame_id)
+{
+    struct frame_queue* const q = &self->queue;
+    slot->hardware_frame_id = frame_id;
+    slot->hardware_timestamp = clock_tic(0);
+    // seq_cst so this store can't be reordered after the load of
+    // readers_waiting. See simcam_pop_frame().
+    atomic_store(&q->head,
+                 atomic_load_explicit(&q->head, memory_order_relaxed) + 1);
+    if (atomic_load(&q->readers_waiting)) {
+        lock_acquire(&self->im.lock);
+        condition_variable_notify_all(&self->im.frame_ready);
+        lock_release(&self->im.lock);
+    }
+}
+
 static void
 simulated_camera_streamer_thread(struct SimulatedCamera* self)
 {
     clock_init(&self->streamer.throttle);
 
     int64_t frame_id = self->im.frame_id;
+    float readout_ms = 0.0f;
     while (self->streamer.is_running) {
         struct ImageShape full = { 0 };
         uint32_t origin[2] = { 0, 0 };
@@ -254,32 +556,56 @@ simulated_camera_streamer_thread(struct SimulatedCamera* self)
 
         clock_tic(&self->streamer.throttle);
 
-        // generate the image
-        switch (self->kind) {
-            case BasicDevice_Camera_Random:
-                im_fill_rand(&full, self->im.render_data);
-                break;
-            case BasicDevice_Camera_Sin:
-                ECHO(im_fill_pattern(&full,
-                                     (float)origin[0],
-                                     (float)origin[1],
-                                     self->im.render_data));
-                break;
-            case BasicDevice_Camera_Empty:
-                break; // do nothing
-            default:
-                LOGE(
-                  "Unexpected index for the kind of simulated camera. Got: %d",
-                  self->kind);
+        // Expose, leaving the end of the frame period for the readout. That
+        // gives get_frame() time to post its buffer so the frame can be
+        // rendered straight into it.
+        if (self->streamer.is_running) {
+            clock_sleep_ms(&self->streamer.throttle,
+                           exposure_time_ms - readout_ms);
+        }
+
+        ECHO(lock_acquire(&self->im.lock));
+        uint8_t* dst = self->im.render_data;
+        const int in_place = can_render_into_target(self, &full);
+        if (in_place) {
+            dst = self->im.target;
+            self->im.is_target_busy = 1;
         }
+        ECHO(lock_release(&self->im.lock));
+
+        // A free-running camera reads out into the next free slot. When the
+        // queue is full the frame is still read out, then dropped.
+        struct frame_slot* slot = 0;
+        if (self->queue.depth && (slot = frame_queue_reserve(&self->queue)))
+            dst = slot->data;
+
+        struct clock readout;
+        clock_init(&readout);
+
+        // generate the image
+        const struct render_job job = {
+            .kind = self->kind,
+            .shape = full,
+            .dst = dst,
+            .ox = (float)origin[0],
+            .oy = (float)origin[1],
+            .t = im_fill_pattern_time_sec(),
+            // The id of the frame being rendered.
+            .seed = (uint64_t)frame_id + 1,
+        };
+        render_pool_run(&self->render, &job);
 
         // apply binning if applicable
         if (self->properties.binning > 1) {
+            const bin2_fn bin2 = bin2_kernels_select()->bin2[full.type];
             int w = full.dims.width;
             int h = full.dims.height;
-            int b = self->properties.binning >> 1;
+            int b = bin2 ? self->properties.binning >> 1 : 0;
+            if (!bin2)
+                LOGE("Can't bin pixels of type %s",
+                     sample_type_to_string(full.type));
             while (b) {
-                ECHO(bin2(self->im.render_data, w, h));
+                ECHO(bin2(dst, w, h));
                 b >>= 1;
                 w >>= 1;
                 h >>= 1;
@@ -287,21 +613,42 @@ simulated_camera_streamer_thread(struct SimulatedCamera* self)
         }
 
         ++frame_id;
-
-        // sleep for the remainder of the exposure time
-        float toc = (float)clock_toc_ms(&self->streamer.throttle);
-        if (self->streamer.is_running) {
-            clock_sleep_ms(&self->streamer.throttle, exposure_time_ms - toc);
+        readout_ms = (float)clock_toc_ms(&readout);
+
+        if (self->queue.depth) {
+            if (slot)
+                simcam_push_frame(self, slot, frame_id);
+            else
+                ++self->queue.frames_dropped;
+            continue;
         }
 
+        // A posted target implies a frame is wanted, so this always clears
+        // is_target_busy.
         if (self->im.frame_wanted) {
             ECHO(lock_acquire(&self->im.lock));
 
-            {
+            // get_frame() posted its buffer after this frame started reading
+            // out. Unless each frame waits for a trigger, render the next
+            // one straight into the buffer rather than copying this one.
+            if (!in_place && can_render_into_target(self, &full) &&
+                !self->properties.input_triggers.frame_start.enable) {
+                ECHO(lock_release(&self->im.lock));
+                continue;
+            }
+
+            if (in_place) {
+                self->im.is_target_busy = 0;
+                ++self->im.frames_in_place;
+            } else {
                 void* const tmp = self->im.frame_data;
                 self->im.frame_data = self->im.render_data;
                 self->im.render_data = tmp;
             }
+            self->im.is_frame_in_target = (uint8_t)in_place;
+            // Each get_frame() call gets one frame. Don't render the next
+            // into a buffer the caller may be done with.
+            self->im.target = 0;
 
             self->hardware_timestamp = clock_tic(0);
             self->im.frame_id = frame_id;
@@ -333,6 +680,14 @@ simcam_get_meta(const struct Camera* camera,
     // max offset - min width and height are 1 px.
     const float ox = max(0, w - cw - 1);
     const float oy = max(0, h - ch - 1);
+    // The bead scene is rendered as a scientific camera would read it out.
+    const uint64_t pixel_types =
+      self->kind == BasicDevice_Camera_Beads
+        ? (1ULL << SampleType_u8) | (1ULL << SampleType_u12) |
+            (1ULL << SampleType_u16)
+        : (1ULL << SampleType_u8) | (1ULL << SampleType_u16) |
+            (1ULL << SampleType_i8) | (1ULL << SampleType_i16) |
+            (1ULL << SampleType_f32);
 
     *meta = (struct CameraPropertyMetadata){
         .line_interval_us = { 0 },
@@ -346,11 +701,7 @@ simcam_get_meta(const struct Camera* camera,
             .x = { .high = ox, .writable = 1, },
             .y = { .high = oy, .writable = 1, },
         },
-        .supported_pixel_types = (1ULL << SampleType_u8)  |
-                                 (1ULL << SampleType_u16) |
-                                 (1ULL << SampleType_i8)  |
-                                 (1ULL << SampleType_i16) |
-                                 (1ULL << SampleType_f32),
+        .supported_pixel_types = pixel_types,
         .digital_lines = {
           .line_count=1,
           .names = { [0] = "software" },
@@ -358,6 +709,11 @@ simcam_get_meta(const struct Camera* camera,
         .triggers = {
           .frame_start = {.input=1, .output=0,},
         },
+        .render_thread_count = { .low = 0.0f,
+                                 .high = (float)MAX_RENDER_THREADS,
+                                 .writable = 1, },
+        .frame_queue_depth = { .high = (float)MAX_FRAME_QUEUE_DEPTH,
+                               .writable = 1, },
     };
     return Device_Ok;
 }
@@ -393,6 +749,10 @@ simcam_set(struct Camera* camera, struct CameraProperties* settings)
     ECHO(lock_acquire(&self->im.lock));
     self->properties = *settings;
     self->properties.pixel_type = settings->pixel_type;
+    self->properties.render_thread_count =
+      clamp(settings->render_thread_count, 1, MAX_RENDER_THREADS);
+    self->properties.frame_queue_depth =
+      clamp(settings->frame_queue_depth, 0, MAX_FRAME_QUEUE_DEPTH);
     self->properties.input_triggers = (struct camera_properties_input_triggers_s){
         .frame_start = { .enable = settings->input_triggers.frame_start.enable,
                          .line = 0, // Software
@@ -421,7 +781,11 @@ simcam_set(struct Camera* camera, struct CameraProperties* settings)
         .y = shape->dims.height,
     };
 
-    size_t nbytes = aligned_bytes_of_image(shape);
+    // Frames are rendered at full resolution, then binned in place.
+    struct ImageShape full = { 0 };
+    uint32_t origin[2] = { 0, 0 };
+    compute_full_resolution_shape_and_offset(self, &full, origin);
+    size_t nbytes = aligned_bytes_of_image(&full);
     CHECK(self->im.frame_data = checked_realloc(self->im.frame_data, nbytes));
     CHECK(self->im.render_data = checked_realloc(self->im.render_data, nbytes));
 
@@ -459,12 +823,33 @@ simcam_start(struct Camera* camera)
     self->streamer.is_running = 1;
     self->im.last_emitted_frame_id = -1;
     self->im.frame_id = -1;
+    self->im.target = 0;
+    self->im.is_target_busy = 0;
+    self->im.is_frame_in_target = 0;
+
+    struct ImageShape full = { 0 };
+    uint32_t origin[2] = { 0, 0 };
+    compute_full_resolution_shape_and_offset(self, &full, origin);
+    EXPECT(frame_queue_start(&self->queue,
+                             self->properties.frame_queue_depth,
+                             aligned_bytes_of_image(&full)),
+           "Failed to allocate a queue of %u frames",
+           self->properties.frame_queue_depth);
+
+    if (!render_pool_start(&self->render,
+                           self->properties.render_thread_count)) {
+        LOGE("Started %u of %u render threads",
+             self->render.nbands,
+             self->properties.render_thread_count);
+    }
     TRACE("SIMULATED CAMERA: thread launch");
     CHECK(thread_create(&self->streamer.thread,
                         (void (*)(void*))simulated_camera_streamer_thread,
                         self));
     return Device_Ok;
 Error:
+    self->streamer.is_running = 0;
+    render_pool_stop(&self->render);
     return Device_Err;
 }
 
@@ -494,11 +879,49 @@ simcam_stop(struct Camera* camera)
 
     TRACE("SIMULATED CAMERA: thread join");
     ECHO(thread_join(&self->streamer.thread));
+    render_pool_stop(&self->render);
 
     TRACE("SIMULATED CAMERA: exiting");
     return Device_Ok;
 }
 
+/// Copies the oldest queued frame to `im`, waiting for one if the queue is
+/// empty. Sets `*nbytes` to zero if the camera stops first.
+static void
+simcam_pop_frame(struct SimulatedCamera* self,
+                 void* im,
+                 size_t* nbytes,
+                 struct ImageInfo* info_out)
+{
+    struct frame_queue* const q = &self->queue;
+    const uint64_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (atomic_load(&q->head) == tail) {
+        ECHO(lock_acquire(&self->im.lock));
+        // Announce this reader before re-checking, so the streamer can't push
+        // in between without seeing it. See simcam_push_frame().
+        atomic_fetch_add(&q->readers_waiting, 1);
+        while (self->streamer.is_running && atomic_load(&q->head) == tail) {
+            ECHO(condition_variable_wait(&self->im.frame_ready,
+                                         &self->im.lock));
+        }
+        atomic_fetch_sub(&q->readers_waiting, 1);
+        ECHO(lock_release(&self->im.lock));
+    }
+    if (atomic_load(&q->head) == tail) {
+        *nbytes = 0;
+        return;
+    }
+
+    const struct frame_slot* const slot = q->slots + tail % q->depth;
+    memcpy(im, slot->data, bytes_of_image(&self->im.shape)); // NOLINT
+    info_out->shape = self->im.shape;
+    info_out->hardware_frame_id = slot->hardware_frame_id;
+    info_out->hardware_timestamp = slot->hardware_timestamp;
+    // seq_cst, like the push, so the streamer sees the slot is free only
+    // after the copy.
+    atomic_store(&q->tail, tail + 1);
+}
+
 static enum DeviceStatusCode
 simcam_get_frame(struct Camera* camera,
                  void* im,
@@ -510,22 +933,38 @@ simcam_get_frame(struct Camera* camera,
     CHECK(*nbytes >= bytes_of_image(&self->im.shape));
     CHECK(self->streamer.is_running);
 
+    if (self->queue.depth) {
+        simcam_pop_frame(self, im, nbytes, info_out);
+        return Device_Ok;
+    }
+
     TRACE("last: %5d current %5d",
           self->im.last_emitted_frame_id,
           self->im.frame_id);
     ECHO(lock_acquire(&self->im.lock));
     self->im.frame_wanted = 1;
+    self->im.target = im;
+    self->im.target_nbytes = *nbytes;
 
     while (self->streamer.is_running &&
            self->im.last_emitted_frame_id >= self->im.frame_id) {
         ECHO(condition_variable_wait(&self->im.frame_ready, &self->im.lock));
     }
+    // When stopping, the streamer may still be rendering into `im`.
+    self->im.target = 0;
+    while (self->im.is_target_busy) {
+        ECHO(condition_variable_wait(&self->im.frame_ready, &self->im.lock));
+    }
     self->im.last_emitted_frame_id = self->im.frame_id;
     if (!self->streamer.is_running) {
         goto Shutdown;
     }
 
-    memcpy(im, self->im.frame_data, bytes_of_image(&self->im.shape)); // NOLINT
+    if (!self->im.is_frame_in_target) {
+        memcpy(im,
+               self->im.frame_data,
+               bytes_of_image(&self->im.shape)); // NOLINT
+    }
     info_out->shape = self->im.shape;
     info_out->hardware_frame_id = self->im.frame_id;
     info_out->hardware_timestamp = self->hardware_timestamp;
@@ -546,6 +985,8 @@ simcam_close_camera(struct Camera* camera_)
 
     free(camera->im.frame_data);
     free(camera->im.render_data);
+    for (int i = 0; i < MAX_FRAME_QUEUE_DEPTH; ++i)
+        free(camera->queue.slots[i].data);
     free(camera);
     return Device_Ok;
 Error:
@@ -564,6 +1005,7 @@ simcam_make_camera(enum BasicDeviceKind kind)
         .readout_direction = Direction_Forward,
         .binning = 1,
         .pixel_type = SampleType_u8,
+        .render_thread_count = 1,
         .shape = { .x = 1920, .y = 1080 },
         .input_triggers = { .frame_start = { .enable = 0,
                                        .line = 0, // Software
@@ -607,6 +1049,10 @@ simcam_make_camera(enum BasicDeviceKind kind)
     };
     thread_init(&self->streamer.thread);
     lock_init(&self->im.lock);
+    lock_init(&self->render.lock);
+    condition_variable_init(&self->render.job_posted);
+    condition_variable_init(&self->render.job_done);
+    self->render.nbands = 1;
     condition_variable_init(&self->im.frame_ready);
     condition_variable_init(&self->software_trigger.trigger_ready);
 
@@ -616,3 +1062,180 @@ Error:
         free(self);
     return 0;
 }
+
+#ifndef NO_UNIT_TESTS
+acquire_export int
+unit_test_simcam_renders_into_caller_buffer()
+{
+    struct Camera* camera = 0;
+    uint8_t* buf = 0;
+    CHECK(camera = simcam_make_camera(BasicDevice_Camera_Sin));
+    struct SimulatedCamera* self =
+      containerof(camera, struct SimulatedCamera, camera);
+
+    struct CameraProperties props = self->properties;
+    props.shape = (struct camera_properties_shape_s){ .x = 64, .y = 48 };
+    props.exposure_time_us = 20000;
+    CHECK(simcam_set(camera, &props) == Device_Ok);
+    const size_t nbytes = bytes_of_image(&self->im.shape);
+    CHECK(buf = malloc(nbytes));
+
+    CHECK(simcam_start(camera) == Device_Ok);
+    for (int i = 0; i < 5; ++i) {
+        struct ImageInfo info = { 0 };
+        size_t sz = nbytes;
+        memset(buf, 0, nbytes); // NOLINT
+        CHECK(simcam_get_frame(camera, buf, &sz, &info) == Device_Ok);
+        CHECK(info.hardware_frame_id >= (uint64_t)i);
+
+        // Whether it was rendered in place or copied, the frame is there.
+        size_t nonzero = 0;
+        for (size_t j = 0; j < nbytes; ++j)
+            nonzero += (buf[j] != 0);
+        CHECK(nonzero > 0);
+    }
+    // The caller waits out most of each exposure, so it's almost always
+    // waiting with its buffer by the time the frame is read out.
+    EXPECT(self->im.frames_in_place > 0,
+           "Expected at least one frame to be rendered in place.");
+
+    simcam_close_camera(camera);
+    free(buf);
+    return 1;
+Error:
+    if (camera)
+        simcam_close_camera(camera);
+    free(buf);
+    return 0;
+}
+
+acquire_export int
+unit_test_simcam_render_threads_match_one_thread()
+{
+    // Odd sizes leave ragged bands, and the random frame spans many blocks.
+    struct ImageShape shape = {
+        .dims = { .channels = 1, .width = 1031, .height = 517, .planes = 1 },
+        .type = SampleType_u16,
+    };
+    compute_strides(&shape);
+    const size_t nbytes = aligned_bytes_of_image(&shape);
+    uint8_t* expected = malloc(nbytes);
+    uint8_t* actual = malloc(nbytes);
+    struct render_pool pool = { 0 };
+    lock_init(&pool.lock);
+    condition_variable_init(&pool.job_posted);
+    condition_variable_init(&pool.job_done);
+    pool.nbands = 1;
+    CHECK(expected && actual);
+
+    const enum BasicDeviceKind kinds[] = { BasicDevice_Camera_Random,
+                                           BasicDevice_Camera_Sin,
+                                           BasicDevice_Camera_Beads };
+    const uint32_t thread_counts[] = { 2, 3, MAX_RENDER_THREADS };
+    for (size_t i = 0; i < countof(kinds); ++i) {
+        struct render_job job = {
+            .kind = kinds[i],
+            .shape = shape,
+            .dst = expected,
+            .ox = 3.0f,
+            .oy = 2.0f,
+            .t = 1.5f,
+            .seed = 42,
+        };
+        // Patterns leave the alignment padding alone.
+        memset(expected, 0, nbytes); // NOLINT
+        render_job_run_band(&job, 0, 1);
+        job.dst = actual;
+        for (size_t j = 0; j < countof(thread_counts); ++j) {
+            memset(actual, 0, nbytes); // NOLINT
+            CHECK(render_pool_start(&pool, thread_counts[j]));
+            render_pool_run(&pool, &job);
+            render_pool_stop(&pool);
+            EXPECT(!memcmp(expected, actual, nbytes),
+                   "Frame of kind %d rendered with %u threads differs from "
+                   "one thread.",
+                   kinds[i],
+                   thread_counts[j]);
+        }
+    }
+    free(expected);
+    free(actual);
+    return 1;
+Error:
+    render_pool_stop(&pool);
+    free(expected);
+    free(actual);
+    return 0;
+}
+
+acquire_export int
+unit_test_simcam_frame_queue_reports_overflow()
+{
+    struct Camera* camera = 0;
+    uint8_t *buf = 0, *expected = 0;
+    CHECK(camera = simcam_make_camera(BasicDevice_Camera_Random));
+    struct SimulatedCamera* self =
+      containerof(camera, struct SimulatedCamera, camera);
+
+    struct CameraProperties props = self->properties;
+    props.shape = (struct camera_properties_shape_s){ .x = 64, .y = 48 };
+    props.exposure_time_us = 1000;
+    props.frame_queue_depth = 4;
+    CHECK(simcam_set(camera, &props) == Device_Ok);
+    const size_t nbytes = aligned_bytes_of_image(&self->im.shape);
+    CHECK(buf = malloc(nbytes));
+    CHECK(expected = malloc(nbytes));
+
+    // Let the camera fill its queue and run on, dropping frames.
+    CHECK(simcam_start(camera) == Device_Ok);
+    struct clock clk;
+    clock_init(&clk);
+    clock_sleep_ms(&clk, 50.0);
+
+    uint64_t last = 0;
+    int has_gap = 0;
+    for (int i = 0; i < 8; ++i) {
+        struct ImageInfo info = { 0 };
+        size_t sz = nbytes;
+        CHECK(simcam_get_frame(camera, buf, &sz, &info) == Device_Ok);
+        CHECK(sz == nbytes);
+        // The queue held the first frames read out.
+        if (i < 4)
+            EXPECT(info.hardware_frame_id == (uint64_t)i,
+                   "Expected frame %d. Got %llu.",
+                   i,
+                   (unsigned long long)info.hardware_frame_id);
+        else
+            CHECK(info.hardware_frame_id > last);
+        has_gap |= info.hardware_frame_id > last + 1;
+        last = info.hardware_frame_id;
+
+        // Random frames are seeded by their id, so each frame is the one its
+        // id says.
+        const struct render_job job = {
+            .kind = BasicDevice_Camera_Random,
+            .shape = self->im.shape,
+            .dst = expected,
+            .seed = info.hardware_frame_id,
+        };
+        render_job_run_band(&job, 0, 1);
+        EXPECT(!memcmp(buf, expected, bytes_of_image(&self->im.shape)),
+               "Frame %llu doesn't hold its own pixels.",
+               (unsigned long long)info.hardware_frame_id);
+    }
+    EXPECT(has_gap, "Expected dropped frames to leave a gap in the ids.");
+
+    simcam_stop(camera);
+    CHECK(self->queue.frames_dropped > 0);
+    simcam_close_camera(camera);
+    free(buf);
+    free(expected);
+    return 1;
+Error:
+    if (camera)
+        simcam_close_camera(camera);
+    free(buf);
+    free(expected);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -85,7 +85,7 @@ basics_make_storage(enum BasicDeviceKind kind)
         const size_t nbytes =
           sizeof(globals.constructors[0]) * BasicDeviceKindCount;
         CHECK(globals.constructors = (struct Storage * (**)()) malloc(nbytes));
-        struct Storage* (*impls[])() = {
+        struct Storage* (*impls[BasicDeviceKindCount])() = {
             [BasicDevice_Storage_Raw] = raw_init,
             [BasicDevice_Storage_Tiff] = tiff_init,
             [BasicDevice_Storage_Trash] = trash_init,
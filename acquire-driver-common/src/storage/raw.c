@@ -2,6 +2,7 @@
 #include "device/kit/storage.h"
 #include "platform.h"
 #include "logger.h"
+#include "write.queue.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -21,13 +22,18 @@
         goto Error;                                                            \
     } while (0)
 
+#define min(a, b) ((a) < (b) ? (a) : (b))
 #define containerof(ptr, T, V) ((T*)(((char*)(ptr)) - offsetof(T, V)))
 
+/// Spans are copied into the write queue at most this many bytes at a time.
+#define RAW_WRITE_BYTES ((size_t)8 << 20)
+
 struct Raw
 {
     struct Storage writer;
     struct StorageProperties properties;
     struct file file;
+    struct write_queue writes;
     size_t offset;
 };
 
@@ -72,7 +78,7 @@ static void
 raw_get_meta(const struct Storage* self_, struct StoragePropertyMetadata* meta)
 {
     CHECK(meta);
-    *meta = (struct StoragePropertyMetadata){ 0 };
+    *meta = (struct StoragePropertyMetadata){ .direct_io_is_supported = 1 };
 Error:
     return;
 }
@@ -81,8 +87,14 @@ static enum DeviceState
 raw_start(struct Storage* self_)
 {
     struct Raw* self = containerof(self_, struct Raw, writer);
-    CHECK(file_create(
+    const uint8_t is_direct = self->properties.direct_io;
+    CHECK((is_direct ? file_create_direct : file_create)(
       &self->file, self->properties.uri.str, self->properties.uri.nbytes));
+    if (!write_queue_init(&self->writes, &self->file, is_direct)) {
+        file_close(&self->file);
+        goto Error;
+    }
+    self->offset = 0;
     LOG("RAW: Frame header size %d bytes", (int)sizeof(struct VideoFrame));
     return DeviceState_Running;
 Error:
@@ -93,21 +105,71 @@ static enum DeviceState
 raw_stop(struct Storage* self_)
 {
     struct Raw* self = containerof(self_, struct Raw, writer);
+    // The queue is only set up while running.
+    if (self->writes.file && !write_queue_flush(&self->writes))
+        LOGE("Failed to write \"%s\"", self->properties.uri.str);
+    write_queue_destroy(&self->writes);
     file_close(&self->file);
     return DeviceState_Armed;
 }
 
+static size_t
+align_up(size_t v, size_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+/// Copies each frame so it starts on a FILE_DIRECT_ALIGNMENT_BYTES boundary.
+/// The copied header's `bytes_of_frame` covers the padding after the frame,
+/// so readers stepping from frame to frame skip over it.
+static int
+raw_append_aligned(struct Raw* self,
+                   const struct VideoFrame* frames,
+                   size_t nbytes)
+{
+    const uint8_t* cur = (const uint8_t*)frames;
+    const uint8_t* end = cur + nbytes;
+    while (cur < end) {
+        const size_t n = ((const struct VideoFrame*)cur)->bytes_of_frame;
+        CHECK(n >= sizeof(struct VideoFrame) && n <= (size_t)(end - cur));
+        const size_t padded = align_up(n, FILE_DIRECT_ALIGNMENT_BYTES);
+        uint8_t* dst = 0;
+        CHECK(dst = write_queue_reserve(&self->writes, self->offset, padded));
+        memcpy(dst, cur, n);            // NOLINT
+        memset(dst + n, 0, padded - n); // NOLINT
+        ((struct VideoFrame*)dst)->bytes_of_frame = padded;
+        self->offset += padded;
+        cur += n;
+    }
+    return 1;
+Error:
+    return 0;
+}
+
 static enum DeviceState
 raw_append(struct Storage* self_,
            const struct VideoFrame* frames,
            size_t* nbytes)
 {
     struct Raw* self = containerof(self_, struct Raw, writer);
-    CHECK(file_write(&self->file,
-                     self->offset,
-                     (uint8_t*)frames,
-                     ((uint8_t*)frames) + *nbytes));
-    self->offset += *nbytes;
+    // The frames are released when this returns, so they're copied into the
+    // queue. Long spans go in pieces so no staging buffer grows past the
+    // queue's target.
+    if (self->properties.direct_io) {
+        CHECK(raw_append_aligned(self, frames, *nbytes));
+    } else {
+        const uint8_t* cur = (const uint8_t*)frames;
+        const uint8_t* end = cur + *nbytes;
+        while (cur < end) {
+            const size_t n = min(RAW_WRITE_BYTES, (size_t)(end - cur));
+            uint8_t* dst = 0;
+            CHECK(dst = write_queue_reserve(&self->writes, self->offset, n));
+            memcpy(dst, cur, n); // NOLINT
+            self->offset += n;
+            cur += n;
+        }
+    }
+    CHECK(write_queue_submit(&self->writes));
 
     return DeviceState_Running;
 Error:
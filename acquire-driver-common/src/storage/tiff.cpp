@@ -2,12 +2,14 @@
 #include "device/kit/storage.h"
 #include "logger.h"
 #include "platform.h"
+#include "write.queue.h"
 
 #include <cstddef>
 #include <cstring>
 #include <exception>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include <algorithm>
 
 using namespace std;
@@ -49,8 +51,15 @@ struct Tiff final : public Storage
     string external_metadata_;
     struct PixelScale pixel_scale_um_;
     struct file file_;
+    struct write_queue writes_;
     uint64_t last_offset_, last_ifd_next_offset_;
     size_t frame_count_; // the number of frames written to the current file
+    bool direct_io_;
+
+    // With direct I/O, the last ifd and its offset, so the terminator can
+    // rewrite the whole ifd rather than patch its next offset in place.
+    vector<uint8_t> last_ifd_;
+    uint64_t last_ifd_offset_;
 
     // Context for constructing string storage during ifd assembly.
     // This acquires memory. Kept in object context to reuse that memory.
@@ -65,10 +74,10 @@ struct Tiff final : public Storage
     int start() noexcept;
     int stop() noexcept;
     int append(const struct VideoFrame* frames, size_t nbytes) noexcept;
-    void write_(uint64_t offset, void* buf, size_t nbytes) noexcept;
+    int write_(uint64_t offset, const void* buf, size_t nbytes) noexcept;
 
   private:
-    void terminate_ifd_list() noexcept;
+    int terminate_ifd_list() noexcept;
 };
 
 #pragma pack(push, 1)
@@ -246,6 +255,7 @@ sample_format(SampleType type)
         case SampleType_u12:
         case SampleType_u14:
         case SampleType_u16:
+        case SampleType_u32:
             return tag_t::as_u16(339, 1); // unsigned
         case SampleType_i8:
         case SampleType_i16:
@@ -393,9 +403,12 @@ Tiff::Tiff() noexcept
   }
   , pixel_scale_um_{.x=1.0,.y=1.0}
   , file_{}
+  , writes_{}
   , last_offset_(0)
   , last_ifd_next_offset_(0)
   , frame_count_(0)
+  , direct_io_(false)
+  , last_ifd_offset_(0)
 {
 }
 
@@ -449,6 +462,7 @@ Tiff::set(const struct StorageProperties* settings) noexcept
         }
     }
     pixel_scale_um_ = settings->pixel_scale_um;
+    direct_io_ = settings->direct_io;
     return 1;
 Error:
     return 0;
@@ -460,6 +474,7 @@ Tiff::get(struct StorageProperties* settings) const noexcept
     settings->uri.str = (char*)filename_.c_str();
     settings->uri.nbytes = filename_.size();
     settings->pixel_scale_um = pixel_scale_um_;
+    settings->direct_io = direct_io_;
 }
 
 void
@@ -467,6 +482,7 @@ Tiff::get_meta(struct StoragePropertyMetadata* meta) noexcept
 {
     CHECK(meta);
     *meta = { 0 };
+    meta->direct_io_is_supported = 1;
 Error:
     return;
 }
@@ -475,11 +491,21 @@ int
 Tiff::start() noexcept
 {
     frame_count_ = 0;
-    CHECK(file_create(&file_, filename_.c_str(), filename_.length()));
+    CHECK((direct_io_ ? file_create_direct : file_create)(
+      &file_, filename_.c_str(), filename_.length()));
     {
-        const auto hdr = header();
-        write_(0, (void*)&hdr, sizeof(hdr));
+        auto hdr = header();
+        // Direct writes put the first ifd on the next block boundary.
+        if (direct_io_)
+            hdr.first_ifd = FILE_DIRECT_ALIGNMENT_BYTES;
+        if (!write_queue_init(&writes_, &file_, direct_io_) ||
+            !write_(0, &hdr, sizeof(hdr))) {
+            write_queue_destroy(&writes_);
+            file_close(&file_);
+            goto Error;
+        }
         last_offset_ = sizeof(hdr);
+        last_ifd_next_offset_ = offsetof(header_t, first_ifd);
     }
     LOG("TIFF: Streaming to \"%s\"", filename_.c_str());
     return 1;
@@ -487,19 +513,37 @@ Error:
     return 0;
 }
 
-void
+int
 Tiff::terminate_ifd_list() noexcept
 {
-    // zero out the last next offset.
-    uint64_t data(0);
-    write_(last_ifd_next_offset_, &data, sizeof(data));
+    if (!direct_io_) {
+        // zero out the last next offset.
+        uint64_t data(0);
+        return write_(last_ifd_next_offset_, &data, sizeof(data));
+    }
+    // Direct writes start on a block boundary. The header and each ifd start
+    // a block, so the one holding the last next offset is written again.
+    if (!frame_count_) {
+        auto hdr = header();
+        hdr.first_ifd = 0;
+        return write_(0, &hdr, sizeof(hdr));
+    }
+    memset(last_ifd_.data() + (last_ifd_next_offset_ - last_ifd_offset_),
+           0,
+           sizeof(uint64_t));
+    return write_(last_ifd_offset_, last_ifd_.data(), last_ifd_.size());
 }
 
 int
 Tiff::stop() noexcept
 {
     if (state == DeviceState_Running) {
-        terminate_ifd_list();
+        // The last ifd may still be in flight. It has to land before its
+        // next offset is zeroed.
+        if (!(write_queue_flush(&writes_) && terminate_ifd_list() &&
+              write_queue_flush(&writes_)))
+            LOGE("Failed to write \"%s\"", filename_.c_str());
+        write_queue_destroy(&writes_);
         file_close(&file_);
         state = DeviceState_Armed;
         frame_count_ = 0;
@@ -514,6 +558,12 @@ align8(uint64_t v)
     return (v + 7) >> 3 << 3;
 }
 
+constexpr uint64_t
+align_up(uint64_t v, uint64_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
 int
 Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
 {
@@ -531,10 +581,14 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
         for (cur = frames; cur; cur = next()) {
             using ifdN_t = ifd_t<16>;
             const auto bytes_of_image = cur->bytes_of_frame - sizeof(*cur);
+            // Direct writes need each ifd and image to start a block.
+            const uint64_t alignment =
+              direct_io_ ? FILE_DIRECT_ALIGNMENT_BYTES : 8;
 
             // compute offsets
-            const auto section_ifd = align8(last_offset_);
-            const auto section_data = align8(section_ifd + sizeof(ifdN_t));
+            const auto section_ifd = align_up(last_offset_, alignment);
+            const auto section_data =
+              align_up(section_ifd + sizeof(ifdN_t), alignment);
             const auto section_strings = align8(section_data + bytes_of_image);
 
             // assemble ifd
@@ -582,19 +636,38 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
                                         cur->timestamps.acq_thread,
                                         cur->timestamps.hardware),
                 },
-                align8(ifd_strings_.offset)
+                align_up(ifd_strings_.offset, alignment)
             };
 
-            // write
-            write_(section_ifd, &ifd, sizeof(ifd));
-            write_(section_data, (void*)cur->data, bytes_of_image);
-            write_(section_strings, ifd_strings_.data, ifd_strings_.size);
+            // write the sections and the padding between them as one span
+            {
+                const auto o_data = section_data - section_ifd;
+                const auto o_strings = section_strings - section_ifd;
+                const auto o_end = o_strings + ifd_strings_.size;
+                uint8_t* dst = 0;
+                CHECK(dst = write_queue_reserve(
+                        &writes_, section_ifd, ifd.next - section_ifd));
+                memcpy(dst, &ifd, sizeof(ifd));
+                memset(dst + sizeof(ifd), 0, o_data - sizeof(ifd));
+                memcpy(dst + o_data, cur->data, bytes_of_image);
+                memset(dst + o_data + bytes_of_image,
+                       0,
+                       o_strings - o_data - bytes_of_image);
+                memcpy(dst + o_strings, ifd_strings_.data, ifd_strings_.size);
+                memset(dst + o_end, 0, ifd.next - section_ifd - o_end);
+            }
 
             // update markers
+            if (direct_io_) {
+                last_ifd_.assign((const uint8_t*)&ifd,
+                                 (const uint8_t*)&ifd + sizeof(ifd));
+                last_ifd_offset_ = section_ifd;
+            }
             last_ifd_next_offset_ = section_ifd + offsetof(ifdN_t, next);
             last_offset_ = ifd.next;
             ++frame_count_;
         }
+        CHECK(write_queue_submit(&writes_));
     } catch (const std::exception& e) {
         LOGE("Exception: %s", e.what());
         return 0;
@@ -603,15 +676,19 @@ Tiff::append(const struct VideoFrame* frames, size_t nbytes) noexcept
         return 0;
     }
     return 1;
+Error:
+    return 0;
 }
 
-void
-Tiff::write_(uint64_t offset, void* buf, size_t nbytes) noexcept
+int
+Tiff::write_(uint64_t offset, const void* buf, size_t nbytes) noexcept
 {
-    CHECK(file_write(&file_, offset, (uint8_t*)buf, (uint8_t*)buf + nbytes));
-    return;
+    uint8_t* dst = 0;
+    CHECK(dst = write_queue_reserve(&writes_, offset, nbytes));
+    memcpy(dst, buf, nbytes);
+    return 1;
 Error:
-    stop();
+    return 0;
 }
 
 enum DeviceState
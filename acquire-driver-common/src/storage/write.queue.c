@@ -0,0 +1,296 @@
+#include "write.queue.h"
+
+#include "device/kit/driver.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Reservations are added to the open buffer until it holds this many bytes.
+#define WRITE_QUEUE_TARGET_BYTES (8ULL << 20)
+
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+#define countof(e) (sizeof(e) / sizeof(*(e)))
+
+static uint64_t
+align_up(uint64_t v, uint64_t alignment)
+{
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+static size_t
+slot_nbytes(const struct write_queue_slot* slot)
+{
+    return slot->request.end - slot->request.beg;
+}
+
+/// Waits for the oldest write in flight and frees its slot.
+/// @returns 0 if no writes were in flight.
+static int
+write_queue_wait_one(struct write_queue* self)
+{
+    struct file_write_request* r = file_queue_wait(&self->queue);
+    if (!r)
+        return 0;
+    self->free[self->nfree++] = (uint32_t)(uintptr_t)r->user;
+    if (!r->ok) {
+        LOGE("Failed to write %llu bytes at offset %llu.",
+             (unsigned long long)(r->end - r->beg),
+             (unsigned long long)r->offset);
+        self->is_ok = 0;
+    }
+    return 1;
+}
+
+int
+write_queue_init(struct write_queue* self,
+                 const struct file* file,
+                 uint8_t is_direct)
+{
+    *self = (struct write_queue){
+        .file = file,
+        .open = -1,
+        .is_ok = 1,
+        .is_direct = is_direct,
+    };
+    CHECK(file_queue_init(&self->queue, WRITE_QUEUE_SLOTS));
+    for (uint32_t i = 0; i < countof(self->slots); ++i)
+        self->free[i] = WRITE_QUEUE_SLOTS - 1 - i;
+    self->nfree = WRITE_QUEUE_SLOTS;
+    return 1;
+Error:
+    return 0;
+}
+
+void
+write_queue_destroy(struct write_queue* self)
+{
+    file_queue_destroy(&self->queue);
+    for (uint32_t i = 0; i < countof(self->slots); ++i)
+        free(self->slots[i].allocation);
+    *self = (struct write_queue){ .open = -1 };
+}
+
+uint8_t*
+write_queue_reserve(struct write_queue* self, uint64_t offset, size_t nbytes)
+{
+    if (!self->is_ok)
+        return 0;
+    if (self->open >= 0) {
+        struct write_queue_slot* slot = self->slots + self->open;
+        const size_t n = slot_nbytes(slot);
+        if (slot->request.offset + n == offset &&
+            n + nbytes <= slot->capacity) {
+            slot->request.end += nbytes;
+            if (offset + nbytes > self->end_of_file)
+                self->end_of_file = offset + nbytes;
+            return slot->data + n;
+        }
+        CHECK(write_queue_submit(self));
+    }
+    EXPECT(!self->is_direct || offset % FILE_DIRECT_ALIGNMENT_BYTES == 0,
+           "Direct writes must start on a %d byte boundary. Got offset %llu.",
+           FILE_DIRECT_ALIGNMENT_BYTES,
+           (unsigned long long)offset);
+
+    while (!self->nfree)
+        CHECK(write_queue_wait_one(self) && self->is_ok);
+    const uint32_t i = self->free[--self->nfree];
+    struct write_queue_slot* slot = self->slots + i;
+    if (slot->capacity < nbytes) {
+        // A multiple of the alignment, so there's room to pad the tail.
+        const size_t capacity = align_up(
+          nbytes > WRITE_QUEUE_TARGET_BYTES ? nbytes : WRITE_QUEUE_TARGET_BYTES,
+          FILE_DIRECT_ALIGNMENT_BYTES);
+        free(slot->allocation);
+        slot->data = 0;
+        slot->capacity = 0;
+        if (!(slot->allocation =
+                malloc(capacity + FILE_DIRECT_ALIGNMENT_BYTES - 1))) {
+            self->free[self->nfree++] = i;
+            EXPECT(0,
+                   "Failed to allocate %llu bytes.",
+                   (unsigned long long)capacity);
+        }
+        slot->data = (uint8_t*)align_up((uintptr_t)slot->allocation,
+                                        FILE_DIRECT_ALIGNMENT_BYTES);
+        slot->capacity = capacity;
+    }
+    slot->request = (struct file_write_request){
+        .file = self->file,
+        .offset = offset,
+        .beg = slot->data,
+        .end = slot->data + nbytes,
+        .user = (void*)(uintptr_t)i,
+    };
+    self->open = (int)i;
+    if (offset + nbytes > self->end_of_file)
+        self->end_of_file = offset + nbytes;
+    return slot->data;
+Error:
+    self->is_ok = 0;
+    return 0;
+}
+
+int
+write_queue_submit(struct write_queue* self)
+{
+    if (!self->is_ok)
+        return 0;
+    if (self->open >= 0) {
+        const uint32_t i = (uint32_t)self->open;
+        struct file_write_request* r = &self->slots[i].request;
+        self->open = -1;
+        if (self->is_direct) {
+            const size_t n = r->end - r->beg;
+            const size_t padded = align_up(n, FILE_DIRECT_ALIGNMENT_BYTES);
+            memset(self->slots[i].data + n, 0, padded - n); // NOLINT
+            r->end = r->beg + padded;
+        }
+        if (!file_queue_submit(&self->queue, r)) {
+            self->free[self->nfree++] = i;
+            goto Error;
+        }
+    }
+    return 1;
+Error:
+    self->is_ok = 0;
+    return 0;
+}
+
+int
+write_queue_flush(struct write_queue* self)
+{
+    write_queue_submit(self);
+    // Wait for every write, even after one fails, so none outlive the call.
+    while (write_queue_wait_one(self)) {
+    }
+    if (self->is_ok && self->is_direct &&
+        !file_truncate(self->file, self->end_of_file)) {
+        LOGE("Failed to cut the file to %llu bytes.",
+             (unsigned long long)self->end_of_file);
+        self->is_ok = 0;
+    }
+    return self->is_ok;
+}
+
+#ifndef NO_UNIT_TESTS
+acquire_export int
+unit_test_write_queue_coalesces_contiguous_writes()
+{
+    const char filename[] = "unit-test-write-queue.bin";
+    struct file file = { 0 };
+    struct write_queue queue = { 0 };
+    struct file_mapping mapping = { 0 };
+    int is_open = 0, is_ok = 0;
+    uint8_t* p = 0;
+
+    remove(filename);
+    CHECK(is_open = file_create(&file, filename, sizeof(filename)));
+    CHECK(write_queue_init(&queue, &file, 0));
+
+    // Three contiguous reservations share one buffer.
+    for (int i = 0; i < 3; ++i) {
+        CHECK(p = write_queue_reserve(&queue, 100 * i, 100));
+        memset(p, 'a' + i, 100); // NOLINT
+    }
+    CHECK(queue.open >= 0);
+    CHECK(slot_nbytes(queue.slots + queue.open) == 300);
+    const int first = queue.open;
+
+    // A gap starts another, and an earlier offset one more.
+    CHECK(p = write_queue_reserve(&queue, 400, 100));
+    memset(p, 'e', 100); // NOLINT
+    CHECK(queue.open != first);
+    CHECK(p = write_queue_reserve(&queue, 300, 100));
+    memset(p, 'd', 100); // NOLINT
+    CHECK(write_queue_flush(&queue));
+    CHECK(queue.nfree == WRITE_QUEUE_SLOTS);
+    write_queue_destroy(&queue);
+    file_close(&file);
+    is_open = 0;
+
+    CHECK(file_map_read(&mapping, filename, sizeof(filename)));
+    CHECK(mapping.nbytes == 500);
+    for (size_t i = 0; i < mapping.nbytes; ++i)
+        EXPECT(mapping.data[i] == 'a' + i / 100,
+               "Byte %d is '%c'.",
+               (int)i,
+               mapping.data[i]);
+    is_ok = 1;
+Error:
+    file_unmap(&mapping);
+    write_queue_destroy(&queue);
+    if (is_open)
+        file_close(&file);
+    remove(filename);
+    return is_ok;
+}
+
+acquire_export int
+unit_test_write_queue_pads_direct_writes()
+{
+    const char filename[] = "unit-test-write-queue-direct.bin";
+    const size_t block = FILE_DIRECT_ALIGNMENT_BYTES;
+    struct file file = { 0 };
+    struct write_queue queue = { 0 };
+    struct file_mapping mapping = { 0 };
+    int is_open = 0, is_ok = 0;
+    uint8_t* p = 0;
+
+    remove(filename);
+    CHECK(is_open = file_create_direct(&file, filename, sizeof(filename)));
+    CHECK(write_queue_init(&queue, &file, 1));
+
+    // The first buffer ends mid-block and is padded. The next starts on the
+    // following boundary and ends the file mid-block.
+    CHECK(p = write_queue_reserve(&queue, 0, 100));
+    memset(p, 'a', 100); // NOLINT
+    CHECK(p = write_queue_reserve(&queue, 100, block + 900));
+    memset(p, 'b', block + 900); // NOLINT
+    CHECK(write_queue_submit(&queue));
+    CHECK(p = write_queue_reserve(&queue, 2 * block, 10));
+    memset(p, 'c', 10); // NOLINT
+    CHECK(write_queue_flush(&queue));
+    CHECK(queue.end_of_file == 2 * block + 10);
+
+    CHECK(file_map_read(&mapping, filename, sizeof(filename)));
+    CHECK(mapping.nbytes == 2 * block + 10);
+    for (size_t i = 0; i < mapping.nbytes; ++i) {
+        uint8_t expected = 'c';
+        if (i < 100)
+            expected = 'a';
+        else if (i < block + 1000)
+            expected = 'b';
+        else if (i < 2 * block)
+            expected = 0;
+        EXPECT(mapping.data[i] == expected,
+               "Byte %d is %d. Expected %d.",
+               (int)i,
+               mapping.data[i],
+               expected);
+    }
+    file_unmap(&mapping);
+
+    // Unaligned buffers can't be written directly.
+    CHECK(!write_queue_reserve(&queue, 3 * block + 8, 10));
+    is_ok = 1;
+Error:
+    file_unmap(&mapping);
+    write_queue_destroy(&queue);
+    if (is_open)
+        file_close(&file);
+    remove(filename);
+    return is_ok;
+}
+#endif
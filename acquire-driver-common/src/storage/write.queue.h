@@ -0,0 +1,102 @@
+//!
+//! # Write queue
+//!
+//! Lets the file storage devices return from `append()` while their writes
+//! are still going to disk. Storage can't hold on to the frames it's given,
+//! so bytes are copied into one of a few staging buffers, and full buffers
+//! are written on a `file_queue` while the next ones fill.
+//!
+//! A reservation that starts where the open buffer ends is added to that
+//! buffer, so frames and their headers reach the file in large writes.
+//! `write_queue_submit()` sends the open buffer off without waiting for it to
+//! fill. Call it at the end of each `append()` so nothing is held back for
+//! long.
+//!
+//! Failed writes are reported by the next call that reserves, submits or
+//! flushes.
+//!
+//! ## Direct I/O
+//!
+//! Files made with `file_create_direct()` only take writes that start and end
+//! on `FILE_DIRECT_ALIGNMENT_BYTES` boundaries. Staging buffers are always
+//! aligned. For a direct queue, each buffer must start on a boundary, so a
+//! reservation that doesn't continue the open buffer must start on one too.
+//! A buffer that ends between boundaries is padded with zeros when it's
+//! submitted, and `write_queue_flush()` cuts the file back to the end of the
+//! last reservation. Later reservations shouldn't continue a padded buffer.
+//!
+
+#ifndef H_ACQUIRE_DRIVER_BASICS_WRITE_QUEUE_V0
+#define H_ACQUIRE_DRIVER_BASICS_WRITE_QUEUE_V0
+
+#include "platform.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// The number of staging buffers, and so the most writes kept in flight.
+#define WRITE_QUEUE_SLOTS (4)
+
+    struct write_queue
+    {
+        const struct file* file;
+        struct file_queue queue;
+        struct write_queue_slot
+        {
+            struct file_write_request request;
+            /// `data`, aligned to FILE_DIRECT_ALIGNMENT_BYTES, is inside
+            /// this allocation.
+            uint8_t* allocation;
+            uint8_t* data;
+            size_t capacity;
+        } slots[WRITE_QUEUE_SLOTS];
+
+        /// Indices of the slots that are neither open nor in flight.
+        uint32_t free[WRITE_QUEUE_SLOTS];
+        uint32_t nfree;
+        /// The slot taking reservations, or -1.
+        int open;
+        int is_ok;
+        uint8_t is_direct;
+        /// The end of the furthest reservation.
+        uint64_t end_of_file;
+    };
+
+    /// Starts a queue of writes to `file`. `file` must stay open until the
+    /// queue is destroyed. Set `is_direct` if `file` was made with
+    /// file_create_direct().
+    int write_queue_init(struct write_queue* self,
+                         const struct file* file,
+                         uint8_t is_direct);
+
+    /// Waits for writes in flight, then frees the staging buffers. Bytes not
+    /// yet submitted are dropped. Use write_queue_flush() first to keep them.
+    void write_queue_destroy(struct write_queue* self);
+
+    /// @brief Reserves `nbytes` to be written at `offset`.
+    /// The caller fills the returned bytes before the next call on the queue.
+    /// May wait for a write in flight to finish.
+    /// @return a pointer to the reserved bytes, or NULL if a write failed.
+    uint8_t* write_queue_reserve(struct write_queue* self,
+                                 uint64_t offset,
+                                 size_t nbytes);
+
+    /// Starts writing the reserved bytes without waiting for them to finish.
+    /// @return 0 if a write failed.
+    int write_queue_submit(struct write_queue* self);
+
+    /// Writes the reserved bytes and waits for every write to finish. Direct
+    /// queues then cut any padding off the end of the file.
+    /// @return 0 if a write failed.
+    int write_queue_flush(struct write_queue* self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // H_ACQUIRE_DRIVER_BASICS_WRITE_QUEUE_V0
@@ -0,0 +1,156 @@
+/// @file file-write.c
+/// Measures how fast a file is written with `file_write()`, one chunk after
+/// another, and with a `file_queue` keeping several chunks in flight.
+///
+/// Each run writes `megabytes` to a fresh file in `chunk_kb` chunks. Small
+/// default workloads mostly land in the page cache. To see the disk, write
+/// more than the machine's memory to a file on the disk.
+///
+/// Usage: file-write [filename] [megabytes] [chunk_kb] [max_depth]
+
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Writes `nchunks` copies of `chunk` to `filename`. A `depth` of 0 writes
+/// with file_write(). Otherwise, up to `depth` chunks are in flight at once.
+/// @returns elapsed milliseconds, or a negative number on error.
+static double
+run(const char* filename,
+    const uint8_t* chunk,
+    size_t chunk_bytes,
+    size_t nchunks,
+    uint32_t depth)
+{
+    double elapsed_ms = -1.0;
+    struct file file = { 0 };
+    struct file_queue queue = { 0 };
+    struct file_write_request* requests = 0;
+    int is_open = 0, is_ok = 1;
+
+    remove(filename);
+    if (!(is_open = file_create(&file, filename, strlen(filename) + 1))) {
+        ERR("Failed to create \"%s\"", filename);
+        goto Finalize;
+    }
+    if (depth && (!(requests = calloc(depth, sizeof(*requests))) ||
+                  !file_queue_init(&queue, depth))) {
+        ERR("Failed to start a queue %u writes deep", depth);
+        goto Finalize;
+    }
+
+    struct clock clk = { 0 };
+    clock_init(&clk);
+    if (!depth) {
+        for (size_t i = 0; i < nchunks && is_ok; ++i)
+            is_ok = file_write(
+              &file, i * chunk_bytes, chunk, chunk + chunk_bytes);
+    } else {
+        for (size_t i = 0; i < nchunks && is_ok; ++i) {
+            struct file_write_request* r = requests + i % depth;
+            if (i >= depth) {
+                // Reuse the request of a completed write.
+                r = file_queue_wait(&queue);
+                if (!(is_ok = r && r->ok))
+                    break;
+            }
+            *r = (struct file_write_request){
+                .file = &file,
+                .offset = i * chunk_bytes,
+                .beg = chunk,
+                .end = chunk + chunk_bytes,
+            };
+            is_ok = file_queue_submit(&queue, r);
+        }
+        struct file_write_request* r = 0;
+        while ((r = file_queue_wait(&queue)))
+            is_ok = is_ok && r->ok;
+    }
+    if (is_ok)
+        elapsed_ms = clock_toc_ms(&clk);
+    else
+        ERR("Failed to write \"%s\"", filename);
+
+Finalize:
+    file_queue_destroy(&queue);
+    free(requests);
+    if (is_open)
+        file_close(&file);
+    remove(filename);
+    return elapsed_ms;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const char* filename = (argc > 1) ? argv[1] : TEST ".bin";
+    const size_t megabytes = (argc > 2) ? strtoul(argv[2], 0, 10) : 64;
+    const size_t chunk_kb = (argc > 3) ? strtoul(argv[3], 0, 10) : 1024;
+    const uint32_t max_depth = (argc > 4) ? strtoul(argv[4], 0, 10) : 8;
+    if (!megabytes || !chunk_kb || chunk_kb > (megabytes << 10)) {
+        ERR("Expected at least one chunk to write.");
+        return 1;
+    }
+
+    const size_t chunk_bytes = chunk_kb << 10;
+    const size_t nchunks = (megabytes << 20) / chunk_bytes;
+    uint8_t* chunk = malloc(chunk_bytes);
+    if (!chunk) {
+        ERR("Failed to allocate a %llu byte chunk",
+            (unsigned long long)chunk_bytes);
+        return 1;
+    }
+    for (size_t i = 0; i < chunk_bytes; ++i)
+        chunk[i] = (uint8_t)(i * 31);
+
+    // The first run in a process is slow while the file system warms up.
+    if (run(filename, chunk, chunk_bytes, nchunks, 0) < 0) {
+        free(chunk);
+        return 1;
+    }
+
+    const double bytes = (double)chunk_bytes * nchunks;
+    double serial_ms = 0;
+    for (uint32_t depth = 0; depth <= max_depth;
+         depth = depth ? 2 * depth : 1) {
+        const double ms = run(filename, chunk, chunk_bytes, nchunks, depth);
+        if (ms < 0) {
+            free(chunk);
+            return 1;
+        }
+        if (!depth) {
+            serial_ms = ms;
+            printf("file_write     : %.2f GB/s\n", 1e-6 * bytes / ms);
+        } else {
+            printf("queue depth %3u: %.2f GB/s, %.2fx\n",
+                   depth,
+                   1e-6 * bytes / ms,
+                   serial_ms / ms);
+        }
+    }
+    free(chunk);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/// @file simcam-bin2.c
+/// Measures the simulated camera's 2x2 binning kernels (see bin2.h) for each
+/// sample type the camera produces and each instruction set this CPU
+/// supports, at each binning factor the camera offers.
+///
+/// Binning by `b` applies the 2x2 kernel log2(b) times, halving the image
+/// each time, the way the camera does. Reported bandwidth counts the bytes of
+/// the full-resolution frame. Every result is checked against the scalar
+/// kernels.
+///
+/// Usage: simcam-bin2 [width] [height] [frames]
+
+#include "bin2.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+static const char*
+sample_type_name(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+            return "u8";
+        case SampleType_u16:
+            return "u16";
+        case SampleType_i8:
+            return "i8";
+        case SampleType_i16:
+            return "i16";
+        case SampleType_f32:
+            return "f32";
+        default:
+            return "unknown";
+    }
+}
+
+static size_t
+bytes_per_sample(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+        case SampleType_i8:
+            return 1;
+        case SampleType_f32:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+static void
+bin(bin2_fn bin2, uint8_t* im, int w, int h, int binning)
+{
+    for (int b = binning >> 1; b; b >>= 1) {
+        bin2(im, w, h);
+        w >>= 1;
+        h >>= 1;
+    }
+}
+
+/// Bins a fresh copy of `src` `nframes` times.
+/// @returns the elapsed time in milliseconds, not counting the copies.
+static double
+run(bin2_fn bin2,
+    const uint8_t* src,
+    uint8_t* im,
+    size_t nbytes,
+    int w,
+    int h,
+    int binning,
+    uint32_t nframes)
+{
+    double ms = 0;
+    for (uint32_t i = 0; i < nframes; ++i) {
+        memcpy(im, src, nbytes); // NOLINT
+        struct clock clk;
+        clock_init(&clk);
+        bin(bin2, im, w, h, binning);
+        ms += clock_toc_ms(&clk);
+    }
+    return ms;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const int w = (argc > 1) ? (int)strtol(argv[1], 0, 10) : 2048;
+    const int h = (argc > 2) ? (int)strtol(argv[2], 0, 10) : 2048;
+    const uint32_t nframes = (argc > 3) ? strtoul(argv[3], 0, 10) : 8;
+    if (w < 8 || h < 8 || !nframes) {
+        ERR("Expected at least an 8x8 frame and one frame.");
+        return 1;
+    }
+
+    const size_t capacity = (size_t)w * h * sizeof(float);
+    uint8_t* src = malloc(capacity);
+    uint8_t* expected = malloc(capacity);
+    uint8_t* im = malloc(capacity);
+    int ok = src && expected && im;
+    if (!ok) {
+        ERR("Failed to allocate buffers for a %dx%d frame", w, h);
+        goto Finalize;
+    }
+
+    const enum SampleType types[] = { SampleType_u8,
+                                      SampleType_i8,
+                                      SampleType_u16,
+                                      SampleType_i16,
+                                      SampleType_f32 };
+    const struct bin2_kernels* scalar = bin2_kernels_get(Bin2Isa_Scalar);
+    for (size_t itype = 0; itype < sizeof(types) / sizeof(*types); ++itype) {
+        const enum SampleType type = types[itype];
+        const size_t bps = bytes_per_sample(type);
+        const size_t nbytes = (size_t)w * h * bps;
+        if (type == SampleType_f32) {
+            float* px = (float*)src;
+            for (size_t i = 0; i < (size_t)w * h; ++i)
+                px[i] = (float)((i * 2654435761u) >> 20) * 0.125f;
+        } else {
+            for (size_t i = 0; i < nbytes; ++i)
+                src[i] = (uint8_t)((i * 2654435761u) >> 24);
+        }
+
+        for (int binning = 2; binning <= 8; binning *= 2) {
+            memcpy(expected, src, nbytes); // NOLINT
+            bin(scalar->bin2[type], expected, w, h, binning);
+            const size_t nout = (size_t)(w / binning) * (h / binning) * bps;
+
+            for (int isa = 0; isa < Bin2IsaCount; ++isa) {
+                const struct bin2_kernels* k =
+                  bin2_kernels_get((enum Bin2Isa)isa);
+                if (!k)
+                    continue;
+                // Warm up, so page faults aren't part of the measurement.
+                run(k->bin2[type], src, im, nbytes, w, h, binning, 1);
+                const double ms =
+                  run(k->bin2[type], src, im, nbytes, w, h, binning, nframes);
+                const double bytes = (double)nbytes * nframes;
+                LOG("%-7s %-3s bin %d: %.1f MB in %.2f ms: %.2f GB/s",
+                    k->name,
+                    sample_type_name(type),
+                    binning,
+                    1e-6 * bytes,
+                    ms,
+                    1e-6 * bytes / ms);
+                if (memcmp(im, expected, nout)) {
+                    ERR("%s binning of %s by %d disagrees with scalar",
+                        k->name,
+                        sample_type_name(type),
+                        binning);
+                    ok = 0;
+                }
+            }
+        }
+    }
+
+Finalize:
+    free(src);
+    free(expected);
+    free(im);
+    return !ok;
+}
@@ -0,0 +1,153 @@
+/// @file simcam-pattern.c
+/// Measures how fast the "simulated: radial sin" camera renders its pattern
+/// (see imfill.pattern.h) for each sample type the camera produces.
+///
+/// For comparison, the u8 pattern is also rendered the direct way, calling
+/// `sinf()` for every pixel. Reported bandwidth counts output bytes.
+///
+/// Usage: simcam-pattern [width] [height] [frames]
+
+#include "imfill.pattern.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+static size_t
+bytes_per_sample(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+        case SampleType_i8:
+            return 1;
+        case SampleType_f32:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+/// The pattern evaluated with a `sinf()` per pixel.
+static void
+fill_direct_u8(const struct ImageShape* shape, float t, uint8_t* buf)
+{
+    const float cx = 0.5f * (float)shape->dims.width;
+    const float cy = 0.5f * (float)shape->dims.height;
+    for (uint32_t y = 0; y < shape->dims.height; ++y) {
+        const float dy = y - cy;
+        for (uint32_t x = 0; x < shape->dims.width; ++x) {
+            const float dx = x - cx;
+            buf[(size_t)shape->strides.height * y + x] =
+              (uint8_t)(127.0f * (sinf(6.28f * (t * 10.0f +
+                                                (dx * dx + dy * dy) * 1e-2f)) +
+                                  1.0f));
+        }
+    }
+}
+
+/// @returns the elapsed time in milliseconds.
+static double
+run(struct ImageShape* shape, void* buf, uint32_t nframes, int direct)
+{
+    struct clock clk;
+    clock_init(&clk);
+    for (uint32_t i = 0; i < nframes; ++i) {
+        if (direct) {
+            fill_direct_u8(shape, (float)i, buf);
+            continue;
+        }
+        switch (shape->type) {
+            case SampleType_u8:
+                im_fill_pattern_u8(shape, 0, 0, (float)i, buf);
+                break;
+            case SampleType_i8:
+                im_fill_pattern_i8(shape, 0, 0, (float)i, buf);
+                break;
+            case SampleType_u16:
+                im_fill_pattern_u16(shape, 0, 0, (float)i, buf);
+                break;
+            case SampleType_i16:
+                im_fill_pattern_i16(shape, 0, 0, (float)i, buf);
+                break;
+            default:
+                im_fill_pattern_f32(shape, 0, 0, (float)i, buf);
+                break;
+        }
+    }
+    return clock_toc_ms(&clk);
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const uint32_t w = (argc > 1) ? strtoul(argv[1], 0, 10) : 2048;
+    const uint32_t h = (argc > 2) ? strtoul(argv[2], 0, 10) : 2048;
+    const uint32_t nframes = (argc > 3) ? strtoul(argv[3], 0, 10) : 8;
+    if (!w || !h || !nframes) {
+        ERR("Expected a non-empty frame and at least one frame.");
+        return 1;
+    }
+
+    void* buf = malloc((size_t)w * h * sizeof(float));
+    if (!buf) {
+        ERR("Failed to allocate a %ux%u frame", w, h);
+        return 1;
+    }
+
+    const struct
+    {
+        const char* name;
+        enum SampleType type;
+        int direct;
+    } cases[] = {
+        { "sinf u8", SampleType_u8, 1 },   { "u8", SampleType_u8, 0 },
+        { "i8", SampleType_i8, 0 },        { "u16", SampleType_u16, 0 },
+        { "i16", SampleType_i16, 0 },      { "f32", SampleType_f32, 0 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+        struct ImageShape shape = {
+            .dims = { .channels = 1, .width = w, .height = h, .planes = 1 },
+            .strides = { .channels = 1,
+                         .width = 1,
+                         .height = w,
+                         .planes = (int64_t)w * h },
+            .type = cases[i].type,
+        };
+        // Warm up, so page faults aren't part of the measurement.
+        run(&shape, buf, 1, cases[i].direct);
+        const double ms = run(&shape, buf, nframes, cases[i].direct);
+        const double bytes =
+          (double)w * h * bytes_per_sample(cases[i].type) * nframes;
+        LOG("%-7s: %.1f MB in %.2f ms: %.2f GB/s, %.0f frames/s",
+            cases[i].name,
+            1e-6 * bytes,
+            ms,
+            1e-6 * bytes / ms,
+            1e3 * nframes / ms);
+    }
+    free(buf);
+    return 0;
+}
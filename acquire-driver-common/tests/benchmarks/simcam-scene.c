@@ -0,0 +1,112 @@
+/// @file simcam-scene.c
+/// Measures how fast the "simulated: beads" camera renders its scene (see
+/// imfill.scene.h) for each sample type the camera produces, on one thread.
+/// Reported bandwidth counts output bytes.
+///
+/// Each frame is a new frame of the scene, so the beads move and the noise
+/// is drawn afresh.
+///
+/// Usage: simcam-scene [width] [height] [frames]
+
+#include "imfill.scene.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// @returns the elapsed time in milliseconds.
+static double
+run(struct ImageShape* shape, void* buf, uint64_t first, uint32_t nframes)
+{
+    struct clock clk;
+    clock_init(&clk);
+    for (uint64_t i = first; i < first + nframes; ++i) {
+        switch (shape->type) {
+            case SampleType_u8:
+                im_fill_scene_u8(shape, 0, 0, i, buf);
+                break;
+            case SampleType_u12:
+                im_fill_scene_u12(shape, 0, 0, i, buf);
+                break;
+            default:
+                im_fill_scene_u16(shape, 0, 0, i, buf);
+                break;
+        }
+    }
+    return clock_toc_ms(&clk);
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const uint32_t w = (argc > 1) ? strtoul(argv[1], 0, 10) : 2048;
+    const uint32_t h = (argc > 2) ? strtoul(argv[2], 0, 10) : 2048;
+    const uint32_t nframes = (argc > 3) ? strtoul(argv[3], 0, 10) : 8;
+    if (!w || !h || !nframes || w > (1 << 13)) {
+        ERR("Expected a non-empty frame at most 8192 pixels wide and at "
+            "least one frame.");
+        return 1;
+    }
+
+    void* buf = malloc((size_t)w * h * sizeof(uint16_t));
+    if (!buf) {
+        ERR("Failed to allocate a %ux%u frame", w, h);
+        return 1;
+    }
+
+    const struct
+    {
+        const char* name;
+        enum SampleType type;
+        size_t bytes_per_sample;
+    } cases[] = {
+        { "u8", SampleType_u8, 1 },
+        { "u12", SampleType_u12, 2 },
+        { "u16", SampleType_u16, 2 },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+        struct ImageShape shape = {
+            .dims = { .channels = 1, .width = w, .height = h, .planes = 1 },
+            .strides = { .channels = 1,
+                         .width = 1,
+                         .height = w,
+                         .planes = (int64_t)w * h },
+            .type = cases[i].type,
+        };
+        // Warm up, so page faults aren't part of the measurement.
+        run(&shape, buf, 0, 1);
+        const double ms = run(&shape, buf, 1, nframes);
+        const double bytes =
+          (double)w * h * cases[i].bytes_per_sample * nframes;
+        LOG("%-3s: %.1f MB in %.2f ms: %.2f GB/s, %.0f frames/s",
+            cases[i].name,
+            1e-6 * bytes,
+            ms,
+            1e-6 * bytes / ms,
+            1e3 * nframes / ms);
+    }
+    free(buf);
+    return 0;
+}
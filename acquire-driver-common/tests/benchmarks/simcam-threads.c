@@ -0,0 +1,131 @@
+/// @file simcam-threads.c
+/// Measures how the simulated cameras' frame rate scales with the number of
+/// threads that render each frame (see
+/// `CameraProperties::render_thread_count`).
+///
+/// For each camera that renders and each thread count, the camera runs with
+/// no exposure time and frames are read as fast as it produces them.
+/// Reported bandwidth counts the bytes of the frames read.
+///
+/// Usage: simcam-threads [width] [height] [frames] [max_threads]
+
+#include "simulated.camera.h"
+#include "device/kit/camera.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define L (aq_logger)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    if (!is_error)
+        return; // The camera logs its kernels. Keep the output short.
+    fprintf(stderr, "ERROR %s(%d) - %s: %s\n", file, line, function, msg);
+}
+
+/// Reads `nframes` u16 frames from a camera of `kind` rendering with
+/// `thread_count` threads.
+/// @returns elapsed milliseconds, or a negative number on error.
+static double
+run(enum BasicDeviceKind kind,
+    uint32_t width,
+    uint32_t height,
+    uint32_t nframes,
+    uint32_t thread_count)
+{
+    double elapsed_ms = -1.0;
+    const size_t nbytes = (size_t)width * height * sizeof(uint16_t);
+    uint8_t* buf = malloc(nbytes);
+    struct Camera* camera = simcam_make_camera(kind);
+    if (!buf || !camera) {
+        ERR("Failed to make the camera");
+        goto Finalize;
+    }
+
+    struct CameraProperties props = { 0 };
+    camera->get(camera, &props);
+    props.exposure_time_us = 0;
+    props.pixel_type = SampleType_u16;
+    props.shape = (struct camera_properties_shape_s){ .x = width,
+                                                      .y = height };
+    props.render_thread_count = thread_count;
+    if (camera->set(camera, &props) != Device_Ok ||
+        camera->start(camera) != Device_Ok) {
+        ERR("Failed to start the camera");
+        goto Finalize;
+    }
+
+    struct clock clk = { 0 };
+    for (uint32_t i = 0; i <= nframes; ++i) {
+        // The first frame warms up, so start timing after it.
+        if (i == 1)
+            clock_init(&clk);
+        struct ImageInfo info = { 0 };
+        size_t sz = nbytes;
+        if (camera->get_frame(camera, buf, &sz, &info) != Device_Ok) {
+            ERR("Failed to get frame %u", i);
+            goto Finalize;
+        }
+    }
+    elapsed_ms = clock_toc_ms(&clk);
+
+Finalize:
+    if (camera)
+        simcam_close_camera(camera);
+    free(buf);
+    return elapsed_ms;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const uint32_t width = (argc > 1) ? strtoul(argv[1], 0, 10) : 2048;
+    const uint32_t height = (argc > 2) ? strtoul(argv[2], 0, 10) : 2048;
+    const uint32_t nframes = (argc > 3) ? strtoul(argv[3], 0, 10) : 16;
+    const uint32_t max_threads = (argc > 4) ? strtoul(argv[4], 0, 10) : 8;
+    if (!width || !height || !nframes || !max_threads) {
+        ERR("Expected a non-empty frame, at least one frame and at least one "
+            "thread.");
+        return 1;
+    }
+
+    const struct
+    {
+        const char* name;
+        enum BasicDeviceKind kind;
+    } cameras[] = {
+        { "random", BasicDevice_Camera_Random },
+        { "sin", BasicDevice_Camera_Sin },
+        { "beads", BasicDevice_Camera_Beads },
+    };
+    for (size_t i = 0; i < sizeof(cameras) / sizeof(*cameras); ++i) {
+        double serial_ms = 0;
+        for (uint32_t n = 1; n <= max_threads; n *= 2) {
+            const double ms =
+              run(cameras[i].kind, width, height, nframes, n);
+            if (ms < 0)
+                return 1;
+            if (n == 1)
+                serial_ms = ms;
+            const double bytes =
+              (double)width * height * sizeof(uint16_t) * nframes;
+            printf("%-6s %2u threads: %.1f frames/s, %.2f GB/s, %.2fx\n",
+                   cameras[i].name,
+                   n,
+                   1e3 * nframes / ms,
+                   1e-6 * bytes / ms,
+                   serial_ms / ms);
+        }
+    }
+    return 0;
+}
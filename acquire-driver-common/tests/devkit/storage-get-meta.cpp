@@ -1,7 +1,8 @@
 /// @file storage-get-meta.cpp
 /// @brief Check that all storage devices implement the get_meta function.
 /// Also, since none of the basic storage devices support chunking or
-/// multiscale, check that this is reflected in the metadata.
+/// multiscale, check that this is reflected in the metadata. The file
+/// writers support direct I/O.
 
 #include "platform.h"
 #include "logger.h"
@@ -11,6 +12,7 @@
 #include "device/props/storage.h"
 
 #include <cstdio>
+#include <cstring>
 
 #define containerof(P, T, F) ((T*)(((char*)(P)) - offsetof(T, F)))
 
@@ -77,6 +79,14 @@ main()
                 CHECK(0 == metadata.multiscale_is_supported);
                 CHECK(0 == metadata.s3_is_supported);
 
+                const bool writes_files = strcmp(id.name, "raw") == 0 ||
+                                          strcmp(id.name, "tiff") == 0 ||
+                                          strcmp(id.name, "tiff-json") == 0;
+                EXPECT(writes_files == (bool)metadata.direct_io_is_supported,
+                       "%s: Expected direct_io_is_supported to be %d.",
+                       id.name,
+                       (int)writes_files);
+
                 CHECK(Device_Ok == driver_close_device(device));
             }
         }
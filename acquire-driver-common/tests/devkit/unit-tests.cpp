@@ -55,6 +55,14 @@ main()
     const std::vector<testcase> tests{
 #define CASE(e) { .name = #e, .test = (int (*)())lib_load(&lib, #e) }
         CASE(unit_test_basic_device_kind_to_string_is_complete),
+        CASE(unit_test_simcam_renders_into_caller_buffer),
+        CASE(unit_test_simcam_render_threads_match_one_thread),
+        CASE(unit_test_simcam_frame_queue_reports_overflow),
+        CASE(unit_test_bin2_kernels_match_scalar),
+        CASE(unit_test_im_fill_pattern_matches_sine),
+        CASE(unit_test_im_fill_scene_is_seeded_and_splits),
+        CASE(unit_test_write_queue_coalesces_contiguous_writes),
+        CASE(unit_test_write_queue_pads_direct_writes),
 #undef CASE
     };
 
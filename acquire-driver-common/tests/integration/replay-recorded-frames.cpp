@@ -0,0 +1,238 @@
+/// @file replay-recorded-frames.cpp
+/// Records frames from a simulated camera with the raw storage, then replays
+/// them. The replay is recorded again with the tiff storage, and that file is
+/// replayed too. Both replays must return the frames in the raw file.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str) - 1
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+const static uint32_t nframes = 16;
+
+using Frames = std::vector<std::vector<uint8_t>>;
+
+/// Selects a camera and a storage device for stream 0. An empty `replay`
+/// configures the camera as a simulated camera would be.
+void
+configure(AcquireRuntime* runtime,
+          const char* camera,
+          const char* storage,
+          const std::string& filename,
+          const std::string& replay,
+          enum ReplayTiming timing,
+          uint64_t max_frame_count)
+{
+    auto* dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+    props.video[0].storage = { 0 };
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                camera,
+                                strlen(camera),
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                storage,
+                                strlen(storage),
+                                &props.video[0].storage.identifier));
+    storage_properties_set_uri(&props.video[0].storage.settings,
+                               filename.c_str(),
+                               filename.size() + 1);
+
+    auto& settings = props.video[0].camera.settings;
+    settings.binning = 1;
+    settings.pixel_type = SampleType_u16;
+    settings.shape = { .x = 64, .y = 48 };
+    settings.exposure_time_us = 2000;
+    settings.replay.uri = { .str = (char*)replay.c_str(),
+                            .nbytes = replay.size() + 1,
+                            .is_ref = 1 };
+    settings.replay.timing = timing;
+    settings.replay.loop = max_frame_count > nframes;
+    props.video[0].max_frame_count = max_frame_count;
+
+    OK(acquire_configure(runtime, &props));
+}
+
+/// Runs the configured stream and returns a copy of each frame it acquires.
+Frames
+acquire(AcquireRuntime* runtime)
+{
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    struct clock clock;
+    const double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    Frames frames;
+    OK(acquire_start(runtime));
+    while (frames.size() < props.video[0].max_frame_count) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timeout at %f ms",
+               clock_toc_ms(&clock) + time_limit_ms);
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read_wait(runtime, 0, 100.0f, &beg, &end));
+        for (cur = beg; cur < end;
+             cur = (VideoFrame*)((uint8_t*)cur + cur->bytes_of_frame)) {
+            frames.emplace_back(cur->data,
+                                cur->data + bytes_of_image(&cur->shape));
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+    }
+    OK(acquire_stop(runtime));
+    return frames;
+}
+
+/// Reads the frames in a file written by the raw storage.
+Frames
+read_raw(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)),
+                                     std::istreambuf_iterator<char>());
+    Frames frames;
+    for (size_t offset = 0; offset + sizeof(VideoFrame) <= bytes.size();) {
+        VideoFrame frame = {};
+        memcpy(&frame, bytes.data() + offset, sizeof(frame));
+        CHECK(frame.bytes_of_frame > sizeof(frame));
+        const uint8_t* data = bytes.data() + offset + sizeof(frame);
+        frames.emplace_back(data, data + bytes_of_image(&frame.shape));
+        offset += frame.bytes_of_frame;
+    }
+    return frames;
+}
+
+void
+expect_same_frames(const Frames& actual, const Frames& expected)
+{
+    CHECK(!expected.empty());
+    for (size_t i = 0; i < actual.size(); ++i) {
+        EXPECT(actual[i] == expected[i % expected.size()],
+               "Frame %d differs from recorded frame %d.",
+               (int)i,
+               (int)(i % expected.size()));
+    }
+}
+
+int
+main()
+{
+    int retval = 1;
+    AcquireRuntime* runtime = acquire_init(reporter);
+    const std::string raw = TEST ".raw", tiff = TEST ".tif";
+
+    try {
+        CHECK(runtime);
+        configure(runtime,
+                  "simulated.*random.*",
+                  "raw",
+                  raw,
+                  "",
+                  ReplayTiming_Unthrottled,
+                  nframes);
+        acquire(runtime);
+        const Frames recorded = read_raw(raw);
+        CHECK(recorded.size() == nframes);
+
+        // Replay the raw file, recording it as a tiff.
+        configure(runtime,
+                  "replay",
+                  "tiff",
+                  tiff,
+                  "file://" + raw,
+                  ReplayTiming_Unthrottled,
+                  nframes);
+        {
+            AcquireProperties props = {};
+            OK(acquire_get_configuration(runtime, &props));
+            CHECK(props.video[0].camera.settings.shape.x == 64);
+            CHECK(props.video[0].camera.settings.shape.y == 48);
+            CHECK(props.video[0].camera.settings.pixel_type ==
+                  SampleType_u16);
+        }
+        Frames replayed = acquire(runtime);
+        CHECK(replayed.size() == nframes);
+        expect_same_frames(replayed, recorded);
+
+        // Replay the tiff twice over at a fixed rate.
+        configure(runtime,
+                  "replay",
+                  "trash",
+                  "",
+                  tiff,
+                  ReplayTiming_FixedRate,
+                  2 * nframes);
+        struct clock clock;
+        clock_init(&clock);
+        replayed = acquire(runtime);
+        const double elapsed_ms = clock_toc_ms(&clock);
+        CHECK(replayed.size() == 2 * nframes);
+        expect_same_frames(replayed, recorded);
+        EXPECT(elapsed_ms >= 2.0 * (2 * nframes - 1),
+               "Expected %d frames 2 ms apart to take at least %f ms. Took %f "
+               "ms.",
+               2 * nframes,
+               2.0 * (2 * nframes - 1),
+               elapsed_ms);
+
+        retval = 0;
+    } catch (const std::exception& e) {
+        ERR("Exception: %s", e.what());
+    } catch (...) {
+        ERR("Exception: (unknown)");
+    }
+
+    acquire_shutdown(runtime);
+    return retval;
+}
@@ -0,0 +1,214 @@
+/// @file write-direct-io.cpp
+/// Records frames from a simulated camera with the raw storage, then replays
+/// them into the raw and tiff storage with direct I/O turned on. Replaying
+/// those files must return the recorded frames, and each frame in the direct
+/// raw file must start on a block boundary.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str) - 1
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+const static uint32_t nframes = 16;
+
+using Frames = std::vector<std::vector<uint8_t>>;
+
+/// Selects a camera and a storage device for stream 0.
+void
+configure(AcquireRuntime* runtime,
+          const char* camera,
+          const char* storage,
+          const std::string& filename,
+          const std::string& replay,
+          bool direct_io)
+{
+    auto* dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+    props.video[0].storage = { 0 };
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                camera,
+                                strlen(camera),
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                storage,
+                                strlen(storage),
+                                &props.video[0].storage.identifier));
+    storage_properties_set_uri(&props.video[0].storage.settings,
+                               filename.c_str(),
+                               filename.size() + 1);
+    CHECK(storage_properties_set_direct_io(&props.video[0].storage.settings,
+                                           direct_io));
+
+    auto& settings = props.video[0].camera.settings;
+    settings.binning = 1;
+    settings.pixel_type = SampleType_u16;
+    settings.shape = { .x = 64, .y = 48 };
+    settings.exposure_time_us = 2000;
+    settings.replay.uri = { .str = (char*)replay.c_str(),
+                            .nbytes = replay.size() + 1,
+                            .is_ref = 1 };
+    settings.replay.timing = ReplayTiming_Unthrottled;
+    props.video[0].max_frame_count = nframes;
+
+    OK(acquire_configure(runtime, &props));
+}
+
+/// Runs the configured stream and returns a copy of each frame it acquires.
+Frames
+acquire(AcquireRuntime* runtime)
+{
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    struct clock clock;
+    const double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    Frames frames;
+    OK(acquire_start(runtime));
+    while (frames.size() < props.video[0].max_frame_count) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timeout at %f ms",
+               clock_toc_ms(&clock) + time_limit_ms);
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read_wait(runtime, 0, 100.0f, &beg, &end));
+        for (cur = beg; cur < end;
+             cur = (VideoFrame*)((uint8_t*)cur + cur->bytes_of_frame)) {
+            frames.emplace_back(cur->data,
+                                cur->data + bytes_of_image(&cur->shape));
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+    }
+    OK(acquire_stop(runtime));
+    return frames;
+}
+
+/// Reads the frames in a file written by the raw storage. Each frame must
+/// start at a multiple of `alignment` bytes.
+Frames
+read_raw(const std::string& filename, size_t alignment)
+{
+    std::ifstream file(filename, std::ios::binary);
+    const std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)),
+                                     std::istreambuf_iterator<char>());
+    Frames frames;
+    for (size_t offset = 0; offset + sizeof(VideoFrame) <= bytes.size();) {
+        EXPECT(offset % alignment == 0,
+               "Frame %d starts at %llu, not a multiple of %d.",
+               (int)frames.size(),
+               (unsigned long long)offset,
+               (int)alignment);
+        VideoFrame frame = {};
+        memcpy(&frame, bytes.data() + offset, sizeof(frame));
+        CHECK(frame.bytes_of_frame > sizeof(frame));
+        CHECK(offset + frame.bytes_of_frame <= bytes.size());
+        const uint8_t* data = bytes.data() + offset + sizeof(frame);
+        frames.emplace_back(data, data + bytes_of_image(&frame.shape));
+        offset += frame.bytes_of_frame;
+    }
+    return frames;
+}
+
+void
+expect_same_frames(const Frames& actual, const Frames& expected)
+{
+    CHECK(actual.size() == expected.size());
+    for (size_t i = 0; i < actual.size(); ++i)
+        EXPECT(actual[i] == expected[i], "Frame %d differs.", (int)i);
+}
+
+int
+main()
+{
+    int retval = 1;
+    AcquireRuntime* runtime = acquire_init(reporter);
+    const std::string raw = TEST ".raw", direct_raw = TEST ".direct.raw",
+                      direct_tiff = TEST ".direct.tif";
+
+    try {
+        CHECK(runtime);
+        configure(runtime, "simulated.*random.*", "raw", raw, "", false);
+        acquire(runtime);
+        const Frames recorded = read_raw(raw, 8);
+        CHECK(recorded.size() == nframes);
+
+        configure(runtime, "replay", "raw", direct_raw, raw, true);
+        expect_same_frames(acquire(runtime), recorded);
+        expect_same_frames(read_raw(direct_raw, FILE_DIRECT_ALIGNMENT_BYTES),
+                           recorded);
+
+        configure(runtime, "replay", "tiff", direct_tiff, raw, true);
+        expect_same_frames(acquire(runtime), recorded);
+        {
+            AcquireProperties props = {};
+            OK(acquire_get_configuration(runtime, &props));
+            CHECK(props.video[0].storage.settings.direct_io);
+        }
+
+        // Both files read back through the replay camera.
+        configure(runtime, "replay", "trash", "", direct_raw, false);
+        expect_same_frames(acquire(runtime), recorded);
+        configure(runtime, "replay", "trash", "", direct_tiff, false);
+        expect_same_frames(acquire(runtime), recorded);
+
+        retval = 0;
+    } catch (const std::exception& e) {
+        ERR("Exception: %s", e.what());
+    } catch (...) {
+        ERR("Exception: (unknown)");
+    }
+
+    acquire_shutdown(runtime);
+    return retval;
+}
@@ -5,6 +5,7 @@
 #include "logger.h"
 #include "platform.h"
 #include "runtime/channel.h"
+#include "runtime/filter.h"
 #include "runtime/video.h"
 #include "runtime/vfslice.h"
 
@@ -15,6 +16,16 @@
 #undef max
 #define max(a, b) ((a) < (b) ? (b) : (a))
 
+#define DEFAULT_CHANNEL_CAPACITY_BYTES (1ULL << 30)
+
+/// Tags the averaging stage set up by `frame_average_count`, to tell it
+/// apart from one listed in `stages`.
+#define STAGE_KIND_FRAME_AVERAGE_SHORTHAND (AcquireStageKindCount)
+
+#if ACQUIRE_MAX_STAGE_COUNT + 1 > VIDEO_MAX_STAGES
+#error "A stream's stages, plus the averaging shorthand, must fit the chain."
+#endif
+
 #define containerof(ptr, T, V) ((T*)(((char*)(ptr)) - offsetof(T, V)))
 #define countof(e) (sizeof(e) / sizeof(*(e)))
 
@@ -60,9 +71,9 @@ struct runtime
     enum DeviceState state;
     struct DeviceManager device_manager;
 
-    uint8_t valid_video_streams; /// i'th bit set iff i'th video stream is valid
-
-    struct video_s video[2];
+    uint32_t video_stream_count;
+    uint8_t* valid_video_streams; /// i'th entry set iff i'th stream is valid
+    struct video_s* video;
 };
 
 #define QUOTE(name) #name
@@ -85,30 +96,166 @@ acquire_api_version_string()
     return version;
 }
 
+/// @returns how many input frames the stages consume for each frame the last
+///          one writes.
+static uint64_t
+stage_frame_id_stride(const struct video_s* video)
+{
+    uint64_t stride = 1;
+    for (uint32_t i = 0; i < video->stage_count; ++i)
+        stride *= video->stages[i]->frame_id_stride;
+    return stride;
+}
+
+/// Counts the frames in `slice` and any frames the monitor skipped to get
+/// there. Frame ids advance by `stride` from one frame to the next.
+static void
+monitor_track_frames(struct video_monitor_s* monitor,
+                     uint64_t stride,
+                     const struct vfslice_mut* slice)
+{
+    monitor->frames_mapped = 0;
+    for (const struct VideoFrame* cur = slice->beg;
+         cur < slice->end && cur->bytes_of_frame;
+         cur = (const struct VideoFrame*)((const uint8_t*)cur +
+                                          cur->bytes_of_frame)) {
+        if (monitor->has_seen_frame && cur->frame_id > monitor->next_frame_id)
+            monitor->frames_lost +=
+              (cur->frame_id - monitor->next_frame_id) / stride;
+        monitor->next_frame_id = cur->frame_id + stride;
+        monitor->has_seen_frame = 1;
+        ++monitor->frames_mapped;
+    }
+}
+
+static enum AcquireStatusCode
+monitor_map_read(struct channel* channel,
+                 struct video_monitor_s* monitor,
+                 uint64_t stride,
+                 struct VideoFrame** beg,
+                 struct VideoFrame** end)
+{
+    EXPECT(monitor->reader.state == ChannelState_Unmapped,
+           "Expected an unmapped reader. See acquire_unmap_read().");
+    struct vfslice_mut slice =
+      make_vfslice_mut(channel_read_map(channel, &monitor->reader));
+    CHECK(monitor->reader.status == Channel_Ok);
+    monitor_track_frames(monitor, stride, &slice);
+    *beg = slice.beg;
+    *end = slice.end;
+    return AcquireStatus_Ok;
+Error:
+    return AcquireStatus_Error;
+}
+
+static void
+monitor_unmap_read(struct channel* channel,
+                   struct video_monitor_s* monitor,
+                   size_t consumed_bytes)
+{
+    if (!channel_read_unmap(channel, &monitor->reader, consumed_bytes)) {
+        // A lossy monitor's region was overwritten while it was mapped.
+        monitor->frames_lost += monitor->frames_mapped;
+    }
+    monitor->frames_mapped = 0;
+}
+
+static size_t
+slice_size_bytes(const struct slice* slice)
+{
+    return (uint8_t*)slice->end - (uint8_t*)slice->beg;
+}
+
+/// Releases the monitor's read region, if any, once nothing more is coming.
+/// This takes at most 2 iterations.
+static void
+monitor_flush(struct channel* channel, struct video_monitor_s* monitor)
+{
+    if (!monitor->reader.id)
+        return;
+    size_t nbytes;
+    do {
+        struct slice slice = channel_read_map(channel, &monitor->reader);
+        nbytes = slice_size_bytes(&slice);
+        channel_read_unmap(channel, &monitor->reader, nbytes);
+        TRACE("Monitor flushed %llu bytes", (unsigned long long)nbytes);
+    } while (nbytes);
+}
+
+/// Resets `monitor` so it picks up at the first frame of this run.
+static void
+monitor_restart(const struct channel* channel, struct video_monitor_s* monitor)
+{
+    monitor->next_frame_id = 0;
+    monitor->has_seen_frame = monitor->reader.id != 0;
+    monitor->frames_lost = 0;
+    monitor->bytes_lost_at_start =
+      channel_bytes_lost(channel, &monitor->reader);
+}
+
+/// @returns the stream behind `istream`, or 0 if there isn't one.
+static struct video_s*
+get_video(const struct AcquireRuntime* self_, uint32_t istream)
+{
+    struct runtime* self = 0;
+    EXPECT(self_, "Invalid parameter: `self` was NULL.");
+    self = containerof(self_, struct runtime, handle);
+    EXPECT(istream < self->video_stream_count,
+           "Invalid parameter: `istream` was out-of-bounds (%d).",
+           self->video_stream_count);
+    return self->video + istream;
+Error:
+    return 0;
+}
+
+/// @returns `video`'s branch, or 0 if its stages aren't branched.
+static struct video_sink_s*
+get_branch(struct video_s* video)
+{
+    EXPECT(video && video->is_branched && video->branch.in.data,
+           "Expected a stream with `AcquireStageOutput_Branch` stages.");
+    return &video->branch;
+Error:
+    return 0;
+}
+
 enum AcquireStatusCode
 acquire_map_read(const struct AcquireRuntime* self_,
                  uint32_t istream,
                  struct VideoFrame** beg,
                  struct VideoFrame** end)
 {
-    struct runtime* self = 0;
-    size_t nbytes = 0;
+    struct video_s* video = 0;
+    EXPECT(beg, "Invalid parameter: `beg` was NULL.");
+    EXPECT(end, "Invalid parameter: `end` was NULL.");
+    CHECK(video = get_video(self_, istream));
+    // Branched stages don't change what the sink sees.
+    return monitor_map_read(&video->sink.in,
+                            &video->monitor,
+                            video->is_branched ? 1
+                                               : stage_frame_id_stride(video),
+                            beg,
+                            end);
+Error:
+    return AcquireStatus_Error;
+}
 
-    EXPECT(self_, "Invalid parameter: `self` was NULL.");
+enum AcquireStatusCode
+acquire_map_read_wait(const struct AcquireRuntime* self_,
+                      uint32_t istream,
+                      float timeout_ms,
+                      struct VideoFrame** beg,
+                      struct VideoFrame** end)
+{
+    struct video_s* video = 0;
     EXPECT(beg, "Invalid parameter: `beg` was NULL.");
     EXPECT(end, "Invalid parameter: `end` was NULL.");
-    EXPECT(istream < countof(self->video),
-           "Invalid parameter: `istream` was out-of-bounds (%d).",
-           countof(self->video));
-    self = containerof(self_, struct runtime, handle);
-    EXPECT(self->video[istream].monitor.reader.state == ChannelState_Unmapped,
+    CHECK(video = get_video(self_, istream));
+    EXPECT(video->monitor.reader.state == ChannelState_Unmapped,
            "Expected an unmapped reader. See acquire_unmap_read().");
-    struct vfslice_mut slice = make_vfslice_mut(channel_read_map(
-      &self->video[istream].sink.in, &self->video[istream].monitor.reader));
-    CHECK(self->video[istream].monitor.reader.status == Channel_Ok);
-    *beg = slice.beg;
-    *end = slice.end;
-    return AcquireStatus_Ok;
+    channel_wait_for_data(
+      &video->sink.in, &video->monitor.reader, 1, timeout_ms);
+    return acquire_map_read(self_, istream, beg, end);
 Error:
     return AcquireStatus_Error;
 }
@@ -118,13 +265,68 @@ acquire_unmap_read(const struct AcquireRuntime* self_,
                    uint32_t istream,
                    size_t consumed_bytes)
 {
-    struct runtime* self = 0;
-    CHECK(self_);
-    CHECK(istream < countof(self->video));
-    self = containerof(self_, struct runtime, handle);
-    channel_read_unmap(&self->video[istream].sink.in,
-                       &self->video[istream].monitor.reader,
-                       consumed_bytes);
+    struct video_s* video = 0;
+    CHECK(video = get_video(self_, istream));
+    monitor_unmap_read(&video->sink.in, &video->monitor, consumed_bytes);
+    return AcquireStatus_Ok;
+Error:
+    return AcquireStatus_Error;
+}
+
+enum AcquireStatusCode
+acquire_map_read_stage_output(const struct AcquireRuntime* self_,
+                              uint32_t istream,
+                              struct VideoFrame** beg,
+                              struct VideoFrame** end)
+{
+    struct video_s* video = 0;
+    struct video_sink_s* branch = 0;
+    EXPECT(beg, "Invalid parameter: `beg` was NULL.");
+    EXPECT(end, "Invalid parameter: `end` was NULL.");
+    CHECK(video = get_video(self_, istream));
+    CHECK(branch = get_branch(video));
+    return monitor_map_read(&branch->in,
+                            &video->branch_monitor,
+                            stage_frame_id_stride(video),
+                            beg,
+                            end);
+Error:
+    return AcquireStatus_Error;
+}
+
+enum AcquireStatusCode
+acquire_map_read_stage_output_wait(const struct AcquireRuntime* self_,
+                                   uint32_t istream,
+                                   float timeout_ms,
+                                   struct VideoFrame** beg,
+                                   struct VideoFrame** end)
+{
+    struct video_s* video = 0;
+    struct video_sink_s* branch = 0;
+    EXPECT(beg, "Invalid parameter: `beg` was NULL.");
+    EXPECT(end, "Invalid parameter: `end` was NULL.");
+    CHECK(video = get_video(self_, istream));
+    CHECK(branch = get_branch(video));
+    EXPECT(video->branch_monitor.reader.state == ChannelState_Unmapped,
+           "Expected an unmapped reader. See "
+           "acquire_unmap_read_stage_output().");
+    channel_wait_for_data(
+      &branch->in, &video->branch_monitor.reader, 1, timeout_ms);
+    return acquire_map_read_stage_output(self_, istream, beg, end);
+Error:
+    return AcquireStatus_Error;
+}
+
+enum AcquireStatusCode
+acquire_unmap_read_stage_output(const struct AcquireRuntime* self_,
+                                uint32_t istream,
+                                size_t consumed_bytes)
+{
+    struct video_s* video = 0;
+    struct video_sink_s* branch = 0;
+    CHECK(video = get_video(self_, istream));
+    CHECK(branch = get_branch(video));
+    monitor_unmap_read(&branch->in, &video->branch_monitor, consumed_bytes);
     return AcquireStatus_Ok;
 Error:
     return AcquireStatus_Error;
@@ -139,21 +341,35 @@ sig_sink_stop_source(const struct video_sink_s* sink)
     self->source.is_stopping = 1;
 }
 
+static void
+sig_branch_stop_source(const struct video_sink_s* sink)
+{
+    struct video_s* self = containerof(sink, struct video_s, branch);
+    self->source.is_stopping = 1;
+}
+
 static void
 await_filter_reset(const struct video_source_s* source)
 {
     struct video_s* self = containerof(source, struct video_s, source);
-    self->filter.sig_accumulator_reset = 1;
-    event_wait(&self->filter.accumulator_reset_event);
+    for (uint32_t i = 0; i < self->stage_count; ++i)
+        video_stage_await_reset(self->stages[i]);
 }
 
 static void
 sig_source_stop_filter(const struct video_source_s* source)
 {
-    // This is a pretty hacky way of signaling a video stream to stop
-    // the filter thread.
+    // Stages are stopped in order, each after the one upstream has flushed
+    // into it. The source stops the sink once this returns.
     struct video_s* self = containerof(source, struct video_s, source);
-    self->filter.is_stopping = 1;
+    for (uint32_t i = 0; i < self->stage_count; ++i) {
+        video_stage_sig_stop(self->stages[i]);
+        thread_join(&self->stages[i]->thread);
+    }
+    if (self->is_branched) {
+        self->branch.is_stopping = 1;
+        video_sink_wake(&self->branch);
+    }
 }
 
 static void
@@ -163,6 +379,7 @@ sig_source_stop_sink(const struct video_source_s* source)
     // the sink thread.
     struct video_s* self = containerof(source, struct video_s, source);
     self->sink.is_stopping = 1;
+    video_sink_wake(&self->sink);
 }
 
 static int
@@ -171,8 +388,19 @@ reserve_image_shape(struct video_s* video)
     struct ImageShape image_shape = { 0 };
     CHECK(Device_Ok ==
           camera_get_image_shape(video->source.camera, &image_shape));
+    if (video->is_branched)
+        CHECK(Device_Ok ==
+              storage_reserve_image_shape(video->sink.storage, &image_shape));
+    // Storage sees what the last stage writes.
+    for (uint32_t i = 0; i < video->stage_count; ++i) {
+        const struct video_stage_s* stage = video->stages[i];
+        if (stage->transform_shape)
+            stage->transform_shape(stage, &image_shape);
+    }
     CHECK(Device_Ok ==
-          storage_reserve_image_shape(video->sink.storage, &image_shape));
+          storage_reserve_image_shape(video->is_branched ? video->branch.storage
+                                                         : video->sink.storage,
+                                      &image_shape));
     return 1;
 Error:
     return 0;
@@ -185,37 +413,86 @@ acquire_init(void (*reporter)(int is_error,
                               const char* function,
                               const char* msg))
 {
-    struct runtime* self;
+    return acquire_init_with_video_streams(reporter,
+                                           ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT);
+}
+
+/// Releases the sources, stages, branches and sinks of the first `n` streams.
+static void
+destroy_video_streams(struct runtime* self, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; ++i) {
+        struct video_s* video = self->video + i;
+        video_source_destroy((&video->source));
+        for (uint32_t j = 0; j < video->stage_count; ++j)
+            video_stage_destroy(video->stages[j]);
+        video_sink_destroy(&video->branch);
+        video_sink_destroy(&video->sink);
+    }
+}
+
+struct AcquireRuntime*
+acquire_init_with_video_streams(void (*reporter)(int is_error,
+                                                 const char* file,
+                                                 int line,
+                                                 const char* function,
+                                                 const char* msg),
+                                uint32_t video_stream_count)
+{
+    struct runtime* self = 0;
+    uint8_t has_device_manager = 0;
+    // Streams before `nvideo` are set up. These say how far stream `nvideo`
+    // got.
+    uint32_t nvideo = 0;
+    uint8_t has_sink = 0, has_branch = 0;
     if (!reporter)
         goto Error;
     logger_set_reporter(reporter);
+    EXPECT(video_stream_count > 0 &&
+             video_stream_count <= ACQUIRE_MAX_VIDEO_STREAM_COUNT,
+           "Expected between 1 and %d video streams. Got %u.",
+           ACQUIRE_MAX_VIDEO_STREAM_COUNT,
+           video_stream_count);
 
     self = (struct runtime*)malloc(sizeof(struct runtime));
     EXPECT(self,
            "Failed to allocate AcquireRuntime. Requested %llu bytes",
            sizeof(struct runtime));
     memset(self, 0, sizeof(*self)); // NOLINT
-    CHECK(device_manager_init(&self->device_manager, reporter) == Device_Ok);
-
-    for (uint8_t i = 0; i < countof(self->video); ++i) {
+    EXPECT((self->video = calloc(video_stream_count, sizeof(*self->video))) &&
+             (self->valid_video_streams = calloc(video_stream_count, 1)),
+           "Failed to allocate %u video streams.",
+           video_stream_count);
+    self->video_stream_count = video_stream_count;
+    CHECK(has_device_manager =
+            (device_manager_init(&self->device_manager, reporter) ==
+             Device_Ok));
+
+    for (; nvideo < self->video_stream_count; ++nvideo) {
+        const uint32_t i = nvideo;
         struct video_s* video = self->video + i;
-        memset(video, 0, sizeof(*video)); // NOLINT
         video->stream_id = (uint8_t)i;
+        has_sink = has_branch = 0;
 
-        EXPECT(
-          video_sink_init(&video->sink, i, 1ULL << 30, sig_sink_stop_source) ==
-            Device_Ok,
-          "[stream %d] Failed to initialize video sink controller",
-          i);
-        EXPECT(video_filter_init(
-                 &video->filter, i, 1ULL << 30, &video->sink.in) == Device_Ok,
-               "[stream %d] Failed to initialize video filter controller",
+        EXPECT(has_sink = (video_sink_init(&video->sink,
+                                           i,
+                                           DEFAULT_CHANNEL_CAPACITY_BYTES,
+                                           sig_sink_stop_source) == Device_Ok),
+               "[stream %d] Failed to initialize video sink controller",
+               i);
+        // The branch's queue is allocated once stages are branched.
+        EXPECT(has_branch = (video_sink_init(&video->branch,
+                                             i,
+                                             0,
+                                             sig_branch_stop_source) ==
+                             Device_Ok),
+               "[stream %d] Failed to initialize the branch's sink controller",
                i);
         EXPECT(video_source_init(&video->source,
                                  i,
                                  -1,
                                  &video->sink.in,
-                                 &video->filter.in,
+                                 0,
                                  await_filter_reset,
                                  sig_source_stop_filter,
                                  sig_source_stop_sink) == Device_Ok,
@@ -226,6 +503,18 @@ acquire_init(void (*reporter)(int is_error,
     self->state = DeviceState_AwaitingConfiguration;
     return &self->handle;
 Error:
+    if (self) {
+        if (has_branch)
+            video_sink_destroy(&self->video[nvideo].branch);
+        if (has_sink)
+            video_sink_destroy(&self->video[nvideo].sink);
+        destroy_video_streams(self, nvideo);
+        if (has_device_manager)
+            device_manager_destroy(&self->device_manager);
+        free(self->video);
+        free(self->valid_video_streams);
+        free(self);
+    }
     return 0;
 }
 
@@ -237,19 +526,369 @@ acquire_shutdown(struct AcquireRuntime* self_)
         goto Error;
     acquire_abort(self_);
     self = containerof(self_, struct runtime, handle);
-    for (size_t i = 0; i < countof(self->video); ++i) {
-        struct video_s* video = self->video + i;
-        video_source_destroy((&video->source));
-        video_filter_destroy(&video->filter);
-        video_sink_destroy(&video->sink);
-    }
+    destroy_video_streams(self, self->video_stream_count);
     device_manager_destroy(&self->device_manager);
+    free(self->video);
+    free(self->valid_video_streams);
     free(self);
     return AcquireStatus_Ok;
 Error:
     return AcquireStatus_Error;
 }
 
+static uint64_t
+two_frames_bytes(const struct ImageShape* shape)
+{
+    const size_t nbytes = sizeof(struct VideoFrame) + bytes_of_image(shape);
+    return 2 * 8 * ((nbytes + 7) / 8);
+}
+
+/// @returns the smallest channel capacity that can hold two frames at every
+///          point in `video`'s stage chain, or 0 if the camera shape isn't
+///          known.
+static uint64_t
+min_channel_capacity_bytes(const struct video_s* video)
+{
+    struct ImageShape shape = { 0 };
+    if (!video->source.camera ||
+        camera_get_image_shape(video->source.camera, &shape) != Device_Ok)
+        return 0;
+    uint64_t nbytes = two_frames_bytes(&shape);
+    for (uint32_t i = 0; i < video->stage_count; ++i) {
+        const struct video_stage_s* stage = video->stages[i];
+        if (stage->transform_shape)
+            stage->transform_shape(stage, &shape);
+        nbytes = max(nbytes, two_frames_bytes(&shape));
+    }
+    return nbytes;
+}
+
+/// Makes `channel` the kind of channel `video` asks for.
+static void
+new_channel(const struct video_s* video,
+            struct channel* channel,
+            size_t capacity_bytes)
+{
+    if (video->mirror_channels)
+        channel_new_mirrored(channel, capacity_bytes);
+    else
+        channel_new(channel, capacity_bytes);
+}
+
+/// Replaces `video`'s channels if their capacity or kind needs to change.
+static int
+configure_channel_capacity(struct video_s* video,
+                           enum DeviceState state,
+                           uint64_t capacity_bytes,
+                           uint8_t mirror_channels)
+{
+    if (!capacity_bytes)
+        capacity_bytes = DEFAULT_CHANNEL_CAPACITY_BYTES;
+    mirror_channels = !!mirror_channels;
+    if (mirror_channels) {
+        const uint64_t page = memory_page_size_bytes();
+        capacity_bytes = (capacity_bytes + page - 1) / page * page;
+    }
+    const uint64_t min_bytes = min_channel_capacity_bytes(video);
+    EXPECT(capacity_bytes >= min_bytes,
+           "[stream %d] Channel capacity of %llu bytes is too small. Expected "
+           "at least %llu bytes.",
+           video->stream_id,
+           (unsigned long long)capacity_bytes,
+           (unsigned long long)min_bytes);
+    const int remake = video->mirror_channels != mirror_channels;
+    const int resize_branch =
+      video->is_branched &&
+      (remake || video->branch.in.capacity != capacity_bytes);
+    if (video->sink.in.capacity == capacity_bytes && !remake && !resize_branch)
+        return 1;
+    EXPECT(state != DeviceState_Running,
+           "[stream %d] Channels can't be resized or remapped while running.",
+           video->stream_id);
+    video->mirror_channels = mirror_channels;
+
+    if (resize_branch) {
+        if (video->branch.in.data)
+            channel_release(&video->branch.in);
+        new_channel(video, &video->branch.in, capacity_bytes);
+        video->branch.reader = (struct channel_reader){ 0 };
+        video->branch_monitor.reader = (struct channel_reader){ 0 };
+        CHECK(video->branch.in.data);
+    }
+    if (video->sink.in.capacity == capacity_bytes && !remake)
+        return 1;
+    channel_release(&video->sink.in);
+    new_channel(video, &video->sink.in, capacity_bytes);
+    // Readers were attached to the old channels.
+    video->sink.reader = (struct channel_reader){ 0 };
+    video->monitor.reader = (struct channel_reader){ 0 };
+    CHECK(video->sink.in.data);
+    for (uint32_t i = 0; i < video->stage_count; ++i) {
+        struct video_stage_s* stage = video->stages[i];
+        if (stage->tap)
+            continue; // It has no queue of its own.
+        if (stage->in.data)
+            channel_release(&stage->in);
+        new_channel(video, &stage->in, capacity_bytes);
+        stage->reader = (struct channel_reader){ 0 };
+        CHECK(stage->in.data);
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+static int
+set_monitor_overflow(const struct video_s* video,
+                     struct channel* channel,
+                     struct video_monitor_s* monitor,
+                     enum AcquireMonitorOverflow overflow)
+{
+    if ((enum AcquireMonitorOverflow)monitor->reader.overflow == overflow)
+        return 1;
+    EXPECT(monitor->reader.state == ChannelState_Unmapped,
+           "[stream %d] Monitor overflow policy can't be changed while a "
+           "region is mapped. See acquire_unmap_read().",
+           video->stream_id);
+    channel_set_overflow(
+      channel, &monitor->reader, (enum ChannelOverflow)overflow);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Sets what `video`'s writers do when the monitors fall behind.
+static int
+configure_monitor_overflow(struct video_s* video,
+                           enum AcquireMonitorOverflow overflow)
+{
+    EXPECT(overflow <= AcquireMonitorOverflow_Lossy,
+           "[stream %d] Invalid monitor overflow policy (%d).",
+           video->stream_id,
+           (int)overflow);
+    CHECK(set_monitor_overflow(
+      video, &video->sink.in, &video->monitor, overflow));
+    if (video->is_branched)
+        CHECK(set_monitor_overflow(
+          video, &video->branch.in, &video->branch_monitor, overflow));
+    return 1;
+Error:
+    return 0;
+}
+
+/// The stage's input queue is left to link_stages(), which only allocates
+/// one if the stage doesn't tap another channel.
+static struct video_stage_s*
+create_stage(const struct video_s* video, int kind)
+{
+    struct video_stage_s* stage = 0;
+    switch (kind) {
+        case AcquireStage_Average:
+        case STAGE_KIND_FRAME_AVERAGE_SHORTHAND:
+            stage = video_filter_create(video->stream_id, 0);
+            break;
+        default:
+            break;
+    }
+    if (stage)
+        stage->kind = kind;
+    return stage;
+}
+
+static int
+configure_stage(struct video_stage_s* stage,
+                const struct aq_properties_stage_s* props)
+{
+    switch (stage->kind) {
+        case AcquireStage_Average:
+        case STAGE_KIND_FRAME_AVERAGE_SHORTHAND:
+            return video_filter_configure(
+                     containerof(stage, struct video_filter_s, stage),
+                     (enum FilterMode)props->average.mode,
+                     props->average.frame_count,
+                     props->average.thread_count,
+                     props->average.alpha,
+                     (enum FilterOutput)props->average.output) == Device_Ok;
+        default:
+            return 0;
+    }
+}
+
+static void
+get_stage(const struct video_stage_s* stage,
+          struct aq_properties_stage_s* props)
+{
+    switch (stage->kind) {
+        case AcquireStage_Average:
+        case STAGE_KIND_FRAME_AVERAGE_SHORTHAND: {
+            const struct video_filter_s* filter =
+              containerof(stage, struct video_filter_s, stage);
+            *props = (struct aq_properties_stage_s){
+                .kind = AcquireStage_Average,
+                .average = { .frame_count = filter->filter_window_frames,
+                             .thread_count = filter->thread_count,
+                             .mode = (enum AcquireAverageMode)filter->mode,
+                             .alpha = filter->ema_alpha,
+                             .output =
+                               (enum AcquireAverageOutput)filter->output },
+            };
+            break;
+        }
+        default:
+            *props = (struct aq_properties_stage_s){ 0 };
+            break;
+    }
+}
+
+/// Points each stage at the next one's input, and the source at the first.
+/// Inline, the last stage writes to the sink. Branched, the first stage taps
+/// the sink's input and the last writes to the branch.
+///
+/// Stages that read their own input get a queue like the sink's. A stage
+/// that taps another channel never uses its own, so it's released.
+static int
+link_stages(struct video_s* video)
+{
+    const size_t capacity = video->sink.in.capacity
+                              ? video->sink.in.capacity
+                              : DEFAULT_CHANNEL_CAPACITY_BYTES;
+    int is_ok = 1;
+    for (uint32_t i = 0; i < video->stage_count; ++i) {
+        struct video_stage_s* stage = video->stages[i];
+        struct channel* tap =
+          (i == 0 && video->is_branched) ? &video->sink.in : 0;
+        if (stage->tap != tap) {
+            // The reader moves to a different channel.
+            channel_detach_reader(stage->tap ? stage->tap : &stage->in,
+                                  &stage->reader);
+            stage->tap = tap;
+        }
+        if (stage->tap && stage->in.data) {
+            channel_release(&stage->in);
+            stage->in = (struct channel){ 0 };
+        } else if (!stage->tap && !stage->in.data) {
+            new_channel(video, &stage->in, capacity);
+            if (!stage->in.data) {
+                LOGE("[stream %d] Failed to allocate the queue for stage %u.",
+                     video->stream_id,
+                     i);
+                is_ok = 0;
+            }
+        }
+        stage->out = (i + 1 < video->stage_count) ? &video->stages[i + 1]->in
+                     : video->is_branched         ? &video->branch.in
+                                                  : &video->sink.in;
+    }
+    video->source.to_filter =
+      video->stage_count ? &video->stages[0]->in : 0;
+    return is_ok;
+}
+
+/// Builds `video`'s stage chain from `pvideo`. Stages that are already in
+/// place are reconfigured rather than replaced.
+static int
+configure_stages(struct video_s* video,
+                 enum DeviceState state,
+                 const struct aq_properties_video_s* pvideo)
+{
+    struct aq_properties_stage_s want[VIDEO_MAX_STAGES] = { 0 };
+    int kinds[VIDEO_MAX_STAGES] = { 0 };
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < ACQUIRE_MAX_STAGE_COUNT &&
+                         pvideo->stages[i].kind != AcquireStage_None;
+         ++i) {
+        EXPECT(pvideo->stages[i].kind < AcquireStageKindCount,
+               "[stream %d] Stage %u has an unknown kind (%d).",
+               video->stream_id,
+               i,
+               (int)pvideo->stages[i].kind);
+        want[n] = pvideo->stages[i];
+        kinds[n++] = pvideo->stages[i].kind;
+    }
+    if (pvideo->frame_average_count > 1) {
+        want[n] = (struct aq_properties_stage_s){
+            .kind = AcquireStage_Average,
+            .average = { .frame_count = pvideo->frame_average_count },
+        };
+        kinds[n++] = STAGE_KIND_FRAME_AVERAGE_SHORTHAND;
+    }
+
+    uint32_t keep = 0;
+    while (keep < n && keep < video->stage_count &&
+           video->stages[keep]->kind == kinds[keep])
+        ++keep;
+    if (keep < n || keep < video->stage_count) {
+        EXPECT(state != DeviceState_Running,
+               "[stream %d] Stages can't be added or removed while running.",
+               video->stream_id);
+        for (uint32_t i = keep; i < video->stage_count; ++i) {
+            video_stage_destroy(video->stages[i]);
+            video->stages[i] = 0;
+        }
+        video->stage_count = keep;
+        for (uint32_t i = keep; i < n; ++i) {
+            EXPECT(video->stages[i] = create_stage(video, kinds[i]),
+                   "[stream %d] Failed to create stage %u.",
+                   video->stream_id,
+                   i);
+            video->stage_count = i + 1;
+        }
+    }
+    for (uint32_t i = 0; i < n; ++i)
+        EXPECT(configure_stage(video->stages[i], want + i),
+               "[stream %d] Failed to configure stage %u.",
+               video->stream_id,
+               i);
+    video->frame_average_count = pvideo->frame_average_count;
+    return link_stages(video);
+Error:
+    link_stages(video);
+    return 0;
+}
+
+static int
+configure_stage_output(struct video_s* video,
+                       enum DeviceState state,
+                       enum AcquireStageOutput output)
+{
+    EXPECT(output < AcquireStageOutputCount,
+           "[stream %d] Invalid stage output (%d).",
+           video->stream_id,
+           (int)output);
+    const uint8_t is_branched = (output == AcquireStageOutput_Branch);
+    if (video->is_branched == is_branched)
+        return 1;
+    EXPECT(state != DeviceState_Running,
+           "[stream %d] Stage output can't be changed while running.",
+           video->stream_id);
+    video->is_branched = is_branched;
+    return 1;
+Error:
+    return 0;
+}
+
+static int
+configure_branch_storage(struct video_s* video,
+                         const struct DeviceManager* device_manager,
+                         struct aq_properties_storage_s* pstorage)
+{
+    if (pstorage->identifier.kind == DeviceKind_None)
+        CHECK(Device_Ok ==
+              device_manager_select_default(
+                device_manager, DeviceKind_Storage, &pstorage->identifier));
+    CHECK(video_sink_configure(&video->branch,
+                               device_manager,
+                               &pstorage->identifier,
+                               &pstorage->settings,
+                               pstorage->write_delay_ms,
+                               pstorage->batch_bytes,
+                               pstorage->batch_frames,
+                               pstorage->min_batch_interval_ms) == Device_Ok);
+    return 1;
+Error:
+    return 0;
+}
+
 static enum AcquireStatusCode
 configure_video_stream(struct video_s* const video,
                        enum DeviceState state,
@@ -268,15 +907,19 @@ configure_video_stream(struct video_s* const video,
                     device_manager, DeviceKind_Camera, &pcamera->identifier));
     }
 
-    is_ok &=
-      (video_source_configure(&video->source,
-                              device_manager,
-                              &pcamera->identifier,
-                              &pcamera->settings,
-                              pvideo->max_frame_count,
-                              pvideo->frame_average_count > 1) == Device_Ok);
-    is_ok &= (video_filter_configure(&video->filter,
-                                     pvideo->frame_average_count) == Device_Ok);
+    is_ok &= configure_stage_output(video, state, pvideo->stage_output);
+    is_ok &= configure_stages(video, state, pvideo);
+    EXPECT(!video->is_branched || video->stage_count > 0,
+           "[stream %d] Branched stage output needs at least one stage.",
+           video->stream_id);
+    // Branched stages read what the source writes to the sink.
+    is_ok &= (video_source_configure(&video->source,
+                                     device_manager,
+                                     &pcamera->identifier,
+                                     &pcamera->settings,
+                                     pvideo->max_frame_count,
+                                     video->stage_count > 0 &&
+                                       !video->is_branched) == Device_Ok);
 
     if (pstorage->identifier.kind == DeviceKind_None) {
         is_ok &= (Device_Ok ==
@@ -287,8 +930,18 @@ configure_video_stream(struct video_s* const video,
                                    device_manager,
                                    &pstorage->identifier,
                                    &pstorage->settings,
-                                   pstorage->write_delay_ms) == Device_Ok);
+                                   pstorage->write_delay_ms,
+                                   pstorage->batch_bytes,
+                                   pstorage->batch_frames,
+                                   pstorage->min_batch_interval_ms) ==
+              Device_Ok);
+    if (video->is_branched)
+        is_ok &= configure_branch_storage(
+          video, device_manager, &pvideo->stage_storage);
     is_ok &= reserve_image_shape(video);
+    is_ok &= configure_channel_capacity(
+      video, state, pvideo->channel_capacity_bytes, pvideo->mirror_channels);
+    is_ok &= configure_monitor_overflow(video, pvideo->monitor_overflow);
 
     EXPECT(is_ok, "Failed to configure video stream.");
 
@@ -297,8 +950,6 @@ Error:
     return AcquireStatus_Error;
 }
 
-/// Up to two video streams may be optionally configured.
-///
 /// Performs a cursory check to detect a disabled stream in order to avoid
 /// deeper checks. This reduces log chatter.
 static int
@@ -311,6 +962,50 @@ video_stream_requirements_check(struct aq_properties_video_s* video_settings)
     return 1;
 }
 
+/// Configures the `istream`'th stream, or disables it if `pvideo` selects no
+/// devices.
+static void
+configure_stream(struct runtime* self,
+                 uint32_t istream,
+                 struct aq_properties_video_s* pvideo)
+{
+    self->valid_video_streams[istream] = 0;
+    if (!video_stream_requirements_check(pvideo))
+        return;
+    if (AcquireStatus_Ok == configure_video_stream(self->video + istream,
+                                                   self->state,
+                                                   &self->device_manager,
+                                                   pvideo)) {
+        self->valid_video_streams[istream] = 1;
+        TRACE("Configured video stream %d.", istream);
+    } else {
+        TRACE("Failed to configure video stream %d.", istream);
+    }
+}
+
+static uint32_t
+count_valid_video_streams(const struct runtime* self)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < self->video_stream_count; ++i)
+        n += self->valid_video_streams[i];
+    return n;
+}
+
+/// Arms the runtime if any stream is valid after configuration.
+static void
+update_state_after_configure(struct runtime* self)
+{
+    TRACE("Valid video streams: %u", count_valid_video_streams(self));
+    if (count_valid_video_streams(self) == 0) {
+        acquire_abort(&self->handle); // aborts, moves to an Armed state
+        self->state = DeviceState_AwaitingConfiguration;
+    } else {
+        // success, moved to armed state or leave running
+        self->state = max(self->state, DeviceState_Armed);
+    }
+}
+
 enum AcquireStatusCode
 acquire_configure(struct AcquireRuntime* self_,
                   struct AcquireProperties* settings)
@@ -321,30 +1016,18 @@ acquire_configure(struct AcquireRuntime* self_,
            "Invalid parameter. Expected AcquireProperties* but got NULL.");
     self = containerof(self_, struct runtime, handle);
     EXPECT(self->state != DeviceState_Closed, "Device state is Closed.");
-    self->valid_video_streams = 0;
-    for (uint32_t istream = 0; istream < countof(self->video); ++istream) {
-        if (video_stream_requirements_check(settings->video + istream)) {
-            struct video_s* const video = self->video + istream;
-            if (AcquireStatus_Ok ==
-                configure_video_stream(video,
-                                       self->state,
-                                       &self->device_manager,
-                                       settings->video + istream)) {
-                self->valid_video_streams |= (1 << istream);
-                TRACE("Configured video stream %d.", istream);
-            } else {
-                TRACE("Failed to configure video stream %d.", istream);
-            }
-        }
+    for (uint32_t istream = 0; istream < countof(settings->video); ++istream) {
+        EXPECT(istream < self->video_stream_count ||
+                 !video_stream_requirements_check(settings->video + istream),
+               "Video stream %u was configured, but the runtime only has %u.",
+               istream,
+               self->video_stream_count);
     }
-    TRACE("Valid video streams: code %#04x", self->valid_video_streams);
-    if (self->valid_video_streams == 0) {
-        acquire_abort(self_); // aborts, moves to an Armed state
-        self->state = DeviceState_AwaitingConfiguration;
-    } else {
-        // success, moved to armed state or leave running
-        self->state = max(self->state, DeviceState_Armed);
+    for (uint32_t istream = 0; istream < countof(settings->video); ++istream) {
+        if (istream < self->video_stream_count)
+            configure_stream(self, istream, settings->video + istream);
     }
+    update_state_after_configure(self);
     return AcquireStatus_Ok;
 Error:
     if (self_)
@@ -354,6 +1037,78 @@ Error:
     return AcquireStatus_Error;
 }
 
+enum AcquireStatusCode
+acquire_configure_video_stream(struct AcquireRuntime* self_,
+                               uint32_t istream,
+                               struct aq_properties_video_s* settings)
+{
+    struct runtime* self = 0;
+    EXPECT(self_, "Invalid parameter. Expected AcquireRuntime* got NULL.");
+    EXPECT(settings,
+           "Invalid parameter. Expected aq_properties_video_s* but got NULL.");
+    self = containerof(self_, struct runtime, handle);
+    EXPECT(self->state != DeviceState_Closed, "Device state is Closed.");
+    EXPECT(istream < self->video_stream_count,
+           "Invalid parameter: `istream` was out-of-bounds (%u).",
+           self->video_stream_count);
+    configure_stream(self, istream, settings);
+    update_state_after_configure(self);
+    return AcquireStatus_Ok;
+Error:
+    if (self_)
+        acquire_abort(self_);
+    if (self)
+        self->state = DeviceState_AwaitingConfiguration;
+    return AcquireStatus_Error;
+}
+
+static int
+get_video_stream_configuration(const struct video_s* const video,
+                               struct aq_properties_video_s* const pvideo)
+{
+    struct aq_properties_camera_s* const pcamera = &pvideo->camera;
+    struct aq_properties_storage_s* const pstorage = &pvideo->storage;
+    int is_ok = 1;
+
+    pvideo->frame_average_count = video->frame_average_count;
+    memset(pvideo->stages, 0, sizeof(pvideo->stages)); // NOLINT
+    for (uint32_t i = 0, j = 0;
+         i < video->stage_count && j < ACQUIRE_MAX_STAGE_COUNT;
+         ++i) {
+        if (video->stages[i]->kind != STAGE_KIND_FRAME_AVERAGE_SHORTHAND)
+            get_stage(video->stages[i], pvideo->stages + j++);
+    }
+    pvideo->channel_capacity_bytes = video->sink.in.capacity;
+    pvideo->mirror_channels = video->mirror_channels;
+    pvideo->monitor_overflow =
+      (enum AcquireMonitorOverflow)video->monitor.reader.overflow;
+
+    is_ok &= (video_source_get(&video->source,
+                               &pcamera->identifier,
+                               &pcamera->settings,
+                               &pvideo->max_frame_count) == Device_Ok);
+
+    is_ok &= (video_sink_get(&video->sink,
+                             &pstorage->identifier,
+                             &pstorage->settings,
+                             &pstorage->write_delay_ms,
+                             &pstorage->batch_bytes,
+                             &pstorage->batch_frames,
+                             &pstorage->min_batch_interval_ms) == Device_Ok);
+
+    struct aq_properties_storage_s* const pbranch = &pvideo->stage_storage;
+    pvideo->stage_output = video->is_branched ? AcquireStageOutput_Branch
+                                              : AcquireStageOutput_Inline;
+    is_ok &= (video_sink_get(&video->branch,
+                             &pbranch->identifier,
+                             &pbranch->settings,
+                             &pbranch->write_delay_ms,
+                             &pbranch->batch_bytes,
+                             &pbranch->batch_frames,
+                             &pbranch->min_batch_interval_ms) == Device_Ok);
+    return is_ok;
+}
+
 enum AcquireStatusCode
 acquire_get_configuration(const struct AcquireRuntime* self_,
                           struct AcquireProperties* settings)
@@ -364,23 +1119,14 @@ acquire_get_configuration(const struct AcquireRuntime* self_,
     EXPECT(settings,
            "Invalid parameter. Expected AcquireProperties* got NULL.");
     self = containerof(self_, struct runtime, handle);
-    for (uint32_t istream = 0; istream < countof(self->video); ++istream) {
-        const struct video_s* const video = self->video + istream;
+    for (uint32_t istream = 0; istream < countof(settings->video); ++istream) {
         struct aq_properties_video_s* const pvideo = settings->video + istream;
-        struct aq_properties_camera_s* const pcamera = &pvideo->camera;
-        struct aq_properties_storage_s* const pstorage = &pvideo->storage;
-
-        pvideo->frame_average_count = video->filter.filter_window_frames;
-
-        is_ok &= (video_source_get(&video->source,
-                                   &pcamera->identifier,
-                                   &pcamera->settings,
-                                   &pvideo->max_frame_count) == Device_Ok);
-
-        is_ok &= (video_sink_get(&video->sink,
-                                 &pstorage->identifier,
-                                 &pstorage->settings,
-                                 &pstorage->write_delay_ms) == Device_Ok);
+        if (istream < self->video_stream_count) {
+            is_ok &=
+              get_video_stream_configuration(self->video + istream, pvideo);
+        } else {
+            memset(pvideo, 0, sizeof(*pvideo)); // NOLINT
+        }
     }
 
     return is_ok ? AcquireStatus_Ok : AcquireStatus_Error;
@@ -388,6 +1134,54 @@ Error:
     return AcquireStatus_Error;
 }
 
+enum AcquireStatusCode
+acquire_get_video_stream_configuration(const struct AcquireRuntime* self_,
+                                       uint32_t istream,
+                                       struct aq_properties_video_s* settings)
+{
+    struct runtime* self = 0;
+    EXPECT(self_, "Invalid parameter. Expected AcquireRuntime* got NULL.");
+    EXPECT(settings,
+           "Invalid parameter. Expected aq_properties_video_s* got NULL.");
+    self = containerof(self_, struct runtime, handle);
+    EXPECT(istream < self->video_stream_count,
+           "Invalid parameter: `istream` was out-of-bounds (%u).",
+           self->video_stream_count);
+    return get_video_stream_configuration(self->video + istream, settings)
+             ? AcquireStatus_Ok
+             : AcquireStatus_Error;
+Error:
+    return AcquireStatus_Error;
+}
+
+static void
+get_video_stream_metadata(const struct video_s* const video,
+                          struct aq_metadata_video_s* const metadata)
+{
+    if (video->source.camera)
+        camera_get_meta(video->source.camera, &metadata->camera);
+    if (video->sink.storage)
+        storage_get_meta(video->sink.storage, &metadata->storage);
+    metadata->max_frame_count = (struct Property){
+        .writable = 1,
+        .low = 0.0f,
+        .high = -1.0f, // NOTE: (nclack) Not sure what's right here.
+        .type = PropertyType_FixedPrecision
+    };
+    metadata->frame_average_count =
+      (struct Property){ .writable = 1,
+                         .low = 0.0f,
+                         .high = -1.0f, // TODO: (nclack) Compute this. Depends
+                                        // on the queue and frame size
+                         .type = PropertyType_FixedPrecision };
+    metadata->channel_capacity_bytes = (struct Property){
+        .writable = 1,
+        .low = (float)min_channel_capacity_bytes(video),
+        .high = -1.0f,
+        .type = PropertyType_FixedPrecision
+    };
+}
+
 enum AcquireStatusCode
 acquire_get_configuration_metadata(const struct AcquireRuntime* self_,
                                    struct AcquirePropertyMetadata* metadata)
@@ -396,26 +1190,11 @@ acquire_get_configuration_metadata(const struct AcquireRuntime* self_,
     CHECK(self_);
     CHECK(metadata);
     self = containerof(self_, struct runtime, handle);
-    for (int i = 0; i < countof(metadata->video); ++i) {
-        if (self->video[i].source.camera)
-            camera_get_meta(self->video[i].source.camera,
-                            &metadata->video[i].camera);
-        if (self->video[i].sink.storage)
-            storage_get_meta(self->video[i].sink.storage,
-                             &metadata->video[i].storage);
-        metadata->video[i].max_frame_count = (struct Property){
-            .writable = 1,
-            .low = 0.0f,
-            .high = -1.0f, // NOTE: (nclack) Not sure what's right here.
-            .type = PropertyType_FixedPrecision
-        };
-        metadata->video[i].frame_average_count =
-          (struct Property){ .writable = 1,
-                             .low = 0.0f,
-                             .high =
-                               -1.0f, // TODO: (nclack) Compute this. Depends on
-                                      // the queue and frame size
-                             .type = PropertyType_FixedPrecision };
+    for (uint32_t i = 0; i < countof(metadata->video); ++i) {
+        if (i < self->video_stream_count)
+            get_video_stream_metadata(self->video + i, metadata->video + i);
+        else
+            memset(metadata->video + i, 0, sizeof(*metadata->video)); // NOLINT
     }
 
     return AcquireStatus_Ok;
@@ -423,6 +1202,31 @@ Error:
     return AcquireStatus_Error;
 }
 
+enum AcquireStatusCode
+acquire_get_video_stream_configuration_metadata(
+  const struct AcquireRuntime* self_,
+  uint32_t istream,
+  struct aq_metadata_video_s* metadata)
+{
+    struct runtime* self = 0;
+    CHECK(self_);
+    CHECK(metadata);
+    self = containerof(self_, struct runtime, handle);
+    CHECK(istream < self->video_stream_count);
+    get_video_stream_metadata(self->video + istream, metadata);
+    return AcquireStatus_Ok;
+Error:
+    return AcquireStatus_Error;
+}
+
+uint32_t
+acquire_get_video_stream_count(const struct AcquireRuntime* self_)
+{
+    if (!self_)
+        return 0;
+    return containerof(self_, struct runtime, handle)->video_stream_count;
+}
+
 size_t
 acquire_bytes_waiting_to_be_written_to_disk(const struct AcquireRuntime* self_,
                                             uint32_t istream)
@@ -430,13 +1234,35 @@ acquire_bytes_waiting_to_be_written_to_disk(const struct AcquireRuntime* self_,
     struct runtime* self = 0;
     CHECK(self_);
     self = containerof(self_, struct runtime, handle);
-    CHECK(istream < countof(self->video));
+    CHECK(istream < self->video_stream_count);
     const struct video_s* video = self->video + istream;
-    return video_sink_bytes_waiting(&video->sink);
+    return video_sink_bytes_waiting(&video->sink) +
+           (video->is_branched ? video_sink_bytes_waiting(&video->branch) : 0);
 Error:
     return 0;
 }
 
+enum AcquireStatusCode
+acquire_get_monitor_losses(const struct AcquireRuntime* self_,
+                           uint32_t istream,
+                           uint64_t* bytes,
+                           uint64_t* frames)
+{
+    const struct runtime* self = 0;
+    CHECK(self_);
+    self = containerof(self_, struct runtime, handle);
+    CHECK(istream < self->video_stream_count);
+    const struct video_s* video = self->video + istream;
+    if (bytes)
+        *bytes = channel_bytes_lost(&video->sink.in, &video->monitor.reader) -
+                 video->monitor.bytes_lost_at_start;
+    if (frames)
+        *frames = video->monitor.frames_lost;
+    return AcquireStatus_Ok;
+Error:
+    return AcquireStatus_Error;
+}
+
 static uint32_t
 count_devices_by_kind(const struct runtime* self, enum DeviceKind target_kind)
 {
@@ -489,7 +1315,7 @@ acquire_get_shape(const struct AcquireRuntime* self_,
     CHECK(self_);
     const struct runtime* const self =
       containerof(self_, struct runtime, handle);
-    CHECK(istream < countof(self->video));
+    CHECK(istream < self->video_stream_count);
     const struct video_s* const video = self->video + istream;
 
     CHECK_SILENT(self->state != DeviceState_AwaitingConfiguration);
@@ -504,31 +1330,38 @@ acquire_start(struct AcquireRuntime* self_)
 {
     struct runtime* self = containerof(self_, struct runtime, handle);
 
-    EXPECT(self->valid_video_streams > 0,
+    EXPECT(count_valid_video_streams(self) > 0,
            "At least one video stream must be marked valid");
 
-    for (int i = 0; i < countof(self->video); ++i) {
+    for (int i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping unconfirmed video stream %d", i);
             continue;
         }
 
+        // An attached monitor picks up at the first frame of this run.
+        monitor_restart(&video->sink.in, &video->monitor);
         CHECK(video_sink_start(&video->sink) == Device_Ok);
-        CHECK(video_filter_start(&video->filter) == Device_Ok);
+        if (video->is_branched) {
+            monitor_restart(&video->branch.in, &video->branch_monitor);
+            CHECK(video_sink_start(&video->branch) == Device_Ok);
+        }
+        for (uint32_t j = 0; j < video->stage_count; ++j)
+            CHECK(video_stage_start(video->stages[j]) == Device_Ok);
         CHECK(video_source_start(&video->source) == Device_Ok);
 
-        TRACE("START[%2d] sink:%d processing:%d camera:%d",
+        TRACE("START[%2d] sink:%d stages:%u camera:%d",
               i,
               video->sink.is_running,
-              video->filter.is_running,
+              video->stage_count,
               video->source.is_running);
     }
     self->state = DeviceState_Running;
     return AcquireStatus_Ok;
 Error:
-    for (int i = 0; i < countof(self->video); ++i) {
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+    for (int i = 0; i < self->video_stream_count; ++i) {
+        if (!self->valid_video_streams[i]) {
             TRACE("(Abort) Skipping disabled video stream %d", i);
             continue;
         }
@@ -539,41 +1372,33 @@ Error:
     return AcquireStatus_Error;
 }
 
-static size_t
-slice_size_bytes(const struct slice* slice)
-{
-    return (uint8_t*)slice->end - (uint8_t*)slice->beg;
-}
-
 enum AcquireStatusCode
 acquire_stop(struct AcquireRuntime* self_)
 {
     struct runtime* self = containerof(self_, struct runtime, handle);
 
-    for (size_t i = 0; i < countof(self->video); ++i) {
+    for (size_t i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping disabled video stream %d", i);
             continue;
         }
 
         ECHO(thread_join(&video->source.thread));
-        ECHO(thread_join(&video->filter.thread));
+        for (uint32_t j = 0; j < video->stage_count; ++j)
+            ECHO(thread_join(&video->stages[j]->thread));
         ECHO(thread_join(&video->sink.thread));
         channel_accept_writes(&video->sink.in, 1);
-
-        // If the monitor has been initialized and its read region hasn't
-        // already been released, flush it. This takes at most 2 iterations.
-        if (video->monitor.reader.id) {
-            size_t nbytes;
-            do {
-                struct slice slice =
-                  channel_read_map(&video->sink.in, &video->monitor.reader);
-                nbytes = slice_size_bytes(&slice);
-                channel_read_unmap(
-                  &video->sink.in, &video->monitor.reader, nbytes);
-                TRACE("[stream: %d] Monitor flushed %llu bytes", i, nbytes);
-            } while (nbytes);
+        // Nothing more is coming. Release anyone in acquire_map_read_wait().
+        channel_wake_reader(&video->sink.in, &video->monitor.reader);
+        monitor_flush(&video->sink.in, &video->monitor);
+
+        if (video->is_branched) {
+            ECHO(thread_join(&video->branch.thread));
+            channel_accept_writes(&video->branch.in, 1);
+            channel_wake_reader(&video->branch.in,
+                                &video->branch_monitor.reader);
+            monitor_flush(&video->branch.in, &video->branch_monitor);
         }
     }
     self->state = DeviceState_Armed;
@@ -586,15 +1411,17 @@ acquire_abort(struct AcquireRuntime* self_)
 {
     struct runtime* self = containerof(self_, struct runtime, handle);
 
-    for (size_t i = 0; i < countof(self->video); ++i) {
+    for (size_t i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping disabled video stream %d", i);
             continue;
         }
 
         video->source.is_stopping = 1;
         channel_accept_writes(&video->sink.in, 0);
+        if (video->is_branched)
+            channel_accept_writes(&video->branch.in, 0);
         // if the camera is waiting on a trigger, this will unblock it.
         camera_execute_trigger(video->source.camera);
     }
@@ -605,11 +1432,11 @@ acquire_abort(struct AcquireRuntime* self_)
 enum AcquireStatusCode
 acquire_execute_trigger(struct AcquireRuntime* self_, uint32_t istream)
 {
+    CHECK(self_);
     const struct runtime* const self =
       containerof(self_, struct runtime, handle);
+    CHECK(istream < self->video_stream_count);
     const struct video_s* const video = self->video + istream;
-    CHECK(self_);
-    CHECK(istream < countof(self->video));
     CHECK(video->source.camera);
     CHECK(camera_execute_trigger(video->source.camera) == Device_Ok);
     return AcquireStatus_Ok;
@@ -629,26 +1456,25 @@ acquire_get_state(struct AcquireRuntime* self_)
 
     // check that at least one pipeline has active threads
     uint8_t is_running = 0;
-    for (int i = 0; i < countof(self->video); ++i) {
+    for (int i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping video stream %d", i);
             continue;
         }
 
         TRACE("source %s running, %s stopping\n"
-              "filter %s running, %s stopping\n"
               "  sink %s running, %s stopping",
               video->source.is_running ? "" : "not",
               video->source.is_stopping ? "" : "not",
-              video->filter.is_running ? "" : "not",
-              video->filter.is_stopping ? "" : "not",
               video->sink.is_running ? "" : "not",
               video->sink.is_stopping ? "" : "not");
 
         is_running |= video->source.is_running;
-        is_running |= video->filter.is_running;
+        for (uint32_t j = 0; j < video->stage_count; ++j)
+            is_running |= video->stages[j]->is_running;
         is_running |= video->sink.is_running;
+        is_running |= video->branch.is_running;
 
         if (is_running)
             break;
@@ -695,9 +1521,9 @@ unit_test__monitor_uninitialized_on_stop(
     struct runtime* self = containerof(runtime, struct runtime, handle);
 
     // monitor ID is 0 before starting
-    for (size_t i = 0; i < countof(self->video); ++i) {
+    for (size_t i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping unconfigured video stream %d", i);
             continue;
         }
@@ -707,9 +1533,9 @@ unit_test__monitor_uninitialized_on_stop(
 
     // monitor ID is 0 during acquisition
     OK(acquire_start(runtime));
-    for (size_t i = 0; i < countof(self->video); ++i) {
+    for (size_t i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping unconfigured video stream %d", i);
             continue;
         }
@@ -719,9 +1545,9 @@ unit_test__monitor_uninitialized_on_stop(
 
     // monitor ID is 0 when stopped
     OK(acquire_stop(runtime));
-    for (size_t i = 0; i < countof(self->video); ++i) {
+    for (size_t i = 0; i < self->video_stream_count; ++i) {
         struct video_s* video = self->video + i;
-        if (((self->valid_video_streams >> i) & 1) == 0) {
+        if (!self->valid_video_streams[i]) {
             TRACE("Skipping unconfigured video stream %d", i);
             continue;
         }
@@ -16,41 +16,210 @@ extern "C"
         AcquireStatus_Error,
     };
 
+    /// What a stream does when the reader behind `acquire_map_read()` falls
+    /// behind.
+    enum AcquireMonitorOverflow
+    {
+        /// Wait for the monitor to catch up. Storage may be throttled by a
+        /// slow monitor.
+        AcquireMonitorOverflow_Block = 0,
+
+        /// Drop the oldest frames the monitor hasn't read yet. A region mapped
+        /// by `acquire_map_read()` is never overwritten, so holding one still
+        /// throttles the stream.
+        AcquireMonitorOverflow_DropOldest,
+
+        /// Never wait for the monitor. A mapped region may be overwritten
+        /// while it is in use.
+        AcquireMonitorOverflow_Lossy,
+    };
+
+/// Number of video streams a runtime made with `acquire_init()` has. This is
+/// also how many streams `AcquireProperties` and `AcquirePropertyMetadata`
+/// describe.
+#define ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT (2)
+#define ACQUIRE_MAX_VIDEO_STREAM_COUNT (256)
+
+/// Number of processing stages `aq_properties_video_s::stages` can list.
+#define ACQUIRE_MAX_STAGE_COUNT (4)
+
+    /// Processing a stream can apply to frames between the camera and
+    /// storage.
+    enum AcquireStageKind
+    {
+        /// Ends the list of stages.
+        AcquireStage_None = 0,
+
+        /// Averages frames over `average.frame_count` frames and emits f32
+        /// frames. See `AcquireAverageMode`.
+        AcquireStage_Average,
+
+        AcquireStageKindCount,
+    };
+
+    /// How `AcquireStage_Average` combines frames.
+    enum AcquireAverageMode
+    {
+        /// Emits the mean of each run of `frame_count` frames, so one frame
+        /// goes out for every `frame_count` in.
+        AcquireAverage_Tumbling = 0,
+
+        /// Emits the mean of the last `frame_count` frames for every frame.
+        /// `frame_count` can be at most 256.
+        AcquireAverage_Sliding,
+
+        /// Emits an exponential moving average for every frame. The newest
+        /// frame is weighted by `alpha`.
+        AcquireAverage_Exponential,
+
+        AcquireAverageModeCount,
+    };
+
+    /// What an `AcquireAverage_Tumbling` stage emits for each window.
+    enum AcquireAverageOutput
+    {
+        /// The mean, as f32.
+        AcquireAverageOutput_Float = 0,
+
+        /// The mean, rounded to the input's sample type. Sums are kept in
+        /// u32, so frames come out the size they went in. Needs unsigned
+        /// samples of up to 16 bits and at most 65535 frames.
+        AcquireAverageOutput_Native,
+
+        /// The sum, as u32. Needs unsigned samples of up to 16 bits and at
+        /// most 65535 frames.
+        AcquireAverageOutput_Sum,
+
+        AcquireAverageOutputCount,
+    };
+
+    /// Parameters for `AcquireStage_Average`.
+    struct aq_properties_stage_average_s
+    {
+        uint32_t frame_count;
+        /// Threads that share each frame. Zero selects one.
+        uint32_t thread_count;
+        enum AcquireAverageMode mode;
+        /// Weight of the newest frame for `AcquireAverage_Exponential`, in
+        /// (0, 1]. Zero selects `2 / (frame_count + 1)`.
+        float alpha;
+        /// Only tumbling windows support outputs other than
+        /// `AcquireAverageOutput_Float`.
+        enum AcquireAverageOutput output;
+    };
+
+    /// Where a stream's processing stages send the frames they produce.
+    enum AcquireStageOutput
+    {
+        /// The stages sit between the camera and storage, so storage and
+        /// `acquire_map_read()` see their output.
+        AcquireStageOutput_Inline = 0,
+
+        /// Storage and `acquire_map_read()` see the camera's frames. The
+        /// stages read the same frames, without a copy, and their output
+        /// goes to `stage_storage` and `acquire_map_read_stage_output()`. A
+        /// slow stage throttles the camera's frames as a slow storage device
+        /// would.
+        AcquireStageOutput_Branch,
+
+        AcquireStageOutputCount,
+    };
+
+    /// One step in a stream's processing chain. Each stage runs on its own
+    /// thread and hands frames to the next without copying them.
+    struct aq_properties_stage_s
+    {
+        enum AcquireStageKind kind;
+        union
+        {
+            struct aq_properties_stage_average_s average;
+        };
+    };
+
     struct AcquireRuntime
     {
         void* impl;
     };
 
-    struct AcquireProperties
+    /// Configuration for one video stream.
+    struct aq_properties_video_s
     {
-        struct aq_properties_video_s
+        struct aq_properties_camera_s
         {
-            struct aq_properties_camera_s
-            {
-                struct DeviceIdentifier identifier;
-                struct CameraProperties settings;
-            } camera;
-            struct aq_properties_storage_s
-            {
-                struct DeviceIdentifier identifier;
-                struct StorageProperties settings;
-                float write_delay_ms;
-            } storage;
-            uint64_t max_frame_count;
-            uint32_t frame_average_count;
-        } video[2];
+            struct DeviceIdentifier identifier;
+            struct CameraProperties settings;
+        } camera;
+        struct aq_properties_storage_s
+        {
+            struct DeviceIdentifier identifier;
+            struct StorageProperties settings;
+            float write_delay_ms;
+            /// Storage is appended to once this many bytes or frames are
+            /// queued, whichever comes first, rather than on every frame.
+            /// Zero disables a threshold. Partial batches are still
+            /// appended within 100 ms.
+            uint64_t batch_bytes;
+            uint32_t batch_frames;
+            /// Minimum time between appends to storage. Zero disables.
+            float min_batch_interval_ms;
+        } storage;
+        uint64_t max_frame_count;
+        /// Averages this many frames on one thread after any `stages`. Set
+        /// `stages[i].average.thread_count` to average on more threads.
+        uint32_t frame_average_count;
+        /// Size of each of this stream's frame queues in bytes. Zero
+        /// selects the default of 1 GiB. Memory is only committed as the
+        /// queue is used. Can't be changed while running.
+        uint64_t channel_capacity_bytes;
+        /// Nonzero maps each of this stream's frame queues twice, back to
+        /// back, so frames never skip the end of a queue and every read is
+        /// one span. The capacity is rounded up to a whole number of pages.
+        /// Only Linux supports it. Other platforms use regular queues. Can't
+        /// be changed while running.
+        uint8_t mirror_channels;
+        /// Can't be changed while a region is mapped by
+        /// `acquire_map_read()`.
+        enum AcquireMonitorOverflow monitor_overflow;
+        /// Processing applied to frames, in order, before they're stored.
+        /// The list ends at the first `AcquireStage_None`. An averaging
+        /// stage set up by `frame_average_count` runs after these. Can't be
+        /// changed while running.
+        struct aq_properties_stage_s stages[ACQUIRE_MAX_STAGE_COUNT];
+        /// `AcquireStageOutput_Branch` needs at least one stage. Can't be
+        /// changed while running.
+        enum AcquireStageOutput stage_output;
+        /// Records the stages' output when `stage_output` is
+        /// `AcquireStageOutput_Branch`. Selecting no device selects the
+        /// default. Otherwise unused.
+        struct aq_properties_storage_s stage_storage;
+    };
+
+    /// Configuration for the first `ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT` video
+    /// streams. Use `acquire_configure_video_stream()` and friends to address
+    /// any stream on a runtime with more.
+    struct AcquireProperties
+    {
+        struct aq_properties_video_s video[ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT];
     };
 
+    /// Metadata for one video stream.
+    struct aq_metadata_video_s
+    {
+        struct CameraPropertyMetadata camera;
+        struct StoragePropertyMetadata storage;
+        //  description
+        struct Property max_frame_count;
+        struct Property frame_average_count;
+        /// `low` is the smallest capacity that holds two frames of the
+        /// current camera shape.
+        struct Property channel_capacity_bytes;
+    };
+
+    /// Metadata for the first `ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT` video
+    /// streams. See `acquire_get_video_stream_configuration_metadata()`.
     struct AcquirePropertyMetadata
     {
-        struct aq_metadata_video_s
-        {
-            struct CameraPropertyMetadata camera;
-            struct StoragePropertyMetadata storage;
-            //  description
-            struct Property max_frame_count;
-            struct Property frame_average_count;
-        } video[2];
+        struct aq_metadata_video_s video[ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT];
     };
 
     const char* acquire_api_version_string();
@@ -78,12 +247,75 @@ extern "C"
                                                          const char* function,
                                                          const char* msg));
 
+    /// Like `acquire_init()`, but with `video_stream_count` video streams.
+    ///
+    /// Each stream has its own camera, storage, threads and frame queues.
+    /// `acquire_configure()` and `acquire_get_configuration()` cover the
+    /// first `ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT` of them.
+    ///
+    /// @param[in] reporter A callback function invoked when there is some
+    ///                     logging output.
+    /// @param[in] video_stream_count Between 1 and
+    ///                               `ACQUIRE_MAX_VIDEO_STREAM_COUNT`.
+    /// @return runtime     A pointer to the runtime object, or NULL on
+    ///                     failure. Freed by `acquire_shutdown()`.
+    struct AcquireRuntime* acquire_init_with_video_streams(
+      void (*reporter)(int is_error,
+                       const char* file,
+                       int line,
+                       const char* function,
+                       const char* msg),
+      uint32_t video_stream_count);
+
     enum AcquireStatusCode acquire_shutdown(struct AcquireRuntime* self);
 
+    /// @returns the number of video streams `self` was created with, or 0 if
+    ///          `self` is NULL.
+    uint32_t acquire_get_video_stream_count(const struct AcquireRuntime* self);
+
+    /// Configures the first `ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT` video
+    /// streams. Other streams are left as they are.
+    ///
+    /// A stream with neither a camera nor storage selected is disabled. On a
+    /// runtime with fewer streams than `settings` describes, the extra
+    /// entries must be disabled.
     enum AcquireStatusCode acquire_configure(
       struct AcquireRuntime* self,
       struct AcquireProperties* settings);
 
+    /// Configures the `istream`'th video stream. Like `acquire_configure()`,
+    /// but for a single stream, and any stream on the runtime can be
+    /// addressed.
+    ///
+    /// @param[in]    self     AcquireRuntime. The runtime to configure.
+    /// @param[in]    istream  Index of the video stream to configure.
+    /// @param[inout] settings Must not be NULL. Updated with the settings
+    ///                        actually applied.
+    enum AcquireStatusCode acquire_configure_video_stream(
+      struct AcquireRuntime* self,
+      uint32_t istream,
+      struct aq_properties_video_s* settings);
+
+    /// @param[in]  self     AcquireRuntime. The runtime context to query.
+    /// @param[in]  istream  Index of the video stream to query.
+    /// @param[out] settings Must not be NULL. Populated with the result.
+    enum AcquireStatusCode acquire_get_video_stream_configuration(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      struct aq_properties_video_s* settings);
+
+    /// @param[in]  self     AcquireRuntime. The runtime context to query.
+    /// @param[in]  istream  Index of the video stream to query.
+    /// @param[out] metadata Must not be NULL. Populated with the result.
+    enum AcquireStatusCode acquire_get_video_stream_configuration_metadata(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      struct aq_metadata_video_s* metadata);
+
+    /// Reports the configuration of the first
+    /// `ACQUIRE_DEFAULT_VIDEO_STREAM_COUNT` video streams. Entries past the
+    /// runtime's last stream are zeroed.
+    ///
     /// @param[in]  self        AcquireRuntime. The runtime context to query.
     /// @param[out] properties  Must not be NULL. Populated with the result.
     enum AcquireStatusCode acquire_get_configuration(
@@ -134,13 +366,39 @@ extern "C"
     /// data. When no new data is available an empty region is returned
     /// (`*beg==*end`) - this call does not wait for data.
     ///
-    /// Holding on to a mapped region will prevent writers from making progress.
-    /// Call `acquire_unmap_read()` to release.
+    /// Holding on to a mapped region will prevent writers from making progress
+    /// unless the stream's `monitor_overflow` is
+    /// `AcquireMonitorOverflow_Lossy`. Call `acquire_unmap_read()` to release.
     enum AcquireStatusCode acquire_map_read(const struct AcquireRuntime* self,
                                             uint32_t istream,
                                             struct VideoFrame** beg,
                                             struct VideoFrame** end);
 
+    /// @brief Like `acquire_map_read()`, but waits for data.
+    /// @see acquire_map_read()
+    /// @param[in] self 'runtime' reference.
+    /// @param[in] stream Integer index selecting the video output stream to
+    ///                   read.
+    /// @param[in] timeout_ms The longest time to wait for data in
+    ///                       milliseconds.
+    /// @param[out] beg Must be non-NULL. Populated with the starting address
+    ///                 the memory region mapped for reading.
+    /// @param[out] end Must be non-NULL. Populated with the ending address of
+    ///                 the memory region mapped for reading.
+    /// @returns AcquireStatus_Error if there was an error, otherwise
+    /// AcquireStatus_Ok.
+    ///
+    /// Blocks until data is available on the `istream`'th stream, `timeout_ms`
+    /// elapses, or acquisition stops. The calling thread sleeps while it
+    /// waits and is woken as soon as the next frame is written. If no data
+    /// arrived in time, an empty region is returned (`*beg==*end`).
+    enum AcquireStatusCode acquire_map_read_wait(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      float timeout_ms,
+      struct VideoFrame** beg,
+      struct VideoFrame** end);
+
     /// @brief Releases the read region reserved for the `istream`'th video
     /// stream.
     /// @see acquire_map_read()
@@ -152,6 +410,54 @@ extern "C"
                                               uint32_t istream,
                                               size_t consumed_bytes);
 
+    /// @brief Like `acquire_map_read()`, but reads the frames the
+    /// `istream`'th stream's stages produce when its `stage_output` is
+    /// `AcquireStageOutput_Branch`.
+    /// @see acquire_unmap_read_stage_output()
+    ///
+    /// This reader has its own position, independent of the one behind
+    /// `acquire_map_read()`, and follows the same `monitor_overflow` policy.
+    enum AcquireStatusCode acquire_map_read_stage_output(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      struct VideoFrame** beg,
+      struct VideoFrame** end);
+
+    /// @brief Like `acquire_map_read_stage_output()`, but waits for data the
+    /// way `acquire_map_read_wait()` does.
+    enum AcquireStatusCode acquire_map_read_stage_output_wait(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      float timeout_ms,
+      struct VideoFrame** beg,
+      struct VideoFrame** end);
+
+    /// @brief Releases the region reserved by
+    /// `acquire_map_read_stage_output()`.
+    enum AcquireStatusCode acquire_unmap_read_stage_output(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      size_t consumed_bytes);
+
+    /// @brief Reports the data the `istream`'th stream's monitor has missed
+    /// because of its `monitor_overflow` policy.
+    /// @param[in] self 'runtime' reference.
+    /// @param[in] istream Integer index selecting the video output stream.
+    /// @param[out] bytes May be NULL. Populated with the number of bytes lost
+    ///                   since acquisition last started.
+    /// @param[out] frames May be NULL. Populated with the number of frames
+    ///                    lost since acquisition last started.
+    ///
+    /// Frames are counted from the start of acquisition if the monitor has
+    /// read from the stream before, otherwise from the first frame it reads.
+    /// With `AcquireMonitorOverflow_Lossy`, frames in a mapped region that
+    /// were overwritten before `acquire_unmap_read()` count as lost.
+    enum AcquireStatusCode acquire_get_monitor_losses(
+      const struct AcquireRuntime* self,
+      uint32_t istream,
+      uint64_t* bytes,
+      uint64_t* frames);
+
     size_t acquire_bytes_waiting_to_be_written_to_disk(
       const struct AcquireRuntime* self,
       uint32_t istream);
@@ -0,0 +1,323 @@
+//! AVX2 accumulate kernels. See accumulate.h.
+//!
+//! These are compiled for AVX2 regardless of the target's compile flags and
+//! are only called once accumulate_kernels_get() has checked the CPU.
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include "accumulate.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define AVX2 __attribute__((target("avx2")))
+#else
+#define AVX2
+#endif
+
+// Each loader widens 8 samples starting at `p` to f32.
+
+static inline AVX2 __m256
+widen_u8(const uint8_t* p)
+{
+    const __m128i v = _mm_loadl_epi64((const __m128i*)p);
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+}
+
+static inline AVX2 __m256
+widen_i8(const int8_t* p)
+{
+    const __m128i v = _mm_loadl_epi64((const __m128i*)p);
+    return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v));
+}
+
+static inline AVX2 __m256
+widen_u16(const uint16_t* p)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v));
+}
+
+static inline AVX2 __m256
+widen_i16(const int16_t* p)
+{
+    const __m128i v = _mm_loadu_si128((const __m128i*)p);
+    return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v));
+}
+
+static inline AVX2 __m256
+widen_f32(const float* p)
+{
+    return _mm256_loadu_ps(p);
+}
+
+/// AVX2 only converts signed integers, so the halves are converted apart.
+/// Both are exact, so the sum is rounded once, like a scalar conversion.
+static inline AVX2 __m256
+widen_u32(const uint32_t* p)
+{
+    const __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    const __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+    const __m256 lo =
+      _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xffff)));
+    return _mm256_add_ps(_mm256_mul_ps(hi, _mm256_set1_ps(65536.0f)), lo);
+}
+
+// Integer loaders widen 8 samples to u32, and the narrowers store 8 u32s
+// that are known to fit back in the sample type.
+
+static inline AVX2 __m256i
+widen32_u8(const uint8_t* p)
+{
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+}
+
+static inline AVX2 __m256i
+widen32_u16(const uint16_t* p)
+{
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)p));
+}
+
+static inline AVX2 void
+narrow_u8(uint8_t* p, __m256i v)
+{
+    const __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                       _mm256_extracti128_si256(v, 1));
+    _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(w, w));
+}
+
+static inline AVX2 void
+narrow_u16(uint16_t* p, __m256i v)
+{
+    const __m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                       _mm256_extracti128_si256(v, 1));
+    _mm_storeu_si128((__m128i*)p, w);
+}
+
+/// accumulate_divide() for 8 lanes.
+static inline AVX2 __m256i
+divide_epu32(__m256i x, __m256i m, __m128i shift1, __m128i shift2)
+{
+    const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(x, m), 32);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), m);
+    const __m256i t = _mm256_blend_epi32(even, odd, 0xaa);
+    const __m256i d = _mm256_srl_epi32(_mm256_sub_epi32(x, t), shift1);
+    return _mm256_srl_epi32(_mm256_add_epi32(t, d), shift2);
+}
+
+// Two vectors per iteration keeps a couple of loads in flight. The tails use
+// the same operations in the same order as the scalar kernels, so results
+// match them exactly.
+#define AVX2_KERNELS(name, T)                                                  \
+    static AVX2 void load_##name(                                              \
+      float* restrict acc, const void* in_, size_t count, float scale)         \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        const __m256 s = _mm256_set1_ps(scale);                                \
+        size_t i = 0;                                                          \
+        for (; i + 16 <= count; i += 16) {                                     \
+            const __m256 a = _mm256_mul_ps(widen_##name(in + i), s);           \
+            const __m256 b = _mm256_mul_ps(widen_##name(in + i + 8), s);       \
+            _mm256_storeu_ps(acc + i, a);                                      \
+            _mm256_storeu_ps(acc + i + 8, b);                                  \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] = (float)in[i] * scale;                                     \
+    }                                                                          \
+    static AVX2 void add_##name(                                               \
+      float* restrict acc, const void* in_, size_t count, float scale)         \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        const __m256 s = _mm256_set1_ps(scale);                                \
+        size_t i = 0;                                                          \
+        for (; i + 16 <= count; i += 16) {                                     \
+            const __m256 a = _mm256_add_ps(_mm256_loadu_ps(acc + i),           \
+                                           widen_##name(in + i));              \
+            const __m256 b = _mm256_add_ps(_mm256_loadu_ps(acc + i + 8),       \
+                                           widen_##name(in + i + 8));          \
+            _mm256_storeu_ps(acc + i, _mm256_mul_ps(a, s));                    \
+            _mm256_storeu_ps(acc + i + 8, _mm256_mul_ps(b, s));                \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] = (acc[i] + (float)in[i]) * scale;                          \
+    }                                                                          \
+    static AVX2 void slide_##name(float* restrict sum,                         \
+                                  float* restrict out,                         \
+                                  void* history_,                              \
+                                  const void* in_,                             \
+                                  size_t count,                                \
+                                  float scale)                                 \
+    {                                                                          \
+        T* restrict history = (T*)history_;                                    \
+        const T* restrict in = (const T*)in_;                                  \
+        const __m256 s = _mm256_set1_ps(scale);                                \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            __m256 a = _mm256_sub_ps(_mm256_loadu_ps(sum + i),                 \
+                                     widen_##name(history + i));               \
+            a = _mm256_add_ps(a, widen_##name(in + i));                        \
+            memcpy(history + i, in + i, 8 * sizeof(T)); /* NOLINT */           \
+            _mm256_storeu_ps(sum + i, a);                                      \
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(a, s));                    \
+        }                                                                      \
+        for (; i < count; ++i) {                                               \
+            sum[i] = (sum[i] - (float)history[i]) + (float)in[i];              \
+            history[i] = in[i];                                                \
+            out[i] = sum[i] * scale;                                           \
+        }                                                                      \
+    }                                                                          \
+    static AVX2 void ema_##name(float* restrict acc,                           \
+                                float* restrict out,                           \
+                                const void* in_,                               \
+                                size_t count,                                  \
+                                float alpha)                                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        const __m256 w = _mm256_set1_ps(alpha);                                \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            const __m256 a = _mm256_loadu_ps(acc + i);                         \
+            const __m256 d = _mm256_sub_ps(widen_##name(in + i), a);           \
+            const __m256 r = _mm256_add_ps(a, _mm256_mul_ps(d, w));            \
+            _mm256_storeu_ps(acc + i, r);                                      \
+            _mm256_storeu_ps(out + i, r);                                      \
+        }                                                                      \
+        for (; i < count; ++i) {                                               \
+            acc[i] = acc[i] + ((float)in[i] - acc[i]) * alpha;                 \
+            out[i] = acc[i];                                                   \
+        }                                                                      \
+    }
+
+AVX2_KERNELS(u8, uint8_t)
+AVX2_KERNELS(u16, uint16_t)
+AVX2_KERNELS(i8, int8_t)
+AVX2_KERNELS(i16, int16_t)
+AVX2_KERNELS(f32, float)
+AVX2_KERNELS(u32, uint32_t)
+
+#undef AVX2_KERNELS
+
+#define AVX2_U32_KERNELS(name, T)                                              \
+    static AVX2 void iload_##name(                                             \
+      uint32_t* restrict acc, const void* in_, size_t count)                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8)                                         \
+            _mm256_storeu_si256((__m256i*)(acc + i), widen32_##name(in + i));  \
+        for (; i < count; ++i)                                                 \
+            acc[i] = in[i];                                                    \
+    }                                                                          \
+    static AVX2 void iadd_##name(                                              \
+      uint32_t* restrict acc, const void* in_, size_t count)                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            const __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i));   \
+            _mm256_storeu_si256((__m256i*)(acc + i),                           \
+                                _mm256_add_epi32(a, widen32_##name(in + i)));  \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] += in[i];                                                   \
+    }                                                                          \
+    static AVX2 void imean_##name(void* out_,                                  \
+                                  const uint32_t* restrict acc,                \
+                                  const void* in_,                             \
+                                  size_t count,                                \
+                                  const struct accumulate_divisor* d)          \
+    {                                                                          \
+        T* restrict out = (T*)out_;                                            \
+        const T* restrict in = (const T*)in_;                                  \
+        const uint32_t half = d->n / 2;                                        \
+        const __m256i h = _mm256_set1_epi32((int)half);                        \
+        const __m256i m = _mm256_set1_epi32((int)d->multiplier);               \
+        const __m128i s1 = _mm_cvtsi32_si128((int)d->shift1);                  \
+        const __m128i s2 = _mm_cvtsi32_si128((int)d->shift2);                  \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            __m256i x = _mm256_loadu_si256((const __m256i*)(acc + i));         \
+            x = _mm256_add_epi32(x, widen32_##name(in + i));                   \
+            x = _mm256_add_epi32(x, h);                                        \
+            narrow_##name(out + i, divide_epu32(x, m, s1, s2));                \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            out[i] = (T)accumulate_divide(acc[i] + in[i] + half, d);           \
+    }
+
+AVX2_U32_KERNELS(u8, uint8_t)
+AVX2_U32_KERNELS(u16, uint16_t)
+
+#undef AVX2_U32_KERNELS
+
+const struct accumulate_kernels accumulate_kernels_avx2 = {
+    .name = "avx2",
+    .load = {
+        [SampleType_u8] = load_u8,
+        [SampleType_u16] = load_u16,
+        [SampleType_i8] = load_i8,
+        [SampleType_i16] = load_i16,
+        [SampleType_f32] = load_f32,
+        [SampleType_u10] = load_u16,
+        [SampleType_u12] = load_u16,
+        [SampleType_u14] = load_u16,
+        [SampleType_u32] = load_u32,
+    },
+    .add = {
+        [SampleType_u8] = add_u8,
+        [SampleType_u16] = add_u16,
+        [SampleType_i8] = add_i8,
+        [SampleType_i16] = add_i16,
+        [SampleType_f32] = add_f32,
+        [SampleType_u10] = add_u16,
+        [SampleType_u12] = add_u16,
+        [SampleType_u14] = add_u16,
+        [SampleType_u32] = add_u32,
+    },
+    .slide = {
+        [SampleType_u8] = slide_u8,
+        [SampleType_u16] = slide_u16,
+        [SampleType_i8] = slide_i8,
+        [SampleType_i16] = slide_i16,
+        [SampleType_f32] = slide_f32,
+        [SampleType_u10] = slide_u16,
+        [SampleType_u12] = slide_u16,
+        [SampleType_u14] = slide_u16,
+        [SampleType_u32] = slide_u32,
+    },
+    .ema = {
+        [SampleType_u8] = ema_u8,
+        [SampleType_u16] = ema_u16,
+        [SampleType_i8] = ema_i8,
+        [SampleType_i16] = ema_i16,
+        [SampleType_f32] = ema_f32,
+        [SampleType_u10] = ema_u16,
+        [SampleType_u12] = ema_u16,
+        [SampleType_u14] = ema_u16,
+        [SampleType_u32] = ema_u32,
+    },
+    .load_u32 = {
+        [SampleType_u8] = iload_u8,
+        [SampleType_u16] = iload_u16,
+        [SampleType_u10] = iload_u16,
+        [SampleType_u12] = iload_u16,
+        [SampleType_u14] = iload_u16,
+    },
+    .add_u32 = {
+        [SampleType_u8] = iadd_u8,
+        [SampleType_u16] = iadd_u16,
+        [SampleType_u10] = iadd_u16,
+        [SampleType_u12] = iadd_u16,
+        [SampleType_u14] = iadd_u16,
+    },
+    .mean_u32 = {
+        [SampleType_u8] = imean_u8,
+        [SampleType_u16] = imean_u16,
+        [SampleType_u10] = imean_u16,
+        [SampleType_u12] = imean_u16,
+        [SampleType_u14] = imean_u16,
+    },
+};
+
+#endif // x86_64
@@ -0,0 +1,512 @@
+#include "accumulate.h"
+#include "logger.h"
+
+#include <stdint.h>
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define HAVE_AVX2_KERNELS
+extern const struct accumulate_kernels accumulate_kernels_avx2;
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define HAVE_NEON_KERNELS
+extern const struct accumulate_kernels accumulate_kernels_neon;
+#endif
+
+#define SCALAR_KERNELS(name, T)                                                \
+    static void load_##name(                                                   \
+      float* restrict acc, const void* in_, size_t count, float scale)         \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        for (size_t i = 0; i < count; ++i)                                     \
+            acc[i] = (float)in[i] * scale;                                     \
+    }                                                                          \
+    static void add_##name(                                                    \
+      float* restrict acc, const void* in_, size_t count, float scale)         \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        for (size_t i = 0; i < count; ++i)                                     \
+            acc[i] = (acc[i] + (float)in[i]) * scale;                          \
+    }                                                                          \
+    static void slide_##name(float* restrict sum,                              \
+                             float* restrict out,                              \
+                             void* history_,                                   \
+                             const void* in_,                                  \
+                             size_t count,                                     \
+                             float scale)                                      \
+    {                                                                          \
+        T* restrict history = (T*)history_;                                    \
+        const T* restrict in = (const T*)in_;                                  \
+        for (size_t i = 0; i < count; ++i) {                                   \
+            sum[i] = (sum[i] - (float)history[i]) + (float)in[i];              \
+            history[i] = in[i];                                                \
+            out[i] = sum[i] * scale;                                           \
+        }                                                                      \
+    }                                                                          \
+    static void ema_##name(float* restrict acc,                                \
+                           float* restrict out,                                \
+                           const void* in_,                                    \
+                           size_t count,                                       \
+                           float alpha)                                        \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        for (size_t i = 0; i < count; ++i) {                                   \
+            acc[i] = acc[i] + ((float)in[i] - acc[i]) * alpha;                 \
+            out[i] = acc[i];                                                   \
+        }                                                                      \
+    }
+
+SCALAR_KERNELS(u8, uint8_t)
+SCALAR_KERNELS(u16, uint16_t)
+SCALAR_KERNELS(i8, int8_t)
+SCALAR_KERNELS(i16, int16_t)
+SCALAR_KERNELS(f32, float)
+SCALAR_KERNELS(u32, uint32_t)
+
+#undef SCALAR_KERNELS
+
+#define SCALAR_U32_KERNELS(name, T)                                            \
+    static void iload_##name(                                                  \
+      uint32_t* restrict acc, const void* in_, size_t count)                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        for (size_t i = 0; i < count; ++i)                                     \
+            acc[i] = in[i];                                                    \
+    }                                                                          \
+    static void iadd_##name(                                                   \
+      uint32_t* restrict acc, const void* in_, size_t count)                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        for (size_t i = 0; i < count; ++i)                                     \
+            acc[i] += in[i];                                                   \
+    }                                                                          \
+    static void imean_##name(void* out_,                                       \
+                             const uint32_t* restrict acc,                     \
+                             const void* in_,                                  \
+                             size_t count,                                     \
+                             const struct accumulate_divisor* d)               \
+    {                                                                          \
+        T* restrict out = (T*)out_;                                            \
+        const T* restrict in = (const T*)in_;                                  \
+        const uint32_t half = d->n / 2;                                        \
+        for (size_t i = 0; i < count; ++i)                                     \
+            out[i] = (T)accumulate_divide(acc[i] + in[i] + half, d);           \
+    }
+
+SCALAR_U32_KERNELS(u8, uint8_t)
+SCALAR_U32_KERNELS(u16, uint16_t)
+
+#undef SCALAR_U32_KERNELS
+
+static const struct accumulate_kernels accumulate_kernels_scalar = {
+    .name = "scalar",
+    .load = {
+        [SampleType_u8] = load_u8,
+        [SampleType_u16] = load_u16,
+        [SampleType_i8] = load_i8,
+        [SampleType_i16] = load_i16,
+        [SampleType_f32] = load_f32,
+        [SampleType_u10] = load_u16,
+        [SampleType_u12] = load_u16,
+        [SampleType_u14] = load_u16,
+        [SampleType_u32] = load_u32,
+    },
+    .add = {
+        [SampleType_u8] = add_u8,
+        [SampleType_u16] = add_u16,
+        [SampleType_i8] = add_i8,
+        [SampleType_i16] = add_i16,
+        [SampleType_f32] = add_f32,
+        [SampleType_u10] = add_u16,
+        [SampleType_u12] = add_u16,
+        [SampleType_u14] = add_u16,
+        [SampleType_u32] = add_u32,
+    },
+    .slide = {
+        [SampleType_u8] = slide_u8,
+        [SampleType_u16] = slide_u16,
+        [SampleType_i8] = slide_i8,
+        [SampleType_i16] = slide_i16,
+        [SampleType_f32] = slide_f32,
+        [SampleType_u10] = slide_u16,
+        [SampleType_u12] = slide_u16,
+        [SampleType_u14] = slide_u16,
+        [SampleType_u32] = slide_u32,
+    },
+    .ema = {
+        [SampleType_u8] = ema_u8,
+        [SampleType_u16] = ema_u16,
+        [SampleType_i8] = ema_i8,
+        [SampleType_i16] = ema_i16,
+        [SampleType_f32] = ema_f32,
+        [SampleType_u10] = ema_u16,
+        [SampleType_u12] = ema_u16,
+        [SampleType_u14] = ema_u16,
+        [SampleType_u32] = ema_u32,
+    },
+    .load_u32 = {
+        [SampleType_u8] = iload_u8,
+        [SampleType_u16] = iload_u16,
+        [SampleType_u10] = iload_u16,
+        [SampleType_u12] = iload_u16,
+        [SampleType_u14] = iload_u16,
+    },
+    .add_u32 = {
+        [SampleType_u8] = iadd_u8,
+        [SampleType_u16] = iadd_u16,
+        [SampleType_u10] = iadd_u16,
+        [SampleType_u12] = iadd_u16,
+        [SampleType_u14] = iadd_u16,
+    },
+    .mean_u32 = {
+        [SampleType_u8] = imean_u8,
+        [SampleType_u16] = imean_u16,
+        [SampleType_u10] = imean_u16,
+        [SampleType_u12] = imean_u16,
+        [SampleType_u14] = imean_u16,
+    },
+};
+
+static int
+cpu_has_avx2(void)
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER) && defined(_M_X64)
+    int r[4] = { 0 };
+    __cpuid(r, 0);
+    if (r[0] < 7)
+        return 0;
+    __cpuid(r, 1);
+    // The OS has to save the ymm registers across context switches.
+    const int has_osxsave = (r[2] >> 27) & 1;
+    const int has_avx = (r[2] >> 28) & 1;
+    if (!has_osxsave || !has_avx || (_xgetbv(0) & 6) != 6)
+        return 0;
+    __cpuidex(r, 7, 0);
+    return (r[1] >> 5) & 1;
+#else
+    return 0;
+#endif
+}
+
+const struct accumulate_kernels*
+accumulate_kernels_get(enum AccumulateIsa isa)
+{
+    switch (isa) {
+        case AccumulateIsa_Scalar:
+            return &accumulate_kernels_scalar;
+        case AccumulateIsa_Avx2:
+#ifdef HAVE_AVX2_KERNELS
+            if (cpu_has_avx2())
+                return &accumulate_kernels_avx2;
+#endif
+            return 0;
+        case AccumulateIsa_Neon:
+#ifdef HAVE_NEON_KERNELS
+            // NEON is part of the aarch64 baseline.
+            return &accumulate_kernels_neon;
+#else
+            return 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+struct accumulate_divisor
+accumulate_divisor_init(uint32_t n)
+{
+    // Granlund and Montgomery's round-up method. With l = ceil(log2(n)) and
+    // t the high half of x * multiplier,
+    //     x / n == (t + ((x - t) >> min(l, 1))) >> max(l - 1, 0).
+    if (!n)
+        n = 1;
+    uint32_t l = 0;
+    while (l < 32 && (1ULL << l) < n)
+        ++l;
+    const uint64_t m = (((1ULL << l) - n) << 32) / n + 1;
+    return (struct accumulate_divisor){
+        .n = n,
+        .multiplier = (uint32_t)m,
+        .shift1 = l ? 1 : 0,
+        .shift2 = l ? l - 1 : 0,
+    };
+}
+
+const struct accumulate_kernels*
+accumulate_kernels_select(void)
+{
+    static const struct accumulate_kernels* selected = 0;
+    if (!selected) {
+        const enum AccumulateIsa preference[] = {
+            AccumulateIsa_Avx2,
+            AccumulateIsa_Neon,
+            AccumulateIsa_Scalar,
+        };
+        const struct accumulate_kernels* k = 0;
+        for (int i = 0; !k; ++i)
+            k = accumulate_kernels_get(preference[i]);
+        LOG("Using %s accumulate kernels", k->name);
+        selected = k;
+    }
+    return selected;
+}
+
+#ifndef NO_UNIT_TESTS
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+/// Runs a three frame window through `k` and the scalar kernels and checks
+/// the results are identical. The length isn't a multiple of any vector
+/// width so the tail loops are covered too.
+static int
+test_matches_scalar(const struct accumulate_kernels* k,
+                    enum SampleType type,
+                    const uint8_t* frames,
+                    size_t frame_bytes,
+                    size_t count,
+                    float* expected,
+                    float* actual)
+{
+    const struct accumulate_kernels* ref = &accumulate_kernels_scalar;
+    ref->load[type](expected, frames, count, 1.0f);
+    ref->add[type](expected, frames + frame_bytes, count, 1.0f);
+    ref->add[type](expected, frames + 2 * frame_bytes, count, 1.0f / 3.0f);
+
+    k->load[type](actual, frames, count, 1.0f);
+    k->add[type](actual, frames + frame_bytes, count, 1.0f);
+    k->add[type](actual, frames + 2 * frame_bytes, count, 1.0f / 3.0f);
+
+    for (size_t i = 0; i < count; ++i)
+        EXPECT(memcmp(expected + i, actual + i, sizeof(float)) == 0,
+               "%s kernels: sample type %d, element %llu: expected %f, got %f",
+               k->name,
+               (int)type,
+               (unsigned long long)i,
+               expected[i],
+               actual[i]);
+    return 1;
+Error:
+    return 0;
+}
+
+/// Slides the third frame into a window holding the first, then folds the
+/// second into an exponential average, with `k` and the scalar kernels.
+/// Checks the results are identical.
+static int
+test_running_matches_scalar(const struct accumulate_kernels* k,
+                            enum SampleType type,
+                            const uint8_t* frames,
+                            size_t frame_bytes,
+                            size_t count)
+{
+    const struct accumulate_kernels* ref = &accumulate_kernels_scalar;
+    const size_t nbytes = count * sizeof(float);
+    int ok = 0;
+    float* buf = malloc(4 * nbytes);
+    uint8_t* history = malloc(2 * frame_bytes);
+    CHECK(buf && history);
+    float *sum0 = buf, *sum1 = buf + count;
+    float *out0 = buf + 2 * count, *out1 = buf + 3 * count;
+
+    ref->load[type](sum0, frames, count, 1.0f);
+    ref->load[type](sum1, frames, count, 1.0f);
+    memcpy(history, frames, frame_bytes);               // NOLINT
+    memcpy(history + frame_bytes, frames, frame_bytes); // NOLINT
+    ref->slide[type](
+      sum0, out0, history, frames + 2 * frame_bytes, count, 0.5f);
+    k->slide[type](
+      sum1, out1, history + frame_bytes, frames + 2 * frame_bytes, count, 0.5f);
+    EXPECT(memcmp(buf, buf + count, nbytes) == 0 &&
+             memcmp(out0, out1, nbytes) == 0 &&
+             memcmp(history, history + frame_bytes, frame_bytes) == 0,
+           "%s slide kernel: sample type %d disagrees with scalar",
+           k->name,
+           (int)type);
+
+    ref->ema[type](sum0, out0, frames + frame_bytes, count, 0.3f);
+    k->ema[type](sum1, out1, frames + frame_bytes, count, 0.3f);
+    EXPECT(memcmp(buf, buf + count, nbytes) == 0 &&
+             memcmp(out0, out1, nbytes) == 0,
+           "%s ema kernel: sample type %d disagrees with scalar",
+           k->name,
+           (int)type);
+    ok = 1;
+Error:
+    free(buf);
+    free(history);
+    return ok;
+}
+
+/// Sums three frames into a u32 accumulator and rounds their mean with `k`
+/// and the scalar kernels, and checks both against integer arithmetic.
+static int
+test_integer_matches_scalar(const struct accumulate_kernels* k,
+                            enum SampleType type,
+                            const uint8_t* frames,
+                            size_t frame_bytes,
+                            size_t count)
+{
+    const struct accumulate_kernels* ref = &accumulate_kernels_scalar;
+    const size_t nbytes = count * sizeof(uint32_t);
+    const size_t bytes_per_sample = bytes_of_type(type);
+    const struct accumulate_divisor d = accumulate_divisor_init(3);
+    int ok = 0;
+    uint32_t* sums = malloc(2 * nbytes);
+    uint8_t* out = malloc(2 * count * bytes_per_sample);
+    CHECK(sums && out);
+
+    for (int i = 0; i < 2; ++i) {
+        const struct accumulate_kernels* x = i ? k : ref;
+        uint32_t* acc = sums + i * count;
+        x->load_u32[type](acc, frames, count);
+        x->add_u32[type](acc, frames + frame_bytes, count);
+        x->mean_u32[type](out + i * count * bytes_per_sample,
+                          acc,
+                          frames + 2 * frame_bytes,
+                          count,
+                          &d);
+    }
+    EXPECT(memcmp(sums, sums + count, nbytes) == 0 &&
+             memcmp(out,
+                    out + count * bytes_per_sample,
+                    count * bytes_per_sample) == 0,
+           "%s integer kernels: sample type %d disagree with scalar",
+           k->name,
+           (int)type);
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t sum = 0;
+        for (int f = 0; f < 3; ++f) {
+            const uint8_t* p = frames + f * frame_bytes + i * bytes_per_sample;
+            sum += bytes_per_sample == 1 ? *p : *(const uint16_t*)p;
+        }
+        const uint32_t mean = (sum + 1) / 3;
+        const uint32_t actual = bytes_per_sample == 1
+                                  ? out[i]
+                                  : ((const uint16_t*)out)[i];
+        EXPECT(actual == mean,
+               "%s integer kernels: sample type %d, element %llu: expected "
+               "%u, got %u",
+               k->name,
+               (int)type,
+               (unsigned long long)i,
+               mean,
+               actual);
+    }
+    ok = 1;
+Error:
+    free(sums);
+    free(out);
+    return ok;
+}
+
+int
+unit_test__accumulate__divisor_is_exact()
+{
+    const uint32_t xs[] = { 0,          1,          2,          3,
+                            65535,      65536,      1u << 31,   0x7fffffff,
+                            0xfffffffe, 0xffffffff, 4294868992, 123456789 };
+    for (uint32_t n = 1; n <= 70000; n += (n < 300) ? 1 : 97) {
+        const struct accumulate_divisor d = accumulate_divisor_init(n);
+        for (size_t i = 0; i < sizeof(xs) / sizeof(*xs); ++i) {
+            // Around multiples of n, where rounding down goes wrong first.
+            const uint32_t q = xs[i] / n;
+            for (int dx = -1; dx <= 1; ++dx) {
+                const uint64_t x = (uint64_t)q * n + dx;
+                if (x > 0xffffffff)
+                    continue;
+                EXPECT(accumulate_divide((uint32_t)x, &d) == x / n,
+                       "%llu / %u: expected %llu, got %u",
+                       (unsigned long long)x,
+                       n,
+                       (unsigned long long)(x / n),
+                       accumulate_divide((uint32_t)x, &d));
+            }
+            EXPECT(accumulate_divide(xs[i], &d) == q,
+                   "%u / %u: expected %u, got %u",
+                   xs[i],
+                   n,
+                   q,
+                   accumulate_divide(xs[i], &d));
+        }
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+int
+unit_test__accumulate__kernels_match_scalar()
+{
+    const size_t count = 1000 + 13;
+    const size_t frame_bytes = count * sizeof(float);
+    uint8_t* frames = malloc(3 * frame_bytes);
+    float* expected = malloc(count * sizeof(float));
+    float* actual = malloc(count * sizeof(float));
+    CHECK(frames && expected && actual);
+
+    // Fills every sample type with a spread of values, including negative
+    // ones for the signed types.
+    for (size_t i = 0; i < 3 * frame_bytes; ++i)
+        frames[i] = (uint8_t)(i * 131 + (i >> 7));
+    float* f = (float*)frames;
+    for (size_t i = 0; i < 3 * count; ++i)
+        if (!isfinite(f[i]))
+            f[i] = (float)i;
+
+    const struct accumulate_kernels* k = accumulate_kernels_select();
+    CHECK(k);
+    for (int isa = 0; isa < AccumulateIsaCount; ++isa) {
+        if (!(k = accumulate_kernels_get((enum AccumulateIsa)isa)))
+            continue;
+        for (int type = 0; type < SampleTypeCount; ++type) {
+            CHECK(k->load[type] && k->add[type]);
+            CHECK(k->slide[type] && k->ema[type]);
+            CHECK(test_matches_scalar(k,
+                                      (enum SampleType)type,
+                                      frames,
+                                      frame_bytes,
+                                      count,
+                                      expected,
+                                      actual));
+            CHECK(test_running_matches_scalar(
+              k, (enum SampleType)type, frames, frame_bytes, count));
+            if (k->load_u32[type]) {
+                CHECK(k->add_u32[type] && k->mean_u32[type]);
+                CHECK(test_integer_matches_scalar(
+                  k, (enum SampleType)type, frames, frame_bytes, count));
+            }
+        }
+    }
+    free(frames);
+    free(expected);
+    free(actual);
+    return 1;
+Error:
+    free(frames);
+    free(expected);
+    free(actual);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -0,0 +1,147 @@
+//!
+//! # Accumulate kernels
+//!
+//! The frame-averaging filter sums frames into an f32 accumulator and scales
+//! the sum on the last frame of each window. These kernels do that work for
+//! each input `SampleType`, with one set of kernels per instruction set.
+//!
+//! The `slide` and `ema` kernels keep a running average instead, emitting an
+//! output frame for every input frame at a cost that doesn't depend on the
+//! window length.
+//!
+//! For unsigned integer input, the `*_u32` kernels sum into a u32 accumulator
+//! instead. The sum is exact, and `mean_u32` divides it down to a rounded mean
+//! in the input's own type.
+//!
+//! accumulate_kernels_select() picks the fastest set the CPU supports. Every
+//! set produces the same result, bit for bit, as the scalar one.
+//!
+//! Example:
+//!
+//! ~~~{.c}
+//!     const struct accumulate_kernels* k = accumulate_kernels_select();
+//!     k->load[type](acc, first->data, npx, 1.0f);
+//!     k->add[type](acc, middle->data, npx, 1.0f);
+//!     k->add[type](acc, last->data, npx, 1.0f / n);
+//! ~~~
+//!
+
+#ifndef H_ACQUIRE_ACCUMULATE_V0
+#define H_ACQUIRE_ACCUMULATE_V0
+
+#include "device/props/components.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    enum AccumulateIsa
+    {
+        AccumulateIsa_Scalar = 0,
+        AccumulateIsa_Avx2,
+        AccumulateIsa_Neon,
+        AccumulateIsaCount,
+    };
+
+    typedef void (*accumulate_fn)(float* acc,
+                                  const void* in,
+                                  size_t count,
+                                  float scale);
+
+    typedef void (*accumulate_slide_fn)(float* sum,
+                                        float* out,
+                                        void* history,
+                                        const void* in,
+                                        size_t count,
+                                        float scale);
+
+    typedef void (*accumulate_ema_fn)(float* acc,
+                                      float* out,
+                                      const void* in,
+                                      size_t count,
+                                      float alpha);
+
+    /// Divides u32s by `n` with a multiply and shifts. See
+    /// accumulate_divisor_init().
+    struct accumulate_divisor
+    {
+        uint32_t n;
+        uint32_t multiplier;
+        uint32_t shift1, shift2;
+    };
+
+    typedef void (*accumulate_u32_fn)(uint32_t* acc,
+                                      const void* in,
+                                      size_t count);
+
+    typedef void (*accumulate_u32_mean_fn)(void* out,
+                                           const uint32_t* acc,
+                                           const void* in,
+                                           size_t count,
+                                           const struct accumulate_divisor* d);
+
+    struct accumulate_kernels
+    {
+        const char* name;
+
+        /// `acc[i] = in[i] * scale`. Starts a window. Indexed by the input's
+        /// `SampleType`.
+        accumulate_fn load[SampleTypeCount];
+
+        /// `acc[i] = (acc[i] + in[i]) * scale`. Pass 1 except on the last
+        /// frame of a window, where `scale` normalizes the sum in the same
+        /// pass. Indexed by the input's `SampleType`.
+        accumulate_fn add[SampleTypeCount];
+
+        /// `sum[i] = sum[i] - history[i] + in[i]`, then `history[i] = in[i]`
+        /// and `out[i] = sum[i] * scale`. `history` holds the samples that
+        /// leave the window, in the input's type. Indexed by the input's
+        /// `SampleType`.
+        accumulate_slide_fn slide[SampleTypeCount];
+
+        /// `acc[i] = acc[i] + (in[i] - acc[i]) * alpha`, then
+        /// `out[i] = acc[i]`. Indexed by the input's `SampleType`.
+        accumulate_ema_fn ema[SampleTypeCount];
+
+        /// `acc[i] = in[i]`. Starts an integer window. Indexed by the input's
+        /// `SampleType`, and only set for unsigned types up to 16 bits.
+        accumulate_u32_fn load_u32[SampleTypeCount];
+
+        /// `acc[i] = acc[i] + in[i]`. Indexed like `load_u32`.
+        accumulate_u32_fn add_u32[SampleTypeCount];
+
+        /// `out[i] = (acc[i] + in[i] + n / 2) / n`, where `out` has the
+        /// input's type. Adds the last frame of a window and rounds the mean
+        /// in one pass. Indexed like `load_u32`.
+        accumulate_u32_mean_fn mean_u32[SampleTypeCount];
+    };
+
+    /// Prepares to divide by `n`, which must be at least one. Quotients are
+    /// exact for every u32 dividend.
+    struct accumulate_divisor accumulate_divisor_init(uint32_t n);
+
+    /// `x / d->n`, rounded down.
+    static inline uint32_t accumulate_divide(uint32_t x,
+                                             const struct accumulate_divisor* d)
+    {
+        const uint32_t t = (uint32_t)(((uint64_t)x * d->multiplier) >> 32);
+        return (t + ((x - t) >> d->shift1)) >> d->shift2;
+    }
+
+    /// Returns the kernels for `isa`, or 0 if this build or CPU can't run
+    /// them.
+    const struct accumulate_kernels* accumulate_kernels_get(
+      enum AccumulateIsa isa);
+
+    /// Returns the fastest kernels this CPU supports.
+    const struct accumulate_kernels* accumulate_kernels_select(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // H_ACQUIRE_ACCUMULATE_V0
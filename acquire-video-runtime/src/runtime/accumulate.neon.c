@@ -0,0 +1,332 @@
+//! NEON accumulate kernels. See accumulate.h.
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#include "accumulate.h"
+
+#include <arm_neon.h>
+#include <stdint.h>
+#include <string.h>
+
+// Each loader widens 8 samples starting at `p` to two vectors of f32.
+
+static inline void
+widen_u8(const uint8_t* p, float32x4_t* lo, float32x4_t* hi)
+{
+    const uint16x8_t v = vmovl_u8(vld1_u8(p));
+    *lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+    *hi = vcvtq_f32_u32(vmovl_high_u16(v));
+}
+
+static inline void
+widen_i8(const int8_t* p, float32x4_t* lo, float32x4_t* hi)
+{
+    const int16x8_t v = vmovl_s8(vld1_s8(p));
+    *lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+    *hi = vcvtq_f32_s32(vmovl_high_s16(v));
+}
+
+static inline void
+widen_u16(const uint16_t* p, float32x4_t* lo, float32x4_t* hi)
+{
+    const uint16x8_t v = vld1q_u16(p);
+    *lo = vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+    *hi = vcvtq_f32_u32(vmovl_high_u16(v));
+}
+
+static inline void
+widen_i16(const int16_t* p, float32x4_t* lo, float32x4_t* hi)
+{
+    const int16x8_t v = vld1q_s16(p);
+    *lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+    *hi = vcvtq_f32_s32(vmovl_high_s16(v));
+}
+
+static inline void
+widen_f32(const float* p, float32x4_t* lo, float32x4_t* hi)
+{
+    *lo = vld1q_f32(p);
+    *hi = vld1q_f32(p + 4);
+}
+
+static inline void
+widen_u32(const uint32_t* p, float32x4_t* lo, float32x4_t* hi)
+{
+    *lo = vcvtq_f32_u32(vld1q_u32(p));
+    *hi = vcvtq_f32_u32(vld1q_u32(p + 4));
+}
+
+// Integer loaders widen 8 samples to two vectors of u32, and the narrowers
+// store 8 u32s that are known to fit back in the sample type.
+
+static inline void
+widen32_u8(const uint8_t* p, uint32x4_t* lo, uint32x4_t* hi)
+{
+    const uint16x8_t v = vmovl_u8(vld1_u8(p));
+    *lo = vmovl_u16(vget_low_u16(v));
+    *hi = vmovl_high_u16(v);
+}
+
+static inline void
+widen32_u16(const uint16_t* p, uint32x4_t* lo, uint32x4_t* hi)
+{
+    const uint16x8_t v = vld1q_u16(p);
+    *lo = vmovl_u16(vget_low_u16(v));
+    *hi = vmovl_high_u16(v);
+}
+
+static inline void
+narrow_u8(uint8_t* p, uint32x4_t lo, uint32x4_t hi)
+{
+    vst1_u8(p, vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi))));
+}
+
+static inline void
+narrow_u16(uint16_t* p, uint32x4_t lo, uint32x4_t hi)
+{
+    vst1q_u16(p, vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+}
+
+/// accumulate_divide() for 4 lanes. The shifts are negated, since vshlq
+/// shifts right by negative amounts.
+static inline uint32x4_t
+divide_u32(uint32x4_t x, uint32x4_t m, int32x4_t shift1, int32x4_t shift2)
+{
+    const uint64x2_t lo = vmull_u32(vget_low_u32(x), vget_low_u32(m));
+    const uint64x2_t hi = vmull_high_u32(x, m);
+    const uint32x4_t t =
+      vcombine_u32(vshrn_n_u64(lo, 32), vshrn_n_u64(hi, 32));
+    const uint32x4_t d = vshlq_u32(vsubq_u32(x, t), shift1);
+    return vshlq_u32(vaddq_u32(t, d), shift2);
+}
+
+// The tails use the same operations in the same order as the scalar kernels,
+// so results match them exactly. vmulq/vaddq are never fused.
+#define NEON_KERNELS(name, T)                                                  \
+    static void load_##name(                                                   \
+      float* restrict acc, const void* in_, size_t count, float scale)         \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        const float32x4_t s = vdupq_n_f32(scale);                              \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            float32x4_t lo, hi;                                                \
+            widen_##name(in + i, &lo, &hi);                                    \
+            vst1q_f32(acc + i, vmulq_f32(lo, s));                              \
+            vst1q_f32(acc + i + 4, vmulq_f32(hi, s));                          \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] = (float)in[i] * scale;                                     \
+    }                                                                          \
+    static void add_##name(                                                    \
+      float* restrict acc, const void* in_, size_t count, float scale)         \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        const float32x4_t s = vdupq_n_f32(scale);                              \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            float32x4_t lo, hi;                                                \
+            widen_##name(in + i, &lo, &hi);                                    \
+            lo = vaddq_f32(vld1q_f32(acc + i), lo);                            \
+            hi = vaddq_f32(vld1q_f32(acc + i + 4), hi);                        \
+            vst1q_f32(acc + i, vmulq_f32(lo, s));                              \
+            vst1q_f32(acc + i + 4, vmulq_f32(hi, s));                          \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] = (acc[i] + (float)in[i]) * scale;                          \
+    }                                                                          \
+    static void slide_##name(float* restrict sum,                              \
+                             float* restrict out,                              \
+                             void* history_,                                   \
+                             const void* in_,                                  \
+                             size_t count,                                     \
+                             float scale)                                      \
+    {                                                                          \
+        T* restrict history = (T*)history_;                                    \
+        const T* restrict in = (const T*)in_;                                  \
+        const float32x4_t s = vdupq_n_f32(scale);                              \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            float32x4_t olo, ohi, lo, hi;                                      \
+            widen_##name(history + i, &olo, &ohi);                             \
+            widen_##name(in + i, &lo, &hi);                                    \
+            lo = vaddq_f32(vsubq_f32(vld1q_f32(sum + i), olo), lo);            \
+            hi = vaddq_f32(vsubq_f32(vld1q_f32(sum + i + 4), ohi), hi);        \
+            memcpy(history + i, in + i, 8 * sizeof(T)); /* NOLINT */           \
+            vst1q_f32(sum + i, lo);                                            \
+            vst1q_f32(sum + i + 4, hi);                                        \
+            vst1q_f32(out + i, vmulq_f32(lo, s));                              \
+            vst1q_f32(out + i + 4, vmulq_f32(hi, s));                          \
+        }                                                                      \
+        for (; i < count; ++i) {                                               \
+            sum[i] = (sum[i] - (float)history[i]) + (float)in[i];              \
+            history[i] = in[i];                                                \
+            out[i] = sum[i] * scale;                                           \
+        }                                                                      \
+    }                                                                          \
+    static void ema_##name(float* restrict acc,                                \
+                           float* restrict out,                                \
+                           const void* in_,                                    \
+                           size_t count,                                       \
+                           float alpha)                                        \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        const float32x4_t w = vdupq_n_f32(alpha);                              \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            float32x4_t lo, hi;                                                \
+            widen_##name(in + i, &lo, &hi);                                    \
+            const float32x4_t a = vld1q_f32(acc + i);                          \
+            const float32x4_t b = vld1q_f32(acc + i + 4);                      \
+            lo = vaddq_f32(a, vmulq_f32(vsubq_f32(lo, a), w));                 \
+            hi = vaddq_f32(b, vmulq_f32(vsubq_f32(hi, b), w));                 \
+            vst1q_f32(acc + i, lo);                                            \
+            vst1q_f32(acc + i + 4, hi);                                        \
+            vst1q_f32(out + i, lo);                                            \
+            vst1q_f32(out + i + 4, hi);                                        \
+        }                                                                      \
+        for (; i < count; ++i) {                                               \
+            acc[i] = acc[i] + ((float)in[i] - acc[i]) * alpha;                 \
+            out[i] = acc[i];                                                   \
+        }                                                                      \
+    }
+
+NEON_KERNELS(u8, uint8_t)
+NEON_KERNELS(u16, uint16_t)
+NEON_KERNELS(i8, int8_t)
+NEON_KERNELS(i16, int16_t)
+NEON_KERNELS(f32, float)
+NEON_KERNELS(u32, uint32_t)
+
+#undef NEON_KERNELS
+
+#define NEON_U32_KERNELS(name, T)                                              \
+    static void iload_##name(                                                  \
+      uint32_t* restrict acc, const void* in_, size_t count)                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            uint32x4_t lo, hi;                                                 \
+            widen32_##name(in + i, &lo, &hi);                                  \
+            vst1q_u32(acc + i, lo);                                            \
+            vst1q_u32(acc + i + 4, hi);                                        \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] = in[i];                                                    \
+    }                                                                          \
+    static void iadd_##name(                                                   \
+      uint32_t* restrict acc, const void* in_, size_t count)                   \
+    {                                                                          \
+        const T* restrict in = (const T*)in_;                                  \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            uint32x4_t lo, hi;                                                 \
+            widen32_##name(in + i, &lo, &hi);                                  \
+            vst1q_u32(acc + i, vaddq_u32(vld1q_u32(acc + i), lo));             \
+            vst1q_u32(acc + i + 4, vaddq_u32(vld1q_u32(acc + i + 4), hi));     \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            acc[i] += in[i];                                                   \
+    }                                                                          \
+    static void imean_##name(void* out_,                                       \
+                             const uint32_t* restrict acc,                     \
+                             const void* in_,                                  \
+                             size_t count,                                     \
+                             const struct accumulate_divisor* d)               \
+    {                                                                          \
+        T* restrict out = (T*)out_;                                            \
+        const T* restrict in = (const T*)in_;                                  \
+        const uint32_t half = d->n / 2;                                        \
+        const uint32x4_t h = vdupq_n_u32(half);                                \
+        const uint32x4_t m = vdupq_n_u32(d->multiplier);                       \
+        const int32x4_t s1 = vdupq_n_s32(-(int32_t)d->shift1);                 \
+        const int32x4_t s2 = vdupq_n_s32(-(int32_t)d->shift2);                 \
+        size_t i = 0;                                                          \
+        for (; i + 8 <= count; i += 8) {                                       \
+            uint32x4_t lo, hi;                                                 \
+            widen32_##name(in + i, &lo, &hi);                                  \
+            lo = vaddq_u32(vaddq_u32(vld1q_u32(acc + i), lo), h);              \
+            hi = vaddq_u32(vaddq_u32(vld1q_u32(acc + i + 4), hi), h);          \
+            narrow_##name(out + i,                                             \
+                          divide_u32(lo, m, s1, s2),                           \
+                          divide_u32(hi, m, s1, s2));                          \
+        }                                                                      \
+        for (; i < count; ++i)                                                 \
+            out[i] = (T)accumulate_divide(acc[i] + in[i] + half, d);           \
+    }
+
+NEON_U32_KERNELS(u8, uint8_t)
+NEON_U32_KERNELS(u16, uint16_t)
+
+#undef NEON_U32_KERNELS
+
+const struct accumulate_kernels accumulate_kernels_neon = {
+    .name = "neon",
+    .load = {
+        [SampleType_u8] = load_u8,
+        [SampleType_u16] = load_u16,
+        [SampleType_i8] = load_i8,
+        [SampleType_i16] = load_i16,
+        [SampleType_f32] = load_f32,
+        [SampleType_u10] = load_u16,
+        [SampleType_u12] = load_u16,
+        [SampleType_u14] = load_u16,
+        [SampleType_u32] = load_u32,
+    },
+    .add = {
+        [SampleType_u8] = add_u8,
+        [SampleType_u16] = add_u16,
+        [SampleType_i8] = add_i8,
+        [SampleType_i16] = add_i16,
+        [SampleType_f32] = add_f32,
+        [SampleType_u10] = add_u16,
+        [SampleType_u12] = add_u16,
+        [SampleType_u14] = add_u16,
+        [SampleType_u32] = add_u32,
+    },
+    .slide = {
+        [SampleType_u8] = slide_u8,
+        [SampleType_u16] = slide_u16,
+        [SampleType_i8] = slide_i8,
+        [SampleType_i16] = slide_i16,
+        [SampleType_f32] = slide_f32,
+        [SampleType_u10] = slide_u16,
+        [SampleType_u12] = slide_u16,
+        [SampleType_u14] = slide_u16,
+        [SampleType_u32] = slide_u32,
+    },
+    .ema = {
+        [SampleType_u8] = ema_u8,
+        [SampleType_u16] = ema_u16,
+        [SampleType_i8] = ema_i8,
+        [SampleType_i16] = ema_i16,
+        [SampleType_f32] = ema_f32,
+        [SampleType_u10] = ema_u16,
+        [SampleType_u12] = ema_u16,
+        [SampleType_u14] = ema_u16,
+        [SampleType_u32] = ema_u32,
+    },
+    .load_u32 = {
+        [SampleType_u8] = iload_u8,
+        [SampleType_u16] = iload_u16,
+        [SampleType_u10] = iload_u16,
+        [SampleType_u12] = iload_u16,
+        [SampleType_u14] = iload_u16,
+    },
+    .add_u32 = {
+        [SampleType_u8] = iadd_u8,
+        [SampleType_u16] = iadd_u16,
+        [SampleType_u10] = iadd_u16,
+        [SampleType_u12] = iadd_u16,
+        [SampleType_u14] = iadd_u16,
+    },
+    .mean_u32 = {
+        [SampleType_u8] = imean_u8,
+        [SampleType_u16] = imean_u16,
+        [SampleType_u10] = imean_u16,
+        [SampleType_u12] = imean_u16,
+        [SampleType_u14] = imean_u16,
+    },
+};
+
+#endif // aarch64
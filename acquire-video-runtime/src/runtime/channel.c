@@ -1,89 +1,175 @@
 #include "channel.h"
-#include <string.h>
+
+#include <stdlib.h>
 
 #define countof(e) (sizeof(e) / sizeof((e)[0]))
-#define MAX_READERS countof(((struct channel*)0)->holds.pos) //(1 << 3)
 
-#ifndef min
-#define min(a, b) (((a) < (b)) ? (a) : (b))
-#endif
+#define load(e, order) atomic_load_explicit((e), memory_order_##order)
+#define store(e, v, order) atomic_store_explicit((e), (v), memory_order_##order)
 
-static int
-cursor_cmp(size_t cycle_a, size_t pos_a, size_t cycle_b, size_t pos_b)
+/// Set in a `ChannelOverflow_DropOldest` reader's cursor while it has a region
+/// mapped, so the writer won't skip it.
+#define CURSOR_PINNED (1ULL << 63)
+
+static uint64_t
+cycle_of(const struct channel* self, uint64_t offset)
 {
-    if (cycle_a < cycle_b)
-        return -1;
-    if (cycle_a > cycle_b)
-        return 1;
-    if (pos_a < pos_b)
-        return -1;
-    if (pos_a > pos_b)
-        return 1;
-    return 0;
+    return offset / self->capacity;
 }
 
-static uint32_t
-reader_min(const size_t* tails, const size_t* cycles, uint32_t n)
+/// @returns the offset of the first byte of the cycle following the one
+///          containing `offset`.
+static uint64_t
+cycle_end(const struct channel* self, uint64_t offset)
 {
-    struct
-    {
-        size_t tail, cycle;
-    } mn = {
-        .tail = tails[0],
-        .cycle = cycles[0],
-    };
-    uint32_t argmin = 0;
-    for (uint32_t i = 1; i < n; ++i) {
-        if (cursor_cmp(mn.cycle, mn.tail, cycles[i], tails[i]) == 1) {
-            mn.tail = tails[i];
-            mn.cycle = cycles[i];
-            argmin = i;
-        }
-    }
-    return argmin;
+    return (cycle_of(self, offset) + 1) * self->capacity;
 }
 
-static uint32_t
-next_write(const struct channel* self,
-           size_t nbytes,
-           size_t* beg,
-           uint8_t* should_wrap)
+/// @returns the cursor in slot `i`. The slot's block must be allocated.
+static struct channel_cursor*
+cursor_at(const struct channel* self, unsigned i)
 {
-    *should_wrap = 0;
-
-    if (!self->is_accepting_writes)
-        return 0;
-
-    const uint32_t argmin =
-      reader_min(self->holds.pos, self->holds.cycles, self->holds.n);
-    const size_t tail = self->holds.pos[argmin];
+    struct channel_cursor* const block =
+      atomic_load_explicit(&self->holds.blocks[i / CHANNEL_READERS_PER_BLOCK],
+                           memory_order_acquire);
+    return block + i % CHANNEL_READERS_PER_BLOCK;
+}
 
-    if (self->head < tail) {
-        *beg = self->head;
-        return nbytes <= (tail - self->head);
-    }
+/// Where the writer may consider `reader_pos` to be when deciding how much
+/// space is free.
+///
+/// A reader that has consumed everything before a skipped tail is treated as
+/// if it were already at the start of the next cycle. Otherwise, a caught-up
+/// reader could hold the writer off until it happened to poll again.
+static uint64_t
+effective_reader_pos(const struct channel* self,
+                     uint64_t reader_pos,
+                     uint64_t head,
+                     uint64_t beg,
+                     uint64_t high)
+{
+    if (reader_pos == head && beg > head)
+        return beg;
+    if (reader_pos == high && reader_pos % self->capacity)
+        return cycle_end(self, reader_pos);
+    return reader_pos;
+}
 
-    if (tail == self->head && (self->cycle == self->holds.cycles[argmin] + 1)) {
-        return 0;
+/// Scans the readers for the slowest one the writer has to wait on.
+/// @returns the offset the writer can write up to without clobbering anything
+///          those readers have yet to consume.
+static uint64_t
+scan_write_limit(struct channel* self, uint64_t head, uint64_t beg)
+{
+    self->write_limit_generation = atomic_load(&self->holds.generation);
+    uint64_t limit = UINT64_MAX;
+    const unsigned n = atomic_load(&self->holds.n);
+    const uint64_t high = load(&self->high, relaxed);
+    for (unsigned i = 0; i < n; ++i) {
+        const struct channel_cursor* const cursor = cursor_at(self, i);
+        if (!load(&cursor->is_attached, relaxed) ||
+            load(&cursor->overflow, relaxed) == ChannelOverflow_Lossy)
+            continue;
+        const uint64_t pos =
+          effective_reader_pos(self,
+                               atomic_load(&cursor->pos) & ~CURSOR_PINNED,
+                               head,
+                               beg,
+                               high);
+        if (pos + self->capacity < limit)
+            limit = pos + self->capacity;
     }
+    self->write_limit = limit;
+    return limit;
+}
 
-    if (nbytes <= (self->capacity - self->head)) {
-        *beg = self->head;
+/// @returns 1 if the region [beg,end) can be written without clobbering
+///          anything a reader has yet to consume, otherwise 0.
+///
+/// Only rescans the readers when the last scan doesn't already allow the
+/// write. A reader that attaches just after the generation check starts at
+/// the beginning of the writer's cycle, so it can't be overtaken before the
+/// writer changes cycles, which always rescans under the lock.
+static int
+can_write(struct channel* self, uint64_t head, uint64_t beg, uint64_t end)
+{
+    if (end <= self->write_limit &&
+        atomic_load(&self->holds.generation) == self->write_limit_generation)
         return 1;
-    }
+    return end <= scan_write_limit(self, head, beg);
+}
 
-    if (nbytes <= tail) {
-        *beg = 0;
-        return 1;
+/// Skips `ChannelOverflow_DropOldest` readers that are in the way of the
+/// region [beg,end) past the rest of the cycle they're reading.
+///
+/// Blocking readers are always in the cycle before `end`'s, so that is the
+/// only data they lose. The rest of that cycle ends at `head` if [beg,end)
+/// starts a new cycle. Otherwise it ends at `high`, or at `cycle_beg` for a
+/// mirrored channel, which has no skipped tail.
+static void
+drop_oldest(struct channel* self,
+            uint64_t head,
+            uint64_t beg,
+            uint64_t end,
+            int is_new_cycle)
+{
+    const unsigned n = atomic_load(&self->holds.n);
+    const uint64_t high = load(&self->high, relaxed);
+    const uint64_t valid_end =
+      is_new_cycle       ? head
+      : self->is_mirrored ? load(&self->cycle_beg, relaxed)
+                          : high;
+    for (unsigned i = 0; i < n; ++i) {
+        struct channel_cursor* const cursor = cursor_at(self, i);
+        if (!load(&cursor->is_attached, relaxed) ||
+            load(&cursor->overflow, relaxed) != ChannelOverflow_DropOldest)
+            continue;
+        uint64_t pos = atomic_load(&cursor->pos);
+        if ((pos & CURSOR_PINNED) || pos >= valid_end ||
+            end - effective_reader_pos(self, pos, head, beg, high) <=
+              self->capacity)
+            continue;
+        // Fails if the reader pinned or moved its cursor in the meantime.
+        if (atomic_compare_exchange_strong(&cursor->pos, &pos, valid_end))
+            atomic_fetch_add(&cursor->lost_bytes, valid_end - pos);
     }
+}
 
-    if (tail == self->head) {
-        *beg = 0;
-        *should_wrap = 1;
-        return nbytes < self->capacity;
+static void
+notify_writer(struct channel* self)
+{
+    if (atomic_load(&self->is_writer_waiting)) {
+        lock_acquire(&self->lock);
+        condition_variable_notify_all(&self->notify_space_available);
+        lock_release(&self->lock);
     }
+}
 
-    return 0;
+/// Finds a free reader slot, allocating a new block of slots if needed.
+/// Must be called with the lock held.
+/// @returns the slot's index, or `CHANNEL_MAX_READERS` if there is none.
+static unsigned
+reserve_reader_slot(struct channel* self)
+{
+    const unsigned n = atomic_load(&self->holds.n);
+    for (unsigned i = 0; i < n; ++i)
+        if (!load(&cursor_at(self, i)->is_attached, relaxed))
+            return i;
+    if (n == CHANNEL_MAX_READERS)
+        return CHANNEL_MAX_READERS;
+
+    _Atomic(struct channel_cursor*)* const block =
+      self->holds.blocks + n / CHANNEL_READERS_PER_BLOCK;
+    if (!load(block, relaxed)) {
+        struct channel_cursor* cursors =
+          calloc(CHANNEL_READERS_PER_BLOCK, sizeof(struct channel_cursor));
+        if (!cursors)
+            return CHANNEL_MAX_READERS;
+        // Published before `n` covers it. See cursor_at().
+        store(block, cursors, release);
+    }
+    atomic_store(&self->holds.n, n + 1);
+    return n;
 }
 
 static int
@@ -91,214 +177,798 @@ reader_initialize(struct channel* self, struct channel_reader* reader)
 {
     if (reader->id > 0)
         return 1;
-    reader->id = ++self->holds.n;
-    self->holds.cycles[reader->id - 1] = self->cycle;
-    self->holds.pos[reader->id - 1] = 0;
-    if (self->holds.n >= MAX_READERS)
-        return 0;
-    return 1;
-}
-
-static size_t
-get_available_byte_count(const struct channel_reader* const reader,
-                         const size_t pos,
-                         const size_t cycle,
-                         const size_t high)
-{
-    if (reader->pos == pos && reader->cycle == cycle)
-        return 0;
-    if (reader->pos == 0)
-        return high - pos;
-    return reader->pos - pos;
+    int ok = 0;
+    lock_acquire(&self->lock);
+    const unsigned i = reserve_reader_slot(self);
+    if (i < CHANNEL_MAX_READERS) {
+        // The writer only changes cycles while holding the lock, so nothing
+        // from the start of the current cycle onward can be overwritten
+        // before this reader's cursor is visible.
+        struct channel_cursor* const cursor = cursor_at(self, i);
+        store(&cursor->pos, load(&self->cycle_beg, relaxed), relaxed);
+        store(&cursor->lost_bytes, 0, relaxed);
+        store(&cursor->overflow, (uint8_t)reader->overflow, relaxed);
+        atomic_store(&cursor->is_attached, 1);
+        atomic_fetch_add(&self->holds.generation, 1);
+        reader->id = i + 1;
+        reader->state = ChannelState_Unmapped;
+        ok = 1;
+    }
+    lock_release(&self->lock);
+    return ok;
 }
 
-void
-channel_new(struct channel* self, size_t capacity)
+static void
+channel_init(struct channel* self,
+             uint8_t* data,
+             size_t capacity,
+             uint8_t is_mirrored)
 {
     *self = (struct channel){
-        .data = memory_alloc(capacity, AllocatorHint_LargePage),
+        .data = data,
         .capacity = capacity,
+        .is_mirrored = is_mirrored,
     };
 
+    // The buffer isn't touched here so its pages are only committed as the
+    // writer first reaches them.
     lock_init(&self->lock);
     condition_variable_init(&self->notify_space_available);
-    memset(self->data, 0, capacity); // NOLINT
-    self->is_accepting_writes = 1;
+    condition_variable_init(&self->notify_data_available);
+    atomic_store(&self->is_accepting_writes, 1);
+}
+
+void
+channel_new(struct channel* self, size_t capacity)
+{
+    channel_init(
+      self, memory_alloc(capacity, AllocatorHint_LargePage), capacity, 0);
+}
+
+void
+channel_new_mirrored(struct channel* self, size_t capacity)
+{
+    const size_t page = memory_page_size_bytes();
+    capacity = (capacity + page - 1) / page * page;
+    uint8_t* const data = memory_alloc_mirrored(capacity);
+    if (data)
+        channel_init(self, data, capacity, 1);
+    else
+        channel_new(self, capacity);
 }
 
 void
 channel_release(struct channel* self)
 {
-    self->holds.n = 0;
-    condition_variable_notify_all(&self->notify_space_available);
+    atomic_store(&self->holds.n, 0);
 
     lock_acquire(&self->lock);
+    condition_variable_notify_all(&self->notify_space_available);
+    condition_variable_notify_all(&self->notify_data_available);
+    for (size_t i = 0; i < countof(self->holds.blocks); ++i) {
+        free(load(self->holds.blocks + i, relaxed));
+        store(self->holds.blocks + i, 0, relaxed);
+    }
     memory_free(self->data);
     self->capacity = 0;
-    self->head = 0;
+    atomic_store(&self->head, 0);
     lock_release(&self->lock);
 }
 
 void
 channel_accept_writes(struct channel* self, uint32_t tf)
 {
-    self->is_accepting_writes = tf;
+    atomic_store(&self->is_accepting_writes, (uint8_t)(tf != 0));
+    lock_acquire(&self->lock);
     condition_variable_notify_all(&self->notify_space_available);
+    lock_release(&self->lock);
 }
 
 void
 channel_abort_write(struct channel* self)
 {
-    lock_acquire(&self->lock);
-    if (self->is_accepting_writes) {
-        self->mapped = self->head;
-    }
-    lock_release(&self->lock);
+    // Publishing the current head again is a no-op. If the aborted write
+    // started a new cycle, `cycle` stays advanced and the next write starts
+    // from the beginning of that cycle.
+    self->mapped_end = load(&self->head, relaxed);
+}
+
+/// Restarts a lossy reader the writer has lapped at the beginning of the
+/// writer's current cycle.
+/// @returns the reader's position.
+static uint64_t
+resync_lossy_reader(struct channel* self,
+                    struct channel_cursor* cursor,
+                    uint64_t pos)
+{
+    if (atomic_load(&self->reserved) <= pos + self->capacity)
+        return pos;
+    const uint64_t next = load(&self->cycle_beg, acquire);
+    atomic_fetch_add(&cursor->lost_bytes, next - pos);
+    store(&cursor->pos, next, relaxed);
+    return next;
 }
 
 struct slice
 channel_read_map(struct channel* self, struct channel_reader* reader)
 {
-    size_t nbytes = 0;
-    lock_acquire(&self->lock);
-
-    reader_initialize(self, reader);
+    if (!reader_initialize(self, reader)) {
+        reader->status = Channel_Error;
+        return (struct slice){ 0 };
+    }
 
-    size_t* const cycle = self->holds.cycles + reader->id - 1;
-    size_t* const pos = self->holds.pos + reader->id - 1;
-    uint8_t* out = self->data + *pos;
+    struct channel_cursor* const cursor = cursor_at(self, reader->id - 1);
+    const uint64_t pin =
+      (reader->overflow == ChannelOverflow_DropOldest) ? CURSOR_PINNED : 0;
+    uint64_t pos = load(&cursor->pos, relaxed);
+    uint64_t head;
 
     if (reader->state == ChannelState_Mapped) {
         reader->status = Channel_Expected_Unmapped_Reader;
+        head = load(&self->head, acquire);
         goto AdvanceToWriterHead;
     }
 
-    if (*pos == self->head && *cycle == self->cycle) {
-        goto Finalize;
+    // Keep the writer from skipping past anything this maps.
+    while (pin && !atomic_compare_exchange_weak(&cursor->pos, &pos, pos | pin))
+        ;
+    head = load(&self->head, acquire);
+    if (reader->overflow == ChannelOverflow_Lossy)
+        pos = resync_lossy_reader(self, cursor, pos);
+
+    if (pos >= head)
+        goto Empty;
+
+    uint64_t end = head;
+    uint64_t next = head;
+    if (!self->is_mirrored && head > cycle_end(self, pos)) {
+        const uint64_t high = load(&self->high, acquire);
+        if (pos == high) {
+            // Nothing left in this cycle. Move on to the next.
+            pos = cycle_end(self, pos);
+            store(&cursor->pos, pos | pin, seq_cst);
+            notify_writer(self);
+        } else {
+            // The writer has moved on to the next cycle. Read up to where it
+            // left off in this one.
+            end = high;
+            next = cycle_end(self, pos);
+        }
     }
 
-    if (*pos < self->head) {
-        if (*cycle != self->cycle)
-            goto Overflow;
-        nbytes = self->head - *pos; // this will never be 0
-        reader->pos = self->head;
-        reader->cycle = self->cycle;
-    } else {
-        if (self->cycle != *cycle + 1)
-            goto Overflow;
-        nbytes = self->high - *pos;
-        reader->pos = 0;
-        reader->cycle = *cycle + 1;
-    }
-
-    // Even if nothing is available on the channel, we still need to advance
-    // this reader's position & cycle bookmarks to the position & cycle of the
-    // writer's head. Normally this would happen in channel_read_unmap(), but
-    // because no data is available, we do not set the reader's state to Mapped
-    // here. A call to channel_read_unmap() would return early and not advance
-    // the reader's bookmarks in that case, so we need to do it here.
-    if (!nbytes) {
-        goto AdvanceToWriterHead;
-    }
+    if (head - pos > self->capacity)
+        goto Overflow;
+
+    if (pos == end)
+        goto Empty;
 
+    reader->beg = pos;
+    reader->end = end;
+    reader->next = next;
     reader->state = ChannelState_Mapped;
 
-Finalize:
-    lock_release(&self->lock);
-    return (struct slice){ .beg = out, .end = out + nbytes };
+    uint8_t* const out = self->data + pos % self->capacity;
+    return (struct slice){ .beg = out, .end = out + (end - pos) };
+
+Empty:
+    if (pin) {
+        atomic_store(&cursor->pos, pos);
+        notify_writer(self);
+    }
+    return (struct slice){ .beg = self->data + pos % self->capacity,
+                           .end = self->data + pos % self->capacity };
 Overflow:
     reader->status = Channel_Error;
 AdvanceToWriterHead:
-    out = 0;
-    nbytes = 0;
-    *pos = self->head;
-    *cycle = self->cycle;
-    goto Finalize;
+    store(&cursor->pos, head, seq_cst);
+    notify_writer(self);
+    return (struct slice){ 0 };
 }
 
-void
+int
 channel_read_unmap(struct channel* self,
                    struct channel_reader* reader,
                    size_t consumed_bytes)
 {
     if (reader->state != ChannelState_Mapped)
+        return 1;
+
+    struct channel_cursor* const cursor = cursor_at(self, reader->id - 1);
+    const uint64_t length = reader->end - reader->beg;
+    const uint64_t pos = (consumed_bytes >= length)
+                           ? reader->next
+                           : reader->beg + consumed_bytes;
+
+    int is_intact = 1;
+    if (reader->overflow == ChannelOverflow_Lossy) {
+        // Pairs with the fence in channel_write_map(). If anything read from
+        // the region came from a later write, this sees that write's
+        // reservation.
+        atomic_thread_fence(memory_order_acquire);
+        if (load(&self->reserved, relaxed) > reader->beg + self->capacity) {
+            atomic_fetch_add(&cursor->lost_bytes, length);
+            is_intact = 0;
+        }
+    }
+
+    // seq_cst so this store can't be reordered after the load of
+    // is_writer_waiting in notify_writer(). Also clears CURSOR_PINNED.
+    atomic_store(&cursor->pos, pos);
+    reader->state = ChannelState_Unmapped;
+    notify_writer(self);
+    return is_intact;
+}
+
+void
+channel_detach_reader(struct channel* self, struct channel_reader* reader)
+{
+    if (!reader->id)
         return;
     lock_acquire(&self->lock);
+    atomic_store(&cursor_at(self, reader->id - 1)->is_attached, 0);
+    atomic_fetch_add(&self->holds.generation, 1);
+    // The writer may be waiting on this reader.
+    condition_variable_notify_all(&self->notify_space_available);
+    lock_release(&self->lock);
+    reader->id = 0;
+    reader->state = ChannelState_Unmapped;
+}
 
-    size_t* const cycle = self->holds.cycles + reader->id - 1;
-    size_t* const pos = self->holds.pos + reader->id - 1;
+void
+channel_set_overflow(struct channel* self,
+                     struct channel_reader* reader,
+                     enum ChannelOverflow overflow)
+{
+    reader->overflow = overflow;
+    if (reader->id) {
+        store(&cursor_at(self, reader->id - 1)->overflow,
+              (uint8_t)overflow,
+              relaxed);
+        atomic_fetch_add(&self->holds.generation, 1);
+        // A reader that stops blocking may be what the writer is waiting on.
+        notify_writer(self);
+    }
+}
 
-    size_t length = get_available_byte_count(reader, *pos, *cycle, self->high);
-    consumed_bytes = min(length, consumed_bytes);
-    if (consumed_bytes >= length) {
-        *cycle = reader->cycle;
-        *pos = reader->pos;
-    } else {
-        *pos += consumed_bytes;
+uint64_t
+channel_bytes_lost(const struct channel* self,
+                   const struct channel_reader* reader)
+{
+    if (!reader->id)
+        return 0;
+    return load(&cursor_at(self, reader->id - 1)->lost_bytes, relaxed);
+}
+
+size_t
+channel_bytes_unread(const struct channel* self,
+                     const struct channel_reader* reader)
+{
+    if (!reader->id)
+        return 0;
+    const uint64_t pos =
+      load(&cursor_at(self, reader->id - 1)->pos, acquire) & ~CURSOR_PINNED;
+    const uint64_t head = load(&self->head, acquire);
+    if (head <= pos)
+        return 0;
+    const uint64_t end_of_cycle = cycle_end(self, pos);
+    if (!self->is_mirrored && head > end_of_cycle) {
+        const uint64_t high = load(&self->high, acquire);
+        return (size_t)((high - pos) + (head - end_of_cycle));
     }
-    if (self->head < *pos && *pos == self->high) {
-        *pos = 0;
-        *cycle += 1;
+    return (size_t)(head - pos);
+}
+
+size_t
+channel_wait_for_data(struct channel* self,
+                      struct channel_reader* reader,
+                      size_t min_bytes,
+                      float timeout_ms)
+{
+    if (!reader_initialize(self, reader))
+        return 0;
+    size_t nbytes = channel_bytes_unread(self, reader);
+    if (nbytes >= min_bytes || timeout_ms <= 0.0f)
+        return nbytes;
+
+    struct clock deadline;
+    clock_init(&deadline);
+    clock_shift_ms(&deadline, timeout_ms);
+
+    lock_acquire(&self->lock);
+    // Announce this reader before re-checking so the writer can't publish
+    // in between without seeing it. See channel_write_unmap().
+    atomic_fetch_add(&self->readers_waiting, 1);
+    while ((nbytes = channel_bytes_unread(self, reader)) < min_bytes &&
+           !atomic_exchange(&reader->is_wake_requested, 0)) {
+        const double remaining_ms = -clock_toc_ms(&deadline);
+        if (remaining_ms <= 0.0 ||
+            !condition_variable_wait_for_ms(&self->notify_data_available,
+                                            &self->lock,
+                                            (float)remaining_ms)) {
+            nbytes = channel_bytes_unread(self, reader);
+            break;
+        }
     }
-    reader->state = ChannelState_Unmapped;
+    atomic_fetch_sub(&self->readers_waiting, 1);
+    lock_release(&self->lock);
+    return nbytes;
+}
+
+void
+channel_wake_reader(struct channel* self, struct channel_reader* reader)
+{
+    atomic_store(&reader->is_wake_requested, 1);
+    lock_acquire(&self->lock);
+    condition_variable_notify_all(&self->notify_data_available);
     lock_release(&self->lock);
-    condition_variable_notify_all(&self->notify_space_available);
 }
 
 void*
 channel_write_map(struct channel* self, size_t nbytes)
 {
-    void* out = 0;
     if (nbytes >= self->capacity)
         return 0;
-    lock_acquire(&self->lock);
 
-    size_t beg, end;
-    if (!self->holds.n) {
-        beg = self->head;
-        end = self->head + nbytes;
-        if (end >= self->capacity) {
-            self->high = self->head;
-            ++self->cycle;
-            self->head = beg = 0;
-            end = nbytes;
-        }
+    const uint64_t head = load(&self->head, relaxed);
+    const uint64_t cycle = load(&self->cycle, relaxed);
+
+    uint64_t beg = head;
+    int is_new_cycle;
+    if (self->is_mirrored) {
+        is_new_cycle =
+          head + nbytes > load(&self->cycle_beg, relaxed) + self->capacity;
     } else {
-        uint8_t should_wrap = 0;
+        if (cycle_of(self, head) < cycle) {
+            // A write that started this cycle was aborted.
+            beg = cycle * self->capacity;
+        } else if (head % self->capacity + nbytes > self->capacity) {
+            // Not enough room before the end of the buffer. Skip the tail.
+            beg = cycle_end(self, head);
+        }
+        is_new_cycle = cycle_of(self, beg) != cycle;
+    }
+    const uint64_t end = beg + nbytes;
 
-        while (self->is_accepting_writes &&
-               !next_write(self, nbytes, &beg, &should_wrap)) {
+    if (atomic_load(&self->holds.n) &&
+        !load(&self->is_accepting_writes, relaxed))
+        return 0;
 
-            condition_variable_wait(&self->notify_space_available, &self->lock);
-        }
-        if (!self->is_accepting_writes)
-            goto Finalize;
-        end = beg + nbytes;
-        if (beg != self->head) {
-            self->high = self->head;
-            self->head = beg;
-            ++self->cycle;
+    int ok = 1;
+    if (is_new_cycle || !can_write(self, head, beg, end)) {
+        // Readers attach at the start of the writer's cycle, so the cycle
+        // may only change under the lock.
+        lock_acquire(&self->lock);
+        atomic_store(&self->is_writer_waiting, 1);
+        for (;;) {
+            drop_oldest(self, head, beg, end, is_new_cycle);
+            if ((ok = (end <= scan_write_limit(self, head, beg))) ||
+                !load(&self->is_accepting_writes, relaxed))
+                break;
+            condition_variable_wait(&self->notify_space_available,
+                                    &self->lock);
         }
-        if (should_wrap) {
-            for (uint32_t i = 0; i < self->holds.n; ++i) {
-                self->holds.pos[i] = 0;
-                self->holds.cycles[i] = self->cycle;
+        atomic_store(&self->is_writer_waiting, 0);
+        if (ok && is_new_cycle) {
+            if (!self->is_mirrored) {
+                store(&self->high, head, release);
+                store(&self->cycle, cycle_of(self, beg), relaxed);
             }
+            store(&self->cycle_beg, beg, release);
         }
+        lock_release(&self->lock);
     }
-    out = self->data + beg;
-    self->mapped = end;
-Finalize:
-    lock_release(&self->lock);
-    return out;
+    if (!ok)
+        return 0;
+
+    self->mapped_beg = beg;
+    self->mapped_end = end;
+    // Announce the reservation before any of it is written. See
+    // channel_read_unmap().
+    store(&self->reserved, end, relaxed);
+    atomic_thread_fence(memory_order_release);
+    return self->data + beg % self->capacity;
 }
 
 void
 channel_write_unmap(struct channel* self)
 {
-    lock_acquire(&self->lock);
-    if (self->is_accepting_writes) {
-        self->head = self->mapped;
+    if (load(&self->is_accepting_writes, relaxed)) {
+        // seq_cst so this store can't be reordered after the load of
+        // readers_waiting.
+        atomic_store(&self->head, self->mapped_end);
+        if (atomic_load(&self->readers_waiting)) {
+            lock_acquire(&self->lock);
+            condition_variable_notify_all(&self->notify_data_available);
+            lock_release(&self->lock);
+        }
     }
-    lock_release(&self->lock);
 }
+
+#ifndef NO_UNIT_TESTS
+#include "logger.h"
+
+#include <string.h>
+
+#define L (aq_logger)
+#define LOGE(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+/// Records written by the test writer: a size followed by a sequence number.
+struct test_record
+{
+    uint32_t nbytes, seq;
+};
+
+struct test_writer
+{
+    struct channel* channel;
+    uint32_t count;
+};
+
+static size_t
+test_record_size(uint32_t seq)
+{
+    return 8 * (1 + (seq * 37) % 29);
+}
+
+static void
+test_writer_thread(struct test_writer* ctx)
+{
+    for (uint32_t i = 0; i < ctx->count; ++i) {
+        const size_t nbytes = test_record_size(i);
+        struct test_record* r = channel_write_map(ctx->channel, nbytes);
+        if (!r)
+            return;
+        *r = (struct test_record){ .nbytes = (uint32_t)nbytes, .seq = i };
+        channel_write_unmap(ctx->channel);
+    }
+}
+
+/// Consumes what's available on `reader`, checking the records are in order.
+/// @returns 0 on error, otherwise 1.
+static int
+test_drain(struct channel* channel,
+           struct channel_reader* reader,
+           uint32_t* expected)
+{
+    struct slice s = channel_read_map(channel, reader);
+    for (uint8_t* cur = s.beg; cur < s.end;) {
+        const struct test_record* r = (const struct test_record*)cur;
+        EXPECT(r->seq == *expected,
+               "Expected record %u. Got %u.",
+               *expected,
+               r->seq);
+        EXPECT(r->nbytes == test_record_size(r->seq),
+               "Record %u has the wrong size: %u",
+               r->seq,
+               r->nbytes);
+        ++*expected;
+        cur += r->nbytes;
+    }
+    channel_read_unmap(channel, reader, s.end - s.beg);
+    return 1;
+Error:
+    channel_read_unmap(channel, reader, s.end - s.beg);
+    return 0;
+}
+
+int
+unit_test__channel__readers_see_every_write_across_wraps()
+{
+    struct channel channel = { 0 };
+    struct thread thread;
+    struct channel_reader readers[2] = { 0 };
+    uint32_t expected[2] = { 0 };
+    struct test_writer ctx = { .channel = &channel, .count = 20000 };
+
+    channel_new(&channel, 1024);
+    thread_init(&thread);
+    // attach both readers before anything is written
+    for (int i = 0; i < 2; ++i) {
+        channel_read_map(&channel, readers + i);
+        channel_read_unmap(&channel, readers + i, 0);
+    }
+    CHECK(thread_create(&thread, (void (*)(void*))test_writer_thread, &ctx));
+
+    for (uint32_t i = 0; expected[0] < ctx.count || expected[1] < ctx.count;
+         ++i) {
+        CHECK(test_drain(&channel, readers + 0, expected + 0));
+        // the second reader lags behind the first
+        if (i % 7 == 0 || expected[0] == ctx.count)
+            CHECK(test_drain(&channel, readers + 1, expected + 1));
+    }
+    thread_join(&thread);
+    CHECK(readers[0].status == Channel_Ok);
+    CHECK(readers[1].status == Channel_Ok);
+    channel_release(&channel);
+    return 1;
+Error:
+    channel_accept_writes(&channel, 0);
+    thread_join(&thread);
+    channel_release(&channel);
+    return 0;
+}
+
+int
+unit_test__channel__read_skips_unused_tail()
+{
+    struct channel channel = { 0 };
+    struct channel_reader reader = { 0 };
+    struct slice s;
+
+    channel_new(&channel, 1024);
+    s = channel_read_map(&channel, &reader);
+    CHECK(s.beg == s.end);
+
+    // 3 writes leave a 124 byte tail that is too small for the 4th.
+    for (int i = 0; i < 3; ++i) {
+        CHECK(channel_write_map(&channel, 300) == channel.data + 300 * i);
+        channel_write_unmap(&channel);
+    }
+    CHECK(channel_bytes_unread(&channel, &reader) == 900);
+    s = channel_read_map(&channel, &reader);
+    CHECK(s.beg == channel.data && s.end == channel.data + 900);
+    channel_read_unmap(&channel, &reader, 900);
+
+    CHECK(channel_write_map(&channel, 300) == channel.data);
+    channel_write_unmap(&channel);
+    CHECK(channel_bytes_unread(&channel, &reader) == 300);
+    s = channel_read_map(&channel, &reader);
+    CHECK(s.beg == channel.data && s.end == channel.data + 300);
+
+    // a partial read resumes where it left off
+    channel_read_unmap(&channel, &reader, 100);
+    s = channel_read_map(&channel, &reader);
+    CHECK(s.beg == channel.data + 100 && s.end == channel.data + 300);
+    channel_read_unmap(&channel, &reader, 200);
+
+    // exactly filling the buffer doesn't skip anything
+    for (int i = 0; i < 3; ++i) {
+        CHECK(channel_write_map(&channel, 240) ==
+              channel.data + 300 + 240 * i);
+        channel_write_unmap(&channel);
+    }
+    CHECK(channel_write_map(&channel, 4) == channel.data + 1020);
+    channel_write_unmap(&channel);
+    CHECK(channel_write_map(&channel, 8) == channel.data);
+    channel_write_unmap(&channel);
+    s = channel_read_map(&channel, &reader);
+    CHECK(s.beg == channel.data + 300 && s.end == channel.data + 1024);
+    channel_read_unmap(&channel, &reader, 724);
+    s = channel_read_map(&channel, &reader);
+    CHECK(s.beg == channel.data && s.end == channel.data + 8);
+    channel_read_unmap(&channel, &reader, 8);
+
+    CHECK(reader.status == Channel_Ok);
+    channel_release(&channel);
+    return 1;
+Error:
+    channel_release(&channel);
+    return 0;
+}
+
+static void
+test_delayed_write_thread(struct channel* channel)
+{
+    clock_sleep_ms(0, 50.0f);
+    channel_write_map(channel, 8);
+    channel_write_unmap(channel);
+}
+
+int
+unit_test__channel__wait_for_data_wakes_on_write()
+{
+    struct channel channel = { 0 };
+    struct channel_reader reader = { 0 };
+    struct thread thread;
+    struct clock clk;
+
+    channel_new(&channel, 1024);
+    thread_init(&thread);
+
+    // times out when nothing is written
+    clock_init(&clk);
+    CHECK(channel_wait_for_data(&channel, &reader, 1, 20.0f) == 0);
+    CHECK(clock_toc_ms(&clk) >= 19.0);
+
+    CHECK(thread_create(
+      &thread, (void (*)(void*))test_delayed_write_thread, &channel));
+    clock_init(&clk);
+    CHECK(channel_wait_for_data(&channel, &reader, 1, 5000.0f) == 8);
+    CHECK(clock_toc_ms(&clk) < 2500.0);
+    thread_join(&thread);
+
+    // returns immediately when enough is already available
+    CHECK(channel_wait_for_data(&channel, &reader, 8, 5000.0f) == 8);
+
+    channel_release(&channel);
+    return 1;
+Error:
+    thread_join(&thread);
+    channel_release(&channel);
+    return 0;
+}
+
+int
+unit_test__channel__overflow_policies()
+{
+    struct channel channel = { 0 };
+    struct channel_reader dropper = { .overflow = ChannelOverflow_DropOldest };
+    struct channel_reader lossy = { .overflow = ChannelOverflow_Lossy };
+    struct slice s;
+
+    channel_new(&channel, 1024);
+    channel_read_map(&channel, &dropper);
+    channel_read_map(&channel, &lossy);
+
+    // Neither reader keeps up. The writer never waits.
+    for (int i = 0; i < 3; ++i) {
+        CHECK(channel_write_map(&channel, 300) == channel.data + 300 * i);
+        channel_write_unmap(&channel);
+    }
+    CHECK(channel_write_map(&channel, 300) == channel.data);
+    channel_write_unmap(&channel);
+    CHECK(channel_bytes_lost(&channel, &dropper) == 900);
+    CHECK(channel_bytes_lost(&channel, &lossy) == 0);
+
+    // The dropped reader picks up at the oldest data that's left.
+    s = channel_read_map(&channel, &dropper);
+    CHECK(s.beg == channel.data && s.end == channel.data + 300);
+
+    CHECK(channel_read_unmap(&channel, &dropper, 300));
+
+    // The lossy reader was lapped. It resumes at the writer's current cycle.
+    for (int i = 0; i < 5; ++i) {
+        CHECK(channel_write_map(&channel, 300));
+        channel_write_unmap(&channel);
+    }
+    s = channel_read_map(&channel, &lossy);
+    CHECK(channel_bytes_lost(&channel, &lossy) == 2048);
+    CHECK(s.beg == channel.data && s.end == channel.data + 900);
+
+    // ...and is told when its mapped data is overwritten.
+    CHECK(channel_write_map(&channel, 300) == channel.data);
+    channel_write_unmap(&channel);
+    CHECK(channel_read_unmap(&channel, &lossy, 900) == 0);
+    CHECK(channel_bytes_lost(&channel, &lossy) == 2048 + 900);
+
+    CHECK(dropper.status == Channel_Ok);
+    CHECK(lossy.status == Channel_Ok);
+    channel_release(&channel);
+    return 1;
+Error:
+    channel_release(&channel);
+    return 0;
+}
+
+int
+unit_test__channel__readers_attach_and_detach()
+{
+    struct channel channel = { 0 };
+    struct channel_reader readers[40] = { 0 };
+    struct channel_reader late = { 0 };
+    struct slice s;
+
+    channel_new(&channel, 1024);
+    // More readers than fit in one block of slots.
+    for (unsigned i = 0; i < countof(readers); ++i) {
+        channel_read_map(&channel, readers + i);
+        CHECK(readers[i].id == i + 1);
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        CHECK(channel_write_map(&channel, 300));
+        channel_write_unmap(&channel);
+    }
+    for (unsigned i = 0; i + 1 < countof(readers); ++i) {
+        s = channel_read_map(&channel, readers + i);
+        CHECK(s.end - s.beg == 900);
+        channel_read_unmap(&channel, readers + i, 900);
+    }
+
+    // The last reader hasn't read anything. Without detaching it, the next
+    // write would wait for it.
+    CHECK(channel_bytes_unread(&channel, readers + 39) == 900);
+    channel_detach_reader(&channel, readers + 39);
+    CHECK(readers[39].id == 0);
+    CHECK(channel_write_map(&channel, 300) == channel.data);
+    channel_write_unmap(&channel);
+
+    // Free slots are reused. A new reader starts at the writer's cycle.
+    channel_detach_reader(&channel, readers + 4);
+    channel_read_map(&channel, &late);
+    CHECK(late.id == 5);
+    CHECK(channel_bytes_unread(&channel, &late) == 300);
+    channel_read_map(&channel, readers + 39);
+    CHECK(readers[39].id == 40);
+    channel_read_unmap(&channel, readers + 39, 0);
+
+    channel_release(&channel);
+    return 1;
+Error:
+    channel_release(&channel);
+    return 0;
+}
+
+int
+unit_test__channel__mirrored_regions_are_contiguous()
+{
+    struct channel channel = { 0 };
+    struct thread thread;
+    struct channel_reader readers[2] = { 0 };
+    uint32_t expected[2] = { 0 };
+    struct test_writer ctx = { .channel = &channel, .count = 20000 };
+    struct slice s;
+    uint8_t* w;
+
+    thread_init(&thread);
+    channel_new_mirrored(&channel, 1);
+    CHECK(channel.data);
+    if (!channel.is_mirrored) {
+        // Not supported on this platform.
+        channel_release(&channel);
+        return 1;
+    }
+    const size_t cap = channel.capacity;
+    const size_t nbytes = cap / 3 + 1;
+    s = channel_read_map(&channel, readers);
+    CHECK(s.beg == s.end);
+
+    // The third write runs past the end of the buffer instead of skipping
+    // the tail.
+    for (size_t i = 0; i < 3; ++i) {
+        CHECK((w = channel_write_map(&channel, nbytes)) ==
+              channel.data + i * nbytes);
+        memset(w, (int)(i + 1), nbytes);
+        channel_write_unmap(&channel);
+        if (i == 1) {
+            s = channel_read_map(&channel, readers);
+            CHECK((size_t)(s.end - s.beg) == 2 * nbytes);
+            channel_read_unmap(&channel, readers, s.end - s.beg);
+        }
+    }
+    CHECK(channel_bytes_unread(&channel, readers) == nbytes);
+    s = channel_read_map(&channel, readers);
+    CHECK(s.beg == channel.data + 2 * nbytes &&
+          (size_t)(s.end - s.beg) == nbytes);
+    CHECK(s.end[-1] == 3 && channel.data[3 * nbytes - cap - 1] == 3);
+    channel_read_unmap(&channel, readers, nbytes);
+
+    // The next write starts where the last one ended.
+    CHECK(channel_write_map(&channel, 8) == channel.data + 3 * nbytes - cap);
+    channel_abort_write(&channel);
+    channel_release(&channel);
+
+    // Same as readers_see_every_write_across_wraps().
+    channel_new_mirrored(&channel, 1024);
+    for (int i = 0; i < 2; ++i) {
+        readers[i] = (struct channel_reader){ 0 };
+        channel_read_map(&channel, readers + i);
+        channel_read_unmap(&channel, readers + i, 0);
+    }
+    CHECK(thread_create(&thread, (void (*)(void*))test_writer_thread, &ctx));
+    for (uint32_t i = 0; expected[0] < ctx.count || expected[1] < ctx.count;
+         ++i) {
+        CHECK(test_drain(&channel, readers + 0, expected + 0));
+        if (i % 7 == 0 || expected[0] == ctx.count)
+            CHECK(test_drain(&channel, readers + 1, expected + 1));
+    }
+    thread_join(&thread);
+    CHECK(readers[0].status == Channel_Ok);
+    CHECK(readers[1].status == Channel_Ok);
+    channel_release(&channel);
+    return 1;
+Error:
+    channel_accept_writes(&channel, 0);
+    thread_join(&thread);
+    channel_release(&channel);
+    return 0;
+}
+#endif // NO_UNIT_TESTS
@@ -3,20 +3,87 @@
 
 #include "platform.h"
 
+#include <stdatomic.h>
+
 #ifdef __cplusplus
 extern "C"
 {
 #endif //__cplusplus
 
+#define CHANNEL_CACHE_LINE_BYTES (64)
+/// Reader slots are allocated this many at a time as readers attach.
+#define CHANNEL_READERS_PER_BLOCK (8)
+#define CHANNEL_MAX_READER_BLOCKS (16)
+#define CHANNEL_MAX_READERS                                                    \
+    (CHANNEL_READERS_PER_BLOCK * CHANNEL_MAX_READER_BLOCKS)
+
+    /// What the writer does when the next write would clobber data a reader
+    /// hasn't consumed yet.
+    enum ChannelOverflow
+    {
+        /// Wait for the reader to catch up.
+        ChannelOverflow_Block = 0,
+
+        /// Skip the reader past the oldest data it hasn't consumed. Data the
+        /// reader has mapped is never overwritten, so the writer still waits
+        /// for a mapped region to be released.
+        ChannelOverflow_DropOldest,
+
+        /// Never wait for the reader. Mapped data may be overwritten while the
+        /// reader is using it. channel_read_unmap() reports when that
+        /// happened.
+        ChannelOverflow_Lossy,
+    };
+
+    /// A reader's bookmark: the virtual offset of the next byte it will
+    /// consume.
+    ///
+    /// Written by the owning reader and polled by the writer. The writer only
+    /// writes to `pos` to skip a `ChannelOverflow_DropOldest` reader ahead.
+    /// Each cursor is padded out to a cache line so readers don't
+    /// false-share.
+    struct channel_cursor
+    {
+        _Atomic uint64_t pos;
+        /// Bytes this reader has lost to its overflow policy.
+        _Atomic uint64_t lost_bytes;
+        /// An `enum ChannelOverflow`.
+        _Atomic uint8_t overflow;
+        /// Cleared when the reader detaches. The writer ignores free slots.
+        _Atomic uint8_t is_attached;
+        uint8_t padding_[CHANNEL_CACHE_LINE_BYTES - 2 * sizeof(uint64_t) -
+                         2 * sizeof(uint8_t)];
+    };
+
     /// @brief A bipartite circular queue for zero-copy streaming to multiple
     /// consumers.
     ///
     /// Inspired by
     /// https://www.codeproject.com/Articles/3479/The-Bip-Buffer-The-Circular-Buffer-with-a-Twist
+    ///
+    /// Positions are tracked as "virtual offsets" that only ever increase.
+    /// The buffer position of an offset is `offset % capacity` and its cycle
+    /// is `offset / capacity`, so a (position, cycle) pair fits in a single
+    /// atomic word.
+    ///
+    /// A channel made with channel_new_mirrored() maps its buffer twice, back
+    /// to back, so a region that runs off the end of the buffer continues at
+    /// its start. The writer never skips a tail and every region is one
+    /// contiguous span. A cycle is then the `capacity` bytes starting at
+    /// `cycle_beg`, and `cycle` and `high` are unused.
+    ///
+    /// There is one writer and up to `CHANNEL_MAX_READERS` readers. Readers
+    /// may attach and detach at any time. The common paths are lock-free: the
+    /// writer publishes `head`, and each reader publishes its own cursor.
+    /// `lock` is only taken when:
+    /// - a reader attaches or detaches,
+    /// - the writer moves into a new cycle, or
+    /// - the writer has to wait for space.
     struct channel
     {
         struct lock lock;
         struct condition_variable notify_space_available;
+        struct condition_variable notify_data_available;
 
         /// Pointer to the start of the channel's buffer.
         uint8_t* data;
@@ -24,31 +91,67 @@ extern "C"
         /// Maximum number of bytes this channel can hold.
         size_t capacity;
 
-        /// Position in the channel where the next write operation will occur.
-        size_t head;
+        /// Set when `data` is mapped twice, back to back.
+        uint8_t is_mirrored;
+
+        /// Writer private: the reserved region of a mapped write.
+        uint64_t mapped_beg, mapped_end;
 
-        /// Highest position in the channel that has been written to in the
-        /// current cycle.
-        size_t high;
+        /// Writer private: the offset the writer could write up to the last
+        /// time it scanned the readers, and `holds.generation` at the time.
+        /// Reader cursors only move forward, so the writer only rescans when
+        /// a write would pass the limit or the set of readers changes.
+        uint64_t write_limit;
+        unsigned write_limit_generation;
 
-        /// Number of times the buffer has been filled and wrapped around to the
-        /// start.
-        size_t cycle;
+        uint8_t padding0_[CHANNEL_CACHE_LINE_BYTES];
 
-        /// Pointer to the end position of the reserved region of a mapped
-        /// write.
-        size_t mapped;
+        /// Offset just past the last byte published by the writer.
+        _Atomic uint64_t head;
+
+        /// Offset just past the last valid byte of the most recently
+        /// completed cycle. Bytes from here to the end of that cycle were
+        /// skipped by the writer when it wrapped.
+        _Atomic uint64_t high;
+
+        /// The cycle the writer is reserving space in.
+        /// Only changes while `lock` is held.
+        _Atomic uint64_t cycle;
+
+        /// Offset of the first byte of the writer's current cycle. Readers
+        /// attach here. Only changes while `lock` is held.
+        _Atomic uint64_t cycle_beg;
+
+        /// End of the region the writer has reserved. Lets lossy readers
+        /// detect when their data was overwritten.
+        _Atomic uint64_t reserved;
 
         /// Whether or not the channel is accepting writes.
-        unsigned char is_accepting_writes;
+        _Atomic uint8_t is_accepting_writes;
+
+        /// Set while the writer is blocked waiting for readers to make space.
+        _Atomic uint8_t is_writer_waiting;
+
+        /// Number of readers blocked in channel_wait_for_data().
+        _Atomic unsigned readers_waiting;
+
+        uint8_t padding1_[CHANNEL_CACHE_LINE_BYTES];
 
-        /// Current positions and cycles of readers on this channel.
+        /// Current positions of readers on this channel.
+        ///
+        /// Slot `i` is `blocks[i / CHANNEL_READERS_PER_BLOCK]` at
+        /// `i % CHANNEL_READERS_PER_BLOCK`. Blocks are allocated as readers
+        /// attach and are only freed by channel_release(), so the writer can
+        /// scan them without the lock.
         struct
         {
-            size_t pos[8];
-            size_t cycles[8];
-            unsigned
-              n; /// Number of readers currently reading from the channel.
+            struct channel_cursor* _Atomic blocks[CHANNEL_MAX_READER_BLOCKS];
+            /// One past the highest slot in use. Slots below this may be
+            /// free.
+            _Atomic unsigned n;
+            /// Changes whenever a reader attaches, detaches or changes its
+            /// overflow policy.
+            _Atomic unsigned generation;
         } holds;
     };
 
@@ -72,14 +175,32 @@ extern "C"
 
     struct channel_reader
     {
+        /// One more than the reader's slot in the channel, or 0 when the
+        /// reader isn't attached.
         unsigned id;
-        size_t pos, cycle;
+        /// Offsets bounding the currently mapped region.
+        uint64_t beg, end;
+        /// Where the reader resumes once the whole region is consumed.
+        uint64_t next;
         enum ChannelStatus status;
         enum ChannelState state;
+        /// Takes effect when the reader attaches. Use channel_set_overflow()
+        /// to change it afterwards.
+        enum ChannelOverflow overflow;
+        /// Set by channel_wake_reader(). Cleared when a wait returns early
+        /// because of it.
+        _Atomic uint8_t is_wake_requested;
     };
 
     void channel_new(struct channel* self, size_t capacity);
 
+    /// @brief Like channel_new(), but maps the buffer twice so no region has
+    /// to wrap.
+    /// `capacity` is rounded up to a multiple of memory_page_size_bytes().
+    /// Falls back to channel_new() where mirrored memory isn't available;
+    /// check `is_mirrored` to see which one you got.
+    void channel_new_mirrored(struct channel* self, size_t capacity);
+
     void channel_release(struct channel* self);
 
     void* channel_write_map(struct channel* self, size_t nbytes);
@@ -93,9 +214,47 @@ extern "C"
     struct slice channel_read_map(struct channel* self,
                                   struct channel_reader* reader);
 
-    void channel_read_unmap(struct channel* self,
-                            struct channel_reader* reader,
-                            size_t consumed_bytes);
+    /// @returns 0 if `reader` is lossy and the writer overwrote some of the
+    ///          mapped region before it was released, otherwise 1.
+    int channel_read_unmap(struct channel* self,
+                           struct channel_reader* reader,
+                           size_t consumed_bytes);
+
+    /// @brief Detaches `reader` from the channel.
+    /// The writer stops waiting on `reader` as soon as this returns, and its
+    /// slot is reused by the next reader to attach. `reader` reattaches at
+    /// the start of the writer's current cycle the next time it reads.
+    void channel_detach_reader(struct channel* self,
+                               struct channel_reader* reader);
+
+    /// Changes what the writer does when `reader` falls behind.
+    /// `reader` should not have a region mapped.
+    void channel_set_overflow(struct channel* self,
+                              struct channel_reader* reader,
+                              enum ChannelOverflow overflow);
+
+    /// @returns the number of bytes `reader` has lost to its overflow policy.
+    uint64_t channel_bytes_lost(const struct channel* self,
+                                const struct channel_reader* reader);
+
+    /// @returns the number of published bytes `reader` has yet to consume.
+    size_t channel_bytes_unread(const struct channel* self,
+                                const struct channel_reader* reader);
+
+    /// @brief Blocks until at least `min_bytes` are waiting to be read by
+    ///        `reader`.
+    /// Returns early if `timeout_ms` elapses or channel_wake_reader() is
+    /// called for `reader`.
+    /// @returns the number of bytes waiting to be read by `reader`.
+    size_t channel_wait_for_data(struct channel* self,
+                                 struct channel_reader* reader,
+                                 size_t min_bytes,
+                                 float timeout_ms);
+
+    /// @brief Releases `reader` from channel_wait_for_data().
+    /// If `reader` isn't waiting, its next wait returns immediately.
+    void channel_wake_reader(struct channel* self,
+                             struct channel_reader* reader);
 
 #ifdef __cplusplus
 } // end extern "C"
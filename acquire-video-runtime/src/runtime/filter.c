@@ -1,10 +1,10 @@
 #include "filter.h"
-#include "frame_iterator.h"
+#include "accumulate.h"
 #include "platform.h"
 #include "logger.h"
-#include "vfslice.h"
-#include "throttler.h"
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
@@ -25,12 +25,6 @@
     } while (0)
 #define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
 
-static size_t
-slice_size_bytes(const struct slice* slice)
-{
-    return (uint8_t*)slice->end - (uint8_t*)slice->beg;
-}
-
 static int
 assert_consistent_shape(const struct VideoFrame* acc,
                         const struct VideoFrame* in)
@@ -42,198 +36,889 @@ assert_consistent_shape(const struct VideoFrame* acc,
     return (res0 == 0) && (res1 == 0);
 }
 
-static int
-accumulate(struct VideoFrame* acc, const struct VideoFrame* in)
+/// Bands start on a cache line so threads never write the same line.
+#define FILTER_BAND_ALIGN_SAMPLES (64 / sizeof(float))
+
+/// Runs band `band` of `job`.
+static void
+filter_job_run_band(const struct filter_job* job, uint32_t band, uint32_t n)
 {
-    size_t npx = acc->shape.strides.planes; // assumes planes is outer dim
-    if (acc->shape.type != SampleType_f32)
-        return 0;
+    const size_t a = FILTER_BAND_ALIGN_SAMPLES;
+    const size_t beg = (job->count * band / n) / a * a;
+    const size_t end =
+      (band + 1 == n) ? job->count : (job->count * (band + 1) / n) / a * a;
+    if (end <= beg)
+        return;
+    const size_t offset = beg * job->bytes_per_sample;
+    if (job->slide)
+        job->slide(job->acc + beg,
+                   job->out + beg,
+                   job->history + offset,
+                   job->in + offset,
+                   end - beg,
+                   job->scale);
+    else if (job->ema)
+        job->ema(
+          job->acc + beg, job->out + beg, job->in + offset, end - beg, job->scale);
+    else if (job->fu)
+        job->fu(job->sums + beg, job->in + offset, end - beg);
+    else if (job->mean)
+        job->mean(job->native_out + offset,
+                  job->sums + beg,
+                  job->in + offset,
+                  end - beg,
+                  &job->divisor);
+    else
+        job->f(job->acc + beg, job->in + offset, end - beg, job->scale);
+}
 
-    float* x = (float*)acc->data;
-    switch (in->shape.type) {
-        case SampleType_u8: {
-            const uint8_t* y = in->data;
-            for (size_t i = 0; i < npx; ++i)
-                x[i] += y[i];
-            break;
-        }
-        case SampleType_u10:
-        case SampleType_u12:
-        case SampleType_u14:
-        case SampleType_u16: {
-            const uint16_t* y = (uint16_t*)in->data;
-            for (size_t i = 0; i < npx; ++i)
-                x[i] += y[i];
-            break;
-        }
-        case SampleType_i8: {
-            const int8_t* y = (int8_t*)in->data;
-            for (size_t i = 0; i < npx; ++i)
-                x[i] += y[i];
-            break;
-        }
-        case SampleType_i16: {
-            const int16_t* y = (int16_t*)in->data;
-            for (size_t i = 0; i < npx; ++i)
-                x[i] += y[i];
+static void
+filter_worker_thread(struct filter_worker* self)
+{
+    struct filter_pool* pool = self->pool;
+    uint64_t generation = 0;
+    lock_acquire(&pool->lock);
+    while (1) {
+        while (!pool->is_stopping && pool->generation == generation)
+            condition_variable_wait(&pool->job_posted, &pool->lock);
+        if (pool->is_stopping)
             break;
-        }
+        generation = pool->generation;
+        const struct filter_job job = pool->job;
+        const uint32_t nbands = pool->nbands;
+        lock_release(&pool->lock);
+
+        filter_job_run_band(&job, self->band, nbands);
+
+        lock_acquire(&pool->lock);
+        if (--pool->pending == 0)
+            condition_variable_notify_all(&pool->job_done);
+    }
+    lock_release(&pool->lock);
+}
+
+/// Starts `thread_count - 1` workers. On failure the pool is left with the
+/// workers that did start.
+static int
+filter_pool_start(struct filter_pool* self, uint32_t thread_count)
+{
+    self->generation = 0;
+    self->pending = 0;
+    self->nbands = 1;
+    self->is_stopping = 0;
+    for (uint32_t i = 1; i < thread_count; ++i) {
+        struct filter_worker* w = self->workers + i - 1;
+        *w = (struct filter_worker){ .pool = self, .band = i };
+        thread_init(&w->thread);
+        CHECK(thread_create(
+          &w->thread, (void (*)(void*))filter_worker_thread, w));
+        self->nbands = i + 1;
+    }
+    return 1;
+Error:
+    return 0;
+}
+
+static void
+filter_pool_stop(struct filter_pool* self)
+{
+    lock_acquire(&self->lock);
+    self->is_stopping = 1;
+    condition_variable_notify_all(&self->job_posted);
+    lock_release(&self->lock);
+    for (uint32_t i = 0; i + 1 < self->nbands; ++i)
+        thread_join(&self->workers[i].thread);
+    self->nbands = 1;
+}
+
+/// Runs `job` across the pool. The calling thread takes the first band.
+static void
+filter_pool_run(struct filter_pool* self, const struct filter_job* job)
+{
+    if (self->nbands == 1) {
+        filter_job_run_band(job, 0, 1);
+        return;
+    }
+    lock_acquire(&self->lock);
+    self->job = *job;
+    self->pending = self->nbands - 1;
+    ++self->generation;
+    condition_variable_notify_all(&self->job_posted);
+    lock_release(&self->lock);
+
+    filter_job_run_band(job, 0, self->nbands);
+
+    lock_acquire(&self->lock);
+    while (self->pending)
+        condition_variable_wait(&self->job_done, &self->lock);
+    lock_release(&self->lock);
+}
+
+static int
+is_same_shape(const struct ImageShape* a, const struct ImageShape* b)
+{
+    return a->type == b->type &&
+           memcmp(&a->dims, &b->dims, sizeof(a->dims)) == 0 &&
+           memcmp(&a->strides, &b->strides, sizeof(a->strides)) == 0;
+}
+
+static enum SampleType
+output_type(const struct video_filter_s* self, enum SampleType in)
+{
+    switch (self->output) {
+        case FilterOutput_Native:
+            return in;
+        case FilterOutput_Sum:
+            return SampleType_u32;
         default:
-            LOGE("Unsupported pixel type");
-            return 0;
+            return SampleType_f32;
+    }
+}
+
+/// Maps an output frame for `in` from the output channel.
+/// @returns 0 if the channel can't take it.
+static struct VideoFrame*
+map_output_frame(struct video_filter_s* self, const struct VideoFrame* in)
+{
+    struct ImageShape shape = in->shape;
+    shape.type = output_type(self, in->shape.type);
+    const size_t nbytes = bytes_of_image(&shape) + sizeof(struct VideoFrame);
+    const size_t bytes_of_frame = 8 * ((nbytes + 7) / 8);
+    struct VideoFrame* out = channel_write_map(self->stage.out, bytes_of_frame);
+    if (out) {
+        *out = (struct VideoFrame){
+            .bytes_of_frame = bytes_of_frame,
+            .frame_id = in->frame_id,
+            .shape = shape,
+            .timestamps = in->timestamps,
+        };
     }
+    return out;
+}
+
+static void
+running_free(struct video_filter_s* self)
+{
+    free(self->running);
+    free(self->history);
+    self->running = 0;
+    self->history = 0;
+    self->history_frames = 0;
+}
+
+/// Allocates the sliding or exponential state for frames of `shape`.
+static int
+running_alloc(struct video_filter_s* self, const struct ImageShape* shape)
+{
+    running_free(self);
+    const size_t count = shape->strides.planes; // assumes planes is outer dim
+    CHECK(self->running = malloc(count * sizeof(float)));
+    if (self->mode == FilterMode_Sliding) {
+        self->bytes_of_history_frame = count * bytes_of_type(shape->type);
+        CHECK(self->history = malloc(self->bytes_of_history_frame *
+                                     self->filter_window_frames));
+        self->history_frames = self->filter_window_frames;
+    }
+    self->running_shape = *shape;
+    self->frame_count = 0;
     return 1;
+Error:
+    LOGE("[stream %d] FILTER: Failed to allocate the running average",
+         self->stage.stream_id);
+    running_free(self);
+    return 0;
 }
 
+/// Sums the sliding window's history into `running` from scratch.
+///
+/// f32 and u32 samples don't sum exactly in f32, so every add and subtract
+/// of a running sum can round, and the error would build up for as long as
+/// the stream runs. Re-summing once per window bounds it to what one
+/// window's worth of steps can add.
 static void
-normalize(struct VideoFrame* acc, float inverse_norm)
+resum_history(struct video_filter_s* self, enum SampleType type)
 {
-    float* const x = (float*)acc->data;
-    const size_t npx = acc->shape.strides.planes;
-    for (size_t i = 0; i < npx; ++i)
-        x[i] *= inverse_norm;
+    struct filter_job job = {
+        .f = self->kernels->load[type],
+        .acc = self->running,
+        .in = self->history,
+        .count = self->running_shape.strides.planes,
+        .bytes_per_sample = bytes_of_type(type),
+        .scale = 1.0f,
+    };
+    filter_pool_run(&self->pool, &job);
+    job.f = self->kernels->add[type];
+    for (uint32_t i = 1; i < self->history_frames; ++i) {
+        job.in = self->history + i * self->bytes_of_history_frame;
+        filter_pool_run(&self->pool, &job);
+    }
 }
 
+/// Sliding and exponential modes. Folds `in` into the running state and
+/// emits the current average, so one frame goes out for every frame in.
 static int
-process_data(struct video_filter_s* self,
-             struct VideoFrame** accumulator,
-             uint64_t* frame_count)
-{
-    struct VideoFrame* in = 0;
-    {
-        struct slice slice = channel_read_map(&self->in, &self->reader);
-        struct frame_iterator it = frame_iterator_init(&slice);
-        while ((in = frame_iterator_next(&it))) {
-            if (!*accumulator) {
-                struct ImageShape shape = in->shape;
-                shape.type = SampleType_f32;
-
-                const size_t nbytes =
-                  bytes_of_image(&shape) + sizeof(struct VideoFrame);
-                const size_t bytes_of_accumulator = 8*((nbytes+7)/8);
-
-                *accumulator = (struct VideoFrame*)channel_write_map(
-                  self->out, bytes_of_accumulator);
-                if (*accumulator) {
-                    *accumulator[0] = (struct VideoFrame){
-                        .bytes_of_frame = bytes_of_accumulator,
-                        .frame_id = in->frame_id,
-                        .shape = shape,
-                        .timestamps = in->timestamps,
-                    };
-                    CHECK(accumulate(*accumulator, in));
-                    *frame_count = 1;
-                }
-            } else {
-                if (assert_consistent_shape(*accumulator, in)) {
-                    CHECK(accumulate(*accumulator, in));
-                    ++*frame_count;
-                    if (*frame_count >= self->filter_window_frames) {
-                        normalize(*accumulator,
-                                  *frame_count ? 1.0f / (*frame_count) : 1.0f);
-                        *frame_count = 0;
-                        *accumulator = 0;
-                        channel_write_unmap(self->out);
-                    }
-                } else {
-                    LOG("FILTER: emitting early -- shape inconsistent");
-                    *frame_count = 0;
-                    *accumulator = 0;
-                    channel_abort_write(self->out);
-                }
-            }
-        }
-        channel_read_unmap(&self->in, &self->reader, slice_size_bytes(&slice));
+process_running(struct video_filter_s* self, const struct VideoFrame* in)
+{
+    if ((unsigned)in->shape.type >= SampleTypeCount) {
+        LOGE("Unsupported pixel type");
+        return 0;
+    }
+    const int is_sliding = self->mode == FilterMode_Sliding;
+    if (!self->running || !is_same_shape(&self->running_shape, &in->shape) ||
+        (is_sliding && self->history_frames != self->filter_window_frames)) {
+        if (self->running)
+            LOG("FILTER: restarting the running average -- shape changed");
+        CHECK(running_alloc(self, &in->shape));
+    }
+
+    const size_t count = in->shape.strides.planes;
+    if (self->frame_count == 0) {
+        // An empty window: nothing to subtract and nothing to decay.
+        memset(self->running, 0, count * sizeof(float)); // NOLINT
+        if (is_sliding)
+            memset(self->history, // NOLINT
+                   0,
+                   self->bytes_of_history_frame * self->history_frames);
+        self->history_next = 0;
+    }
+
+    struct VideoFrame* out = map_output_frame(self, in);
+    if (!out)
+        return 1; // Dropped. The window carries on without this frame.
+
+    const enum SampleType type = in->shape.type;
+    struct filter_job job = {
+        .acc = self->running,
+        .out = (float*)out->data,
+        .in = in->data,
+        .count = count,
+        .bytes_per_sample = bytes_of_type(type),
     };
+    if (is_sliding) {
+        const uint64_t n = self->frame_count < self->history_frames
+                             ? self->frame_count + 1
+                             : self->history_frames;
+        job.slide = self->kernels->slide[type];
+        job.history =
+          self->history + self->history_next * self->bytes_of_history_frame;
+        job.scale = 1.0f / (float)n;
+        self->history_next = (self->history_next + 1) % self->history_frames;
+    } else {
+        job.ema = self->kernels->ema[type];
+        // The first frame seeds the average.
+        job.scale = self->frame_count ? self->ema_alpha : 1.0f;
+    }
+    filter_pool_run(&self->pool, &job);
+    ++self->frame_count;
+    // Samples of up to 16 bits sum exactly. See FILTER_MAX_SLIDING_WINDOW.
+    if (is_sliding && self->history_next == 0 && bytes_of_type(type) > 2)
+        resum_history(self, type);
+    channel_write_unmap(self->stage.out);
+    return 1;
+Error:
+    return 0;
+}
 
-    if (self->sig_accumulator_reset) {
-        LOG("FILTER: accumulator reset (%d)", *frame_count);
-        if (*accumulator) {
-            *accumulator = 0;
-            *frame_count = 0;
-            channel_abort_write(self->out);
-        }
-        self->sig_accumulator_reset = 0;
-        event_notify_all(&self->accumulator_reset_event);
+/// Makes sure `sums` holds `count` samples, for `FilterOutput_Native`.
+static int
+reserve_sums(struct video_filter_s* self, size_t count)
+{
+    if (self->sums_count < count) {
+        free(self->sums);
+        self->sums_count = 0;
+        CHECK(self->sums = malloc(count * sizeof(uint32_t)));
+        self->sums_count = count;
     }
     return 1;
 Error:
-    channel_read_unmap(&self->in, &self->reader, 0);
-    // reset state
-    *frame_count = 0;
-    *accumulator = 0;
-    channel_write_unmap(self->out);
+    LOGE("[stream %d] FILTER: Failed to allocate the accumulator",
+         self->stage.stream_id);
     return 0;
 }
 
+/// Tumbling mode. Adds `in` to the window's accumulator. The first frame of
+/// a window overwrites it instead, and the last one finishes the output
+/// frame (the mean or the sum) in the same pass.
 static int
-video_filter_thread(struct video_filter_s* self)
-{
-    int ecode = 0;
-    uint64_t frame_count = 0;
-    struct VideoFrame* accumulator = 0;
-    LOG("[stream %d] PROCESSING: Entering frame processing thread",
-        self->stream_id);
-    struct throttler throttler = throttler_init(10e-3f);
-    while (!self->is_stopping) {
-        CHECK(process_data(self, &accumulator, &frame_count));
-        throttler_wait(&throttler);
-    }
-    LOG("[stream: %d] PROCESSING: Flush", self->stream_id);
-    CHECK(process_data(self, &accumulator, &frame_count));
-Finalize:
-    if (accumulator)
-        channel_write_unmap(self->out);
-    LOG("[stream: %d] PROCESSING: Exiting frame processing thread",
-        self->stream_id);
-    self->is_running = 0;
-    self->is_stopping = 0;
-    return ecode;
+process_tumbling(struct video_filter_s* self, const struct VideoFrame* in)
+{
+    const enum SampleType type = in->shape.type;
+    if ((unsigned)type >= SampleTypeCount) {
+        LOGE("Unsupported pixel type");
+        return 0;
+    }
+    const int is_integer = self->output != FilterOutput_Float;
+    EXPECT(!is_integer || self->kernels->load_u32[type],
+           "[stream %d] FILTER: Integer accumulation needs unsigned samples "
+           "of up to 16 bits. Got %s.",
+           self->stage.stream_id,
+           sample_type_as_string(type));
+
+    if (self->accumulator && !assert_consistent_shape(self->accumulator, in)) {
+        LOG("FILTER: emitting early -- shape inconsistent");
+        self->frame_count = 0;
+        self->accumulator = 0;
+        channel_abort_write(self->stage.out);
+        return 1;
+    }
+    if (!self->accumulator) {
+        if (!(self->accumulator = map_output_frame(self, in)))
+            return 1;
+        self->frame_count = 0;
+    }
+
+    const size_t count = in->shape.strides.planes; // assumes planes is outer
+    const uint64_t n = self->frame_count + 1;
+    const int is_first = n == 1;
+    const int is_last = n >= self->filter_window_frames;
+    struct filter_job job = {
+        .in = in->data,
+        .count = count,
+        .bytes_per_sample = bytes_of_type(type),
+    };
+    switch (self->output) {
+        case FilterOutput_Native:
+            CHECK(reserve_sums(self, count));
+            job.sums = self->sums;
+            if (is_last) {
+                if (is_first)
+                    memset(self->sums, 0, count * sizeof(uint32_t)); // NOLINT
+                job.mean = self->kernels->mean_u32[type];
+                job.native_out = self->accumulator->data;
+                job.divisor = accumulate_divisor_init((uint32_t)n);
+            } else {
+                job.fu = is_first ? self->kernels->load_u32[type]
+                                  : self->kernels->add_u32[type];
+            }
+            break;
+        case FilterOutput_Sum:
+            job.sums = (uint32_t*)self->accumulator->data;
+            job.fu = is_first ? self->kernels->load_u32[type]
+                              : self->kernels->add_u32[type];
+            break;
+        default:
+            job.acc = (float*)self->accumulator->data;
+            job.f = is_first ? self->kernels->load[type]
+                             : self->kernels->add[type];
+            job.scale = is_last ? 1.0f / (float)n : 1.0f;
+            break;
+    }
+    filter_pool_run(&self->pool, &job);
+
+    self->frame_count = n;
+    if (is_last) {
+        self->frame_count = 0;
+        self->accumulator = 0;
+        channel_write_unmap(self->stage.out);
+    }
+    return 1;
 Error:
-    ecode = 1;
-    goto Finalize;
+    return 0;
+}
+
+#define containerof(ptr, T, V) ((T*)(((char*)(ptr)) - offsetof(T, V)))
+
+static int
+process_frame(struct video_stage_s* stage, const struct VideoFrame* in)
+{
+    struct video_filter_s* self =
+      containerof(stage, struct video_filter_s, stage);
+    return self->mode == FilterMode_Tumbling ? process_tumbling(self, in)
+                                             : process_running(self, in);
+}
+
+static void
+reset(struct video_stage_s* stage)
+{
+    struct video_filter_s* self =
+      containerof(stage, struct video_filter_s, stage);
+    LOG("FILTER: accumulator reset (%d)", (int)self->frame_count);
+    if (self->accumulator)
+        channel_abort_write(self->stage.out);
+    self->accumulator = 0;
+    self->frame_count = 0;
+}
+
+static int
+start(struct video_stage_s* stage)
+{
+    struct video_filter_s* self =
+      containerof(stage, struct video_filter_s, stage);
+    self->accumulator = 0;
+    self->frame_count = 0;
+    if (!filter_pool_start(&self->pool, self->thread_count)) {
+        LOGE("[stream %d] FILTER: Started %u of %u threads",
+             self->stage.stream_id,
+             self->pool.nbands,
+             self->thread_count);
+    }
+    return 1;
+}
+
+static void
+stop(struct video_stage_s* stage)
+{
+    struct video_filter_s* self =
+      containerof(stage, struct video_filter_s, stage);
+    filter_pool_stop(&self->pool);
+    // A partial window is flushed as it is. A native mean isn't written
+    // until the last frame, so there's nothing to flush.
+    if (self->accumulator) {
+        if (self->output == FilterOutput_Native)
+            channel_abort_write(self->stage.out);
+        else
+            channel_write_unmap(self->stage.out);
+    }
+    self->accumulator = 0;
+    self->frame_count = 0;
+    running_free(self);
+    free(self->sums);
+    self->sums = 0;
+    self->sums_count = 0;
+}
+
+static void
+transform_shape(const struct video_stage_s* stage, struct ImageShape* shape)
+{
+    const struct video_filter_s* self =
+      containerof(stage, struct video_filter_s, stage);
+    shape->type = output_type(self, shape->type);
+}
+
+static void
+destroy(struct video_stage_s* stage)
+{
+    free(containerof(stage, struct video_filter_s, stage));
 }
 
 enum DeviceStatusCode
 video_filter_init(struct video_filter_s* self,
                   uint8_t stream_id,
-                  size_t channel_size_bytes,
-                  struct channel* out)
+                  size_t channel_size_bytes)
 {
-    CHECK(out);
-    *self = (struct video_filter_s){ .stream_id = stream_id, .out = out };
-    channel_new(&self->in, channel_size_bytes);
-    thread_init(&self->thread);
-    event_init(&self->accumulator_reset_event);
+    *self = (struct video_filter_s){
+        .thread_count = 1,
+        .kernels = accumulate_kernels_select(),
+    };
+    CHECK(video_stage_init(&self->stage, stream_id, channel_size_bytes) ==
+          Device_Ok);
+    self->stage.name = "FILTER";
+    self->stage.process = process_frame;
+    self->stage.reset = reset;
+    self->stage.start = start;
+    self->stage.stop = stop;
+    self->stage.transform_shape = transform_shape;
+    lock_init(&self->pool.lock);
+    condition_variable_init(&self->pool.job_posted);
+    condition_variable_init(&self->pool.job_done);
+    self->pool.nbands = 1;
     return Device_Ok;
 Error:
     return Device_Err;
 }
 
-void
-video_filter_destroy(struct video_filter_s* self)
+struct video_stage_s*
+video_filter_create(uint8_t stream_id, size_t channel_size_bytes)
 {
-    thread_join(&self->thread);
-    event_destroy(&self->accumulator_reset_event);
-    channel_release(&self->in);
+    struct video_filter_s* self = malloc(sizeof(*self));
+    CHECK(self);
+    if (video_filter_init(self, stream_id, channel_size_bytes) != Device_Ok) {
+        free(self);
+        goto Error;
+    }
+    self->stage.destroy = destroy;
+    return &self->stage;
+Error:
+    return 0;
 }
 
 enum DeviceStatusCode
 video_filter_configure(struct video_filter_s* self,
-                       uint32_t frame_average_count)
+                       enum FilterMode mode,
+                       uint32_t frame_average_count,
+                       uint32_t thread_count,
+                       float ema_alpha,
+                       enum FilterOutput output)
 {
+    EXPECT((unsigned)mode < FilterModeCount,
+           "[stream %d] FILTER: Unknown mode (%d).",
+           self->stage.stream_id,
+           (int)mode);
+    EXPECT((unsigned)output < FilterOutputCount,
+           "[stream %d] FILTER: Unknown output (%d).",
+           self->stage.stream_id,
+           (int)output);
+    EXPECT(output == FilterOutput_Float || mode == FilterMode_Tumbling,
+           "[stream %d] FILTER: Only tumbling windows can accumulate in u32.",
+           self->stage.stream_id);
+    EXPECT(output == FilterOutput_Float ||
+             frame_average_count <= FILTER_MAX_INTEGER_WINDOW,
+           "[stream %d] FILTER: A u32 accumulator can hold up to %d frames. "
+           "Got %u.",
+           self->stage.stream_id,
+           FILTER_MAX_INTEGER_WINDOW,
+           frame_average_count);
+    EXPECT(mode != FilterMode_Sliding ||
+             (frame_average_count >= 1 &&
+              frame_average_count <= FILTER_MAX_SLIDING_WINDOW),
+           "[stream %d] FILTER: A sliding window must hold 1 to %d frames. "
+           "Got %u.",
+           self->stage.stream_id,
+           FILTER_MAX_SLIDING_WINDOW,
+           frame_average_count);
+    EXPECT(ema_alpha >= 0.0f && ema_alpha <= 1.0f,
+           "[stream %d] FILTER: Expected an EMA weight in [0, 1]. Got %f.",
+           self->stage.stream_id,
+           ema_alpha);
+    if (ema_alpha == 0.0f)
+        ema_alpha = frame_average_count > 1
+                      ? 2.0f / ((float)frame_average_count + 1.0f)
+                      : 1.0f;
+
+    self->mode = mode;
+    self->output = output;
     self->filter_window_frames = frame_average_count;
+    self->ema_alpha = ema_alpha;
+    self->stage.frame_id_stride =
+      (mode == FilterMode_Tumbling && frame_average_count > 1)
+        ? frame_average_count
+        : 1;
+    self->thread_count = thread_count ? thread_count : 1;
+    if (self->thread_count > FILTER_MAX_THREADS)
+        self->thread_count = FILTER_MAX_THREADS;
     return Device_Ok;
+Error:
+    return Device_Err;
 }
 
-enum DeviceStatusCode
-video_filter_start(struct video_filter_s* self)
+#ifndef NO_UNIT_TESTS
+#include <math.h>
+
+static uint16_t
+test_pixel(size_t j, uint32_t frame)
 {
-    self->is_stopping = 0;
-    self->is_running = 1;
-    CHECK(
-      thread_create(&self->thread, (void (*)(void*))video_filter_thread, self));
-    return Device_Ok;
+    return (uint16_t)(j * 2654435761u + frame * 40503u);
+}
+
+/// f32 test samples. The first frame is so large that adding the next one
+/// to it rounds, so a running sum that later subtracts it is off.
+static float
+test_float_pixel(size_t j, uint32_t frame)
+{
+    return frame ? (float)test_pixel(j, frame) : 1e8f;
+}
+
+/// Averages `nframes` frames in windows of `window` frames using
+/// `thread_count` threads. Copies the output pixels to `out`, packed. u16
+/// frames hold test_pixel() and f32 frames test_float_pixel().
+/// @returns the number of output frames, or -1 on error.
+static int
+test_average_with_output(enum FilterMode mode,
+                         enum FilterOutput output,
+                         enum SampleType type,
+                         uint32_t window,
+                         uint32_t thread_count,
+                         uint32_t width,
+                         uint32_t height,
+                         uint32_t nframes,
+                         void* out)
+{
+    const size_t capacity = 64ULL << 20;
+    const size_t npx = (size_t)width * height;
+    const size_t bytes_of_in =
+      8 * ((sizeof(struct VideoFrame) + npx * bytes_of_type(type) + 7) / 8);
+    struct channel sink = { 0 };
+    struct channel_reader reader = { 0 };
+    struct video_filter_s filter = { 0 };
+    int nout = 0;
+
+    channel_new(&sink, capacity);
+    CHECK(sink.data);
+    CHECK(video_filter_init(&filter, 0, capacity) == Device_Ok);
+    filter.stage.out = &sink;
+    CHECK(video_filter_configure(
+            &filter, mode, window, thread_count, 0, output) == Device_Ok);
+
+    for (uint32_t i = 0; i < nframes; ++i) {
+        struct VideoFrame* f = channel_write_map(&filter.stage.in, bytes_of_in);
+        CHECK(f);
+        *f = (struct VideoFrame){
+            .bytes_of_frame = bytes_of_in,
+            .shape = { .dims = { .channels = 1,
+                                 .width = width,
+                                 .height = height,
+                                 .planes = 1 },
+                       .strides = { .channels = 1,
+                                    .width = 1,
+                                    .height = width,
+                                    .planes = (int64_t)npx },
+                       .type = type },
+            .frame_id = i,
+        };
+        for (size_t j = 0; j < npx; ++j) {
+            if (type == SampleType_f32)
+                ((float*)f->data)[j] = test_float_pixel(j, i);
+            else
+                ((uint16_t*)f->data)[j] = test_pixel(j, i);
+        }
+        channel_write_unmap(&filter.stage.in);
+    }
+
+    // All the input is queued, so the filter's final flush consumes it.
+    CHECK(video_stage_start(&filter.stage) == Device_Ok);
+    video_stage_sig_stop(&filter.stage);
+    video_stage_destroy(&filter.stage);
+
+    struct slice s = channel_read_map(&sink, &reader);
+    for (uint8_t* cur = s.beg; cur < s.end; ++nout) {
+        const struct VideoFrame* f = (const struct VideoFrame*)cur;
+        const size_t nbytes = bytes_of_image(&f->shape);
+        memcpy((uint8_t*)out + nout * nbytes, f->data, nbytes); // NOLINT
+        cur += f->bytes_of_frame;
+    }
+    channel_read_unmap(&sink, &reader, s.end - s.beg);
+    channel_release(&sink);
+    return nout;
 Error:
-    return Device_Err;
+    channel_release(&filter.stage.in);
+    channel_release(&sink);
+    return -1;
+}
+
+static int
+test_average(enum FilterMode mode,
+             uint32_t window,
+             uint32_t thread_count,
+             uint32_t width,
+             uint32_t height,
+             uint32_t nframes,
+             float* out)
+{
+    return test_average_with_output(mode,
+                                    FilterOutput_Float,
+                                    SampleType_u16,
+                                    window,
+                                    thread_count,
+                                    width,
+                                    height,
+                                    nframes,
+                                    out);
+}
+
+int
+unit_test__filter__threaded_average_matches_serial()
+{
+    // Not a multiple of the band alignment, so the last band is ragged.
+    const uint32_t width = 1013, height = 37, nframes = 9;
+    const size_t nbytes = (size_t)width * height * sizeof(float) * nframes;
+    // Only a third of each buffer is written, so zero the rest for memcmp.
+    float* serial = calloc(1, nbytes);
+    float* threaded = calloc(1, nbytes);
+    CHECK(serial && threaded);
+
+    CHECK(test_average(
+            FilterMode_Tumbling, 3, 1, width, height, nframes, serial) == 3);
+    for (uint32_t n = 2; n <= 5; ++n) {
+        CHECK(test_average(FilterMode_Tumbling,
+                           3,
+                           n,
+                           width,
+                           height,
+                           nframes,
+                           threaded) == 3);
+        EXPECT(memcmp(serial, threaded, nbytes) == 0,
+               "Averaging with %u threads differs from one thread",
+               n);
+    }
+    free(serial);
+    free(threaded);
+    return 1;
+Error:
+    free(serial);
+    free(threaded);
+    return 0;
+}
+
+int
+unit_test__filter__running_modes_match_reference()
+{
+    const uint32_t width = 1013, height = 7, nframes = 11, window = 4;
+    const size_t npx = (size_t)width * height;
+    const size_t nbytes = npx * sizeof(float) * nframes;
+    float* serial = malloc(nbytes);
+    float* threaded = malloc(nbytes);
+    CHECK(serial && threaded);
+
+    // Every input frame produces an output frame. The sliding mean of up to
+    // `window` integer frames is exact in f32 up to the final scaling.
+    CHECK(test_average(FilterMode_Sliding,
+                       window,
+                       1,
+                       width,
+                       height,
+                       nframes,
+                       serial) == (int)nframes);
+    for (uint32_t i = 0; i < nframes; ++i) {
+        const uint32_t n = i + 1 < window ? i + 1 : window;
+        for (size_t j = 0; j < npx; ++j) {
+            double sum = 0;
+            for (uint32_t k = i + 1 - n; k <= i; ++k)
+                sum += test_pixel(j, k);
+            const float expected = (float)sum * (1.0f / (float)n);
+            EXPECT(serial[i * npx + j] == expected,
+                   "Sliding mean of frame %u, pixel %llu: expected %f, got %f",
+                   i,
+                   (unsigned long long)j,
+                   expected,
+                   serial[i * npx + j]);
+        }
+    }
+    CHECK(test_average(FilterMode_Sliding,
+                       window,
+                       3,
+                       width,
+                       height,
+                       nframes,
+                       threaded) == (int)nframes);
+    CHECK(memcmp(serial, threaded, nbytes) == 0);
+
+    // An alpha of zero selects 2 / (window + 1).
+    const float alpha = 2.0f / ((float)window + 1.0f);
+    CHECK(test_average(FilterMode_Exponential,
+                       window,
+                       1,
+                       width,
+                       height,
+                       nframes,
+                       serial) == (int)nframes);
+    for (size_t j = 0; j < npx; ++j) {
+        float ema = 0;
+        for (uint32_t i = 0; i < nframes; ++i) {
+            const float a = i ? alpha : 1.0f;
+            ema = ema + ((float)test_pixel(j, i) - ema) * a;
+            // Compilers may fuse this into an FMA, so allow for rounding.
+            EXPECT(fabsf(serial[i * npx + j] - ema) <= 1e-5f * fabsf(ema),
+                   "EMA of frame %u, pixel %llu: expected %f, got %f",
+                   i,
+                   (unsigned long long)j,
+                   ema,
+                   serial[i * npx + j]);
+        }
+    }
+    CHECK(test_average(FilterMode_Exponential,
+                       window,
+                       3,
+                       width,
+                       height,
+                       nframes,
+                       threaded) == (int)nframes);
+    CHECK(memcmp(serial, threaded, nbytes) == 0);
+
+    free(serial);
+    free(threaded);
+    return 1;
+Error:
+    free(serial);
+    free(threaded);
+    return 0;
+}
+
+int
+unit_test__filter__integer_outputs_are_exact()
+{
+    const uint32_t width = 1013, height = 7, nframes = 9, window = 3;
+    const size_t npx = (size_t)width * height;
+    const uint32_t nout = nframes / window;
+    uint16_t* means = malloc(npx * sizeof(uint16_t) * nout);
+    uint32_t* sums = malloc(npx * sizeof(uint32_t) * nout);
+    CHECK(means && sums);
+
+    for (uint32_t nthreads = 1; nthreads <= 3; nthreads += 2) {
+        CHECK(test_average_with_output(FilterMode_Tumbling,
+                                       FilterOutput_Native,
+                                       SampleType_u16,
+                                       window,
+                                       nthreads,
+                                       width,
+                                       height,
+                                       nframes,
+                                       means) == (int)nout);
+        CHECK(test_average_with_output(FilterMode_Tumbling,
+                                       FilterOutput_Sum,
+                                       SampleType_u16,
+                                       window,
+                                       nthreads,
+                                       width,
+                                       height,
+                                       nframes,
+                                       sums) == (int)nout);
+        for (uint32_t i = 0; i < nout; ++i) {
+            for (size_t j = 0; j < npx; ++j) {
+                uint32_t sum = 0;
+                for (uint32_t k = i * window; k < (i + 1) * window; ++k)
+                    sum += test_pixel(j, k);
+                const uint32_t mean = (sum + window / 2) / window;
+                EXPECT(sums[i * npx + j] == sum,
+                       "Sum of window %u, pixel %llu: expected %u, got %u",
+                       i,
+                       (unsigned long long)j,
+                       sum,
+                       sums[i * npx + j]);
+                EXPECT(means[i * npx + j] == mean,
+                       "Mean of window %u, pixel %llu: expected %u, got %u",
+                       i,
+                       (unsigned long long)j,
+                       mean,
+                       means[i * npx + j]);
+            }
+        }
+    }
+    free(means);
+    free(sums);
+    return 1;
+Error:
+    free(means);
+    free(sums);
+    return 0;
+}
+
+int
+unit_test__filter__sliding_float_sums_dont_drift()
+{
+    const uint32_t width = 1013, height = 7, nframes = 13, window = 4;
+    const size_t npx = (size_t)width * height;
+    float* out = malloc(npx * sizeof(float) * nframes);
+    CHECK(out);
+
+    CHECK(test_average_with_output(FilterMode_Sliding,
+                                   FilterOutput_Float,
+                                   SampleType_f32,
+                                   window,
+                                   2,
+                                   width,
+                                   height,
+                                   nframes,
+                                   out) == (int)nframes);
+    // The sum is re-summed after frames 3 and 7. The first frame is out of
+    // the window by then, so from frame 8 on the sums are exact again.
+    for (uint32_t i = 2 * window; i < nframes; ++i) {
+        for (size_t j = 0; j < npx; ++j) {
+            double sum = 0;
+            for (uint32_t k = i + 1 - window; k <= i; ++k)
+                sum += test_float_pixel(j, k);
+            const float expected = (float)sum * (1.0f / (float)window);
+            EXPECT(out[i * npx + j] == expected,
+                   "Sliding mean of frame %u, pixel %llu: expected %f, got %f",
+                   i,
+                   (unsigned long long)j,
+                   expected,
+                   out[i * npx + j]);
+        }
+    }
+    free(out);
+    return 1;
+Error:
+    free(out);
+    return 0;
 }
+#endif // NO_UNIT_TESTS
@@ -2,7 +2,9 @@
 #define H_ACQUIRE_FILTER_V0
 
 #include <stdint.h>
+#include "accumulate.h"
 #include "channel.h"
+#include "stage.h"
 #include "device/props/device.h"
 
 #ifdef __cplusplus
@@ -10,39 +12,168 @@ extern "C"
 {
 #endif
 
-    /// Context for video filter threads
+/// Upper bound on the threads, including the filter thread, that share the
+/// work of accumulating a frame.
+#define FILTER_MAX_THREADS (16)
+
+/// Longest window `FilterMode_Sliding` accepts. Up to this many samples of
+/// 16 bits or fewer sum exactly in f32, so their running sum never drifts.
+/// f32 and u32 sums round, so the filter re-sums those windows from scratch
+/// once per window.
+#define FILTER_MAX_SLIDING_WINDOW (256)
+
+/// Longest window the integer outputs accept. This many 16-bit samples, plus
+/// half the window for rounding, still fit in a u32.
+#define FILTER_MAX_INTEGER_WINDOW (65535)
+
+    enum FilterMode
+    {
+        /// Emits the mean of each run of `filter_window_frames` frames.
+        FilterMode_Tumbling = 0,
+        /// Emits the mean of the last `filter_window_frames` frames for every
+        /// input frame.
+        FilterMode_Sliding,
+        /// Emits an exponential moving average for every input frame.
+        FilterMode_Exponential,
+        FilterModeCount,
+    };
+
+    /// What the tumbling mode emits for each window.
+    enum FilterOutput
+    {
+        /// The mean, as f32.
+        FilterOutput_Float = 0,
+        /// The mean rounded to the nearest value of the input's type. Sums
+        /// are accumulated in u32.
+        FilterOutput_Native,
+        /// The sum, as u32.
+        FilterOutput_Sum,
+        FilterOutputCount,
+    };
+
+    struct filter_pool;
+
+    /// A filter thread helper. Accumulates one band of each frame.
+    struct filter_worker
+    {
+        struct thread thread;
+        struct filter_pool* pool;
+        uint32_t band;
+    };
+
+    /// One frame's worth of work, split into `nbands` bands of samples.
+    /// Exactly one of `f`, `slide`, `ema`, `fu` and `mean` is set.
+    struct filter_job
+    {
+        accumulate_fn f;
+        accumulate_slide_fn slide;
+        accumulate_ema_fn ema;
+        accumulate_u32_fn fu;
+        accumulate_u32_mean_fn mean;
+        float* acc;
+        /// Output samples, for `slide` and `ema`.
+        float* out;
+        /// Samples leaving the window, for `slide`.
+        uint8_t* history;
+        /// The integer accumulator, for `fu` and `mean`.
+        uint32_t* sums;
+        /// Output samples in the input's type, for `mean`.
+        uint8_t* native_out;
+        struct accumulate_divisor divisor;
+        const uint8_t* in;
+        size_t count;
+        size_t bytes_per_sample;
+        float scale;
+    };
+
+    /// Workers that help the filter thread accumulate frames. The filter
+    /// thread posts a job, does the first band itself, then waits for the
+    /// workers to finish the rest.
+    struct filter_pool
+    {
+        struct lock lock;
+        struct condition_variable job_posted;
+        struct condition_variable job_done;
+        struct filter_job job;
+        /// Incremented each time a job is posted.
+        uint64_t generation;
+        /// Workers that haven't finished the current job.
+        uint32_t pending;
+        /// The worker count plus one for the filter thread.
+        uint32_t nbands;
+        uint8_t is_stopping;
+        struct filter_worker workers[FILTER_MAX_THREADS - 1];
+    };
+
+    /// The frame-averaging stage. Emits f32 frames averaged over
+    /// `filter_window_frames` input frames, as selected by `mode`.
     struct video_filter_s
     {
+        struct video_stage_s stage;
+
+        enum FilterMode mode;
+        enum FilterOutput output;
         uint32_t filter_window_frames;
-        struct channel in;
-        struct channel* out;
-        struct channel_reader reader;
-        int sig_accumulator_reset;
+        /// Weight of the newest frame in `FilterMode_Exponential`.
+        float ema_alpha;
 
-        /// Used by external threads to signal the controller thread to stop
-        /// Other threads may write.
-        uint8_t is_stopping;
+        /// Threads, including the stage thread, that accumulate each frame.
+        /// Takes effect when the stage starts.
+        uint32_t thread_count;
+        struct filter_pool pool;
 
-        /// When true, the controller thread has completed it's work.
-        /// Other threads should only read.
-        uint8_t is_running;
+        /// Chosen for this CPU when the filter is initialized.
+        const struct accumulate_kernels* kernels;
 
-        struct event accumulator_reset_event;
-        struct thread thread;
-        uint8_t stream_id;
+        /// The output frame being accumulated, mapped from `stage.out`, and
+        /// the number of frames added to it so far.
+        struct VideoFrame* accumulator;
+        uint64_t frame_count;
+
+        /// The u32 sums behind a `FilterOutput_Native` window, which has no
+        /// room for them in the output frame.
+        uint32_t* sums;
+        size_t sums_count;
+
+        /// Running state for the sliding and exponential modes, allocated
+        /// for `running_shape` on the first frame and freed when the stage
+        /// stops. `running` is the f32 sum or average. `history` is a ring of
+        /// the last `history_frames` input frames, and `history_next` is the
+        /// slot the next frame replaces.
+        struct ImageShape running_shape;
+        float* running;
+        uint8_t* history;
+        size_t bytes_of_history_frame;
+        uint32_t history_frames;
+        uint32_t history_next;
     };
 
+    /// Initializes an averaging stage in place. Release with
+    /// `video_stage_destroy(&self->stage)`.
     enum DeviceStatusCode video_filter_init(struct video_filter_s* self,
                                             uint8_t stream_id,
-                                            size_t channel_size_bytes,
-                                            struct channel* out);
+                                            size_t channel_size_bytes);
 
-    void video_filter_destroy(struct video_filter_s* self);
+    /// Allocates and initializes an averaging stage. Release with
+    /// `video_stage_destroy()`, which also frees it.
+    /// @returns 0 on failure.
+    struct video_stage_s* video_filter_create(uint8_t stream_id,
+                                              size_t channel_size_bytes);
 
+    /// @param[in] thread_count Threads used to accumulate each frame. Zero
+    ///                         is treated as one. Clamped to
+    ///                         `FILTER_MAX_THREADS`.
+    /// @param[in] ema_alpha Weight of the newest frame in
+    ///                      `FilterMode_Exponential`, in (0, 1]. Zero selects
+    ///                      `2 / (frame_average_count + 1)`.
+    /// @param[in] output What tumbling windows emit. The other modes only
+    ///                   support `FilterOutput_Float`.
     enum DeviceStatusCode video_filter_configure(struct video_filter_s* self,
-                                                 uint32_t frame_average_count);
-
-    enum DeviceStatusCode video_filter_start(struct video_filter_s* self);
+                                                 enum FilterMode mode,
+                                                 uint32_t frame_average_count,
+                                                 uint32_t thread_count,
+                                                 float ema_alpha,
+                                                 enum FilterOutput output);
 
 #ifdef __cplusplus
 } // extern "C"
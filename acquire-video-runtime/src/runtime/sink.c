@@ -4,6 +4,7 @@
 #include "logger.h"
 #include "throttler.h"
 #include "device/hal/storage.h"
+#include <stdint.h>
 #include <string.h>
 
 #define L (aq_logger)
@@ -22,6 +23,10 @@
     } while (0)
 #define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
 
+/// Partial batches are appended at least this often. Also bounds how long a
+/// change in storage state can go unnoticed.
+#define SINK_MAX_WAIT_MS (100.0f)
+
 static int
 is_equal(const struct DeviceIdentifier* const a,
          const struct DeviceIdentifier* const b)
@@ -39,37 +44,103 @@ video_sink_init(struct video_sink_s* self,
     self->stream_id = stream_id;
     self->sig_stop_source = sig_stop_source;
 
-    LOG("Video[%2d]: Allocating %llu bytes for the queue.",
-        stream_id,
-        channel_capacity_bytes);
-    channel_new(&self->in, channel_capacity_bytes);
+    if (channel_capacity_bytes) {
+        LOG("Video[%2d]: Allocating %llu bytes for the queue.",
+            stream_id,
+            channel_capacity_bytes);
+        channel_new(&self->in, channel_capacity_bytes);
+        CHECK(self->in.data);
+    }
 
     thread_init(&self->thread);
     return Device_Ok;
+Error:
+    return Device_Err;
+}
+
+/// @returns the number of waiting bytes that should wake the sink thread.
+static size_t
+batch_threshold_bytes(const struct video_sink_s* self, size_t bytes_of_frame)
+{
+    uint64_t nbytes = self->batch_bytes;
+    if (self->batch_frames && bytes_of_frame) {
+        const uint64_t frame_bytes =
+          (uint64_t)self->batch_frames * bytes_of_frame;
+        if (!nbytes || frame_bytes < nbytes)
+            nbytes = frame_bytes;
+    }
+    // The writer blocks once the channel is full, so don't wait on more than
+    // half of it.
+    if (nbytes > self->in.capacity / 2)
+        nbytes = self->in.capacity / 2;
+    return nbytes ? (size_t)nbytes : 1;
+}
+
+/// @brief Appends every frame older than the write delay to storage.
+/// @param[out] held_since Acquisition time of the first frame held back by the
+///                        write delay, or 0 if none were.
+/// @param[in,out] bytes_of_frame Updated with the size of the frames seen.
+/// @returns 1 on success, otherwise 0.
+static int
+append_ready_frames(struct video_sink_s* self,
+                    uint64_t* held_since,
+                    size_t* bytes_of_frame)
+{
+    struct vfslice slice = { .beg = 0, .end = 0 };
+    struct vfslice remaining = { .beg = 0, .end = 0 };
+    do {
+        slice = make_vfslice(channel_read_map(&self->in, &self->reader));
+        if (slice.end > slice.beg)
+            *bytes_of_frame = slice.beg->bytes_of_frame;
+        remaining = vfslice_split_at_delay_ms(&slice, self->write_delay_ms);
+        CHECK(storage_append(self->storage, slice.beg, remaining.beg) ==
+              Device_Ok);
+        channel_read_unmap(&self->in,
+                           &self->reader,
+                           (uint8_t*)remaining.beg - (uint8_t*)slice.beg);
+    } while (slice.end > slice.beg && remaining.beg == remaining.end);
+    *held_since = 0;
+    if (remaining.beg < remaining.end)
+        *held_since = remaining.beg->timestamps.acq_thread;
+    return 1;
+Error:
+    return 0;
 }
 
 static int
 video_sink_thread(struct video_sink_s* const self)
 {
     TRACE("[stream %d]: SINK: Entering thread", self->stream_id);
-    struct throttler throttler = throttler_init(10e-3f);
+    struct throttler throttler =
+      throttler_init(1e-3f * self->min_batch_interval_ms);
     struct vfslice slice = { .beg = 0, .end = 0 };
+    size_t bytes_of_frame = 0;
+    uint64_t held_since = 0;
 
-    // Write to storage.
+    // Write to storage as batches become available.
     // Enforce write delay.
     while (!self->is_stopping && self->storage &&
            storage_get_state(self->storage) == DeviceState_Running) {
-        do {
-            slice = make_vfslice(channel_read_map(&self->in, &self->reader));
-            struct vfslice remaining =
-              vfslice_split_at_delay_ms(&slice, self->write_delay_ms);
-            CHECK(storage_append(self->storage, slice.beg, remaining.beg) ==
-                  Device_Ok);
-            channel_read_unmap(&self->in,
-                               &self->reader,
-                               (uint8_t*)remaining.beg - (uint8_t*)slice.beg);
-        } while (slice.end > slice.beg);
-        throttler_wait(&throttler);
+        if (held_since) {
+            // Frames are waiting out the write delay. More data won't make
+            // them ready, so just sleep until the oldest one is.
+            const double age_ms = 1e-6 * (double)(clock_tic(0) - held_since);
+            const double ready_in_ms = self->write_delay_ms - age_ms;
+            channel_wait_for_data(
+              &self->in,
+              &self->reader,
+              SIZE_MAX,
+              (float)(ready_in_ms < SINK_MAX_WAIT_MS ? ready_in_ms
+                                                     : SINK_MAX_WAIT_MS));
+        } else {
+            channel_wait_for_data(&self->in,
+                                  &self->reader,
+                                  batch_threshold_bytes(self, bytes_of_frame),
+                                  SINK_MAX_WAIT_MS);
+        }
+        CHECK(append_ready_frames(self, &held_since, &bytes_of_frame));
+        if (self->min_batch_interval_ms > 0.0f)
+            throttler_wait(&throttler);
     }
     TRACE("[stream %d]: SINK: Flushing", self->stream_id);
     do {
@@ -126,10 +197,16 @@ enum DeviceStatusCode
 video_sink_get(const struct video_sink_s* const self,
                struct DeviceIdentifier* const identifier,
                struct StorageProperties* const settings,
-               float* const write_delay_ms)
+               float* const write_delay_ms,
+               uint64_t* const batch_bytes,
+               uint32_t* const batch_frames,
+               float* const min_batch_interval_ms)
 {
     *identifier = self->identifier;
     *write_delay_ms = self->write_delay_ms;
+    *batch_bytes = self->batch_bytes;
+    *batch_frames = self->batch_frames;
+    *min_batch_interval_ms = self->min_batch_interval_ms;
 
     return self->storage ? storage_get(self->storage, settings) : Device_Ok;
 }
@@ -141,23 +218,14 @@ video_sink_destroy(struct video_sink_s* self)
     if (self->storage) {
         storage_close(self->storage);
     }
-    channel_release(&self->in);
+    if (self->in.data)
+        channel_release(&self->in);
 }
 
 size_t
 video_sink_bytes_waiting(const struct video_sink_s* self)
 {
-    if (self->reader.id > 0) {
-        size_t pos = self->in.holds.pos[self->reader.id - 1];
-        size_t head = self->in.head;
-        size_t high = self->in.high;
-        if (pos > head) {
-            return (high - pos) + head;
-        } else {
-            return head - pos;
-        }
-    }
-    return 0;
+    return channel_bytes_unread(&self->in, &self->reader);
 }
 
 enum DeviceStatusCode
@@ -165,9 +233,18 @@ video_sink_configure(struct video_sink_s* self,
                      const struct DeviceManager* device_manager,
                      struct DeviceIdentifier* identifier,
                      struct StorageProperties* settings,
-                     float write_delay_ms)
+                     float write_delay_ms,
+                     uint64_t batch_bytes,
+                     uint32_t batch_frames,
+                     float min_batch_interval_ms)
 {
+    EXPECT(min_batch_interval_ms >= 0.0f,
+           "Expected a non-negative minimum batch interval. Got %f ms.",
+           min_batch_interval_ms);
     self->write_delay_ms = write_delay_ms;
+    self->batch_bytes = batch_bytes;
+    self->batch_frames = batch_frames;
+    self->min_batch_interval_ms = min_batch_interval_ms;
     if (self->storage && !is_equal(&self->identifier, identifier)) {
         storage_close(self->storage);
         self->storage = NULL;
@@ -181,3 +258,9 @@ video_sink_configure(struct video_sink_s* self,
 Error:
     return Device_Err;
 }
+
+void
+video_sink_wake(struct video_sink_s* self)
+{
+    channel_wake_reader(&self->in, &self->reader);
+}
@@ -25,6 +25,18 @@ extern "C"
 
         uint8_t stream_id;
         float write_delay_ms;
+
+        /// The sink thread wakes to append once `batch_bytes` or
+        /// `batch_frames` are waiting, whichever comes first. Zero disables
+        /// the corresponding threshold. With both disabled, every published
+        /// frame wakes the thread.
+        uint64_t batch_bytes;
+        uint32_t batch_frames;
+
+        /// Minimum time between appends. Lets writes coalesce at high frame
+        /// rates. Zero disables.
+        float min_batch_interval_ms;
+
         void (*sig_stop_source)(const struct video_sink_s*);
         struct Storage* storage;
         struct channel in;
@@ -33,6 +45,8 @@ extern "C"
         struct channel_reader reader;
     };
 
+    /// A `channel_capacity_bytes` of 0 leaves `in` unallocated. The caller
+    /// must allocate it before the sink starts.
     enum DeviceStatusCode video_sink_init(
       struct video_sink_s* self,
       uint8_t stream_id,
@@ -49,18 +63,32 @@ extern "C"
     /// device.
     /// @param [out] settings The current `StorageProperties`.
     /// @param [out] write_delay_ms The current write delay.
+    /// @param [out] batch_bytes The current batch threshold in bytes.
+    /// @param [out] batch_frames The current batch threshold in frames.
+    /// @param [out] min_batch_interval_ms The current minimum time between
+    ///              appends.
     /// @return Device_Ok on success, otherwise Device_Err
     enum DeviceStatusCode video_sink_get(const struct video_sink_s* self,
                                          struct DeviceIdentifier* identifier,
                                          struct StorageProperties* settings,
-                                         float* write_delay_ms);
+                                         float* write_delay_ms,
+                                         uint64_t* batch_bytes,
+                                         uint32_t* batch_frames,
+                                         float* min_batch_interval_ms);
 
     enum DeviceStatusCode video_sink_configure(
       struct video_sink_s* self,
       const struct DeviceManager* device_manager,
       struct DeviceIdentifier* identifier,
       struct StorageProperties* settings,
-      float write_delay_ms);
+      float write_delay_ms,
+      uint64_t batch_bytes,
+      uint32_t batch_frames,
+      float min_batch_interval_ms);
+
+    /// Releases the sink thread if it's waiting for data. Used to signal a
+    /// stop.
+    void video_sink_wake(struct video_sink_s* self);
 
     size_t video_sink_bytes_waiting(const struct video_sink_s* self);
 
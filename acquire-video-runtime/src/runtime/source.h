@@ -47,7 +47,8 @@ extern "C"
     /// @param[in] max_frame_count Number of frames to acquire in a finite
     /// acquisition. Set to -1 for infinite.
     /// @param[in] to_sink video frame channel consumed by the sink.
-    /// @param[in] to_filter video frame channel consumed by any filtering.
+    /// @param[in] to_filter video frame channel consumed by the first
+    /// processing stage. The runtime updates this as stages are configured.
     /// @return `Device_Ok` on success, otherwise `Device_Err`
     ///
     /// The video source may output to either the `to_sink` channel or the
@@ -0,0 +1,159 @@
+#include "stage.h"
+#include "frame_iterator.h"
+#include "logger.h"
+
+#define LOG(...) aq_logger(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define LOGE(...) aq_logger(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            LOGE(__VA_ARGS__);                                                 \
+            goto Error;                                                        \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false:\n\t%s", #e)
+
+/// Bounds how long the stage thread sleeps when no data arrives.
+#define STAGE_MAX_WAIT_MS (100.0f)
+
+/// @returns the channel the stage reads.
+static struct channel*
+input(struct video_stage_s* self)
+{
+    return self->tap ? self->tap : &self->in;
+}
+
+static void
+handle_reset_signal(struct video_stage_s* self)
+{
+    if (self->sig_reset) {
+        LOG("[stream %d] %s: reset", self->stream_id, self->name);
+        self->reset(self);
+        self->sig_reset = 0;
+        event_notify_all(&self->reset_event);
+    }
+}
+
+static int
+process_available(struct video_stage_s* self)
+{
+    struct channel* const channel = input(self);
+    struct slice slice = channel_read_map(channel, &self->reader);
+    struct frame_iterator it = frame_iterator_init(&slice);
+    struct VideoFrame* in = 0;
+    while ((in = frame_iterator_next(&it)))
+        EXPECT(self->process(self, in),
+               "[stream %d] %s: Failed to process frame %llu",
+               self->stream_id,
+               self->name,
+               (unsigned long long)in->frame_id);
+    channel_read_unmap(
+      channel, &self->reader, (uint8_t*)slice.end - (uint8_t*)slice.beg);
+    handle_reset_signal(self);
+    return 1;
+Error:
+    channel_read_unmap(channel, &self->reader, 0);
+    self->reset(self);
+    // Release the source if it's waiting on a reset.
+    handle_reset_signal(self);
+    return 0;
+}
+
+static int
+video_stage_thread(struct video_stage_s* self)
+{
+    int ecode = 0;
+    LOG("[stream %d] %s: Entering stage thread", self->stream_id, self->name);
+    if (self->start)
+        CHECK(self->start(self));
+    while (!self->is_stopping) {
+        channel_wait_for_data(input(self), &self->reader, 1, STAGE_MAX_WAIT_MS);
+        CHECK(process_available(self));
+    }
+    LOG("[stream %d] %s: Flush", self->stream_id, self->name);
+    CHECK(process_available(self));
+Finalize:
+    if (self->stop)
+        self->stop(self);
+    LOG("[stream %d] %s: Exiting stage thread", self->stream_id, self->name);
+    self->is_running = 0;
+    self->is_stopping = 0;
+    return ecode;
+Error:
+    ecode = 1;
+    goto Finalize;
+}
+
+enum DeviceStatusCode
+video_stage_init(struct video_stage_s* self,
+                 uint8_t stream_id,
+                 size_t channel_size_bytes)
+{
+    *self = (struct video_stage_s){
+        .name = "STAGE",
+        .frame_id_stride = 1,
+        .stream_id = stream_id,
+    };
+    if (channel_size_bytes) {
+        channel_new(&self->in, channel_size_bytes);
+        CHECK(self->in.data);
+    }
+    thread_init(&self->thread);
+    event_init(&self->reset_event);
+    return Device_Ok;
+Error:
+    return Device_Err;
+}
+
+void
+video_stage_destroy(struct video_stage_s* self)
+{
+    thread_join(&self->thread);
+    // A shared channel would otherwise keep waiting on this reader.
+    if (self->tap)
+        channel_detach_reader(self->tap, &self->reader);
+    event_destroy(&self->reset_event);
+    if (self->in.data)
+        channel_release(&self->in);
+    if (self->destroy)
+        self->destroy(self);
+}
+
+enum DeviceStatusCode
+video_stage_start(struct video_stage_s* self)
+{
+    CHECK(self->out);
+    CHECK(self->process && self->reset);
+    self->is_stopping = 0;
+    self->is_running = 1;
+    CHECK(
+      thread_create(&self->thread, (void (*)(void*))video_stage_thread, self));
+    return Device_Ok;
+Error:
+    self->is_running = 0;
+    return Device_Err;
+}
+
+void
+video_stage_sig_stop(struct video_stage_s* self)
+{
+    self->is_stopping = 1;
+    video_stage_wake(self);
+}
+
+void
+video_stage_await_reset(struct video_stage_s* self)
+{
+    if (!self->is_running)
+        return;
+    self->sig_reset = 1;
+    video_stage_wake(self);
+    event_wait(&self->reset_event);
+}
+
+void
+video_stage_wake(struct video_stage_s* self)
+{
+    channel_wake_reader(input(self), &self->reader);
+}
@@ -0,0 +1,123 @@
+//!
+//! # Processing stages
+//!
+//! A stage sits between a stream's source and its sink. It reads frames from
+//! its own input channel and writes the frames it produces to `out`, which
+//! is the next stage's input or the sink's. Each stage runs on its own
+//! thread. Input frames are read in place, and output frames are written
+//! directly into the output channel, so nothing is copied on the way through.
+//! A stage can instead read a channel it shares with other readers; see
+//! `tap`.
+//!
+//! An implementation embeds a `video_stage_s`, fills in the callbacks, and
+//! recovers its own context with `containerof()`. The runner in `stage.c`
+//! owns the thread, the input channel, and the stop and reset signals.
+//!
+
+#ifndef H_ACQUIRE_STAGE_V0
+#define H_ACQUIRE_STAGE_V0
+
+#include "platform.h"
+#include "channel.h"
+#include "device/props/components.h"
+#include "device/props/device.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// Upper bound on the stages chained in one stream.
+#define VIDEO_MAX_STAGES (8)
+
+    struct video_stage_s
+    {
+        const char* name;
+
+        /// A tag the stage's owner can use to tell implementations apart.
+        /// Not used by the runner.
+        int kind;
+
+        /// Input frames consumed for each frame written. Output frame ids
+        /// advance by this much. Implementations that keep every frame leave
+        /// it at 1.
+        uint32_t frame_id_stride;
+
+        /// Called on the stage thread for each input frame. May write any
+        /// number of frames to `out`. `in` is only valid during the call.
+        /// @returns 0 on error, which stops the stage.
+        int (*process)(struct video_stage_s* self, const struct VideoFrame* in);
+
+        /// Called on the stage thread to discard any partially built output,
+        /// when the source resets the chain or after an error.
+        void (*reset)(struct video_stage_s* self);
+
+        /// Optional. Called on the stage thread before the first frame.
+        /// @returns 0 on error, which stops the stage.
+        int (*start)(struct video_stage_s* self);
+
+        /// Optional. Called on the stage thread after the last frame.
+        void (*stop)(struct video_stage_s* self);
+
+        /// Optional. Updates `shape` from the shape of this stage's input
+        /// frames to the shape of its output frames.
+        void (*transform_shape)(const struct video_stage_s* self,
+                                struct ImageShape* shape);
+
+        /// Optional. Releases the implementation. Called last by
+        /// `video_stage_destroy()`.
+        void (*destroy)(struct video_stage_s* self);
+
+        struct channel in;
+        struct channel* out;
+        struct channel_reader reader;
+
+        /// When set, the stage reads this channel instead of `in`, as one
+        /// more reader alongside the channel's others. `reader` is then
+        /// attached to `tap`.
+        struct channel* tap;
+
+        /// Set by the source to ask the stage to call `reset`.
+        int sig_reset;
+        struct event reset_event;
+
+        /// Used by external threads to signal the stage thread to stop.
+        /// Other threads may write.
+        uint8_t is_stopping;
+
+        /// When true, the stage thread has completed it's work.
+        /// Other threads should only read.
+        uint8_t is_running;
+
+        struct thread thread;
+        uint8_t stream_id;
+    };
+
+    /// Initializes the runner's part of `self`. Callbacks are left to the
+    /// implementation. With a `channel_size_bytes` of 0, `in` is left
+    /// unallocated for the caller to set up.
+    enum DeviceStatusCode video_stage_init(struct video_stage_s* self,
+                                           uint8_t stream_id,
+                                           size_t channel_size_bytes);
+
+    /// Waits for the stage thread, detaches from `tap`, releases the input
+    /// channel, then calls `self->destroy`.
+    void video_stage_destroy(struct video_stage_s* self);
+
+    enum DeviceStatusCode video_stage_start(struct video_stage_s* self);
+
+    /// Asks the stage thread to drain its input and exit.
+    void video_stage_sig_stop(struct video_stage_s* self);
+
+    /// Asks the stage thread to discard partial output and blocks until it
+    /// has.
+    void video_stage_await_reset(struct video_stage_s* self);
+
+    /// Releases the stage thread if it's waiting for data.
+    void video_stage_wake(struct video_stage_s* self);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // H_ACQUIRE_STAGE_V0
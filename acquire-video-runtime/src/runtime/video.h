@@ -5,7 +5,7 @@
 #include "channel.h"
 #include "sink.h"
 #include "source.h"
-#include "filter.h"
+#include "stage.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -14,6 +14,20 @@ extern "C"
     struct video_monitor_s
     {
         struct channel_reader reader;
+
+        /// The `frame_id` the monitor expects next, once it has a reference
+        /// point. Used to count the frames it missed.
+        uint64_t next_frame_id;
+        uint8_t has_seen_frame;
+
+        /// Frames in the currently mapped region.
+        uint64_t frames_mapped;
+
+        /// Frames the monitor has missed because of its overflow policy.
+        uint64_t frames_lost;
+
+        /// The reader's lost byte count when acquisition started.
+        uint64_t bytes_lost_at_start;
     };
 
     struct video_s
@@ -25,8 +39,29 @@ extern "C"
           monitor; //< A reader exposed through the public api
 
         struct video_source_s source; //< context for the video source thread
-        struct video_filter_s filter; //< context for the video filter thread
         struct video_sink_s sink;     //< context for the video sink thread
+
+        /// Processing between the source and the sink, in order. Each stage
+        /// writes to the next stage's input, and the last writes to the
+        /// sink's.
+        struct video_stage_s* stages[VIDEO_MAX_STAGES];
+        uint32_t stage_count;
+
+        /// When set, the stages branch off the stream instead of sitting
+        /// between the source and the sink. The source writes to the sink,
+        /// the first stage reads the same frames alongside it, and the last
+        /// stage writes to `branch`, which has its own storage and monitor.
+        uint8_t is_branched;
+        struct video_sink_s branch;
+        struct video_monitor_s branch_monitor;
+
+        /// `frame_average_count` as last configured. Averaging more than one
+        /// frame adds a stage.
+        uint32_t frame_average_count;
+
+        /// Set when the stream's channels are made with
+        /// `channel_new_mirrored()`.
+        uint8_t mirror_channels;
     };
 
 #ifdef __cplusplus
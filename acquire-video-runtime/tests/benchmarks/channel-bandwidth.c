@@ -0,0 +1,166 @@
+/// @file channel-bandwidth.c
+/// Measures sustained write/read bandwidth through a `channel` for each kind
+/// of memory backing `memory_alloc()` can provide on this machine.
+///
+/// The writer copies each frame into the channel and the reader sums every
+/// word it maps, so every byte of the ring is touched twice per cycle.
+///
+/// Usage: channel-bandwidth [capacity_MiB] [total_MiB] [frame_KiB]
+
+#include "runtime/channel.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+struct context
+{
+    struct channel channel;
+    const uint8_t* frame;
+    size_t bytes_of_frame;
+    uint64_t frame_count;
+
+    volatile uint8_t writer_done;
+    uint64_t bytes_read, checksum;
+};
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+static void
+writer_thread(struct context* ctx)
+{
+    for (uint64_t i = 0; i < ctx->frame_count; ++i) {
+        uint8_t* dst = channel_write_map(&ctx->channel, ctx->bytes_of_frame);
+        if (!dst)
+            break;
+        memcpy(dst, ctx->frame, ctx->bytes_of_frame); // NOLINT
+        channel_write_unmap(&ctx->channel);
+    }
+    ctx->writer_done = 1;
+}
+
+static void
+reader_thread(struct context* ctx)
+{
+    struct channel_reader reader = { 0 };
+    size_t nbytes = 0;
+    uint8_t done = 0;
+    // Data that wraps around the end of the buffer takes two reads.
+    while (!done || nbytes) {
+        done = ctx->writer_done;
+        struct slice s = channel_read_map(&ctx->channel, &reader);
+        nbytes = (size_t)(s.end - s.beg);
+        const uint64_t* words = (const uint64_t*)s.beg;
+        uint64_t acc = 0;
+        for (size_t i = 0; i < nbytes / sizeof(*words); ++i)
+            acc += words[i];
+        ctx->checksum += acc;
+        ctx->bytes_read += nbytes;
+        channel_read_unmap(&ctx->channel, &reader, nbytes);
+    }
+}
+
+static int
+run(enum AllocatorHint hint,
+    size_t capacity,
+    const uint8_t* frame,
+    size_t bytes_of_frame,
+    uint64_t frame_count)
+{
+    struct context ctx = {
+        .frame = frame,
+        .bytes_of_frame = bytes_of_frame,
+        .frame_count = frame_count,
+    };
+    channel_new(&ctx.channel, capacity);
+
+    // Swap in a buffer with the requested backing. Fault it in so page
+    // faults aren't part of the measurement.
+    memory_free(ctx.channel.data);
+    if (!(ctx.channel.data = memory_alloc(capacity, hint))) {
+        ERR("Failed to allocate %llu bytes", (unsigned long long)capacity);
+        return 0;
+    }
+    memset(ctx.channel.data, 0, capacity); // NOLINT
+    const enum MemoryBacking backing = memory_backing(ctx.channel.data);
+
+    struct thread writer, reader;
+    thread_init(&writer);
+    thread_init(&reader);
+
+    struct clock clk;
+    clock_init(&clk);
+    thread_create(&reader, (void (*)(void*))reader_thread, &ctx);
+    thread_create(&writer, (void (*)(void*))writer_thread, &ctx);
+    thread_join(&writer);
+    thread_join(&reader);
+    const double elapsed_ms = clock_toc_ms(&clk);
+
+    channel_release(&ctx.channel);
+
+    const uint64_t expected = (uint64_t)bytes_of_frame * frame_count;
+    LOG("%-16s pages: %.1f MB in %.1f ms: %.2f GB/s",
+        memory_backing_as_string(backing),
+        1e-6 * (double)ctx.bytes_read,
+        elapsed_ms,
+        1e-6 * (double)ctx.bytes_read / elapsed_ms);
+    if (ctx.bytes_read != expected) {
+        ERR("Expected to read %llu bytes. Got %llu.",
+            (unsigned long long)expected,
+            (unsigned long long)ctx.bytes_read);
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const size_t capacity = ((argc > 1) ? strtoull(argv[1], 0, 10) : 64)
+                            << 20;
+    const uint64_t total = ((argc > 2) ? strtoull(argv[2], 0, 10) : 1024)
+                           << 20;
+    const size_t bytes_of_frame =
+      ((argc > 3) ? strtoull(argv[3], 0, 10) : 1024) << 10;
+    if (!bytes_of_frame || bytes_of_frame >= capacity) {
+        ERR("Frames must be smaller than the channel.");
+        return 1;
+    }
+
+    uint8_t* frame = malloc(bytes_of_frame);
+    if (!frame)
+        return 1;
+    for (size_t i = 0; i < bytes_of_frame; ++i)
+        frame[i] = (uint8_t)(i * 31);
+
+    int ok = 1;
+    const enum AllocatorHint hints[] = { AllocatorHint_Default,
+                                         AllocatorHint_LargePage };
+    for (int i = 0; i < 2; ++i) {
+        ok &= run(
+          hints[i], capacity, frame, bytes_of_frame, total / bytes_of_frame);
+    }
+    free(frame);
+    return !ok;
+}
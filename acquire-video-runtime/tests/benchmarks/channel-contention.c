@@ -0,0 +1,175 @@
+/// @file channel-contention.c
+/// Measures `channel` throughput with one writer, a draining sink reader and a
+/// monitor reader that polls as fast as it can - the pattern a UI polling
+/// `acquire_map_read()` produces against the source and sink threads.
+///
+/// Usage: channel-contention [frame_count] [frame_bytes]
+
+#include "runtime/channel.h"
+#include "runtime/frame_iterator.h"
+#include "device/props/components.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+struct context
+{
+    struct channel channel;
+    uint64_t frame_count;
+    size_t bytes_of_frame;
+
+    volatile uint8_t writer_done;
+    uint64_t sink_frames, monitor_frames, monitor_polls;
+    double max_write_map_ms;
+    int sink_error;
+};
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+static void
+writer_thread(struct context* ctx)
+{
+    struct clock clk;
+    for (uint64_t i = 0; i < ctx->frame_count; ++i) {
+        clock_init(&clk);
+        struct VideoFrame* im = (struct VideoFrame*)channel_write_map(
+          &ctx->channel, ctx->bytes_of_frame);
+        const double ms = clock_toc_ms(&clk);
+        if (ms > ctx->max_write_map_ms)
+            ctx->max_write_map_ms = ms;
+        if (!im)
+            break;
+        *im = (struct VideoFrame){ .bytes_of_frame = ctx->bytes_of_frame,
+                                   .frame_id = i };
+        channel_write_unmap(&ctx->channel);
+    }
+    ctx->writer_done = 1;
+}
+
+static uint64_t
+drain(struct context* ctx, struct channel_reader* reader, uint64_t* expected)
+{
+    struct slice slice = channel_read_map(&ctx->channel, reader);
+    struct frame_iterator it = frame_iterator_init(&slice);
+    struct VideoFrame* cur = 0;
+    uint64_t n = 0;
+    while ((cur = frame_iterator_next(&it))) {
+        if (expected) {
+            if (cur->frame_id != *expected) {
+                ERR("Expected frame %llu but got %llu",
+                    (unsigned long long)*expected,
+                    (unsigned long long)cur->frame_id);
+                ctx->sink_error = 1;
+            }
+            *expected = cur->frame_id + 1;
+        }
+        ++n;
+    }
+    channel_read_unmap(
+      &ctx->channel, reader, (size_t)(slice.end - slice.beg));
+    return n;
+}
+
+static void
+sink_thread(struct context* ctx)
+{
+    struct channel_reader reader = { 0 };
+    uint64_t expected = 0, n = 0;
+    uint8_t done = 0;
+    // Sample the flag before reading so the last write can't be missed.
+    // Data that wraps around the end of the buffer takes two reads.
+    while ((!done || n) && !ctx->sink_error) {
+        done = ctx->writer_done;
+        ctx->sink_frames += (n = drain(ctx, &reader, &expected));
+    }
+}
+
+static void
+monitor_thread(struct context* ctx)
+{
+    struct channel_reader reader = { 0 };
+    uint64_t n = 0;
+    uint8_t done = 0;
+    while (!done || n) {
+        done = ctx->writer_done;
+        ctx->monitor_frames += (n = drain(ctx, &reader, 0));
+        ++ctx->monitor_polls;
+    }
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    struct context ctx = {
+        .frame_count = (argc > 1) ? strtoull(argv[1], 0, 10) : 200000,
+        .bytes_of_frame = (argc > 2) ? strtoull(argv[2], 0, 10) : 4096,
+    };
+    // frames are 8-byte aligned, like the video source writes them.
+    ctx.bytes_of_frame = 8 * ((ctx.bytes_of_frame + 7) / 8);
+    if (ctx.bytes_of_frame < sizeof(struct VideoFrame))
+        ctx.bytes_of_frame = 8 * ((sizeof(struct VideoFrame) + 7) / 8);
+
+    channel_new(&ctx.channel, 1ULL << 24);
+
+    struct thread writer, sink, monitor;
+    thread_init(&writer);
+    thread_init(&sink);
+    thread_init(&monitor);
+
+    struct clock clk;
+    clock_init(&clk);
+    thread_create(&monitor, (void (*)(void*))monitor_thread, &ctx);
+    thread_create(&sink, (void (*)(void*))sink_thread, &ctx);
+    // let the readers attach before the first write
+    clock_sleep_ms(0, 10.0f);
+    thread_create(&writer, (void (*)(void*))writer_thread, &ctx);
+    thread_join(&writer);
+    thread_join(&sink);
+    thread_join(&monitor);
+    const double elapsed_ms = clock_toc_ms(&clk) - 10.0;
+
+    const double mb =
+      (double)ctx.frame_count * (double)ctx.bytes_of_frame * 1e-6;
+    LOG("%llu frames of %llu bytes in %.1f ms: %.0f frames/s, %.1f MB/s",
+        (unsigned long long)ctx.frame_count,
+        (unsigned long long)ctx.bytes_of_frame,
+        elapsed_ms,
+        1e3 * (double)ctx.frame_count / elapsed_ms,
+        1e3 * mb / elapsed_ms);
+    LOG("monitor polls: %llu; max write_map latency: %.3f ms",
+        (unsigned long long)ctx.monitor_polls,
+        ctx.max_write_map_ms);
+
+    channel_release(&ctx.channel);
+
+    if (ctx.sink_error || ctx.sink_frames != ctx.frame_count ||
+        ctx.monitor_frames != ctx.frame_count) {
+        ERR("Expected %llu frames. Sink got %llu. Monitor got %llu.",
+            (unsigned long long)ctx.frame_count,
+            (unsigned long long)ctx.sink_frames,
+            (unsigned long long)ctx.monitor_frames);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,190 @@
+/// @file channel-mirrored.c
+/// Compares a bip-buffer `channel` with a mirrored one (see
+/// channel_new_mirrored()) when frames vary in size.
+///
+/// Each run writes the same sequence of frame sizes. For each mode this
+/// reports bandwidth, how many bytes the writer skipped at the end of the
+/// buffer, and how many non-empty read maps it took to drain the stream.
+///
+/// Usage: channel-mirrored [capacity_MiB] [total_MiB] [min_KiB] [max_KiB]
+
+#include "runtime/channel.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+struct context
+{
+    struct channel channel;
+    const uint8_t* frame;
+    size_t min_bytes, max_bytes;
+    uint64_t total_bytes;
+
+    volatile uint8_t writer_done;
+    uint64_t bytes_written, bytes_read, checksum, read_maps;
+};
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// A fixed pseudo-random sequence of frame sizes, so every run sees the same
+/// one. Sizes are multiples of 8 bytes.
+static size_t
+frame_size(const struct context* ctx, uint64_t* state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    const size_t span = ctx->max_bytes - ctx->min_bytes + 1;
+    return (ctx->min_bytes + (size_t)((*state >> 33) % span)) & ~(size_t)7;
+}
+
+static void
+writer_thread(struct context* ctx)
+{
+    uint64_t state = 1;
+    while (ctx->bytes_written < ctx->total_bytes) {
+        const size_t nbytes = frame_size(ctx, &state);
+        uint8_t* dst = channel_write_map(&ctx->channel, nbytes);
+        if (!dst)
+            break;
+        memcpy(dst, ctx->frame, nbytes); // NOLINT
+        channel_write_unmap(&ctx->channel);
+        ctx->bytes_written += nbytes;
+    }
+    ctx->writer_done = 1;
+}
+
+static void
+reader_thread(struct context* ctx)
+{
+    struct channel_reader reader = { 0 };
+    size_t nbytes = 0;
+    uint8_t done = 0;
+    while (!done || nbytes) {
+        done = ctx->writer_done;
+        struct slice s = channel_read_map(&ctx->channel, &reader);
+        nbytes = (size_t)(s.end - s.beg);
+        const uint64_t* words = (const uint64_t*)s.beg;
+        uint64_t acc = 0;
+        for (size_t i = 0; i < nbytes / sizeof(*words); ++i)
+            acc += words[i];
+        ctx->checksum += acc;
+        ctx->bytes_read += nbytes;
+        ctx->read_maps += (nbytes > 0);
+        channel_read_unmap(&ctx->channel, &reader, nbytes);
+    }
+}
+
+static int
+run(int is_mirrored,
+    size_t capacity,
+    const uint8_t* frame,
+    size_t min_bytes,
+    size_t max_bytes,
+    uint64_t total_bytes)
+{
+    struct context ctx = {
+        .frame = frame,
+        .min_bytes = min_bytes,
+        .max_bytes = max_bytes,
+        .total_bytes = total_bytes,
+    };
+    if (is_mirrored) {
+        channel_new_mirrored(&ctx.channel, capacity);
+        if (!ctx.channel.is_mirrored) {
+            LOG("Mirrored channels aren't supported here. Skipping.");
+            channel_release(&ctx.channel);
+            return 1;
+        }
+    } else {
+        channel_new(&ctx.channel, capacity);
+    }
+    if (!ctx.channel.data) {
+        ERR("Failed to allocate %llu bytes", (unsigned long long)capacity);
+        return 0;
+    }
+    // Fault the buffer in so page faults aren't part of the measurement.
+    memset(ctx.channel.data, 0, ctx.channel.capacity); // NOLINT
+
+    struct thread writer, reader;
+    thread_init(&writer);
+    thread_init(&reader);
+
+    struct clock clk;
+    clock_init(&clk);
+    thread_create(&reader, (void (*)(void*))reader_thread, &ctx);
+    thread_create(&writer, (void (*)(void*))writer_thread, &ctx);
+    thread_join(&writer);
+    thread_join(&reader);
+    const double elapsed_ms = clock_toc_ms(&clk);
+
+    // Anything the writer advanced past without writing was a skipped tail.
+    const uint64_t skipped =
+      atomic_load(&ctx.channel.head) - ctx.bytes_written;
+    channel_release(&ctx.channel);
+
+    LOG("%-8s: %.1f MB in %.1f ms: %.2f GB/s. Skipped %.1f MB of tail. "
+        "%llu reads.",
+        is_mirrored ? "mirrored" : "bip",
+        1e-6 * (double)ctx.bytes_read,
+        elapsed_ms,
+        1e-6 * (double)ctx.bytes_read / elapsed_ms,
+        1e-6 * (double)skipped,
+        (unsigned long long)ctx.read_maps);
+    if (ctx.bytes_read != ctx.bytes_written) {
+        ERR("Expected to read %llu bytes. Got %llu.",
+            (unsigned long long)ctx.bytes_written,
+            (unsigned long long)ctx.bytes_read);
+        return 0;
+    }
+    return 1;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const size_t capacity = ((argc > 1) ? strtoull(argv[1], 0, 10) : 16)
+                            << 20;
+    const uint64_t total = ((argc > 2) ? strtoull(argv[2], 0, 10) : 512)
+                           << 20;
+    const size_t min_bytes = ((argc > 3) ? strtoull(argv[3], 0, 10) : 100)
+                             << 10;
+    const size_t max_bytes = ((argc > 4) ? strtoull(argv[4], 0, 10) : 3000)
+                             << 10;
+    if (min_bytes < 8 || max_bytes < min_bytes || max_bytes >= capacity) {
+        ERR("Frames must be at least 8 bytes and smaller than the channel.");
+        return 1;
+    }
+
+    uint8_t* frame = malloc(max_bytes);
+    if (!frame)
+        return 1;
+    for (size_t i = 0; i < max_bytes; ++i)
+        frame[i] = (uint8_t)(i * 31);
+
+    int ok = 1;
+    for (int is_mirrored = 0; is_mirrored < 2; ++is_mirrored)
+        ok &= run(is_mirrored, capacity, frame, min_bytes, max_bytes, total);
+    free(frame);
+    return !ok;
+}
@@ -0,0 +1,107 @@
+/// @file channel-readers.c
+/// Measures the cost of `channel_write_map()` as the number of attached
+/// readers grows, and checks that detached readers no longer hold the writer
+/// back.
+///
+/// Runs on one thread: each write is followed by a round of reads, so every
+/// reader stays within a frame of the writer.
+///
+/// Usage: channel-readers [frame_count] [frame_bytes]
+
+#include "runtime/channel.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Writes `frame_count` frames, draining `nreaders` readers after each one.
+/// Every other reader detaches halfway through.
+/// @returns the mean time spent in channel_write_map() in nanoseconds, or a
+///          negative number on error.
+static double
+run(unsigned nreaders, uint64_t frame_count, size_t bytes_of_frame)
+{
+    struct channel channel = { 0 };
+    struct channel_reader readers[CHANNEL_MAX_READERS] = { 0 };
+    struct clock clk;
+    double write_map_ms = 0.0;
+    int is_ok = 1;
+
+    channel_new(&channel, 1ULL << 20);
+    for (unsigned i = 0; i < nreaders; ++i) {
+        channel_read_map(&channel, readers + i);
+        channel_read_unmap(&channel, readers + i, 0);
+        is_ok &= (readers[i].id != 0);
+    }
+
+    for (uint64_t i = 0; i < frame_count && is_ok; ++i) {
+        if (i == frame_count / 2)
+            for (unsigned j = 1; j < nreaders; j += 2)
+                channel_detach_reader(&channel, readers + j);
+
+        clock_init(&clk);
+        void* frame = channel_write_map(&channel, bytes_of_frame);
+        write_map_ms += clock_toc_ms(&clk);
+        if (!frame) {
+            is_ok = 0;
+            break;
+        }
+        channel_write_unmap(&channel);
+
+        for (unsigned j = 0; j < nreaders; ++j) {
+            if (!readers[j].id)
+                continue;
+            // Data that wraps around the end of the buffer takes two reads.
+            for (int k = 0; k < 2; ++k) {
+                struct slice s = channel_read_map(&channel, readers + j);
+                channel_read_unmap(
+                  &channel, readers + j, (size_t)(s.end - s.beg));
+            }
+            is_ok &= (channel_bytes_unread(&channel, readers + j) == 0);
+        }
+    }
+    channel_release(&channel);
+    return is_ok ? 1e6 * write_map_ms / (double)frame_count : -1.0;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const uint64_t frame_count =
+      (argc > 1) ? strtoull(argv[1], 0, 10) : 20000;
+    size_t bytes_of_frame = (argc > 2) ? strtoull(argv[2], 0, 10) : 4096;
+    bytes_of_frame = 8 * ((bytes_of_frame + 7) / 8);
+
+    const unsigned counts[] = { 1, 8, 32, 64, CHANNEL_MAX_READERS };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        const double ns = run(counts[i], frame_count, bytes_of_frame);
+        if (ns < 0) {
+            ERR("Failed with %u readers", counts[i]);
+            return 1;
+        }
+        LOG("%3u readers: %.1f ns per channel_write_map()", counts[i], ns);
+    }
+    return 0;
+}
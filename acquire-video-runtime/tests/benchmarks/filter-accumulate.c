@@ -0,0 +1,317 @@
+/// @file filter-accumulate.c
+/// Measures the frame-averaging kernels (see accumulate.h) for each sample
+/// type and each instruction set this CPU supports.
+///
+/// Frames are averaged in windows the way the filter does: the first frame
+/// of a window is loaded, the rest are added, and the last one normalizes the
+/// sum. The sliding-window and exponential kernels are then run over the same
+/// frames, emitting an output frame per input frame. For unsigned types the
+/// integer kernels, which sum in u32 and round the mean back to the input
+/// type, are run in windows too. Reported bandwidth counts input bytes
+/// consumed.
+///
+/// Usage: filter-accumulate [megapixels] [frames] [window]
+
+#include "runtime/accumulate.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+/// Distinct input frames cycled through, so the inputs don't sit in cache.
+#define NINPUTS (4)
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+static const char*
+sample_type_name(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+            return "u8";
+        case SampleType_u16:
+            return "u16";
+        case SampleType_i8:
+            return "i8";
+        case SampleType_i16:
+            return "i16";
+        case SampleType_f32:
+            return "f32";
+        case SampleType_u10:
+            return "u10";
+        case SampleType_u12:
+            return "u12";
+        case SampleType_u14:
+            return "u14";
+        case SampleType_u32:
+            return "u32";
+        default:
+            return "unknown";
+    }
+}
+
+static size_t
+bytes_per_sample(enum SampleType type)
+{
+    switch (type) {
+        case SampleType_u8:
+        case SampleType_i8:
+            return 1;
+        case SampleType_f32:
+        case SampleType_u32:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+/// @returns the elapsed time in milliseconds.
+static double
+run(const struct accumulate_kernels* k,
+    enum SampleType type,
+    float* acc,
+    const uint8_t* inputs,
+    size_t count,
+    uint32_t nframes,
+    uint32_t window)
+{
+    const size_t frame_bytes = count * bytes_per_sample(type);
+    struct clock clk;
+    clock_init(&clk);
+    for (uint32_t i = 0; i < nframes; ++i) {
+        const uint8_t* in = inputs + (i % NINPUTS) * frame_bytes;
+        const uint32_t n = i % window + 1;
+        if (n == 1)
+            k->load[type](acc, in, count, 1.0f);
+        else
+            k->add[type](acc, in, count, n == window ? 1.0f / n : 1.0f);
+    }
+    return clock_toc_ms(&clk);
+}
+
+/// Like run(), but sums in u32 and writes the rounded mean of each window to
+/// `out` in the input's type.
+/// @returns the elapsed time in milliseconds.
+static double
+run_integer(const struct accumulate_kernels* k,
+            enum SampleType type,
+            uint32_t* sums,
+            void* out,
+            const uint8_t* inputs,
+            size_t count,
+            uint32_t nframes,
+            uint32_t window)
+{
+    const size_t frame_bytes = count * bytes_per_sample(type);
+    const struct accumulate_divisor d = accumulate_divisor_init(window);
+    struct clock clk;
+    clock_init(&clk);
+    for (uint32_t i = 0; i < nframes; ++i) {
+        const uint8_t* in = inputs + (i % NINPUTS) * frame_bytes;
+        const uint32_t n = i % window + 1;
+        if (n == window)
+            k->mean_u32[type](out, sums, in, count, &d);
+        else if (n == 1)
+            k->load_u32[type](sums, in, count);
+        else
+            k->add_u32[type](sums, in, count);
+    }
+    return clock_toc_ms(&clk);
+}
+
+/// Runs the sliding-window kernel (`is_sliding`) or the exponential one over
+/// `nframes` frames, starting from an empty window.
+/// @returns the elapsed time in milliseconds.
+static double
+run_running(const struct accumulate_kernels* k,
+            enum SampleType type,
+            int is_sliding,
+            float* state,
+            float* out,
+            uint8_t* history,
+            const uint8_t* inputs,
+            size_t count,
+            uint32_t nframes,
+            uint32_t window)
+{
+    const size_t frame_bytes = count * bytes_per_sample(type);
+    memset(state, 0, count * sizeof(float));  // NOLINT
+    memset(history, 0, window * frame_bytes); // NOLINT
+    struct clock clk;
+    clock_init(&clk);
+    for (uint32_t i = 0; i < nframes; ++i) {
+        const uint8_t* in = inputs + (i % NINPUTS) * frame_bytes;
+        if (is_sliding) {
+            const uint32_t n = i < window ? i + 1 : window;
+            k->slide[type](state,
+                           out,
+                           history + (i % window) * frame_bytes,
+                           in,
+                           count,
+                           1.0f / (float)n);
+        } else {
+            k->ema[type](state, out, in, count, i ? 0.25f : 1.0f);
+        }
+    }
+    return clock_toc_ms(&clk);
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const size_t count =
+      (size_t)((argc > 1) ? strtod(argv[1], 0) : 4.0) * 1000000;
+    const uint32_t nframes = (argc > 2) ? strtoul(argv[2], 0, 10) : 16;
+    const uint32_t window = (argc > 3) ? strtoul(argv[3], 0, 10) : 4;
+    if (!count || !nframes || !window) {
+        ERR("Expected a positive number of pixels, frames and window size.");
+        return 1;
+    }
+
+    int ok = 0;
+    uint8_t* inputs = malloc(NINPUTS * count * sizeof(float));
+    float* acc = malloc(count * sizeof(float));
+    float* expected = malloc(count * sizeof(float));
+    float* state = malloc(count * sizeof(float));
+    uint8_t* history = malloc(window * count * sizeof(float));
+    if (!inputs || !acc || !expected || !state || !history) {
+        ERR("Failed to allocate buffers for %llu pixels",
+            (unsigned long long)count);
+        goto Finalize;
+    }
+    // Small values keep f32 inputs finite.
+    for (size_t i = 0; i < NINPUTS * count * sizeof(float); ++i)
+        inputs[i] = (uint8_t)((i * 31) & 0x3f);
+
+    ok = 1;
+    const struct accumulate_kernels* scalar =
+      accumulate_kernels_get(AccumulateIsa_Scalar);
+    for (int type = 0; type < SampleTypeCount; ++type) {
+        // The scalar result for the last window checks the others.
+        run(scalar, type, expected, inputs, count, nframes, window);
+        for (int isa = 0; isa < AccumulateIsaCount; ++isa) {
+            const struct accumulate_kernels* k =
+              accumulate_kernels_get((enum AccumulateIsa)isa);
+            if (!k)
+                continue;
+            // Warm up, so page faults aren't part of the measurement.
+            run(k, type, acc, inputs, count, 1, window);
+            const double ms = run(k, type, acc, inputs, count, nframes, window);
+            const double bytes =
+              (double)count * bytes_per_sample(type) * (double)nframes;
+            LOG("%-6s %-4s: %.1f MB in %.1f ms: %.2f GB/s",
+                k->name,
+                sample_type_name(type),
+                1e-6 * bytes,
+                ms,
+                1e-6 * bytes / ms);
+            if (memcmp(acc, expected, count * sizeof(float))) {
+                ERR("%s kernels disagree with scalar for %s",
+                    k->name,
+                    sample_type_name(type));
+                ok = 0;
+            }
+        }
+        for (int is_sliding = 1; is_sliding >= 0; --is_sliding) {
+            const char* mode = is_sliding ? "slide" : "ema";
+            run_running(scalar,
+                        type,
+                        is_sliding,
+                        state,
+                        expected,
+                        history,
+                        inputs,
+                        count,
+                        nframes,
+                        window);
+            for (int isa = 0; isa < AccumulateIsaCount; ++isa) {
+                const struct accumulate_kernels* k =
+                  accumulate_kernels_get((enum AccumulateIsa)isa);
+                if (!k)
+                    continue;
+                const double ms = run_running(k,
+                                              type,
+                                              is_sliding,
+                                              state,
+                                              acc,
+                                              history,
+                                              inputs,
+                                              count,
+                                              nframes,
+                                              window);
+                const double bytes =
+                  (double)count * bytes_per_sample(type) * (double)nframes;
+                LOG("%-6s %-4s %-5s: %.1f MB in %.1f ms: %.2f GB/s",
+                    k->name,
+                    sample_type_name(type),
+                    mode,
+                    1e-6 * bytes,
+                    ms,
+                    1e-6 * bytes / ms);
+                if (memcmp(acc, expected, count * sizeof(float))) {
+                    ERR("%s %s kernels disagree with scalar for %s",
+                        k->name,
+                        mode,
+                        sample_type_name(type));
+                    ok = 0;
+                }
+            }
+        }
+        if (!scalar->load_u32[type] || window < 2)
+            continue;
+        uint32_t* sums = (uint32_t*)state;
+        run_integer(
+          scalar, type, sums, expected, inputs, count, nframes, window);
+        for (int isa = 0; isa < AccumulateIsaCount; ++isa) {
+            const struct accumulate_kernels* k =
+              accumulate_kernels_get((enum AccumulateIsa)isa);
+            if (!k)
+                continue;
+            const double ms =
+              run_integer(k, type, sums, acc, inputs, count, nframes, window);
+            const double bytes =
+              (double)count * bytes_per_sample(type) * (double)nframes;
+            LOG("%-6s %-4s u32  : %.1f MB in %.1f ms: %.2f GB/s",
+                k->name,
+                sample_type_name(type),
+                1e-6 * bytes,
+                ms,
+                1e-6 * bytes / ms);
+            if (memcmp(acc, expected, count * bytes_per_sample(type))) {
+                ERR("%s integer kernels disagree with scalar for %s",
+                    k->name,
+                    sample_type_name(type));
+                ok = 0;
+            }
+        }
+    }
+
+Finalize:
+    free(inputs);
+    free(acc);
+    free(expected);
+    free(state);
+    free(history);
+    return !ok;
+}
@@ -0,0 +1,186 @@
+/// @file filter-threads.c
+/// Measures how the frame-averaging filter scales with the number of threads
+/// that share each frame (see `video_filter_configure()`).
+///
+/// For each thread count, u16 frames are queued on the filter's input and the
+/// filter is run until it has drained them. Reported bandwidth counts input
+/// bytes consumed. Every run's output is checked against the one-thread run.
+///
+/// Usage: filter-threads [width] [height] [frames] [window] [max_threads]
+
+#include "runtime/filter.h"
+#include "device/props/components.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+struct params
+{
+    uint32_t width, height, nframes, window;
+};
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    if (!is_error)
+        return; // The filter logs every start and stop. Keep the output short.
+    fprintf(stderr, "ERROR %s(%d) - %s: %s\n", file, line, function, msg);
+}
+
+static size_t
+bytes_of_input_frame(const struct params* p)
+{
+    const size_t n = sizeof(struct VideoFrame) +
+                     (size_t)p->width * p->height * sizeof(uint16_t);
+    return 8 * ((n + 7) / 8);
+}
+
+/// Averages the frames with `thread_count` threads and copies the output
+/// pixels to `out`.
+/// @returns elapsed milliseconds, or a negative number on error.
+static double
+run(const struct params* p, uint32_t thread_count, float* out)
+{
+    const size_t npx = (size_t)p->width * p->height;
+    const size_t bytes_of_in = bytes_of_input_frame(p);
+    const size_t capacity = bytes_of_in * (p->nframes + 1);
+    struct channel sink = { 0 };
+    struct channel_reader reader = { 0 };
+    struct video_filter_s filter = { 0 };
+    double elapsed_ms = -1.0;
+
+    channel_new(&sink, 2 * capacity);
+    if (!sink.data || video_filter_init(&filter, 0, capacity) ||
+        video_filter_configure(&filter,
+                               FilterMode_Tumbling,
+                               p->window,
+                               thread_count,
+                               0,
+                               FilterOutput_Float)) {
+        ERR("Failed to set up the filter");
+        goto Finalize;
+    }
+    filter.stage.out = &sink;
+    // Fault the output in so page faults aren't part of the measurement.
+    memset(sink.data, 0, sink.capacity); // NOLINT
+
+    for (uint32_t i = 0; i < p->nframes; ++i) {
+        struct VideoFrame* f =
+          channel_write_map(&filter.stage.in, bytes_of_in);
+        if (!f) {
+            ERR("Failed to queue frame %u", i);
+            goto Finalize;
+        }
+        *f = (struct VideoFrame){
+            .bytes_of_frame = bytes_of_in,
+            .shape = { .dims = { .channels = 1,
+                                 .width = p->width,
+                                 .height = p->height,
+                                 .planes = 1 },
+                       .strides = { .channels = 1,
+                                    .width = 1,
+                                    .height = p->width,
+                                    .planes = (int64_t)npx },
+                       .type = SampleType_u16 },
+            .frame_id = i,
+        };
+        uint16_t* px = (uint16_t*)f->data;
+        for (size_t j = 0; j < npx; ++j)
+            px[j] = (uint16_t)(j * 31 + i);
+        channel_write_unmap(&filter.stage.in);
+    }
+
+    // The input is all queued, so the filter drains it in its final flush
+    // and exits.
+    struct clock clk;
+    clock_init(&clk);
+    if (video_stage_start(&filter.stage)) {
+        ERR("Failed to start the filter");
+        goto Finalize;
+    }
+    video_stage_sig_stop(&filter.stage);
+    thread_join(&filter.stage.thread);
+    elapsed_ms = clock_toc_ms(&clk);
+
+    struct slice s = channel_read_map(&sink, &reader);
+    size_t nout = 0;
+    for (uint8_t* cur = s.beg; cur < s.end; ++nout) {
+        const struct VideoFrame* f = (const struct VideoFrame*)cur;
+        memcpy(out + nout * npx, f->data, npx * sizeof(float)); // NOLINT
+        cur += f->bytes_of_frame;
+    }
+    channel_read_unmap(&sink, &reader, s.end - s.beg);
+    if (nout != p->nframes / p->window) {
+        ERR("Expected %u averaged frames. Got %u.",
+            p->nframes / p->window,
+            (unsigned)nout);
+        elapsed_ms = -1.0;
+    }
+
+Finalize:
+    video_stage_destroy(&filter.stage);
+    channel_release(&sink);
+    return elapsed_ms;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    const struct params p = {
+        .width = (argc > 1) ? strtoul(argv[1], 0, 10) : 2048,
+        .height = (argc > 2) ? strtoul(argv[2], 0, 10) : 2048,
+        .nframes = (argc > 3) ? strtoul(argv[3], 0, 10) : 12,
+        .window = (argc > 4) ? strtoul(argv[4], 0, 10) : 3,
+    };
+    const uint32_t max_threads = (argc > 5) ? strtoul(argv[5], 0, 10) : 8;
+    if (!p.width || !p.height || p.window < 2 || p.nframes < p.window ||
+        !max_threads || max_threads > FILTER_MAX_THREADS) {
+        ERR("Expected a non-empty frame, a window of at least two frames, at "
+            "least one window of frames, and 1 to %d threads.",
+            FILTER_MAX_THREADS);
+        return 1;
+    }
+
+    const size_t bytes_of_out = (size_t)p.width * p.height * sizeof(float) *
+                                (p.nframes / p.window);
+    float* serial = malloc(bytes_of_out);
+    float* threaded = malloc(bytes_of_out);
+    int ok = serial && threaded;
+
+    double serial_ms = 0;
+    for (uint32_t n = 1; ok && n <= max_threads; n *= 2) {
+        const double ms = run(&p, n, n == 1 ? serial : threaded);
+        if (ms < 0) {
+            ok = 0;
+            break;
+        }
+        if (n == 1)
+            serial_ms = ms;
+        const double bytes = (double)bytes_of_input_frame(&p) * p.nframes;
+        printf("%2u threads: %.1f MB in %.1f ms: %.2f GB/s, %.2fx\n",
+               n,
+               1e-6 * bytes,
+               ms,
+               1e-6 * bytes / ms,
+               serial_ms / ms);
+        if (n > 1 && memcmp(serial, threaded, bytes_of_out)) {
+            ERR("Output with %u threads differs from one thread", n);
+            ok = 0;
+        }
+    }
+    free(serial);
+    free(threaded);
+    return !ok;
+}
@@ -0,0 +1,219 @@
+/// @file sink-latency.c
+/// Measures how long a frame waits in a `channel` before a sink-like reader
+/// hands it to storage: the time from `timestamps.acq_thread`, stamped when
+/// the frame is published, to the moment it would be appended.
+///
+/// The writer publishes frames at a fixed rate. The reader follows one of the
+/// strategies the sink thread can use:
+/// - poll:  wake every 10 ms and drain (the sink's old throttled loop).
+/// - event: wake whenever the writer publishes.
+/// - batch: wake once `batch_frames` frames are queued, or after 100 ms.
+///
+/// Usage: sink-latency [frame_count] [frame_period_us] [frame_KiB]
+///                     [batch_frames]
+
+#include "runtime/channel.h"
+#include "runtime/frame_iterator.h"
+#include "device/props/components.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+enum Strategy
+{
+    Strategy_Poll,
+    Strategy_Event,
+    Strategy_Batch,
+};
+
+static const char* const strategy_names[] = { "poll", "event", "batch" };
+
+struct context
+{
+    struct channel channel;
+    struct channel_reader reader;
+    enum Strategy strategy;
+    uint64_t frame_count;
+    size_t bytes_of_frame;
+    float frame_period_ms;
+    uint32_t batch_frames;
+
+    volatile uint8_t writer_done;
+    double* latency_ms;
+    uint64_t frames_read, wakeups;
+};
+
+static void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+static int
+compare_double(const void* a, const void* b)
+{
+    const double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void
+writer_thread(struct context* ctx)
+{
+    struct clock clk;
+    clock_init(&clk);
+    for (uint64_t i = 0; i < ctx->frame_count; ++i) {
+        clock_sleep_ms(&clk, ctx->frame_period_ms);
+        struct VideoFrame* im = (struct VideoFrame*)channel_write_map(
+          &ctx->channel, ctx->bytes_of_frame);
+        if (!im)
+            break;
+        *im = (struct VideoFrame){
+            .bytes_of_frame = ctx->bytes_of_frame,
+            .frame_id = i,
+            .timestamps.acq_thread = clock_tic(0),
+        };
+        channel_write_unmap(&ctx->channel);
+    }
+    ctx->writer_done = 1;
+    channel_wake_reader(&ctx->channel, &ctx->reader);
+}
+
+static void
+drain(struct context* ctx)
+{
+    struct channel_reader* const reader = &ctx->reader;
+    struct slice slice;
+    do {
+        slice = channel_read_map(&ctx->channel, reader);
+        const uint64_t now = clock_tic(0);
+        struct frame_iterator it = frame_iterator_init(&slice);
+        struct VideoFrame* im;
+        while ((im = frame_iterator_next(&it))) {
+            if (ctx->frames_read < ctx->frame_count)
+                ctx->latency_ms[ctx->frames_read] =
+                  1e-6 * (double)(now - im->timestamps.acq_thread);
+            ++ctx->frames_read;
+        }
+        channel_read_unmap(
+          &ctx->channel, reader, (size_t)(slice.end - slice.beg));
+    } while (slice.end > slice.beg);
+}
+
+static void
+reader_thread(struct context* ctx)
+{
+    struct clock throttler;
+    clock_init(&throttler);
+    const size_t batch_bytes = (size_t)ctx->batch_frames * ctx->bytes_of_frame;
+    uint8_t done = 0;
+    while (!done) {
+        done = ctx->writer_done;
+        switch (ctx->strategy) {
+            case Strategy_Poll:
+                clock_sleep_ms(&throttler, 10.0f);
+                break;
+            case Strategy_Event:
+                channel_wait_for_data(&ctx->channel, &ctx->reader, 1, 100.0f);
+                break;
+            case Strategy_Batch:
+                channel_wait_for_data(
+                  &ctx->channel, &ctx->reader, batch_bytes, 100.0f);
+                break;
+        }
+        ++ctx->wakeups;
+        drain(ctx);
+    }
+}
+
+static int
+run(struct context* ctx)
+{
+    channel_new(&ctx->channel, 64ULL << 20);
+    if (!ctx->channel.data) {
+        ERR("Failed to allocate channel");
+        return 0;
+    }
+    ctx->reader = (struct channel_reader){ 0 };
+    ctx->writer_done = 0;
+    ctx->frames_read = 0;
+    ctx->wakeups = 0;
+
+    struct thread writer, reader;
+    thread_init(&writer);
+    thread_init(&reader);
+    thread_create(&reader, (void (*)(void*))reader_thread, ctx);
+    thread_create(&writer, (void (*)(void*))writer_thread, ctx);
+    thread_join(&writer);
+    thread_join(&reader);
+    channel_release(&ctx->channel);
+
+    if (ctx->frames_read != ctx->frame_count) {
+        ERR("%s: Expected %llu frames. Got %llu.",
+            strategy_names[ctx->strategy],
+            (unsigned long long)ctx->frame_count,
+            (unsigned long long)ctx->frames_read);
+        return 0;
+    }
+
+    const uint64_t n = ctx->frame_count;
+    qsort(ctx->latency_ms, n, sizeof(double), compare_double);
+    double mean = 0.0;
+    for (uint64_t i = 0; i < n; ++i)
+        mean += ctx->latency_ms[i];
+    mean /= (double)n;
+    LOG("%-5s latency ms: mean %7.3f p50 %7.3f p99 %7.3f max %7.3f "
+        "- %llu wakeups for %llu frames",
+        strategy_names[ctx->strategy],
+        mean,
+        ctx->latency_ms[n / 2],
+        ctx->latency_ms[(n * 99) / 100],
+        ctx->latency_ms[n - 1],
+        (unsigned long long)ctx->wakeups,
+        (unsigned long long)n);
+    return 1;
+}
+
+int
+main(int argc, char** argv)
+{
+    logger_set_reporter(reporter);
+    struct context ctx = {
+        .frame_count = (argc > 1) ? strtoull(argv[1], 0, 10) : 300,
+        .frame_period_ms =
+          1e-3f * (float)((argc > 2) ? strtoull(argv[2], 0, 10) : 2000),
+        .bytes_of_frame = ((argc > 3) ? strtoull(argv[3], 0, 10) : 64) << 10,
+        .batch_frames = (argc > 4) ? (uint32_t)strtoul(argv[4], 0, 10) : 8,
+    };
+    if (!ctx.frame_count || ctx.bytes_of_frame < sizeof(struct VideoFrame) ||
+        !ctx.batch_frames) {
+        ERR("Invalid arguments.");
+        return 1;
+    }
+    if (!(ctx.latency_ms = malloc(ctx.frame_count * sizeof(double))))
+        return 1;
+
+    int ok = 1;
+    for (int i = 0; i < 3; ++i) {
+        ctx.strategy = (enum Strategy)i;
+        ok &= run(&ctx);
+    }
+    free(ctx.latency_ms);
+    return !ok;
+}
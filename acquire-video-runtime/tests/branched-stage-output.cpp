@@ -0,0 +1,168 @@
+/// @file branched-stage-output.cpp
+/// Test that a stream with `AcquireStageOutput_Branch` stages delivers both
+/// the camera's frames and the stages' output, and that each averaged frame
+/// is the mean of the raw frames it covers.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str) - 1
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+int
+main()
+{
+    auto runtime = acquire_init(reporter);
+    CHECK(runtime);
+    auto dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated.*random.*"),
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                SIZED("trash"),
+                                &props.video[0].storage.identifier));
+    props.video[0].camera.settings.binning = 1;
+    props.video[0].camera.settings.pixel_type = SampleType_u8;
+    props.video[0].camera.settings.shape = { .x = 320, .y = 240 };
+    props.video[0].camera.settings.exposure_time_us = 1e4;
+    props.video[0].max_frame_count = 12;
+    props.video[0].channel_capacity_bytes = 16 << 20;
+    props.video[0].stages[0] = { .kind = AcquireStage_Average,
+                                 .average = { .frame_count = 3 } };
+    props.video[0].stage_output = AcquireStageOutput_Branch;
+    OK(acquire_configure(runtime, &props));
+
+    {
+        AcquireProperties actual = {};
+        OK(acquire_get_configuration(runtime, &actual));
+        CHECK(actual.video[0].stage_output == AcquireStageOutput_Branch);
+        // No storage was selected for the stages, so they get the default.
+        CHECK(actual.video[0].stage_storage.identifier.kind ==
+              DeviceKind_Storage);
+    }
+
+    const auto next = [](VideoFrame* cur) -> VideoFrame* {
+        return (VideoFrame*)(((uint8_t*)cur) + cur->bytes_of_frame);
+    };
+
+    const uint64_t expected_raw = 12, expected_averaged = 4;
+    const size_t npx = 320 * 240;
+    std::vector<uint8_t> raw(expected_raw * npx);
+    std::vector<float> averaged(expected_averaged * npx);
+
+    struct clock clock = {};
+    static double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    OK(acquire_start(runtime));
+    uint64_t nraw = 0, naveraged = 0;
+    while (nraw < expected_raw || naveraged < expected_averaged) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timeout at %f ms",
+               clock_toc_ms(&clock) + time_limit_ms);
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read(runtime, 0, &beg, &end));
+        for (cur = beg; cur < end; cur = next(cur)) {
+            CHECK(nraw < expected_raw);
+            EXPECT(cur->frame_id == nraw,
+                   "Expected raw frame %llu. Got %llu.",
+                   (unsigned long long)nraw,
+                   (unsigned long long)cur->frame_id);
+            CHECK(cur->shape.type == SampleType_u8);
+            memcpy(raw.data() + nraw * npx, cur->data, npx); // NOLINT
+            ++nraw;
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+
+        OK(acquire_map_read_stage_output(runtime, 0, &beg, &end));
+        for (cur = beg; cur < end; cur = next(cur)) {
+            CHECK(naveraged < expected_averaged);
+            EXPECT(cur->frame_id == 3 * naveraged,
+                   "Expected averaged frame %llu. Got %llu.",
+                   (unsigned long long)(3 * naveraged),
+                   (unsigned long long)cur->frame_id);
+            CHECK(cur->shape.type == SampleType_f32);
+            memcpy(averaged.data() + naveraged * npx, // NOLINT
+                   cur->data,
+                   npx * sizeof(float));
+            ++naveraged;
+        }
+        OK(acquire_unmap_read_stage_output(
+          runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+        clock_sleep_ms(nullptr, 5.0f);
+    }
+    OK(acquire_stop(runtime));
+
+    for (size_t k = 0; k < expected_averaged; ++k) {
+        for (size_t i = 0; i < npx; ++i) {
+            const float expected = ((float)raw[(3 * k) * npx + i] +
+                                    (float)raw[(3 * k + 1) * npx + i] +
+                                    (float)raw[(3 * k + 2) * npx + i]) /
+                                   3.0f;
+            const float actual = averaged[k * npx + i];
+            EXPECT(fabsf(actual - expected) < 1e-3f,
+                   "Averaged frame %u pixel %u: expected %f. Got %f.",
+                   (unsigned)k,
+                   (unsigned)i,
+                   expected,
+                   actual);
+        }
+    }
+
+    // Without stages there's nothing to branch.
+    props.video[0].stages[0] = {};
+    OK(acquire_configure(runtime, &props));
+    CHECK(acquire_get_state(runtime) == DeviceState_AwaitingConfiguration);
+
+    OK(acquire_shutdown(runtime));
+    return 0;
+}
@@ -0,0 +1,166 @@
+/// @file configure-channel-capacity.cpp
+/// Test that the frame queue capacity can be configured per stream, and that
+/// capacities too small to hold a frame are rejected. Then run again with
+/// mirrored queues, passing enough frames to wrap them several times.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str)
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+static const uint64_t capacity_bytes = 1ULL << 20;
+
+AcquireProperties
+configure(AcquireRuntime* runtime)
+{
+    CHECK(runtime);
+
+    const DeviceManager* dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated.*empty.*") - 1,
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                SIZED("trash") - 1,
+                                &props.video[0].storage.identifier));
+
+    props.video[0].camera.settings.binning = 1;
+    props.video[0].camera.settings.pixel_type = SampleType_u8;
+    props.video[0].camera.settings.shape = {
+        .x = 64,
+        .y = 48,
+    };
+    props.video[0].max_frame_count = 100;
+    OK(acquire_configure(runtime, &props));
+
+    // The default capacity is reported when none was requested.
+    OK(acquire_get_configuration(runtime, &props));
+    CHECK(props.video[0].channel_capacity_bytes == 1ULL << 30);
+
+    AcquirePropertyMetadata metadata = {};
+    OK(acquire_get_configuration_metadata(runtime, &metadata));
+    const auto low = (uint64_t)metadata.video[0].channel_capacity_bytes.low;
+    EXPECT(low >= 2 * 64 * 48 && low < capacity_bytes,
+           "Unexpected lower bound on channel capacity: %llu",
+           (unsigned long long)low);
+
+    // Too small to hold two frames
+    props.video[0].channel_capacity_bytes = low / 2;
+    OK(acquire_configure(runtime, &props));
+    CHECK(acquire_get_state(runtime) == DeviceState_AwaitingConfiguration);
+
+    props.video[0].channel_capacity_bytes = capacity_bytes;
+    OK(acquire_configure(runtime, &props));
+    CHECK(acquire_get_state(runtime) == DeviceState_Armed);
+    OK(acquire_get_configuration(runtime, &props));
+    CHECK(props.video[0].channel_capacity_bytes == capacity_bytes);
+    return props;
+}
+
+void
+acquire(AcquireRuntime* runtime, const AcquireProperties& props)
+{
+    const auto next = [](VideoFrame* cur) -> VideoFrame* {
+        return (VideoFrame*)(((uint8_t*)cur) + cur->bytes_of_frame);
+    };
+
+    struct clock clock = {};
+    static double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    OK(acquire_start(runtime));
+    uint64_t nframes = 0;
+    while (nframes < props.video[0].max_frame_count) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timeout at %f ms",
+               clock_toc_ms(&clock) + time_limit_ms);
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read(runtime, 0, &beg, &end));
+        for (cur = beg; cur < end; cur = next(cur)) {
+            CHECK(cur->frame_id == nframes);
+            ++nframes;
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+        clock_sleep_ms(0, 1.0f);
+    }
+    OK(acquire_stop(runtime));
+}
+
+int
+main()
+{
+    int retval = 1;
+    AcquireRuntime* runtime = acquire_init(reporter);
+
+    try {
+        const auto props = configure(runtime);
+        acquire(runtime, props);
+
+        // Mirrored queues are a whole number of pages.
+        auto mirrored = props;
+        mirrored.video[0].channel_capacity_bytes = capacity_bytes + 1;
+        mirrored.video[0].mirror_channels = 1;
+        mirrored.video[0].max_frame_count = 1000;
+        OK(acquire_configure(runtime, &mirrored));
+        OK(acquire_get_configuration(runtime, &mirrored));
+        CHECK(mirrored.video[0].mirror_channels == 1);
+        CHECK(mirrored.video[0].channel_capacity_bytes > capacity_bytes);
+        CHECK(mirrored.video[0].channel_capacity_bytes % 4096 == 0);
+        acquire(runtime, mirrored);
+        retval = 0;
+    } catch (const std::exception& e) {
+        ERR("Exception: %s", e.what());
+    } catch (...) {
+        ERR("Exception: (unknown)");
+    }
+
+    acquire_shutdown(runtime);
+    return retval;
+}
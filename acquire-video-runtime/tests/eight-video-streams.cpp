@@ -0,0 +1,158 @@
+/// @file eight-video-streams.cpp
+/// Test that a runtime with more than the default number of video streams
+/// runs all of them: eight simulated cameras, each writing to trash.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str) - 1
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+#define NSTREAMS (8)
+
+int
+main()
+{
+    auto runtime = acquire_init_with_video_streams(reporter, NSTREAMS);
+    CHECK(runtime);
+    auto dm = acquire_device_manager(runtime);
+    CHECK(dm);
+    CHECK(acquire_get_video_stream_count(runtime) == NSTREAMS);
+
+    const char* cameras[] = { "simulated.*random.*",
+                              "simulated.*sin.*",
+                              "simulated.*empty.*" };
+    aq_properties_video_s props[NSTREAMS] = {};
+    for (uint32_t i = 0; i < NSTREAMS; ++i) {
+        OK(acquire_get_video_stream_configuration(runtime, i, props + i));
+        const char* camera = cameras[i % 3];
+        DEVOK(device_manager_select(dm,
+                                    DeviceKind_Camera,
+                                    camera,
+                                    strlen(camera),
+                                    &props[i].camera.identifier));
+        DEVOK(device_manager_select(dm,
+                                    DeviceKind_Storage,
+                                    SIZED("trash"),
+                                    &props[i].storage.identifier));
+        props[i].camera.settings.binning = 1;
+        props[i].camera.settings.pixel_type = SampleType_u8;
+        props[i].camera.settings.shape = { .x = 64, .y = 48 };
+        props[i].camera.settings.exposure_time_us = 1e4;
+        props[i].max_frame_count = 20 + i;
+        props[i].channel_capacity_bytes = 1 << 20;
+        OK(acquire_configure_video_stream(runtime, i, props + i));
+    }
+
+    // The two-stream view sees the first two streams.
+    {
+        AcquireProperties view = {};
+        OK(acquire_get_configuration(runtime, &view));
+        for (int i = 0; i < 2; ++i) {
+            CHECK(view.video[i].max_frame_count == props[i].max_frame_count);
+            CHECK(view.video[i].channel_capacity_bytes ==
+                  props[i].channel_capacity_bytes);
+        }
+    }
+
+    const auto next = [](VideoFrame* cur) -> VideoFrame* {
+        return (VideoFrame*)(((uint8_t*)cur) + cur->bytes_of_frame);
+    };
+
+    struct clock clock = {};
+    static double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    OK(acquire_start(runtime));
+    uint64_t nframes[NSTREAMS] = { 0 };
+    for (bool done = false; !done;) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timeout at %f ms",
+               clock_toc_ms(&clock) + time_limit_ms);
+        done = true;
+        for (uint32_t i = 0; i < NSTREAMS; ++i) {
+            VideoFrame *beg, *end, *cur;
+            OK(acquire_map_read(runtime, i, &beg, &end));
+            for (cur = beg; cur < end; cur = next(cur)) {
+                EXPECT(cur->frame_id == nframes[i],
+                       "[stream %u] Expected frame %llu. Got %llu.",
+                       i,
+                       (unsigned long long)nframes[i],
+                       (unsigned long long)cur->frame_id);
+                CHECK(cur->shape.dims.width ==
+                      props[i].camera.settings.shape.x);
+                ++nframes[i];
+            }
+            OK(acquire_unmap_read(
+              runtime, i, (uint8_t*)end - (uint8_t*)beg));
+            done &= (nframes[i] == props[i].max_frame_count);
+        }
+        clock_sleep_ms(nullptr, 5.0f);
+    }
+    OK(acquire_stop(runtime));
+
+    for (uint32_t i = 0; i < NSTREAMS; ++i) {
+        LOG("[stream %u] %llu frames", i, (unsigned long long)nframes[i]);
+        CHECK(nframes[i] == props[i].max_frame_count);
+    }
+
+    // Streams past the runtime's last can't be configured through the
+    // two-stream view.
+    {
+        auto one = acquire_init_with_video_streams(reporter, 1);
+        CHECK(one);
+        AcquireProperties p = {};
+        OK(acquire_get_configuration(one, &p));
+        CHECK(p.video[1].camera.identifier.kind == DeviceKind_None);
+        DEVOK(device_manager_select(acquire_device_manager(one),
+                                    DeviceKind_Camera,
+                                    SIZED("simulated.*empty.*"),
+                                    &p.video[1].camera.identifier));
+        CHECK(acquire_configure(one, &p) == AcquireStatus_Error);
+        OK(acquire_shutdown(one));
+    }
+
+    OK(acquire_shutdown(runtime));
+    return 0;
+}
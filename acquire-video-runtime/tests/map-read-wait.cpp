@@ -0,0 +1,150 @@
+/// @file map-read-wait.cpp
+/// Test that acquire_map_read_wait() returns frames as they arrive, times out
+/// when there's nothing to read, and returns promptly once acquisition stops.
+/// NULL outputs are rejected without waiting.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str)
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+void
+configure(AcquireRuntime* runtime)
+{
+    CHECK(runtime);
+
+    const DeviceManager* dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated.*random.*") - 1,
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                SIZED("trash") - 1,
+                                &props.video[0].storage.identifier));
+
+    props.video[0].camera.settings.binning = 1;
+    props.video[0].camera.settings.pixel_type = SampleType_u8;
+    props.video[0].camera.settings.shape = {
+        .x = 64,
+        .y = 48,
+    };
+    props.video[0].camera.settings.exposure_time_us = 1e4;
+    props.video[0].max_frame_count = 50;
+    OK(acquire_configure(runtime, &props));
+}
+
+void
+acquire(AcquireRuntime* runtime)
+{
+    const auto next = [](VideoFrame* cur) -> VideoFrame* {
+        return (VideoFrame*)(((uint8_t*)cur) + cur->bytes_of_frame);
+    };
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    OK(acquire_start(runtime));
+    uint64_t nframes = 0;
+    uint32_t nwaits = 0;
+    while (nframes < props.video[0].max_frame_count) {
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read_wait(runtime, 0, 5000.0f, &beg, &end));
+        EXPECT(beg < end,
+               "Timed out after %llu frames",
+               (unsigned long long)nframes);
+        for (cur = beg; cur < end; cur = next(cur)) {
+            CHECK(cur->frame_id == nframes);
+            ++nframes;
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+        ++nwaits;
+    }
+    LOG("Read %llu frames in %u waits", (unsigned long long)nframes, nwaits);
+    OK(acquire_stop(runtime));
+
+    // Nothing more is coming, so this should time out.
+    struct clock clock = {};
+    clock_init(&clock);
+    VideoFrame *beg, *end;
+    OK(acquire_map_read_wait(runtime, 0, 100.0f, &beg, &end));
+    CHECK(beg == end);
+    const double elapsed_ms = clock_toc_ms(&clock);
+    EXPECT(elapsed_ms < 1000.0, "Wait took %f ms", elapsed_ms);
+    OK(acquire_unmap_read(runtime, 0, 0));
+
+    // Bad arguments fail without waiting.
+    clock_init(&clock);
+    CHECK(acquire_map_read_wait(runtime, 0, 5000.0f, nullptr, &end) ==
+          AcquireStatus_Error);
+    CHECK(acquire_map_read_wait(runtime, 0, 5000.0f, &beg, nullptr) ==
+          AcquireStatus_Error);
+    EXPECT(clock_toc_ms(&clock) < 1000.0,
+           "Rejecting NULL outputs took %f ms",
+           clock_toc_ms(&clock));
+}
+
+int
+main()
+{
+    int retval = 1;
+    AcquireRuntime* runtime = acquire_init(reporter);
+
+    try {
+        configure(runtime);
+        acquire(runtime);
+        retval = 0;
+    } catch (const std::exception& e) {
+        ERR("Exception: %s", e.what());
+    } catch (...) {
+        ERR("Exception: (unknown)");
+    }
+
+    acquire_shutdown(runtime);
+    return retval;
+}
@@ -0,0 +1,201 @@
+/// @file monitor-overflow.cpp
+/// Test that a monitor that falls behind doesn't hold up acquisition when its
+/// overflow policy says not to, and that it's told what it missed.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str)
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+void
+configure(AcquireRuntime* runtime, AcquireMonitorOverflow overflow)
+{
+    CHECK(runtime);
+
+    const DeviceManager* dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated.*empty.*") - 1,
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                SIZED("trash") - 1,
+                                &props.video[0].storage.identifier));
+
+    props.video[0].camera.settings.binning = 1;
+    props.video[0].camera.settings.pixel_type = SampleType_u8;
+    props.video[0].camera.settings.shape = {
+        .x = 64,
+        .y = 48,
+    };
+    props.video[0].camera.settings.exposure_time_us = 1e3;
+    props.video[0].max_frame_count = 100;
+    // Room for about 10 frames.
+    props.video[0].channel_capacity_bytes = 1 << 15;
+    props.video[0].monitor_overflow = overflow;
+    OK(acquire_configure(runtime, &props));
+
+    OK(acquire_get_configuration(runtime, &props));
+    CHECK(props.video[0].monitor_overflow == overflow);
+}
+
+const auto next = [](VideoFrame* cur) -> VideoFrame* {
+    return (VideoFrame*)(((uint8_t*)cur) + cur->bytes_of_frame);
+};
+
+/// Reads until the last frame shows up.
+/// @returns the number of frames read.
+uint64_t
+read_to_end(AcquireRuntime* runtime, uint64_t max_frame_count)
+{
+    struct clock clock = {};
+    static double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    uint64_t nframes = 0;
+    uint64_t last_frame_id = 0;
+    while (!nframes || last_frame_id + 1 < max_frame_count) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timed out after %llu frames",
+               (unsigned long long)nframes);
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read_wait(runtime, 0, 100.0f, &beg, &end));
+        for (cur = beg; cur < end; cur = next(cur)) {
+            last_frame_id = cur->frame_id;
+            ++nframes;
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+    }
+    return nframes;
+}
+
+/// The monitor doesn't read until the writer has lapped it.
+void
+drop_oldest(AcquireRuntime* runtime)
+{
+    configure(runtime, AcquireMonitorOverflow_DropOldest);
+
+    // Attach the monitor so it's accountable for every frame.
+    VideoFrame *beg, *end;
+    OK(acquire_map_read(runtime, 0, &beg, &end));
+    CHECK(beg == end);
+    OK(acquire_unmap_read(runtime, 0, 0));
+
+    OK(acquire_start(runtime));
+    clock_sleep_ms(0, 1000.0f);
+
+    const uint64_t nframes = read_to_end(runtime, 100);
+    uint64_t lost_bytes = 0, lost_frames = 0;
+    OK(acquire_get_monitor_losses(runtime, 0, &lost_bytes, &lost_frames));
+    LOG("Read %llu frames. Lost %llu frames (%llu bytes).",
+        (unsigned long long)nframes,
+        (unsigned long long)lost_frames,
+        (unsigned long long)lost_bytes);
+    CHECK(lost_frames > 0);
+    CHECK(lost_bytes > 0);
+    CHECK(nframes + lost_frames == 100);
+    OK(acquire_stop(runtime));
+}
+
+/// The monitor holds on to a region while the writer overwrites it.
+void
+lossy(AcquireRuntime* runtime)
+{
+    configure(runtime, AcquireMonitorOverflow_Lossy);
+    OK(acquire_start(runtime));
+
+    struct clock clock = {};
+    static double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    VideoFrame *beg, *end;
+    do {
+        EXPECT(clock_cmp_now(&clock) < 0, "Timed out waiting for a frame");
+        OK(acquire_unmap_read(runtime, 0, 0));
+        OK(acquire_map_read_wait(runtime, 0, 100.0f, &beg, &end));
+    } while (beg == end);
+
+    // Wait for the writer to come back around and overwrite the first frame.
+    const volatile uint64_t* frame_id = &beg->frame_id;
+    const uint64_t first_frame_id = *frame_id;
+    while (*frame_id == first_frame_id) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "The writer never lapped the monitor");
+        clock_sleep_ms(0, 1.0f);
+    }
+    OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+
+    uint64_t lost_frames = 0;
+    OK(acquire_get_monitor_losses(runtime, 0, 0, &lost_frames));
+    CHECK(lost_frames > 0);
+
+    read_to_end(runtime, 100);
+    OK(acquire_stop(runtime));
+}
+
+int
+main()
+{
+    int retval = 1;
+    AcquireRuntime* runtime = acquire_init(reporter);
+
+    try {
+        drop_oldest(runtime);
+        lossy(runtime);
+        retval = 0;
+    } catch (const std::exception& e) {
+        ERR("Exception: %s", e.what());
+    } catch (...) {
+        ERR("Exception: (unknown)");
+    }
+
+    acquire_shutdown(runtime);
+    return retval;
+}
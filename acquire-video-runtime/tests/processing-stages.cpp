@@ -0,0 +1,154 @@
+/// @file processing-stages.cpp
+/// Test that a stream runs a chain of processing stages listed in its
+/// properties: two averaging stages in a row average over both windows.
+
+#include "acquire.h"
+#include "device/hal/device.manager.h"
+#include "platform.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+void
+reporter(int is_error,
+         const char* file,
+         int line,
+         const char* function,
+         const char* msg)
+{
+    fprintf(is_error ? stderr : stdout,
+            "%s%s(%d) - %s: %s\n",
+            is_error ? "ERROR " : "",
+            file,
+            line,
+            function,
+            msg);
+}
+
+/// Helper for passing size static strings as function args.
+/// For a function: `f(char*,size_t)` use `f(SIZED("hello"))`.
+/// Expands to `f("hello",5)`.
+#define SIZED(str) str, sizeof(str) - 1
+
+#define L (aq_logger)
+#define LOG(...) L(0, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ERR(...) L(1, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define EXPECT(e, ...)                                                         \
+    do {                                                                       \
+        if (!(e)) {                                                            \
+            char buf[1 << 8] = { 0 };                                          \
+            ERR(__VA_ARGS__);                                                  \
+            snprintf(buf, sizeof(buf) - 1, __VA_ARGS__);                       \
+            throw std::runtime_error(buf);                                     \
+        }                                                                      \
+    } while (0)
+#define CHECK(e) EXPECT(e, "Expression evaluated as false: %s", #e)
+#define DEVOK(e) CHECK(Device_Ok == (e))
+#define OK(e) CHECK(AcquireStatus_Ok == (e))
+
+int
+main()
+{
+    auto runtime = acquire_init(reporter);
+    CHECK(runtime);
+    auto dm = acquire_device_manager(runtime);
+    CHECK(dm);
+
+    AcquireProperties props = {};
+    OK(acquire_get_configuration(runtime, &props));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Camera,
+                                SIZED("simulated.*random.*"),
+                                &props.video[0].camera.identifier));
+    DEVOK(device_manager_select(dm,
+                                DeviceKind_Storage,
+                                SIZED("trash"),
+                                &props.video[0].storage.identifier));
+    props.video[0].camera.settings.binning = 1;
+    props.video[0].camera.settings.pixel_type = SampleType_u8;
+    props.video[0].camera.settings.shape = { .x = 320, .y = 240 };
+    props.video[0].camera.settings.exposure_time_us = 1e4;
+    props.video[0].max_frame_count = 12;
+    props.video[0].channel_capacity_bytes = 16 << 20;
+
+    // Average pairs of frames, then average three of those.
+    props.video[0].stages[0] = { .kind = AcquireStage_Average,
+                                 .average = { .frame_count = 2 } };
+    props.video[0].stages[1] = { .kind = AcquireStage_Average,
+                                 .average = { .frame_count = 3,
+                                              .thread_count = 2 } };
+    OK(acquire_configure(runtime, &props));
+
+    {
+        AcquireProperties actual = {};
+        OK(acquire_get_configuration(runtime, &actual));
+        CHECK(actual.video[0].stages[0].kind == AcquireStage_Average);
+        CHECK(actual.video[0].stages[0].average.frame_count == 2);
+        CHECK(actual.video[0].stages[1].kind == AcquireStage_Average);
+        CHECK(actual.video[0].stages[1].average.frame_count == 3);
+        CHECK(actual.video[0].stages[1].average.thread_count == 2);
+        CHECK(actual.video[0].stages[2].kind == AcquireStage_None);
+    }
+
+    const auto next = [](VideoFrame* cur) -> VideoFrame* {
+        return (VideoFrame*)(((uint8_t*)cur) + cur->bytes_of_frame);
+    };
+
+    // Each output is the mean of 6 draws from a discrete uniform
+    // distribution on [0, 255].
+    const uint64_t expected_nframes = 2;
+    const size_t npx = 320 * 240;
+    const double expected_variance = (256.0 * 256.0 - 1.0) / 12.0 / 6.0;
+    double sum = 0, sum_of_squares = 0;
+
+    struct clock clock = {};
+    static double time_limit_ms = 20000.0;
+    clock_init(&clock);
+    clock_shift_ms(&clock, time_limit_ms);
+
+    OK(acquire_start(runtime));
+    uint64_t nframes = 0;
+    while (nframes < expected_nframes) {
+        EXPECT(clock_cmp_now(&clock) < 0,
+               "Timeout at %f ms",
+               clock_toc_ms(&clock) + time_limit_ms);
+        VideoFrame *beg, *end, *cur;
+        OK(acquire_map_read(runtime, 0, &beg, &end));
+        for (cur = beg; cur < end; cur = next(cur)) {
+            EXPECT(cur->frame_id == 6 * nframes,
+                   "Expected frame %llu. Got %llu.",
+                   (unsigned long long)(6 * nframes),
+                   (unsigned long long)cur->frame_id);
+            CHECK(cur->shape.type == SampleType_f32);
+            CHECK(cur->shape.dims.width == 320);
+            const float* data = (const float*)cur->data;
+            for (size_t i = 0; i < npx; ++i) {
+                CHECK(data[i] >= 0.0f && data[i] <= 255.0f);
+                sum += data[i];
+                sum_of_squares += (double)data[i] * data[i];
+            }
+            ++nframes;
+        }
+        OK(acquire_unmap_read(runtime, 0, (uint8_t*)end - (uint8_t*)beg));
+        clock_sleep_ms(nullptr, 5.0f);
+    }
+    OK(acquire_stop(runtime));
+    CHECK(nframes == expected_nframes);
+
+    const double n = (double)(npx * nframes);
+    const double mean = sum / n;
+    const double variance = sum_of_squares / n - mean * mean;
+    LOG("pixel mean %g, variance %g (expected %g)",
+        mean,
+        variance,
+        expected_variance);
+    EXPECT(variance > 0.9 * expected_variance &&
+             variance < 1.1 * expected_variance,
+           "Expected a pixel variance near %g. Got %g.",
+           expected_variance,
+           variance);
+
+    OK(acquire_shutdown(runtime));
+    return 0;
+}
@@ -41,6 +41,23 @@ extern "C"
     int unit_test__storage__copy_string();
     int unit_test__monotonic_clock_increases_monotonically();
     int unit_test__clock_sleep_ms_accepts_null();
+    int unit_test__memory_alloc_large_page_is_writable();
+    int unit_test__memory_alloc_mirrored_aliases();
+    int unit_test__file_queue_writes_out_of_order();
+    int unit_test__file_queue_writes_on_threads();
+    int unit_test__file_queue_waits_out_io_uring_errors();
+    int unit_test__channel__readers_see_every_write_across_wraps();
+    int unit_test__channel__read_skips_unused_tail();
+    int unit_test__channel__wait_for_data_wakes_on_write();
+    int unit_test__channel__overflow_policies();
+    int unit_test__channel__readers_attach_and_detach();
+    int unit_test__channel__mirrored_regions_are_contiguous();
+    int unit_test__accumulate__kernels_match_scalar();
+    int unit_test__accumulate__divisor_is_exact();
+    int unit_test__filter__threaded_average_matches_serial();
+    int unit_test__filter__running_modes_match_reference();
+    int unit_test__filter__integer_outputs_are_exact();
+    int unit_test__filter__sliding_float_sums_dont_drift();
 }
 
 //
@@ -63,6 +80,23 @@ main()
         CASE(unit_test__storage__copy_string),
         CASE(unit_test__monotonic_clock_increases_monotonically),
         CASE(unit_test__clock_sleep_ms_accepts_null),
+        CASE(unit_test__memory_alloc_large_page_is_writable),
+        CASE(unit_test__memory_alloc_mirrored_aliases),
+        CASE(unit_test__file_queue_writes_out_of_order),
+        CASE(unit_test__file_queue_writes_on_threads),
+        CASE(unit_test__file_queue_waits_out_io_uring_errors),
+        CASE(unit_test__channel__readers_see_every_write_across_wraps),
+        CASE(unit_test__channel__read_skips_unused_tail),
+        CASE(unit_test__channel__wait_for_data_wakes_on_write),
+        CASE(unit_test__channel__overflow_policies),
+        CASE(unit_test__channel__readers_attach_and_detach),
+        CASE(unit_test__channel__mirrored_regions_are_contiguous),
+        CASE(unit_test__accumulate__kernels_match_scalar),
+        CASE(unit_test__accumulate__divisor_is_exact),
+        CASE(unit_test__filter__threaded_average_matches_serial),
+        CASE(unit_test__filter__running_modes_match_reference),
+        CASE(unit_test__filter__integer_outputs_are_exact),
+        CASE(unit_test__filter__sliding_float_sums_dont_drift),
 #undef CASE
     };
 
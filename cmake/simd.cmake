@@ -1,7 +1,13 @@
 include(cmake/TargetArch.cmake)
 
+# Kernels that need wider instruction sets check the CPU at run time, so
+# builds run on any x86_64 CPU by default. Turning this on compiles everything
+# for AVX2, which lets the compiler vectorize more on its own but faults on
+# CPUs without it.
+option(ACQUIRE_ASSUME_AVX2 "Compile x86_64 targets for AVX2 CPUs only" OFF)
+
 function(target_enable_simd tgt)
-    if(NOT APPLE)
+    if(NOT APPLE AND ACQUIRE_ASSUME_AVX2)
         # Broken on osx github runners for some reason
         target_architecture(arch)
         set(is_gcc_like "$<OR:$<COMPILE_LANG_AND_ID:CXX,AppleClang,Clang,GNU>,$<COMPILE_LANG_AND_ID:C,AppleClang,Clang,GNU>>")